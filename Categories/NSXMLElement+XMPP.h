@@ -39,6 +39,16 @@
 - (NSXMLElement *)elementForName:(NSString *)name;
 - (NSXMLElement *)elementForName:(NSString *)name xmlns:(NSString *)xmlns;
 - (NSXMLElement *)elementForName:(NSString *)name xmlnsPrefix:(NSString *)xmlnsPrefix;
+- (NSXMLElement *)elementForXmlns:(NSString *)ns;
+
+/**
+ * Extracting a single descendant element, e.g. [message elementForPath:@"result[urn:xmpp:mam:2]/forwarded/message/body"]
+ * 
+ * See XMPPElementPath for the syntax.
+ * The compiled path is cached, so the string may be passed each time.
+**/
+
+- (NSXMLElement *)elementForPath:(NSString *)path;
 
 /**
  * Convenience methods for removing child elements.
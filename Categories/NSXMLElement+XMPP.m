@@ -1,5 +1,6 @@
 #import "NSXMLElement+XMPP.h"
 #import "NSNumber+XMPP.h"
+#import "XMPPElementPath.h"
 
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
@@ -80,13 +81,22 @@
 	return self;
 }
 
+/**
+ * Returns the first child node, without creating the children array.
+ * The remaining children can then be reached via nextSibling.
+**/
+- (NSXMLNode *)xmpp_firstChild
+{
+	return ([self childCount] > 0) ? [self childAtIndex:0] : nil;
+}
+
 - (NSArray *)elementsForXmlns:(NSString *)ns
 {
 	NSMutableArray *elements = [NSMutableArray array];
 	
-	for (NSXMLNode *node in [self children])
+	for (NSXMLNode *node = [self xmpp_firstChild]; node; node = [node nextSibling])
 	{
-		if ([node isKindOfClass:[NSXMLElement class]])
+		if ([node kind] == NSXMLElementKind)
 		{
 			NSXMLElement *element = (NSXMLElement *)node;
 			
@@ -100,6 +110,28 @@
 	return elements;
 }
 
+/**
+ * This method returns the first child element with the given xmlns.
+ * If no child elements exist with the given xmlns, nil is returned.
+**/
+- (NSXMLElement *)elementForXmlns:(NSString *)ns
+{
+	for (NSXMLNode *node = [self xmpp_firstChild]; node; node = [node nextSibling])
+	{
+		if ([node kind] == NSXMLElementKind)
+		{
+			NSXMLElement *element = (NSXMLElement *)node;
+			
+			if ([[element xmlns] isEqual:ns])
+			{
+				return element;
+			}
+		}
+	}
+	
+	return nil;
+}
+
 - (NSArray *)elementsForXmlnsPrefix:(NSString *)nsPrefix
 {
     NSMutableArray *elements = [NSMutableArray array];
@@ -126,6 +158,24 @@
 **/
 - (NSXMLElement *)elementForName:(NSString *)name
 {
+	if ([name rangeOfString:@":"].location == NSNotFound)
+	{
+		// Walk the children until the first match,
+		// instead of collecting all the matches into an array (via elementsForName:) just to return the first one.
+		
+		for (NSXMLNode *node = [self xmpp_firstChild]; node; node = [node nextSibling])
+		{
+			if ([node kind] == NSXMLElementKind && [[node localName] isEqualToString:name])
+			{
+				return (NSXMLElement *)node;
+			}
+		}
+		
+		return nil;
+	}
+	
+	// Prefixed names need to be resolved against the namespaces in scope
+	
 	NSArray *elements = [self elementsForName:name];
 	if ([elements count] > 0)
 	{
@@ -162,24 +212,30 @@
 **/
 - (NSXMLElement *)elementForName:(NSString *)name xmlns:(NSString *)xmlns
 {
-	NSArray *elements = [self elementsForLocalName:name URI:xmlns];
-	if ([elements count] > 0)
-	{
-		return elements[0];
-	}
-	else
+	for (NSXMLNode *node = [self xmpp_firstChild]; node; node = [node nextSibling])
 	{
-		return nil;
+		if ([node kind] == NSXMLElementKind && [[node localName] isEqualToString:name])
+		{
+			// The URI is the namespace of the element itself (as with elementsForLocalName:URI:),
+			// but elements created via elementWithName:xmlns: may only have the default namespace declared.
+			
+			if ([[node URI] isEqualToString:xmlns] || [[(NSXMLElement *)node xmlns] isEqualToString:xmlns])
+			{
+				return (NSXMLElement *)node;
+			}
+		}
 	}
+	
+	return nil;
 }
 
 - (NSXMLElement *)elementForName:(NSString *)name xmlnsPrefix:(NSString *)xmlnsPrefix{
     
     NSXMLElement *result = nil;
 	
-	for (NSXMLNode *node in [self children])
+	for (NSXMLNode *node = [self xmpp_firstChild]; node; node = [node nextSibling])
 	{
-		if ([node isKindOfClass:[NSXMLElement class]])
+		if ([node kind] == NSXMLElementKind)
 		{
 			NSXMLElement *element = (NSXMLElement *)node;
 			
@@ -194,6 +250,11 @@
 	return result;
 }
 
+- (NSXMLElement *)elementForPath:(NSString *)path
+{
+	return [[XMPPElementPath cachedPathWithString:path] firstMatchInElement:self];
+}
+
 /**
  * This method removes the first child element for the given name.
  * If no child elements exist for the given name, this method does nothing.
@@ -121,6 +121,7 @@
 #import "XMPPMessageDeliveryReceipts.h"
 #import "XMPPBlocking.h"
 #import "XMPPStreamManagementMemoryStorage.h"
+#import "XMPPStreamManagementFileStorage.h"
 #import "XMPPStreamManagementStanzas.h"
 #import "XMPPStreamManagement.h"
 #import "XMPPAutoPing.h"
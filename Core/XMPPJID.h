@@ -65,6 +65,23 @@ typedef enum XMPPJIDCompareOptions XMPPJIDCompareOptions;
 **/
 - (XMPPJID *)jidWithNewResource:(NSString *)resource;
 
+/**
+ * jidWithString: caches the JIDs it parses in a process-wide intern table, keyed by the given string.
+ * So parsing the same string again (e.g. the from attribute of every stanza from a MUC occupant)
+ * returns the same immutable JID instance, without running stringprep again.
+ * Interned JIDs also have their hash, bare and full strings, and bareJID precomputed.
+ * 
+ * The table is bounded, and evicts the least recently used JIDs (approximately) once full.
+ * The default capacity is 4096 JIDs. Setting the capacity to zero disables interning.
+ * 
+ * These methods are thread-safe.
+**/
++ (NSUInteger)internTableCapacity;
++ (void)setInternTableCapacity:(NSUInteger)capacity;
+
++ (NSUInteger)numberOfInternedJIDs;
++ (void)removeAllInternedJIDs;
+
 /**
  * When you know both objects are JIDs, this method is a faster way to check equality than isEqual:.
 **/
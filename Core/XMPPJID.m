@@ -5,6 +5,70 @@
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
 #endif
 
+#define XMPP_JID_DEFAULT_INTERN_TABLE_CAPACITY 4096
+
+/**
+ * Interned JIDs are shared across threads, so everything that would otherwise be computed on demand
+ * is computed once, before the JID is published in the intern table.
+**/
+@interface XMPPJID ()
+{
+	BOOL isInterned;
+	NSUInteger internedHash;
+	NSString *internedFull;
+	NSString *internedBare;
+	XMPPJID *internedBareJID; // nil if the JID is already bare
+}
+
++ (XMPPJID *)jidWithPrevalidatedUser:(NSString *)user
+                  prevalidatedDomain:(NSString *)domain
+                prevalidatedResource:(NSString *)resource;
+
+@end
+
+/**
+ * A bounded cache of JIDs, keyed by the raw string they were parsed from.
+ * 
+ * Lookups run concurrently on a concurrent queue, and modifications are barrier blocks.
+ * Eviction uses the CLOCK approximation of LRU:
+ * a lookup only sets the referenced flag of the entry (so it never needs exclusive access),
+ * and the eviction hand skips (and clears) referenced entries.
+**/
+@interface XMPPJIDInternTable : NSObject
+{
+	dispatch_queue_t queue;
+	
+	NSMutableDictionary *entries; // key -> XMPPJIDInternEntry
+	NSMutableArray *clock;
+	NSUInteger clockHand;
+	NSUInteger capacity;
+}
+
++ (XMPPJIDInternTable *)sharedTable;
+
+- (XMPPJID *)jidForKey:(NSString *)key;
+- (XMPPJID *)jidForKey:(NSString *)key capacity:(NSUInteger *)capacityPtr;
+- (void)setJID:(XMPPJID *)jid forKey:(NSString *)key;
+
+@property (atomic, assign) NSUInteger capacity;
+
+- (NSUInteger)count;
+- (void)removeAllJIDs;
+
+@end
+
+@interface XMPPJIDInternEntry : NSObject
+{
+  @public
+	NSString *key;
+	XMPPJID *jid;
+	volatile BOOL referenced;
+}
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 @implementation XMPPJID
 
@@ -110,17 +174,33 @@
 
 + (XMPPJID *)jidWithString:(NSString *)jidStr
 {
+	if (jidStr == nil) return nil;
+	
+	XMPPJIDInternTable *table = [XMPPJIDInternTable sharedTable];
+	
+	// A miss also reports the capacity, so the table is only consulted once before parsing
+	NSUInteger capacity = 0;
+	
+	XMPPJID *jid = [table jidForKey:jidStr capacity:&capacity];
+	if (jid) return jid;
+	
 	NSString *user;
 	NSString *domain;
 	NSString *resource;
 	
 	if ([XMPPJID parse:jidStr outUser:&user outDomain:&domain outResource:&resource])
 	{
-		XMPPJID *jid = [[XMPPJID alloc] init];
+		jid = [[XMPPJID alloc] init];
 		jid->user = [user copy];
 		jid->domain = [domain copy];
 		jid->resource = [resource copy];
 		
+		if (capacity > 0)
+		{
+			[jid prepareForInterning];
+			[table setJID:jid forKey:jidStr];
+		}
+		
 		return jid;
 	}
 	
@@ -194,6 +274,60 @@
 	return jid;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Interning:
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
++ (NSUInteger)internTableCapacity
+{
+	return [[XMPPJIDInternTable sharedTable] capacity];
+}
+
++ (void)setInternTableCapacity:(NSUInteger)capacity
+{
+	[[XMPPJIDInternTable sharedTable] setCapacity:capacity];
+}
+
++ (NSUInteger)numberOfInternedJIDs
+{
+	return [[XMPPJIDInternTable sharedTable] count];
+}
+
++ (void)removeAllInternedJIDs
+{
+	[[XMPPJIDInternTable sharedTable] removeAllJIDs];
+}
+
+- (void)prepareForInterning
+{
+	// This method is invoked before the JID is published in the intern table (i.e. before it is shared).
+	
+	internedFull = [self full];
+	internedBare = [self bare];
+	internedHash = [self hash];
+	
+	if (resource)
+	{
+		// The bare JID is looked up in the intern table as well,
+		// so that all the occupants of a room (or resources of a contact) share a single bare JID.
+		
+		XMPPJIDInternTable *table = [XMPPJIDInternTable sharedTable];
+		
+		XMPPJID *bareJID = [table jidForKey:internedBare];
+		if (bareJID == nil)
+		{
+			bareJID = [XMPPJID jidWithPrevalidatedUser:user prevalidatedDomain:domain prevalidatedResource:nil];
+			[bareJID prepareForInterning];
+			
+			[table setJID:bareJID forKey:internedBare];
+		}
+		
+		internedBareJID = bareJID;
+	}
+	
+	isInterned = YES;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Encoding, Decoding:
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -303,6 +437,10 @@
 	{
 		return self;
 	}
+	else if (isInterned)
+	{
+		return internedBareJID;
+	}
 	else
 	{
 		return [XMPPJID jidWithPrevalidatedUser:user prevalidatedDomain:domain prevalidatedResource:nil];
@@ -323,6 +461,9 @@
 
 - (NSString *)bare
 {
+	if (isInterned)
+		return internedBare;
+	
 	if (user)
 		return [NSString stringWithFormat:@"%@@%@", user, domain];
 	else
@@ -331,6 +472,9 @@
 
 - (NSString *)full
 {
+	if (isInterned)
+		return internedFull;
+	
 	if (user)
 	{
 		if (resource)
@@ -405,6 +549,9 @@
 	// MurmurHash2 was written by Austin Appleby, and is placed in the public domain.
 	// http://code.google.com/p/smhasher
 	
+	if (isInterned)
+		return internedHash;
+	
 	NSUInteger uhash = [user hash];
 	NSUInteger dhash = [domain hash];
 	NSUInteger rhash = [resource hash];
@@ -560,6 +707,7 @@
 - (BOOL)isEqualToJID:(XMPPJID *)aJID options:(XMPPJIDCompareOptions)mask
 {
 	if (aJID == nil) return NO;
+	if (aJID == self) return YES;
 	
 	if (mask & XMPPJIDCompareUser)
 	{
@@ -601,3 +749,162 @@
 
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPJIDInternTable
+
++ (XMPPJIDInternTable *)sharedTable
+{
+	static XMPPJIDInternTable *sharedTable;
+	static dispatch_once_t onceToken;
+	
+	dispatch_once(&onceToken, ^{
+		sharedTable = [[XMPPJIDInternTable alloc] init];
+	});
+	
+	return sharedTable;
+}
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		queue = dispatch_queue_create("XMPPJIDInternTable", DISPATCH_QUEUE_CONCURRENT);
+		
+		entries = [[NSMutableDictionary alloc] init];
+		clock = [[NSMutableArray alloc] init];
+		clockHand = 0;
+		capacity = XMPP_JID_DEFAULT_INTERN_TABLE_CAPACITY;
+	}
+	return self;
+}
+
+- (XMPPJID *)jidForKey:(NSString *)key
+{
+	return [self jidForKey:key capacity:NULL];
+}
+
+- (XMPPJID *)jidForKey:(NSString *)key capacity:(NSUInteger *)capacityPtr
+{
+	__block XMPPJID *result = nil;
+	__block NSUInteger currentCapacity = 0;
+	
+	dispatch_sync(queue, ^{
+		
+		XMPPJIDInternEntry *entry = entries[key];
+		if (entry)
+		{
+			// Concurrent lookups may set the flag at the same time, which is harmless
+			entry->referenced = YES;
+			result = entry->jid;
+		}
+		
+		currentCapacity = capacity;
+	});
+	
+	if (capacityPtr) *capacityPtr = currentCapacity;
+	return result;
+}
+
+- (void)setJID:(XMPPJID *)jid forKey:(NSString *)aKey
+{
+	NSString *key = [aKey copy];
+	
+	dispatch_barrier_async(queue, ^{ @autoreleasepool {
+		
+		if (capacity == 0 || entries[key]) return;
+		
+		XMPPJIDInternEntry *entry = [[XMPPJIDInternEntry alloc] init];
+		entry->key = key;
+		entry->jid = jid;
+		entry->referenced = NO;
+		
+		if ([clock count] < capacity)
+		{
+			[clock addObject:entry];
+		}
+		else
+		{
+			// Advance the clock hand until we find an entry that hasn't been referenced since the last sweep.
+			// This terminates within one full rotation, as the referenced flags are cleared along the way.
+			
+			NSUInteger count = [clock count];
+			
+			XMPPJIDInternEntry *victim = clock[clockHand];
+			while (victim->referenced)
+			{
+				victim->referenced = NO;
+				
+				clockHand = (clockHand + 1) % count;
+				victim = clock[clockHand];
+			}
+			
+			[entries removeObjectForKey:victim->key];
+			
+			clock[clockHand] = entry;
+			clockHand = (clockHand + 1) % count;
+		}
+		
+		entries[key] = entry;
+	}});
+}
+
+- (NSUInteger)capacity
+{
+	__block NSUInteger result = 0;
+	
+	dispatch_sync(queue, ^{
+		result = capacity;
+	});
+	
+	return result;
+}
+
+- (void)setCapacity:(NSUInteger)newCapacity
+{
+	dispatch_barrier_async(queue, ^{ @autoreleasepool {
+		
+		capacity = newCapacity;
+		
+		if ([clock count] > capacity)
+		{
+			// Simply start over, rather than evicting one by one
+			[entries removeAllObjects];
+			[clock removeAllObjects];
+			clockHand = 0;
+		}
+	}});
+}
+
+- (NSUInteger)count
+{
+	__block NSUInteger result = 0;
+	
+	dispatch_sync(queue, ^{
+		result = [entries count];
+	});
+	
+	return result;
+}
+
+- (void)removeAllJIDs
+{
+	dispatch_barrier_async(queue, ^{ @autoreleasepool {
+		
+		[entries removeAllObjects];
+		[clock removeAllObjects];
+		clockHand = 0;
+	}});
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPJIDInternEntry
+@end
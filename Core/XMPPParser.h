@@ -2,10 +2,40 @@
 
 @import KissXML;
 
+@class XMPPArenaElement;
+
+/**
+ * The parser can build the parsed elements in one of two ways:
+ *
+ * XMPPParserBackendLibxml:
+ *   The SAX callbacks build a libxml tree, which is then wrapped (iOS) or converted (Mac) into an NSXMLElement.
+ *   This is the traditional (and default) backend.
+ *
+ * XMPPParserBackendArena:
+ *   The SAX callbacks build a compact stanza tree within a per-stanza arena (see XMPPStanzaArena.h).
+ *   The NSXMLElement is only created on demand, on the delegate queue.
+ *   Delegates that implement xmppParser:didReadArenaElement: may avoid creating it altogether.
+ *
+ * XMPPParserBackendArenaLazy:
+ *   Like XMPPParserBackendArena, but only the top-level element of each stanza (its name, namespaces and attributes)
+ *   and the name/namespace of its first child are built. The raw bytes of the stanza are recorded,
+ *   and the full subtree is only parsed if (and when) the NSXMLElement is requested.
+ *   So stanzas which are routed (or dropped) based solely on these values never pay for a full tree.
+**/
+typedef NS_ENUM(NSInteger, XMPPParserBackend) {
+	XMPPParserBackendLibxml = 0,
+	XMPPParserBackendArena,
+	XMPPParserBackendArenaLazy,
+};
+
 @interface XMPPParser : NSObject
 
 - (id)initWithDelegate:(id)delegate delegateQueue:(dispatch_queue_t)dq;
 - (id)initWithDelegate:(id)delegate delegateQueue:(dispatch_queue_t)dq parserQueue:(dispatch_queue_t)pq;
+- (id)initWithDelegate:(id)delegate delegateQueue:(dispatch_queue_t)dq parserQueue:(dispatch_queue_t)pq
+               backend:(XMPPParserBackend)backend;
+
+@property (nonatomic, readonly) XMPPParserBackend backend;
 
 - (void)setDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue;
 
@@ -28,6 +58,12 @@
 
 - (void)xmppParser:(XMPPParser *)sender didReadElement:(NSXMLElement *)element;
 
+/**
+ * Only invoked when using XMPPParserBackendArena or XMPPParserBackendArenaLazy.
+ * If implemented, this method is invoked instead of xmppParser:didReadElement:.
+**/
+- (void)xmppParser:(XMPPParser *)sender didReadArenaElement:(XMPPArenaElement *)element;
+
 - (void)xmppParserDidEnd:(XMPPParser *)sender;
 
 - (void)xmppParser:(XMPPParser *)sender didFail:(NSError *)error;
@@ -1,5 +1,6 @@
 #import "XMPPParser.h"
 #import "XMPPLogging.h"
+#import "XMPPStanzaArena.h"
 #import <libxml/parser.h>
 #import <libxml/parserInternals.h>
 
@@ -39,6 +40,10 @@
   static void xmpp_recursiveAddChild(NSXMLElement *parent, xmlNodePtr childNode);
 #endif
 
+@interface XMPPParser ()
+- (id)initForMaterialization;
+@end
+
 @implementation XMPPParser
 {
 	#if __has_feature(objc_arc_weak)
@@ -55,8 +60,24 @@
 	unsigned depth;
 	
 	xmlParserCtxt *parserCtxt;
+	
+	XMPPParserBackend backend;
+	XMPPStanzaInternTable *internTable;
+	XMPPStanzaArena *stanzaArena;
+	XMPPArenaNode *stanzaNode;
+	BOOL stanzaHasFirstChild;
+	
+	NSMutableData *rawData;
+	uint64_t rawDataOffset;
+	uint64_t stanzaStartOffset;
+	NSData *rawPreamble;
+	
+	BOOL isMaterializer;
+	XMPPArenaElement *materializedElement;
 }
 
+@synthesize backend = backend;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark iPhone
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -700,12 +721,382 @@ static void xmpp_xmlEndElement(void *ctx, const xmlChar *localname,
 	xmpp_postEndElement(ctxt);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Arena
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void xmpp_onDidReadArenaRoot(XMPPParser *parser, XMPPArenaElement *root)
+{
+	if (parser->delegateQueue && [parser->delegate respondsToSelector:@selector(xmppParser:didReadRoot:)])
+	{
+		__strong id theDelegate = parser->delegate;
+		
+		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
+			
+			[theDelegate xmppParser:parser didReadRoot:[root element]];
+		}});
+	}
+}
+
+static void xmpp_onDidReadArenaElement(XMPPParser *parser, XMPPArenaElement *child)
+{
+	if (parser->isMaterializer)
+	{
+		parser->materializedElement = child;
+		return;
+	}
+	
+	if (parser->delegateQueue == NULL) return;
+	
+	__strong id theDelegate = parser->delegate;
+	
+	if ([theDelegate respondsToSelector:@selector(xmppParser:didReadArenaElement:)])
+	{
+		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
+			
+			[theDelegate xmppParser:parser didReadArenaElement:child];
+		}});
+	}
+	else if ([theDelegate respondsToSelector:@selector(xmppParser:didReadElement:)])
+	{
+		// Note: The NSXMLElement is created on the delegate queue, not the parser queue.
+		
+		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
+			
+			[theDelegate xmppParser:parser didReadElement:[child element]];
+		}});
+	}
+}
+
+/**
+ * Parses the raw bytes of a lazy stanza.
+ * 
+ * The preamble consists of the bytes of the stream up to (and including) the root element's start tag.
+ * This ensures the stanza is parsed within the exact same namespace context as it was originally.
+**/
+static NSXMLElement * xmpp_materializeLazyElement(NSData *preamble, NSData *raw)
+{
+	XMPPParser *materializer = [[XMPPParser alloc] initForMaterialization];
+	xmlParserCtxt *ctxt = materializer->parserCtxt;
+	
+	if (ctxt == NULL) return nil;
+	
+	if (xmlParseChunk(ctxt, (const char *)[preamble bytes], (int)[preamble length], 0) != 0) return nil;
+	if (xmlParseChunk(ctxt, (const char *)[raw bytes], (int)[raw length], 0) != 0) return nil;
+	
+	return [materializer->materializedElement element];
+}
+
+/**
+ * SAX parser C-style callback (arena backends).
+ * Invoked when a new node element is started.
+ * 
+ * The root element (stream:stream) is built in its own arena, and reported immediately.
+ * Every child of the root (i.e. every stanza) gets a fresh arena,
+ * into which the stanza's entire subtree is built.
+ * 
+ * With the lazy backend, only the top-level element of the stanza and its first child are built.
+ * Everything else is skipped, and will be parsed again from the raw bytes if needed.
+**/
+static void xmpp_arenaStartElement(void *ctx, const xmlChar  *nodeName,
+                                              const xmlChar  *nodePrefix,
+                                              const xmlChar  *nodeUri,
+                                                        int   nb_namespaces,
+                                              const xmlChar **namespaces,
+                                                        int   nb_attributes,
+                                                        int   nb_defaulted,
+                                              const xmlChar **attributes)
+{
+	int i, j;
+	
+	xmlParserCtxt *ctxt = (xmlParserCtxt *)ctx;
+	XMPPParser *parser = (__bridge XMPPParser *)ctxt->_private;
+	
+	BOOL isLazy = (parser->backend == XMPPParserBackendArenaLazy);
+	
+	if (isLazy && (parser->depth >= 2))
+	{
+		if ((parser->depth > 2) || parser->stanzaHasFirstChild)
+		{
+			parser->depth++;
+			return;
+		}
+	}
+	
+	XMPPStanzaArena *arena;
+	XMPPArenaNode *parent;
+	
+	if (parser->depth == 0)
+	{
+		if (parser->internTable == nil && !parser->isMaterializer)
+		{
+			parser->internTable = [[XMPPStanzaInternTable alloc] init];
+		}
+		
+		arena = [[XMPPStanzaArena alloc] initWithInternTable:parser->internTable];
+		parent = NULL;
+	}
+	else if (parser->depth == 1)
+	{
+		parser->stanzaArena = [[XMPPStanzaArena alloc] initWithInternTable:parser->internTable];
+		parser->stanzaHasFirstChild = NO;
+		
+		arena = parser->stanzaArena;
+		parent = NULL;
+	}
+	else
+	{
+		arena = parser->stanzaArena;
+		parent = parser->stanzaNode;
+	}
+	
+	if (arena == nil)
+	{
+		xmpp_xmlAbortDueToMemoryShortage(ctxt);
+		return;
+	}
+	
+	// Create the node
+	XMPPArenaNode *newNode = XMPPArenaNodeCreate(arena, parent, (const char *)nodeName, (const char *)nodePrefix);
+	CHECK_FOR_NULL(newNode);
+	
+	// Process the namespaces
+	for (i = 0, j = 0; j < nb_namespaces; j++)
+	{
+		const xmlChar *nsPrefix = namespaces[i++];
+		const xmlChar *nsUri    = namespaces[i++];
+		
+		if (!XMPPArenaNodeAddNamespace(arena, newNode, (const char *)nsPrefix, (const char *)nsUri))
+		{
+			xmpp_xmlAbortDueToMemoryShortage(ctxt);
+			return;
+		}
+	}
+	
+	// Just like the libxml backend, we don't allow a stanza to reference a namespace declared in the root.
+	// So if the node's namespace isn't declared within the stanza, we declare it on the node.
+	// E.g. <message/> -> <message xmlns="jabber:client"/>
+	
+	if (nodeUri && !XMPPArenaNodeHasNamespace(newNode, (const char *)nodePrefix))
+	{
+		if (!XMPPArenaNodeAddNamespace(arena, newNode, (const char *)nodePrefix, (const char *)nodeUri))
+		{
+			xmpp_xmlAbortDueToMemoryShortage(ctxt);
+			return;
+		}
+	}
+	
+	// Process all the attributes
+	for (i = 0, j = 0; j < nb_attributes; j++)
+	{
+		const xmlChar *attrName   = attributes[i++];
+		const xmlChar *attrPrefix = attributes[i++];
+		                            i++; // attrUri
+		const xmlChar *valueBegin = attributes[i++];
+		const xmlChar *valueEnd   = attributes[i++];
+		
+		// The attribute value might contain character references which need to be decoded.
+		// 
+		// "Franks &#38; Beans" -> "Franks & Beans"
+		
+		xmlChar *value = xmlStringLenDecodeEntities(ctxt,                    // the parser context
+		                                            valueBegin,              // the input string
+		                                      (int)(valueEnd - valueBegin),  // the input string length
+		                                           (XML_SUBSTITUTE_REF),     // what to substitue
+		                                            0, 0, 0);                // end markers, 0 if none
+		CHECK_FOR_NULL(value);
+		
+		BOOL added = XMPPArenaNodeAddAttribute(arena, newNode,
+		                                       (const char *)attrName,
+		                                       (const char *)attrPrefix,
+		                                       (const char *)value, strlen((const char *)value));
+		xmlFree(value);
+		
+		if (!added)
+		{
+			xmpp_xmlAbortDueToMemoryShortage(ctxt);
+			return;
+		}
+	}
+	
+	parser->depth++;
+	
+	if (parser->depth == 1)
+	{
+		if (isLazy)
+		{
+			// The parser is sitting on the closing '>' of the root start tag.
+			// Everything up to (and including) it forms the preamble for parsing lazy stanzas later.
+			
+			long consumed = xmlByteConsumed(ctxt);
+			uint64_t rootEnd = (consumed >= 0) ? ((uint64_t)consumed + 1) : 0;
+			
+			if ((consumed >= 0) && (rootEnd <= (parser->rawDataOffset + [parser->rawData length])))
+			{
+				parser->rawPreamble = [parser->rawData subdataWithRange:NSMakeRange(0, (NSUInteger)rootEnd)];
+				parser->stanzaStartOffset = rootEnd;
+			}
+			else
+			{
+				// We can't reliably locate the stanzas within the stream.
+				// Fallback to building the full stanzas.
+				
+				parser->backend = XMPPParserBackendArena;
+				parser->rawData = nil;
+			}
+		}
+		
+		// We've received the full root - report it to the delegate
+		
+		if (!parser->hasReportedRoot)
+		{
+			xmpp_onDidReadArenaRoot(parser, XMPPArenaElementCreate(arena, newNode));
+			
+			parser->hasReportedRoot = YES;
+		}
+	}
+	else if (isLazy && (parser->depth == 3))
+	{
+		// The first child of a lazy stanza
+		parser->stanzaHasFirstChild = YES;
+	}
+	else
+	{
+		// Update our parent node pointer
+		parser->stanzaNode = newNode;
+	}
+}
+
+/**
+ * SAX parser C-style callback (arena backends).
+ * Invoked when characters are found within a node.
+**/
+static void xmpp_arenaCharacters(void *ctx, const xmlChar *ch, int len)
+{
+	xmlParserCtxt *ctxt = (xmlParserCtxt *)ctx;
+	XMPPParser *parser = (__bridge XMPPParser *)ctxt->_private;
+	
+	// Lazy stanzas don't include any character data until they're materialized.
+	// Whitespace between stanzas (i.e. directly within the root element) is ignored.
+	
+	if (parser->backend == XMPPParserBackendArenaLazy) return;
+	
+	if (parser->stanzaNode != NULL)
+	{
+		if (!XMPPArenaNodeAppendText(parser->stanzaArena, parser->stanzaNode, (const char *)ch, (size_t)len))
+		{
+			xmpp_xmlAbortDueToMemoryShortage(ctxt);
+		}
+	}
+}
+
+/**
+ * SAX parser C-style callback (arena backends).
+ * Invoked when a new node element is ended.
+**/
+static void xmpp_arenaEndElement(void *ctx, const xmlChar *localname,
+                                            const xmlChar *prefix,
+                                            const xmlChar *URI)
+{
+	xmlParserCtxt *ctxt = (xmlParserCtxt *)ctx;
+	XMPPParser *parser = (__bridge XMPPParser *)ctxt->_private;
+	
+	BOOL isLazy = (parser->backend == XMPPParserBackendArenaLazy);
+	
+	parser->depth--;
+	
+	if (parser->depth == 1)
+	{
+		// End of full xmpp element.
+		// Hand off the arena (along with the stanza in it) to the delegate.
+		
+		XMPPArenaElement *child = nil;
+		
+		if (isLazy)
+		{
+			// The parser is sitting just past the end of the stanza.
+			// So the raw stanza spans from the end of the previous stanza (or root start tag) to here.
+			// (This may include some leading whitespace, which is harmless.)
+			
+			long consumed = xmlByteConsumed(ctxt);
+			uint64_t stanzaEnd = (consumed >= 0) ? (uint64_t)consumed : 0;
+			
+			uint64_t rawDataEnd = parser->rawDataOffset + [parser->rawData length];
+			
+			if ((stanzaEnd > parser->stanzaStartOffset) && (stanzaEnd <= rawDataEnd) &&
+			    (parser->stanzaStartOffset >= parser->rawDataOffset))
+			{
+				NSRange range = NSMakeRange((NSUInteger)(parser->stanzaStartOffset - parser->rawDataOffset),
+				                            (NSUInteger)(stanzaEnd - parser->stanzaStartOffset));
+				
+				NSData *raw = [parser->rawData subdataWithRange:range];
+				NSData *preamble = parser->rawPreamble;
+				
+				child = XMPPArenaElementCreateLazy(parser->stanzaArena, parser->stanzaNode, ^NSXMLElement *{
+					
+					return xmpp_materializeLazyElement(preamble, raw);
+				});
+				
+				parser->stanzaStartOffset = stanzaEnd;
+			}
+			else
+			{
+				// This should never happen.
+				// But if it does, the delegate will at least get the top-level element.
+				
+				child = XMPPArenaElementCreate(parser->stanzaArena, parser->stanzaNode);
+				
+				if (stanzaEnd > parser->stanzaStartOffset)
+					parser->stanzaStartOffset = stanzaEnd;
+			}
+		}
+		else
+		{
+			child = XMPPArenaElementCreate(parser->stanzaArena, parser->stanzaNode);
+		}
+		
+		parser->stanzaArena = nil;
+		parser->stanzaNode = NULL;
+		parser->stanzaHasFirstChild = NO;
+		
+		if (child)
+		{
+			xmpp_onDidReadArenaElement(parser, child);
+		}
+	}
+	else if (parser->depth == 0)
+	{
+		// End of the root element
+		
+		if (parser->delegateQueue && [parser->delegate respondsToSelector:@selector(xmppParserDidEnd:)])
+		{
+			__strong id theDelegate = parser->delegate;
+			
+			dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
+			
+				[theDelegate xmppParserDidEnd:parser];
+			}});
+		}
+	}
+	else if (!isLazy)
+	{
+		// Update our parent node pointer
+		parser->stanzaNode = XMPPArenaNodeGetParent(parser->stanzaNode);
+	}
+}
+
 - (id)initWithDelegate:(id)aDelegate delegateQueue:(dispatch_queue_t)dq
 {
 	return [self initWithDelegate:aDelegate delegateQueue:dq parserQueue:NULL];
 }
 
 - (id)initWithDelegate:(id)aDelegate delegateQueue:(dispatch_queue_t)dq parserQueue:(dispatch_queue_t)pq
+{
+	return [self initWithDelegate:aDelegate delegateQueue:dq parserQueue:pq backend:XMPPParserBackendLibxml];
+}
+
+- (id)initWithDelegate:(id)aDelegate delegateQueue:(dispatch_queue_t)dq parserQueue:(dispatch_queue_t)pq
+               backend:(XMPPParserBackend)aBackend
 {
 	if ((self = [super init]))
 	{
@@ -731,34 +1122,77 @@ static void xmpp_xmlEndElement(void *ctx, const xmlChar *localname,
 		xmppParserQueueTag = &xmppParserQueueTag;
 		dispatch_queue_set_specific(parserQueue, xmppParserQueueTag, xmppParserQueueTag, NULL);
 		
-		hasReportedRoot = NO;
-		depth  = 0;
+		backend = aBackend;
 		
-		// Create SAX handler
-		xmlSAXHandler saxHandler;
-		memset(&saxHandler, 0, sizeof(xmlSAXHandler));
+		if (backend == XMPPParserBackendArenaLazy)
+		{
+			rawData = [[NSMutableData alloc] init];
+		}
+		
+		[self setupParserContext];
+	}
+	return self;
+}
+
+/**
+ * Private initializer used to (synchronously) parse the raw bytes of lazy stanzas.
+ * Such a parser has no delegate and no queue. The parsed stanza is stored in materializedElement.
+**/
+- (id)initForMaterialization
+{
+	if ((self = [super init]))
+	{
+		backend = XMPPParserBackendArena;
+		isMaterializer = YES;
 		
-		saxHandler.initialized = XML_SAX2_MAGIC;
+		[self setupParserContext];
+	}
+	return self;
+}
+
+- (void)setupParserContext
+{
+	hasReportedRoot = NO;
+	depth  = 0;
+	
+	// Create SAX handler
+	xmlSAXHandler saxHandler;
+	memset(&saxHandler, 0, sizeof(xmlSAXHandler));
+	
+	saxHandler.initialized = XML_SAX2_MAGIC;
+	
+	if (backend == XMPPParserBackendLibxml)
+	{
 		saxHandler.startElementNs = xmpp_xmlStartElement;
 		saxHandler.characters = xmpp_xmlCharacters;
 		saxHandler.endElementNs = xmpp_xmlEndElement;
-		
-		// Create the push parser context
-		parserCtxt = xmlCreatePushParserCtxt(&saxHandler, NULL, NULL, 0, NULL);
-		
-		// Note: This method copies the saxHandler, so we don't have to keep it around.
-		
+	}
+	else
+	{
+		saxHandler.startElementNs = xmpp_arenaStartElement;
+		saxHandler.characters = xmpp_arenaCharacters;
+		saxHandler.endElementNs = xmpp_arenaEndElement;
+	}
+	
+	// Create the push parser context
+	parserCtxt = xmlCreatePushParserCtxt(&saxHandler, NULL, NULL, 0, NULL);
+	
+	// Note: This method copies the saxHandler, so we don't have to keep it around.
+	
+	if (parserCtxt == NULL) return;
+	
+	if (backend == XMPPParserBackendLibxml)
+	{
 		// Create the document to hold the parsed elements
 		parserCtxt->myDoc = xmlNewDoc(parserCtxt->version);
-		
-		// Store reference to ourself
-		parserCtxt->_private = (__bridge void *)(self);
-		
-		// Note: The parserCtxt also has a userData variable, but it is used by the DOM building functions.
-		// If we put a value there, it actually causes a crash!
-		// We need to be sure to use the _private variable which libxml won't touch.
 	}
-	return self;
+	
+	// Store reference to ourself
+	parserCtxt->_private = (__bridge void *)(self);
+	
+	// Note: The parserCtxt also has a userData variable, but it is used by the DOM building functions.
+	// If we put a value there, it actually causes a crash!
+	// We need to be sure to use the _private variable which libxml won't touch.
 }
 
 - (void)dealloc
@@ -812,8 +1246,24 @@ static void xmpp_xmlEndElement(void *ctx, const xmlChar *localname,
 {
 	dispatch_block_t block = ^{ @autoreleasepool {
 	
+		// The lazy backend needs access to the raw bytes of every stanza.
+		// So we keep the received data from the start of the current (incomplete) stanza onwards.
+		
+		if (rawData)
+		{
+			[rawData appendData:data];
+		}
+		
 		int result = xmlParseChunk(parserCtxt, (const char *)[data bytes], (int)[data length], 0);
 		
+		if (rawData && (stanzaStartOffset > rawDataOffset))
+		{
+			NSUInteger trim = (NSUInteger)MIN(stanzaStartOffset - rawDataOffset, (uint64_t)[rawData length]);
+			
+			[rawData replaceBytesInRange:NSMakeRange(0, trim) withBytes:NULL length:0];
+			rawDataOffset += trim;
+		}
+		
 		if (result == 0)
 		{
 			if (delegateQueue && [delegate respondsToSelector:@selector(xmppParserDidParseData:)])
@@ -0,0 +1,166 @@
+#import <Foundation/Foundation.h>
+
+@import KissXML;
+
+@class XMPPStanzaArena;
+
+/**
+ * A compact, arena-allocated representation of a single parsed stanza.
+ *
+ * When XMPPParser is configured with XMPPParserBackendArena, it builds this representation directly
+ * from the SAX callbacks, instead of building a libxml tree (and then converting it into an NSXMLElement).
+ * Every node, attribute and string of the stanza lives in a single arena,
+ * which is released in one step when the XMPPArenaElement is deallocated.
+ *
+ * Element names, prefixes, attribute names and namespace URIs are interned (per parser),
+ * so the common names ("message", "body", "jabber:client", ...) are neither copied nor converted more than once.
+ *
+ * An NSXMLElement representation is only created if (and when) it's requested via the element method.
+ * The most commonly inspected values (name, xmlns, attributes, first child) are available without it.
+ *
+ * This class is NOT thread-safe.
+ * Once handed off by the parser, it should only be accessed from a single queue at a time.
+**/
+@interface XMPPArenaElement : NSObject
+
+/**
+ * The qualified name of the element (e.g. "message" or "stream:features").
+**/
+@property (nonatomic, readonly) NSString *name;
+
+/**
+ * The value of the default namespace declared on the element (i.e. the xmlns attribute), if any.
+**/
+@property (nonatomic, readonly) NSString *xmlns;
+
+/**
+ * Returns the value of the attribute with the given (qualified) name, or nil if there is no such attribute.
+ * This method does not create the NSXMLElement representation.
+**/
+- (NSString *)attributeStringValueForName:(NSString *)name;
+
+/**
+ * The name and xmlns of the first child element, if any.
+ * These methods do not create the NSXMLElement representation.
+**/
+@property (nonatomic, readonly) NSString *firstChildName;
+@property (nonatomic, readonly) NSString *firstChildXmlns;
+
+/**
+ * Convenience methods for the common stanza attributes.
+ * These methods do not create the NSXMLElement representation.
+**/
+@property (nonatomic, readonly) NSString *toStr;
+@property (nonatomic, readonly) NSString *fromStr;
+@property (nonatomic, readonly) NSString *elementID;
+@property (nonatomic, readonly) NSString *type;
+
+/**
+ * A lazy element (see XMPPParserBackendArenaLazy) only contains the information listed above.
+ * The rest of the stanza is kept as raw bytes, and is only parsed when the element method is first invoked.
+ * 
+ * Returns YES if the full stanza is available (i.e. the element isn't lazy, or has already been materialized).
+**/
+@property (nonatomic, readonly) BOOL isMaterialized;
+
+/**
+ * Returns the NSXMLElement representation of the entire stanza.
+ *
+ * The element is created on the first invocation of this method, and cached for subsequent invocations.
+ * For lazy elements, this is also when the raw stanza is parsed.
+ * The returned element is fully independent of the arena.
+**/
+- (NSXMLElement *)element;
+
+/**
+ * The total number of bytes allocated by the underlying arena.
+**/
+@property (nonatomic, readonly) NSUInteger arenaSize;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A bounded table of interned strings, shared by all the arenas created by a single parser.
+ *
+ * Strings are added by the parser (on the parser queue), and are never removed.
+ * Once the table is full, new strings are simply copied into their arena instead.
+ * Every arena retains the table, so interned strings remain valid for as long as any stanza references them.
+ *
+ * This class is NOT thread-safe. (Only the parser queue may add strings.)
+**/
+@interface XMPPStanzaInternTable : NSObject
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The arena itself.
+ *
+ * The builder functions below are used by XMPPParser to construct the stanza tree from the SAX callbacks.
+ * They are NOT thread-safe, and return NULL/NO if the arena is unable to allocate memory.
+**/
+@interface XMPPStanzaArena : NSObject
+
+- (instancetype)initWithInternTable:(XMPPStanzaInternTable *)internTable;
+
+@property (nonatomic, readonly) NSUInteger size;
+
+@end
+
+typedef struct XMPPArenaNode XMPPArenaNode;
+
+/**
+ * Creates a new element node, and appends it to the given parent (which may be NULL for the top-level element).
+ * The given strings are UTF-8 and NUL-terminated. The prefix may be NULL.
+**/
+XMPPArenaNode * XMPPArenaNodeCreate(XMPPStanzaArena *arena, XMPPArenaNode *parent,
+                                    const char *name, const char *prefix);
+
+/**
+ * Adds a namespace declaration to the given element node. The prefix is NULL for the default namespace.
+**/
+BOOL XMPPArenaNodeAddNamespace(XMPPStanzaArena *arena, XMPPArenaNode *node, const char *prefix, const char *uri);
+
+/**
+ * Returns whether a namespace with the given prefix (NULL for the default namespace) is declared
+ * on the given node, or on any of its ancestors within the stanza.
+**/
+BOOL XMPPArenaNodeHasNamespace(XMPPArenaNode *node, const char *prefix);
+
+/**
+ * Adds an attribute to the given element node. The value is UTF-8, and need not be NUL-terminated.
+**/
+BOOL XMPPArenaNodeAddAttribute(XMPPStanzaArena *arena, XMPPArenaNode *node,
+                               const char *name, const char *prefix, const char *value, size_t valueLength);
+
+/**
+ * Appends character data to the given element node, merging it with any directly preceding character data.
+**/
+BOOL XMPPArenaNodeAppendText(XMPPStanzaArena *arena, XMPPArenaNode *node, const char *text, size_t length);
+
+/**
+ * Returns the parent of the given node (NULL for the top-level element).
+**/
+XMPPArenaNode * XMPPArenaNodeGetParent(XMPPArenaNode *node);
+
+/**
+ * Wraps the given top-level node (and the arena that owns it) in an XMPPArenaElement.
+ * The returned object keeps the arena alive.
+**/
+XMPPArenaElement * XMPPArenaElementCreate(XMPPStanzaArena *arena, XMPPArenaNode *node);
+
+/**
+ * Wraps the given (partial) top-level node in a lazy XMPPArenaElement.
+ * The given block is invoked (at most once) to create the full NSXMLElement representation when it's requested.
+**/
+XMPPArenaElement * XMPPArenaElementCreateLazy(XMPPStanzaArena *arena, XMPPArenaNode *node,
+                                              NSXMLElement * (^materializer)(void));
@@ -0,0 +1,690 @@
+#import "XMPPStanzaArena.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Strings longer than this are never interned (they're unlikely to be names)
+#define XMPP_INTERN_MAX_LENGTH        64
+
+// Arena blocks start small (most stanzas are small), and double in size up to the max
+#define XMPP_ARENA_INITIAL_BLOCK_SIZE 1024
+#define XMPP_ARENA_MAX_BLOCK_SIZE     (32 * 1024)
+
+#define XMPP_ARENA_ALIGNMENT          8
+
+typedef struct XMPPArenaString {
+	const char *utf8;                       // NUL-terminated, or NULL if not present
+	uint32_t length;                        // Not including the NUL terminator
+	__unsafe_unretained NSString *interned; // Owned by the intern table, or nil if not interned
+} XMPPArenaString;
+
+typedef struct XMPPArenaNamespace {
+	XMPPArenaString prefix;
+	XMPPArenaString uri;
+	struct XMPPArenaNamespace *next;
+} XMPPArenaNamespace;
+
+typedef struct XMPPArenaAttribute {
+	XMPPArenaString name;
+	XMPPArenaString prefix;
+	XMPPArenaString value;
+	struct XMPPArenaAttribute *next;
+} XMPPArenaAttribute;
+
+typedef enum XMPPArenaNodeKind {
+	XMPPArenaNodeKindElement = 0,
+	XMPPArenaNodeKindText,
+} XMPPArenaNodeKind;
+
+struct XMPPArenaNode {
+	XMPPArenaNodeKind kind;
+
+	XMPPArenaString name;   // The local name for elements, or the character data for text nodes
+	XMPPArenaString prefix;
+
+	XMPPArenaNamespace *firstNamespace;
+	XMPPArenaNamespace *lastNamespace;
+
+	XMPPArenaAttribute *firstAttribute;
+	XMPPArenaAttribute *lastAttribute;
+
+	XMPPArenaNode *parent;
+	XMPPArenaNode *firstChild;
+	XMPPArenaNode *lastChild;
+	XMPPArenaNode *next;
+};
+
+typedef struct XMPPArenaBlock {
+	struct XMPPArenaBlock *next;
+	size_t capacity;
+	size_t used;
+	uint8_t data[];
+} XMPPArenaBlock;
+
+typedef struct XMPPInternEntry {
+	uint32_t hash;
+	uint32_t length;
+	char *utf8;
+	CFStringRef string;
+} XMPPInternEntry;
+
+static inline uint32_t xmpp_hashBytes(const char *bytes, size_t length)
+{
+	// FNV-1a
+
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t)bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPStanzaInternTable
+{
+	XMPPInternEntry *entries;
+	NSUInteger capacity;
+	NSUInteger count;
+}
+
+- (id)init
+{
+	return [self initWithCapacity:512];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)inCapacity
+{
+	if ((self = [super init]))
+	{
+		// The table is open-addressed, and kept at most half full.
+		// So the number of slots is the next power of two that's at least twice the requested capacity.
+
+		capacity = 16;
+		while (capacity < (inCapacity * 2))
+		{
+			capacity *= 2;
+		}
+
+		entries = calloc(capacity, sizeof(XMPPInternEntry));
+		if (entries == NULL)
+		{
+			return nil;
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	for (NSUInteger i = 0; i < capacity; i++)
+	{
+		if (entries[i].utf8)
+		{
+			free(entries[i].utf8);
+			CFRelease(entries[i].string);
+		}
+	}
+	free(entries);
+}
+
+/**
+ * Looks up (or adds) the given string in the intern table.
+ * Returns YES, and fills in the result, if the string is (now) interned.
+ * Returns NO if the string is too long, the table is full, or memory couldn't be allocated.
+**/
+static BOOL xmpp_internString(XMPPStanzaInternTable *table, const char *utf8, size_t length, XMPPArenaString *result)
+{
+	if (table == nil || length > XMPP_INTERN_MAX_LENGTH) return NO;
+
+	uint32_t hash = xmpp_hashBytes(utf8, length);
+	NSUInteger mask = table->capacity - 1;
+	NSUInteger index = hash & mask;
+
+	while (table->entries[index].utf8 != NULL)
+	{
+		XMPPInternEntry *entry = &table->entries[index];
+
+		if (entry->hash == hash && entry->length == length && memcmp(entry->utf8, utf8, length) == 0)
+		{
+			result->utf8 = entry->utf8;
+			result->length = entry->length;
+			result->interned = (__bridge NSString *)entry->string;
+
+			return YES;
+		}
+
+		index = (index + 1) & mask;
+	}
+
+	if ((table->count + 1) > (table->capacity / 2))
+	{
+		// Table is full
+		return NO;
+	}
+
+	char *copy = malloc(length + 1);
+	if (copy == NULL) return NO;
+
+	memcpy(copy, utf8, length);
+	copy[length] = 0;
+
+	NSString *string = [[NSString alloc] initWithBytes:copy length:length encoding:NSUTF8StringEncoding];
+	if (string == nil)
+	{
+		free(copy);
+		return NO;
+	}
+
+	XMPPInternEntry *entry = &table->entries[index];
+	entry->hash = hash;
+	entry->length = (uint32_t)length;
+	entry->utf8 = copy;
+	entry->string = CFBridgingRetain(string);
+
+	table->count++;
+
+	result->utf8 = entry->utf8;
+	result->length = entry->length;
+	result->interned = (__bridge NSString *)entry->string;
+
+	return YES;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPStanzaArena
+{
+	XMPPStanzaInternTable *internTable;
+
+	XMPPArenaBlock *currentBlock; // Blocks are linked newest first
+	NSUInteger size;
+}
+
+@synthesize size = size;
+
+- (instancetype)initWithInternTable:(XMPPStanzaInternTable *)table
+{
+	if ((self = [super init]))
+	{
+		internTable = table;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	// This is the whole point of the arena.
+	// Every node, attribute and string of the stanza is released right here.
+
+	XMPPArenaBlock *block = currentBlock;
+	while (block)
+	{
+		XMPPArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+/**
+ * Allocates zeroed memory from the arena, with the given alignment (which must be a power of two).
+**/
+static void * xmpp_arenaAlloc(XMPPStanzaArena *arena, size_t length, size_t alignment)
+{
+	XMPPArenaBlock *block = arena->currentBlock;
+
+	if (block)
+	{
+		size_t offset = (block->used + (alignment - 1)) & ~(alignment - 1);
+
+		if (offset + length <= block->capacity)
+		{
+			block->used = offset + length;
+			return block->data + offset;
+		}
+	}
+
+	size_t blockCapacity = block ? MIN(block->capacity * 2, (size_t)XMPP_ARENA_MAX_BLOCK_SIZE)
+	                             : XMPP_ARENA_INITIAL_BLOCK_SIZE;
+	blockCapacity = MAX(blockCapacity, length);
+
+	XMPPArenaBlock *newBlock = calloc(1, sizeof(XMPPArenaBlock) + blockCapacity);
+	if (newBlock == NULL) return NULL;
+
+	newBlock->next = block;
+	newBlock->capacity = blockCapacity;
+	newBlock->used = length;
+
+	arena->currentBlock = newBlock;
+	arena->size += blockCapacity;
+
+	// Note: The data member immediately follows two size_t members and a pointer,
+	// so it's suitably aligned for everything we store in the arena.
+
+	return newBlock->data;
+}
+
+static BOOL xmpp_arenaString(XMPPStanzaArena *arena, const char *utf8, size_t length, BOOL intern,
+                             XMPPArenaString *result)
+{
+	if (utf8 == NULL)
+	{
+		result->utf8 = NULL;
+		result->length = 0;
+		result->interned = nil;
+
+		return YES;
+	}
+
+	if (intern && xmpp_internString(arena->internTable, utf8, length, result))
+	{
+		return YES;
+	}
+
+	char *copy = xmpp_arenaAlloc(arena, length + 1, 1);
+	if (copy == NULL) return NO;
+
+	memcpy(copy, utf8, length);
+	copy[length] = 0;
+
+	result->utf8 = copy;
+	result->length = (uint32_t)length;
+	result->interned = nil;
+
+	return YES;
+}
+
+XMPPArenaNode * XMPPArenaNodeCreate(XMPPStanzaArena *arena, XMPPArenaNode *parent,
+                                    const char *name, const char *prefix)
+{
+	XMPPArenaNode *node = xmpp_arenaAlloc(arena, sizeof(XMPPArenaNode), XMPP_ARENA_ALIGNMENT);
+	if (node == NULL) return NULL;
+
+	node->kind = XMPPArenaNodeKindElement;
+
+	if (!xmpp_arenaString(arena, name, name ? strlen(name) : 0, YES, &node->name)) return NULL;
+	if (!xmpp_arenaString(arena, prefix, prefix ? strlen(prefix) : 0, YES, &node->prefix)) return NULL;
+
+	if (parent)
+	{
+		node->parent = parent;
+
+		if (parent->lastChild)
+			parent->lastChild->next = node;
+		else
+			parent->firstChild = node;
+
+		parent->lastChild = node;
+	}
+
+	return node;
+}
+
+BOOL XMPPArenaNodeAddNamespace(XMPPStanzaArena *arena, XMPPArenaNode *node, const char *prefix, const char *uri)
+{
+	XMPPArenaNamespace *ns = xmpp_arenaAlloc(arena, sizeof(XMPPArenaNamespace), XMPP_ARENA_ALIGNMENT);
+	if (ns == NULL) return NO;
+
+	if (!xmpp_arenaString(arena, prefix, prefix ? strlen(prefix) : 0, YES, &ns->prefix)) return NO;
+	if (!xmpp_arenaString(arena, uri, uri ? strlen(uri) : 0, YES, &ns->uri)) return NO;
+
+	if (node->lastNamespace)
+		node->lastNamespace->next = ns;
+	else
+		node->firstNamespace = ns;
+
+	node->lastNamespace = ns;
+
+	return YES;
+}
+
+BOOL XMPPArenaNodeHasNamespace(XMPPArenaNode *node, const char *prefix)
+{
+	while (node)
+	{
+		for (XMPPArenaNamespace *ns = node->firstNamespace; ns; ns = ns->next)
+		{
+			if (ns->uri.utf8 == NULL) continue;
+
+			if (prefix == NULL)
+			{
+				if (ns->prefix.utf8 == NULL) return YES;
+			}
+			else if (ns->prefix.utf8 && strcmp(ns->prefix.utf8, prefix) == 0)
+			{
+				return YES;
+			}
+		}
+
+		node = node->parent;
+	}
+
+	return NO;
+}
+
+BOOL XMPPArenaNodeAddAttribute(XMPPStanzaArena *arena, XMPPArenaNode *node,
+                               const char *name, const char *prefix, const char *value, size_t valueLength)
+{
+	XMPPArenaAttribute *attr = xmpp_arenaAlloc(arena, sizeof(XMPPArenaAttribute), XMPP_ARENA_ALIGNMENT);
+	if (attr == NULL) return NO;
+
+	if (!xmpp_arenaString(arena, name, name ? strlen(name) : 0, YES, &attr->name)) return NO;
+	if (!xmpp_arenaString(arena, prefix, prefix ? strlen(prefix) : 0, YES, &attr->prefix)) return NO;
+	if (!xmpp_arenaString(arena, value ? value : "", valueLength, NO, &attr->value)) return NO;
+
+	if (node->lastAttribute)
+		node->lastAttribute->next = attr;
+	else
+		node->firstAttribute = attr;
+
+	node->lastAttribute = attr;
+
+	return YES;
+}
+
+BOOL XMPPArenaNodeAppendText(XMPPStanzaArena *arena, XMPPArenaNode *node, const char *text, size_t length)
+{
+	if (length == 0) return YES;
+
+	XMPPArenaNode *textNode = node->lastChild;
+
+	if (textNode && textNode->kind == XMPPArenaNodeKindText)
+	{
+		// The parser may deliver character data in several pieces.
+		// If the existing text is the most recent allocation in the arena, we can simply extend it in place.
+
+		XMPPArenaString *str = &textNode->name;
+		XMPPArenaBlock *block = arena->currentBlock;
+
+		char *end = (char *)str->utf8 + str->length;
+
+		if (block && ((uint8_t *)end + 1 == block->data + block->used) && (block->used + length <= block->capacity))
+		{
+			memcpy(end, text, length);
+			end[length] = 0;
+
+			block->used += length;
+			str->length += (uint32_t)length;
+
+			return YES;
+		}
+
+		char *merged = xmpp_arenaAlloc(arena, str->length + length + 1, 1);
+		if (merged == NULL) return NO;
+
+		memcpy(merged, str->utf8, str->length);
+		memcpy(merged + str->length, text, length);
+		merged[str->length + length] = 0;
+
+		str->utf8 = merged;
+		str->length += (uint32_t)length;
+
+		return YES;
+	}
+
+	textNode = xmpp_arenaAlloc(arena, sizeof(XMPPArenaNode), XMPP_ARENA_ALIGNMENT);
+	if (textNode == NULL) return NO;
+
+	textNode->kind = XMPPArenaNodeKindText;
+
+	if (!xmpp_arenaString(arena, text, length, NO, &textNode->name)) return NO;
+
+	textNode->parent = node;
+
+	if (node->lastChild)
+		node->lastChild->next = textNode;
+	else
+		node->firstChild = textNode;
+
+	node->lastChild = textNode;
+
+	return YES;
+}
+
+XMPPArenaNode * XMPPArenaNodeGetParent(XMPPArenaNode *node)
+{
+	return node ? node->parent : NULL;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static NSString * xmpp_stringFromArenaString(const XMPPArenaString *str)
+{
+	if (str->interned) return str->interned;
+	if (str->utf8 == NULL) return nil;
+
+	return [[NSString alloc] initWithBytes:str->utf8 length:str->length encoding:NSUTF8StringEncoding];
+}
+
+static NSString * xmpp_qualifiedName(const XMPPArenaString *name, const XMPPArenaString *prefix)
+{
+	NSString *localName = xmpp_stringFromArenaString(name) ?: @"";
+
+	if (prefix->length > 0)
+	{
+		// E.g: <deusty:element xmlns:deusty="deusty.com"/>
+
+		return [NSString stringWithFormat:@"%@:%@", xmpp_stringFromArenaString(prefix), localName];
+	}
+
+	return localName;
+}
+
+static BOOL xmpp_qualifiedNameEquals(const XMPPArenaString *name, const XMPPArenaString *prefix, const char *target)
+{
+	if (name->utf8 == NULL) return NO;
+
+	if (prefix->length > 0)
+	{
+		if (strncmp(target, prefix->utf8, prefix->length) != 0) return NO;
+		if (target[prefix->length] != ':') return NO;
+
+		target += prefix->length + 1;
+	}
+
+	return (strcmp(target, name->utf8) == 0);
+}
+
+static XMPPArenaNode * xmpp_firstChildElement(XMPPArenaNode *node)
+{
+	for (XMPPArenaNode *child = node->firstChild; child; child = child->next)
+	{
+		if (child->kind == XMPPArenaNodeKindElement) return child;
+	}
+	return NULL;
+}
+
+static NSString * xmpp_defaultNamespace(XMPPArenaNode *node)
+{
+	for (XMPPArenaNamespace *ns = node->firstNamespace; ns; ns = ns->next)
+	{
+		if (ns->prefix.utf8 == NULL) return xmpp_stringFromArenaString(&ns->uri);
+	}
+	return nil;
+}
+
+/**
+ * Creates and returns an NSXMLElement from the given arena node (and its entire subtree).
+**/
+static NSXMLElement * xmpp_elementFromArenaNode(XMPPArenaNode *node)
+{
+	NSXMLElement *element = [NSXMLElement elementWithName:xmpp_qualifiedName(&node->name, &node->prefix)];
+
+	for (XMPPArenaNamespace *ns = node->firstNamespace; ns; ns = ns->next)
+	{
+		if (ns->uri.utf8 == NULL) continue;
+
+		NSString *nsName = xmpp_stringFromArenaString(&ns->prefix) ?: @"";
+		NSString *nsValue = xmpp_stringFromArenaString(&ns->uri);
+
+		[element addNamespace:[NSXMLNode namespaceWithName:nsName stringValue:nsValue]];
+	}
+
+	for (XMPPArenaAttribute *attr = node->firstAttribute; attr; attr = attr->next)
+	{
+		NSString *attrName = xmpp_qualifiedName(&attr->name, &attr->prefix);
+		NSString *attrValue = xmpp_stringFromArenaString(&attr->value) ?: @"";
+
+		[element addAttribute:[NSXMLNode attributeWithName:attrName stringValue:attrValue]];
+	}
+
+	for (XMPPArenaNode *child = node->firstChild; child; child = child->next)
+	{
+		if (child->kind == XMPPArenaNodeKindElement)
+		{
+			[element addChild:xmpp_elementFromArenaNode(child)];
+		}
+		else
+		{
+			NSString *text = xmpp_stringFromArenaString(&child->name);
+			if (text)
+			{
+				[element addChild:[NSXMLNode textWithStringValue:text]];
+			}
+		}
+	}
+
+	return element;
+}
+
+@implementation XMPPArenaElement
+{
+	XMPPStanzaArena *arena;
+	XMPPArenaNode *node;
+
+	NSXMLElement *element;
+	NSXMLElement * (^materializer)(void);
+}
+
+XMPPArenaElement * XMPPArenaElementCreate(XMPPStanzaArena *arena, XMPPArenaNode *node)
+{
+	if (arena == nil || node == NULL) return nil;
+
+	XMPPArenaElement *result = [[XMPPArenaElement alloc] init];
+	result->arena = arena;
+	result->node = node;
+
+	return result;
+}
+
+XMPPArenaElement * XMPPArenaElementCreateLazy(XMPPStanzaArena *arena, XMPPArenaNode *node,
+                                              NSXMLElement * (^materializer)(void))
+{
+	XMPPArenaElement *result = XMPPArenaElementCreate(arena, node);
+	if (result)
+	{
+		result->materializer = [materializer copy];
+	}
+
+	return result;
+}
+
+- (NSString *)name
+{
+	return xmpp_qualifiedName(&node->name, &node->prefix);
+}
+
+- (NSString *)xmlns
+{
+	return xmpp_defaultNamespace(node);
+}
+
+- (NSString *)attributeStringValueForName:(NSString *)name
+{
+	const char *target = [name UTF8String];
+	if (target == NULL) return nil;
+
+	for (XMPPArenaAttribute *attr = node->firstAttribute; attr; attr = attr->next)
+	{
+		if (xmpp_qualifiedNameEquals(&attr->name, &attr->prefix, target))
+		{
+			return xmpp_stringFromArenaString(&attr->value);
+		}
+	}
+
+	return nil;
+}
+
+- (NSString *)firstChildName
+{
+	XMPPArenaNode *child = xmpp_firstChildElement(node);
+
+	return child ? xmpp_qualifiedName(&child->name, &child->prefix) : nil;
+}
+
+- (NSString *)firstChildXmlns
+{
+	XMPPArenaNode *child = xmpp_firstChildElement(node);
+
+	return child ? xmpp_defaultNamespace(child) : nil;
+}
+
+- (NSString *)toStr
+{
+	return [self attributeStringValueForName:@"to"];
+}
+
+- (NSString *)fromStr
+{
+	return [self attributeStringValueForName:@"from"];
+}
+
+- (NSString *)elementID
+{
+	return [self attributeStringValueForName:@"id"];
+}
+
+- (NSString *)type
+{
+	return [self attributeStringValueForName:@"type"];
+}
+
+- (BOOL)isMaterialized
+{
+	return (materializer == nil || element != nil);
+}
+
+- (NSXMLElement *)element
+{
+	if (element == nil)
+	{
+		if (materializer)
+		{
+			element = materializer();
+			materializer = nil;
+		}
+
+		if (element == nil)
+		{
+			// Not lazy (or the raw stanza couldn't be parsed, in which case the partial stanza is all we have)
+			element = xmpp_elementFromArenaNode(node);
+		}
+	}
+
+	return element;
+}
+
+- (NSUInteger)arenaSize
+{
+	return [arena size];
+}
+
+- (NSString *)description
+{
+	return [[self element] description];
+}
+
+@end
@@ -0,0 +1,106 @@
+#import <Foundation/Foundation.h>
+#import "XMPPJID.h"
+
+@import KissXML;
+
+@class XMPPElement;
+
+typedef NS_OPTIONS(NSUInteger, XMPPStanzaKind) {
+	XMPPStanzaKindIQ       = 1 << 0,
+	XMPPStanzaKindMessage  = 1 << 1,
+	XMPPStanzaKindPresence = 1 << 2,
+
+	XMPPStanzaKindAny      = (XMPPStanzaKindIQ | XMPPStanzaKindMessage | XMPPStanzaKindPresence),
+};
+
+/**
+ * Describes a set of incoming stanzas that a delegate (typically a module) is interested in.
+ *
+ * An interest matches a stanza if ALL of the specified criteria match:
+ * - kind      : the stanza is one of the given kinds
+ * - childName : the stanza has a child element with the given name (nil matches any)
+ * - xmlns     : the stanza has a child element with the given namespace (nil matches any)
+ *               (if both are given, they must match the same child element)
+ * - fromJID   : the from attribute of the stanza matches the given JID, using the given compare options.
+ *               Only XMPPJIDCompareFull, XMPPJIDCompareBare and XMPPJIDCompareDomain are supported.
+ *               (nil matches any)
+ *
+ * Interests are registered with the XMPPStream via addStanzaInterest:forDelegate:.
+ * See the discussion there for how they affect the delivery of incoming stanzas.
+**/
+@interface XMPPStanzaInterest : NSObject <NSCopying>
+
++ (instancetype)interestInKind:(XMPPStanzaKind)kind;
+
++ (instancetype)interestInKind:(XMPPStanzaKind)kind childName:(NSString *)childName xmlns:(NSString *)xmlns;
+
++ (instancetype)interestInKind:(XMPPStanzaKind)kind
+                       fromJID:(XMPPJID *)fromJID
+                       options:(XMPPJIDCompareOptions)fromOptions;
+
+- (instancetype)initWithKind:(XMPPStanzaKind)kind
+                   childName:(NSString *)childName
+                       xmlns:(NSString *)xmlns
+                     fromJID:(XMPPJID *)fromJID
+                     options:(XMPPJIDCompareOptions)fromOptions;
+
+@property (nonatomic, readonly) XMPPStanzaKind kind;
+@property (nonatomic, readonly) NSString *childName;
+@property (nonatomic, readonly) NSString *xmlns;
+@property (nonatomic, readonly) XMPPJID *fromJID;
+@property (nonatomic, readonly) XMPPJIDCompareOptions fromOptions;
+
+/**
+ * Returns whether the given stanza (of the given kind) matches this interest.
+**/
+- (BOOL)matchesStanza:(XMPPElement *)stanza ofKind:(XMPPStanzaKind)kind;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The lookup structure used by XMPPStream to route incoming stanzas according to the registered interests.
+ *
+ * Interests are indexed (per stanza kind) by their from JID (full, bare or domain), or else by their xmlns.
+ * So finding the interested delegates for a stanza only involves a handful of dictionary lookups,
+ * regardless of how many delegates have registered interests.
+ *
+ * Delegates are referenced weakly.
+ *
+ * This class is NOT thread-safe.
+ * It is designed to be used within a thread-safe context (e.g. within a single dispatch_queue).
+**/
+@interface XMPPStanzaRoutingTable : NSObject
+
+- (void)addInterest:(XMPPStanzaInterest *)interest forDelegate:(id)delegate;
+- (void)removeInterestsForDelegate:(id)delegate;
+- (void)removeAllInterests;
+
+/**
+ * Returns YES if any delegate has registered an interest in the given kind of stanza.
+**/
+- (BOOL)hasInterestsForKind:(XMPPStanzaKind)kind;
+
+/**
+ * Returns YES if the given delegate has registered an interest in the given kind of stanza.
+ * Such a delegate should only receive the stanzas (of that kind) that match one of its interests.
+**/
+- (BOOL)isDelegate:(id)delegate routedForKind:(XMPPStanzaKind)kind;
+
+/**
+ * Returns the set of delegates with an interest matching the given stanza.
+ * The set uses pointer equality.
+**/
+- (NSHashTable *)delegatesMatchingStanza:(XMPPElement *)stanza ofKind:(XMPPStanzaKind)kind;
+
+/**
+ * Returns NO only if none of the interests for the given kind can possibly match a stanza from the given JID.
+ * This is used to route stanzas before their children are available (e.g. lazily parsed stanzas),
+ * so interests that depend on the children are assumed to match.
+**/
+- (BOOL)mayMatchStanzaOfKind:(XMPPStanzaKind)kind from:(XMPPJID *)from;
+
+@end
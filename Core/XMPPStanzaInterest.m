@@ -0,0 +1,403 @@
+#import "XMPPStanzaInterest.h"
+#import "XMPPElement.h"
+#import "NSXMLElement+XMPP.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+#define XMPP_STANZA_KIND_COUNT 3
+
+static NSUInteger XMPPStanzaKindIndex(XMPPStanzaKind kind)
+{
+	if (kind & XMPPStanzaKindIQ)      return 0;
+	if (kind & XMPPStanzaKindMessage) return 1;
+	return 2;
+}
+
+@implementation XMPPStanzaInterest
+
++ (instancetype)interestInKind:(XMPPStanzaKind)kind
+{
+	return [[self alloc] initWithKind:kind childName:nil xmlns:nil fromJID:nil options:XMPPJIDCompareFull];
+}
+
++ (instancetype)interestInKind:(XMPPStanzaKind)kind childName:(NSString *)childName xmlns:(NSString *)xmlns
+{
+	return [[self alloc] initWithKind:kind childName:childName xmlns:xmlns fromJID:nil options:XMPPJIDCompareFull];
+}
+
++ (instancetype)interestInKind:(XMPPStanzaKind)kind
+                       fromJID:(XMPPJID *)fromJID
+                       options:(XMPPJIDCompareOptions)fromOptions
+{
+	return [[self alloc] initWithKind:kind childName:nil xmlns:nil fromJID:fromJID options:fromOptions];
+}
+
+- (instancetype)initWithKind:(XMPPStanzaKind)kind
+                   childName:(NSString *)childName
+                       xmlns:(NSString *)xmlns
+                     fromJID:(XMPPJID *)fromJID
+                     options:(XMPPJIDCompareOptions)fromOptions
+{
+	if ((self = [super init]))
+	{
+		_kind = kind & XMPPStanzaKindAny;
+		_childName = [childName copy];
+		_xmlns = [xmlns copy];
+		_fromJID = fromJID;
+
+		if (fromOptions != XMPPJIDCompareBare && fromOptions != XMPPJIDCompareDomain)
+			_fromOptions = XMPPJIDCompareFull;
+		else
+			_fromOptions = fromOptions;
+	}
+	return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+	// Immutable
+	return self;
+}
+
+- (BOOL)matchesFrom:(XMPPJID *)from
+{
+	if (_fromJID == nil) return YES;
+	if (from == nil) return NO;
+
+	return [_fromJID isEqualToJID:from options:_fromOptions];
+}
+
+- (BOOL)matchesChild:(NSXMLElement *)child
+{
+	if (_childName && ![_childName isEqualToString:[child name]]) return NO;
+	if (_xmlns && ![_xmlns isEqualToString:[child xmlns]]) return NO;
+
+	return YES;
+}
+
+- (BOOL)matchesStanza:(XMPPElement *)stanza ofKind:(XMPPStanzaKind)kind
+{
+	if ((_kind & kind) == 0) return NO;
+	if (![self matchesFrom:[stanza from]]) return NO;
+
+	if (_childName == nil && _xmlns == nil) return YES;
+
+	for (NSXMLNode *node in [stanza children])
+	{
+		if ([node kind] != NSXMLElementKind) continue;
+
+		if ([self matchesChild:(NSXMLElement *)node]) return YES;
+	}
+
+	return NO;
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<XMPPStanzaInterest %p: kind=%lu child=%@ xmlns=%@ from=%@>",
+	        self, (unsigned long)_kind, _childName, _xmlns, _fromJID];
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface XMPPStanzaRoute : NSObject
+{
+  @public
+	XMPPStanzaInterest *interest;
+	__weak id delegate;
+}
+@end
+
+@implementation XMPPStanzaRoute
+@end
+
+/**
+ * The routes for a single kind of stanza.
+ *
+ * Routes with a from JID are indexed by the (full, bare or domain) JID string.
+ * Routes without a from JID, but with an xmlns, are indexed by the xmlns.
+ * All other routes are checked for every stanza.
+**/
+@interface XMPPStanzaRouteSet : NSObject
+{
+  @public
+	NSHashTable *routedDelegates;
+
+	NSMutableDictionary *byFull;
+	NSMutableDictionary *byBare;
+	NSMutableDictionary *byDomain;
+	NSMutableDictionary *byXmlns;
+	NSMutableArray *unindexed;
+
+	NSUInteger count;
+}
+@end
+
+@implementation XMPPStanzaRouteSet
+
+- (instancetype)init
+{
+	if ((self = [super init]))
+	{
+		routedDelegates = [[NSHashTable alloc] initWithOptions:(NSPointerFunctionsWeakMemory |
+		                                                           NSPointerFunctionsObjectPointerPersonality)
+		                                               capacity:0];
+
+		byFull = [[NSMutableDictionary alloc] init];
+		byBare = [[NSMutableDictionary alloc] init];
+		byDomain = [[NSMutableDictionary alloc] init];
+		byXmlns = [[NSMutableDictionary alloc] init];
+		unindexed = [[NSMutableArray alloc] init];
+	}
+	return self;
+}
+
+static void XMPPStanzaRouteSetAppend(NSMutableDictionary *dict, NSString *key, XMPPStanzaRoute *route)
+{
+	NSMutableArray *routes = dict[key];
+	if (routes == nil)
+	{
+		routes = [[NSMutableArray alloc] initWithCapacity:1];
+		dict[key] = routes;
+	}
+	[routes addObject:route];
+}
+
+- (void)addRoute:(XMPPStanzaRoute *)route
+{
+	XMPPStanzaInterest *interest = route->interest;
+	XMPPJID *fromJID = interest.fromJID;
+
+	if (fromJID)
+	{
+		switch (interest.fromOptions)
+		{
+			case XMPPJIDCompareBare   : XMPPStanzaRouteSetAppend(byBare, [fromJID bare], route);     break;
+			case XMPPJIDCompareDomain : XMPPStanzaRouteSetAppend(byDomain, [fromJID domain], route); break;
+			default                   : XMPPStanzaRouteSetAppend(byFull, [fromJID full], route);     break;
+		}
+	}
+	else if (interest.xmlns)
+	{
+		XMPPStanzaRouteSetAppend(byXmlns, interest.xmlns, route);
+	}
+	else
+	{
+		[unindexed addObject:route];
+	}
+
+	[routedDelegates addObject:route->delegate];
+	count++;
+}
+
+static NSUInteger XMPPStanzaRoutesRemove(NSMutableArray *routes, id delegate)
+{
+	NSIndexSet *indexes = [routes indexesOfObjectsPassingTest:^BOOL(XMPPStanzaRoute *route, NSUInteger idx, BOOL *stop) {
+
+		id routeDelegate = route->delegate;
+		return (routeDelegate == nil || routeDelegate == delegate);
+	}];
+
+	[routes removeObjectsAtIndexes:indexes];
+	return [indexes count];
+}
+
+static NSUInteger XMPPStanzaRouteSetRemove(NSMutableDictionary *dict, id delegate)
+{
+	NSUInteger removed = 0;
+	NSMutableArray *emptyKeys = nil;
+
+	for (NSString *key in dict)
+	{
+		NSMutableArray *routes = dict[key];
+		removed += XMPPStanzaRoutesRemove(routes, delegate);
+
+		if ([routes count] == 0)
+		{
+			if (emptyKeys == nil) emptyKeys = [[NSMutableArray alloc] init];
+			[emptyKeys addObject:key];
+		}
+	}
+
+	if (emptyKeys) [dict removeObjectsForKeys:emptyKeys];
+	return removed;
+}
+
+- (void)removeRoutesForDelegate:(id)delegate
+{
+	if (![routedDelegates containsObject:delegate]) return;
+
+	NSUInteger removed = 0;
+
+	removed += XMPPStanzaRouteSetRemove(byFull, delegate);
+	removed += XMPPStanzaRouteSetRemove(byBare, delegate);
+	removed += XMPPStanzaRouteSetRemove(byDomain, delegate);
+	removed += XMPPStanzaRouteSetRemove(byXmlns, delegate);
+	removed += XMPPStanzaRoutesRemove(unindexed, delegate);
+
+	[routedDelegates removeObject:delegate];
+	count = (removed > count) ? 0 : count - removed;
+}
+
+static void XMPPStanzaRoutesMatch(NSArray *routes, XMPPElement *stanza, XMPPStanzaKind kind, NSHashTable *result)
+{
+	for (XMPPStanzaRoute *route in routes)
+	{
+		id delegate = route->delegate;
+		if (delegate == nil || [result containsObject:delegate]) continue;
+
+		if ([route->interest matchesStanza:stanza ofKind:kind])
+		{
+			[result addObject:delegate];
+		}
+	}
+}
+
+- (void)addDelegatesMatchingStanza:(XMPPElement *)stanza ofKind:(XMPPStanzaKind)kind to:(NSHashTable *)result
+{
+	XMPPJID *from = [stanza from];
+	if (from)
+	{
+		if ([byFull count] > 0)
+			XMPPStanzaRoutesMatch(byFull[[from full]], stanza, kind, result);
+
+		if ([byBare count] > 0)
+			XMPPStanzaRoutesMatch(byBare[[from bare]], stanza, kind, result);
+
+		if ([byDomain count] > 0)
+			XMPPStanzaRoutesMatch(byDomain[[from domain]], stanza, kind, result);
+	}
+
+	if ([byXmlns count] > 0)
+	{
+		for (NSXMLNode *node in [stanza children])
+		{
+			if ([node kind] != NSXMLElementKind) continue;
+
+			NSString *xmlns = [(NSXMLElement *)node xmlns];
+			if (xmlns)
+			{
+				XMPPStanzaRoutesMatch(byXmlns[xmlns], stanza, kind, result);
+			}
+		}
+	}
+
+	XMPPStanzaRoutesMatch(unindexed, stanza, kind, result);
+}
+
+- (BOOL)mayMatchFrom:(XMPPJID *)from
+{
+	if ([byXmlns count] > 0) return YES;
+	if ([unindexed count] > 0) return YES;
+
+	if (from == nil) return NO;
+
+	if (byFull[[from full]]) return YES;
+	if (byBare[[from bare]]) return YES;
+	if (byDomain[[from domain]]) return YES;
+
+	return NO;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPStanzaRoutingTable
+{
+	XMPPStanzaRouteSet *routeSets[XMPP_STANZA_KIND_COUNT];
+}
+
+- (instancetype)init
+{
+	if ((self = [super init]))
+	{
+		for (NSUInteger i = 0; i < XMPP_STANZA_KIND_COUNT; i++)
+		{
+			routeSets[i] = [[XMPPStanzaRouteSet alloc] init];
+		}
+	}
+	return self;
+}
+
+- (void)addInterest:(XMPPStanzaInterest *)interest forDelegate:(id)delegate
+{
+	if (interest == nil || delegate == nil) return;
+
+	const XMPPStanzaKind kinds[XMPP_STANZA_KIND_COUNT] = {
+		XMPPStanzaKindIQ, XMPPStanzaKindMessage, XMPPStanzaKindPresence
+	};
+
+	for (NSUInteger i = 0; i < XMPP_STANZA_KIND_COUNT; i++)
+	{
+		if ((interest.kind & kinds[i]) == 0) continue;
+
+		XMPPStanzaRoute *route = [[XMPPStanzaRoute alloc] init];
+		route->interest = interest;
+		route->delegate = delegate;
+
+		[routeSets[i] addRoute:route];
+	}
+}
+
+- (void)removeInterestsForDelegate:(id)delegate
+{
+	if (delegate == nil) return;
+
+	for (NSUInteger i = 0; i < XMPP_STANZA_KIND_COUNT; i++)
+	{
+		[routeSets[i] removeRoutesForDelegate:delegate];
+	}
+}
+
+- (void)removeAllInterests
+{
+	for (NSUInteger i = 0; i < XMPP_STANZA_KIND_COUNT; i++)
+	{
+		routeSets[i] = [[XMPPStanzaRouteSet alloc] init];
+	}
+}
+
+- (BOOL)hasInterestsForKind:(XMPPStanzaKind)kind
+{
+	return routeSets[XMPPStanzaKindIndex(kind)]->count > 0;
+}
+
+- (BOOL)isDelegate:(id)delegate routedForKind:(XMPPStanzaKind)kind
+{
+	XMPPStanzaRouteSet *routeSet = routeSets[XMPPStanzaKindIndex(kind)];
+
+	if (routeSet->count == 0) return NO;
+	return [routeSet->routedDelegates containsObject:delegate];
+}
+
+- (NSHashTable *)delegatesMatchingStanza:(XMPPElement *)stanza ofKind:(XMPPStanzaKind)kind
+{
+	NSHashTable *result = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+
+	XMPPStanzaRouteSet *routeSet = routeSets[XMPPStanzaKindIndex(kind)];
+	if (routeSet->count > 0)
+	{
+		[routeSet addDelegatesMatchingStanza:stanza ofKind:kind to:result];
+	}
+
+	return result;
+}
+
+- (BOOL)mayMatchStanzaOfKind:(XMPPStanzaKind)kind from:(XMPPJID *)from
+{
+	XMPPStanzaRouteSet *routeSet = routeSets[XMPPStanzaKindIndex(kind)];
+
+	if (routeSet->count == 0) return NO;
+	return [routeSet mayMatchFrom:from];
+}
+
+@end
@@ -1,6 +1,8 @@
 #import <Foundation/Foundation.h>
 #import "GCDMulticastDelegate.h"
 #import "CocoaAsyncSocket/GCDAsyncSocket.h"
+#import "XMPPParser.h"
+#import "XMPPStanzaInterest.h"
 
 @import KissXML;
 
@@ -14,6 +16,7 @@
 @class XMPPElement;
 @class XMPPElementReceipt;
 @protocol XMPPStreamDelegate;
+@protocol XMPPStreamInlineFilter;
 
 #if TARGET_OS_IPHONE
   #define MIN_KEEPALIVE_INTERVAL      20.0 // 20 Seconds
@@ -35,6 +38,29 @@ typedef NS_ENUM(NSUInteger, XMPPStreamErrorCode) {
 
 extern const NSTimeInterval XMPPStreamTimeoutNone;
 
+/**
+ * The classes of the outbound send queue, highest priority first.
+ * 
+ * Stanzas of the same class are always written in the order they were sent.
+ * While the socket is backed up, a queued stanza may go ahead of queued stanzas of lower classes.
+ * 
+ * @see sendQueueHighWaterMark
+**/
+typedef NS_ENUM(NSUInteger, XMPPSendPriority) {
+	XMPPSendPriorityControl = 0, // Non-stanza elements, such as stream management requests and acks
+	XMPPSendPriorityIQ,
+	XMPPSendPriorityMessage,
+	XMPPSendPriorityPresence,
+	XMPPSendPriorityBulk,        // Any stanza of at least bulkStanzaThreshold bytes (e.g. an avatar upload)
+};
+
+/**
+ * Completion handlers for sendElement:completion: and sendElements:completionQueue:completion: (& co).
+**/
+typedef void (^XMPPSendCompletionBlock)(BOOL sent);
+typedef void (^XMPPBatchSendCompletionBlock)(NSUInteger numberOfSentElements);
+typedef void (^XMPPElementSendCompletionBlock)(NSUInteger index, BOOL sent);
+
 @interface XMPPStream : NSObject <GCDAsyncSocketDelegate>
 
 /**
@@ -58,6 +84,71 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 - (void)removeDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue;
 - (void)removeDelegate:(id)delegate;
 
+/**
+ * By default, every delegate receives every incoming stanza (via the xmppStream:didReceiveX: methods).
+ * Delegates that are only interested in a small subset of the incoming stanzas
+ * (e.g. stanzas from a particular JID, or containing a particular namespace)
+ * can instead register their interests, and the xmppStream will only invoke them for matching stanzas.
+ * 
+ * Interests are registered per kind of stanza (iq, message, presence).
+ * Once a delegate has registered an interest for a kind of stanza,
+ * it only receives the stanzas of that kind that match one of its registered interests.
+ * Other kinds of stanzas are still delivered to it as usual.
+ * 
+ * Interests only affect the xmppStream:didReceiveIQ:, xmppStream:didReceiveMessage:
+ * and xmppStream:didReceivePresence: delegate methods.
+ * In particular, the xmppStream:willReceiveX: filter methods are still invoked for every stanza.
+ * 
+ * The delegate must already be added to the xmppStream (via addDelegate:delegateQueue:).
+ * Interests are automatically removed when the delegate is removed from the xmppStream.
+ * 
+ * When the xmppStream is using the XMPPParserBackendArenaLazy parser backend,
+ * messages and presences that can't match any registered interest (of their kind) are dropped without being fully parsed.
+ * Delegates without interests don't see such stanzas either: all delegates are sent xmppStreamDidFilterStanza: instead.
+ * Only the from attribute is known prior to parsing, so interests that depend on a child element are assumed to match.
+**/
+- (void)addStanzaInterest:(XMPPStanzaInterest *)interest forDelegate:(id)delegate;
+- (void)removeStanzaInterestsForDelegate:(id)delegate;
+
+/**
+ * A module (or other object) may claim an IQ namespace upfront.
+ * 
+ * Incoming IQ requests (type get or set) whose child element has the given xmlns
+ * are then the sole responsibility of the registered handler (via the xmppStream:didReceiveIQ: delegate method).
+ * Only the handler's return value counts: if it returns NO, the xmppStream responds with a feature-not-implemented error.
+ * 
+ * The other delegates don't receive the IQ. Instead they're sent xmppStreamDidFilterStanza:,
+ * just as if the IQ had been filtered, so observers such as stream management still count every received stanza.
+ * (Delegates that need to see such IQs shouldn't rely on the handler's namespace being claimed.)
+ * 
+ * IQ responses (type result or error) are not affected, and are still delivered to all delegates.
+ * 
+ * There can be only one handler per namespace. Registering a new handler replaces the previous one.
+ * The handler is not retained, and is automatically unregistered if it's deallocated.
+ * 
+ * Passing a nil xmlns to unregisterIQHandler:forXmlns: unregisters the handler from all its namespaces.
+**/
+- (void)registerIQHandler:(id)handler handlerQueue:(dispatch_queue_t)handlerQueue forXmlns:(NSString *)xmlns;
+- (void)unregisterIQHandler:(id)handler forXmlns:(NSString *)xmlns;
+
+/**
+ * The xmppStream:willSendX: and xmppStream:willReceiveX: delegate methods are invoked one delegate at a time,
+ * each on its own delegate queue, which costs several queue hops for every stanza.
+ * 
+ * Inline filters are an alternative for filters that are thread-safe, and quick.
+ * They are invoked synchronously on the xmppStream's internal queue, in the order in which they were added,
+ * before any of the xmppStream:willSendX: / xmppStream:willReceiveX: delegate methods.
+ * 
+ * An inline filter must not block, and must not synchronously wait on any queue that may itself be waiting on
+ * the xmppStream (e.g. a module's queue).
+ * 
+ * Inline filters are not retained. They are automatically removed if they're deallocated.
+ * 
+ * @see XMPPStreamInlineFilter
+**/
+- (void)addInlineFilter:(id <XMPPStreamInlineFilter>)filter;
+- (void)removeInlineFilter:(id <XMPPStreamInlineFilter>)filter;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Properties
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -192,6 +283,131 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 **/
 - (void)getNumberOfBytesSent:(uint64_t *)bytesSentPtr numberOfBytesReceived:(uint64_t *)bytesReceivedPtr;
 
+/**
+ * The parser backend used for incoming data. See XMPPParser.h for a description of the available backends.
+ * 
+ * With either of the arena backends, the stream inspects the top-level element of each incoming stanza
+ * before creating its NSXMLElement, and drops message/presence stanzas that no delegate is listening for
+ * (see addStanzaInterest:forDelegate:). Dropped stanzas are reported via xmppStreamDidFilterStanza:.
+ * With XMPPParserBackendArenaLazy, such stanzas are never even fully parsed.
+ * 
+ * Changes take effect the next time the stream is opened.
+ * 
+ * The default value is XMPPParserBackendLibxml.
+**/
+@property (readwrite, assign) XMPPParserBackend parserBackend;
+
+/**
+ * The maximum number of received chunks that may be waiting on (or in) the xml parser at any one time.
+ * 
+ * With a depth of 1, the stream issues its next socket read only after the parser has finished
+ * with the previous chunk. This keeps memory usage to a minimum, but it means the kernel buffer isn't drained
+ * while the parser is busy, which limits receive throughput during large bursts (e.g. roster or archive downloads).
+ * 
+ * With a larger depth, the stream continues reading from the socket while the parser works through
+ * the pending chunks, and only stops reading once the given number of chunks are queued for parsing.
+ * 
+ * The default value is 1. Values less than 1 are treated as 1.
+**/
+@property (readwrite, assign) NSUInteger receivePipelineDepth;
+
+/**
+ * Write coalescing ("corking").
+ *
+ * Normally every outgoing stanza becomes its own socket write.
+ * When a module sends a burst of stanzas (presence probes, receipts, roster pushes, etc),
+ * this means one syscall (and often one TCP segment) per stanza.
+ *
+ * If enabled, stanzas sent during a single turn of the xmppQueue (or within the corkInterval)
+ * are serialized back-to-back into a single buffer, which is then handed to the socket as one write.
+ * The didSend delegate methods are still invoked for each individual stanza,
+ * and XMPPElementReceipts are still signaled once their particular stanza has been written.
+ *
+ * Corked stanzas are always flushed before any other data (e.g. the closing stream tag or keep-alive data).
+ * Disabling corking flushes any pending stanzas immediately.
+ *
+ * The default value is NO.
+**/
+@property (readwrite, assign) BOOL corksWrites;
+
+/**
+ * The maximum amount of time outgoing stanzas may be held back when corksWrites is enabled.
+ *
+ * With an interval of zero, pending stanzas are flushed at the end of the current xmppQueue turn.
+ * A small positive interval (e.g. a few milliseconds) allows stanzas sent from multiple queue turns
+ * (e.g. from several modules reacting to the same event) to share a single write.
+ *
+ * The default value is zero. Negative values are treated as zero.
+**/
+@property (readwrite, assign) NSTimeInterval corkInterval;
+
+/**
+ * The outbound send queue.
+ *
+ * The stream only keeps a limited amount of data in flight on the socket at any one time.
+ * Stanzas sent while the socket is backed up are serialized and held in the send queue,
+ * and are handed to the socket as earlier writes complete.
+ * 
+ * The queue is drained in priority order (see XMPPSendPriority): control elements (e.g. stream management
+ * requests & acks), then IQs, messages, presence, and finally bulk stanzas. Within a class, stanzas are
+ * always written in the order they were sent. So a ping or roster query isn't stuck behind an archive sync.
+ * 
+ * The didSend delegate methods (xmppStream:didSendIQ: & co) are invoked as each stanza is handed to the socket,
+ * and thus in the order the stanzas are actually written. (Stream management relies on this to count them.)
+ * If the order of stanzas of different classes matters (e.g. a MUC join presence followed by a message
+ * to the room), send the second one once the first has been sent (e.g. with sendElement:completion:).
+ *
+ * Note that a stanza can't be interrupted once it's been handed to the socket.
+ *
+ * The sendWindowSize is the amount of data that may be in flight on the socket before stanzas are queued.
+ * A smaller window lets higher classes overtake more of the backlog, at the cost of throughput.
+ *
+ * Sending never fails due to the queue being full.
+ * Instead, xmppStreamDidReachSendQueueHighWaterMark: is invoked once the number of unsent bytes
+ * (queued plus in flight) reaches the sendQueueHighWaterMark,
+ * and xmppStreamDidClearSendQueueHighWaterMark: is invoked once it drops to half the mark.
+ * Producers of large amounts of data (e.g. file transfer or archive sync) should pause in between.
+ *
+ * The default sendQueueHighWaterMark is 1 MB. A value of zero disables the callbacks.
+ * The default bulkStanzaThreshold is 32 KB. A value of zero disables the bulk class.
+ * The default sendWindowSize is 64 KB. (A single write is always allowed in flight.)
+**/
+@property (readwrite, assign) NSUInteger sendWindowSize;
+@property (readwrite, assign) NSUInteger sendQueueHighWaterMark;
+@property (readwrite, assign) NSUInteger bulkStanzaThreshold;
+
+@property (readonly) BOOL isAboveSendQueueHighWaterMark;
+
+/**
+ * The current depth of the send queue.
+ * 
+ * The per-class values only count stanzas that are waiting in the queue (i.e. not yet handed to the socket).
+ * The numberOfUnsentBytes also includes the data currently in flight on the socket.
+**/
+- (NSUInteger)numberOfQueuedStanzasForPriority:(XMPPSendPriority)priority;
+- (NSUInteger)numberOfQueuedBytesForPriority:(XMPPSendPriority)priority;
+
+@property (readonly) NSUInteger numberOfUnsentBytes;
+
+/**
+ * Batched delivery of received messages and presences.
+ *
+ * Delegates that implement xmppStream:didReceiveMessages: (or xmppStream:didReceivePresences:)
+ * receive consecutive messages (or presences) in batches, instead of one invocation per stanza.
+ * This is useful when a large number of stanzas arrive at once (e.g. offline messages or an archive page),
+ * as a storage delegate can then process an entire batch within a single transaction.
+ *
+ * A batch is delivered when it reaches the deliveryBatchMaxSize,
+ * when a stanza of a different kind is received (so stanzas are always delivered in order),
+ * or after the deliveryBatchLatency.
+ * With a latency of zero, batches are delivered once the xmppStream has processed
+ * all the stanzas that arrived within the same read from the socket.
+ *
+ * The default deliveryBatchMaxSize is 64. The default deliveryBatchLatency is zero.
+**/
+@property (readwrite, assign) NSUInteger deliveryBatchMaxSize;
+@property (readwrite, assign) NSTimeInterval deliveryBatchLatency;
+
 /**
  * Affects the funtionality of the byte counter.
  * 
@@ -377,6 +593,67 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 **/
 - (void)sendElement:(NSXMLElement *)element andGetReceipt:(XMPPElementReceipt **)receiptPtr;
 
+/**
+ * Asynchronous alternatives to sendElement:andGetReceipt:.
+ * 
+ * The completion handler is invoked once the element has been written to the socket (sent == YES),
+ * or once it's clear the element won't be sent, e.g. due to a disconnection or a filter dropping it (sent == NO).
+ * Just like a receipt, this does NOT mean the server has received the element.
+ * 
+ * The completion handler is invoked on the given queue, or on the main queue if NULL.
+**/
+- (void)sendElement:(NSXMLElement *)element completion:(XMPPSendCompletionBlock)completion;
+- (void)sendElement:(NSXMLElement *)element
+    completionQueue:(dispatch_queue_t)completionQueue
+         completion:(XMPPSendCompletionBlock)completion;
+
+/**
+ * Sends the given elements (in order), and invokes the completion handler once,
+ * after every element has either been written or has failed to send.
+ * 
+ * The completion handler receives the number of elements that were written.
+ * If this equals the number of given elements, the whole batch was sent.
+ * 
+ * The batch is corked (regardless of corksWrites): the cork stays open until every element has either
+ * been serialized or has failed, including elements held up by the willSend delegate methods.
+ * So the elements that aren't waiting in the send queue are handed to the socket in as few writes as possible.
+ * Other elements sent in the meantime join the cork.
+**/
+- (void)sendElements:(NSArray *)elements
+     completionQueue:(dispatch_queue_t)completionQueue
+          completion:(XMPPBatchSendCompletionBlock)completion;
+
+/**
+ * Same as above, but the completion handler is invoked for each element,
+ * with the index of the element within the given array.
+**/
+- (void)sendElements:(NSArray *)elements
+     completionQueue:(dispatch_queue_t)completionQueue
+   elementCompletion:(XMPPElementSendCompletionBlock)completion;
+
+/**
+ * Sends the given XML element as "early data".
+ * 
+ * If the stream is connected, this method is equivalent to sendElement:.
+ * If the stream is still connecting, the element is buffered,
+ * and written immediately after the opening stream header (in the same write).
+ * As the header carries the credentials (and the stream management resume state),
+ * this saves waiting for xmppStreamDidAuthenticate: before sending the first stanzas on a (re)connect.
+ * 
+ * Only use this method for elements that are safe to send before authentication has completed.
+ * If authentication fails, the server discards them (they are NOT resent),
+ * and they may also have been acted upon if the resumption of a previous session partially succeeded.
+ * 
+ * The outgoing inline filters are applied to early elements, and the didSend delegate methods are invoked.
+ * However, the willSend delegate methods are NOT invoked for elements written along with the header.
+ * 
+ * Stream management (XEP-0198) tracks early stanzas as part of the session enabled or resumed by the header.
+ * 
+ * If the stream disconnects before the header has been written,
+ * the didFailToSend delegate methods are invoked for the buffered elements.
+**/
+- (void)sendElementAsEarlyData:(NSXMLElement *)element;
+
 /**
  * Fetches and resends the myPresence element (if available) in a single atomic operation.
  * 
@@ -482,6 +759,20 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 + (NSString *)generateUUID;
 - (NSString *)generateUUID;
 
+/**
+ * Generates and returns a new id for an xmpp element sent through this stream.
+ * 
+ * The id is a short base-62 string (e.g. "Bx3kq0a9") derived from a per-stream counter and a random prefix.
+ * It is unique for this stream, which is all that is needed to match responses to requests,
+ * and is much cheaper to generate than a UUID.
+ * Additionally, XMPPIDTracker recognizes these ids, and tracks them without any string hashing or comparisons.
+ * 
+ * Use generateUUID instead if the id must be globally unique.
+ * 
+ * This method may be invoked on any thread/queue.
+**/
+- (NSString *)generateElementID;
+
 @end
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -594,7 +885,9 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 - (XMPPPresence *)xmppStream:(XMPPStream *)sender willReceivePresence:(XMPPPresence *)presence;
 
 /**
- * This method is called if any of the xmppStream:willReceiveX: methods filter the incoming stanza.
+ * This method is called if any of the xmppStream:willReceiveX: methods filter the incoming stanza,
+ * if an incoming IQ was delivered only to the handler that claimed its namespace (see registerIQHandler:...),
+ * or if an incoming stanza was dropped for lack of interest (see addStanzaInterest:forDelegate:).
  * 
  * It may be useful for some extensions to know that something was received,
  * even if it was filtered for some reason.
@@ -617,6 +910,18 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 - (void)xmppStream:(XMPPStream *)sender didReceiveMessage:(XMPPMessage *)message;
 - (void)xmppStream:(XMPPStream *)sender didReceivePresence:(XMPPPresence *)presence;
 
+/**
+ * Batched variants of xmppStream:didReceiveMessage: and xmppStream:didReceivePresence:.
+ * 
+ * A delegate that implements one of these methods receives the corresponding stanzas in batches (in order),
+ * and the corresponding single-stanza method is NOT invoked.
+ * 
+ * @see deliveryBatchMaxSize
+ * @see deliveryBatchLatency
+**/
+- (void)xmppStream:(XMPPStream *)sender didReceiveMessages:(NSArray *)messages;
+- (void)xmppStream:(XMPPStream *)sender didReceivePresences:(NSArray *)presences;
+
 /**
  * This method is called if an XMPP error is received.
  * In other words, a <stream:error/>.
@@ -657,6 +962,10 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
  * These methods are called after their respective XML elements are sent over the stream.
  * These methods may be used to listen for certain events (such as an unavailable presence having been sent),
  * or for general logging purposes. (E.g. a central history logging mechanism).
+ * 
+ * They're invoked in the order the elements are handed to the socket, which may differ from the order
+ * they were sent in when the send queue is backed up. (See sendWindowSize)
+ * An element that's dropped from the send queue (e.g. on disconnect) gets the didFailToSend method instead.
 **/
 - (void)xmppStream:(XMPPStream *)sender didSendIQ:(XMPPIQ *)iq;
 - (void)xmppStream:(XMPPStream *)sender didSendMessage:(XMPPMessage *)message;
@@ -670,6 +979,15 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 - (void)xmppStream:(XMPPStream *)sender didFailToSendMessage:(XMPPMessage *)message error:(NSError *)error;
 - (void)xmppStream:(XMPPStream *)sender didFailToSendPresence:(XMPPPresence *)presence error:(NSError *)error;
 
+/**
+ * These methods are called when the number of unsent bytes reaches the sendQueueHighWaterMark,
+ * and once it has dropped back down to half the mark (or the stream has disconnected).
+ * 
+ * @see sendQueueHighWaterMark
+**/
+- (void)xmppStreamDidReachSendQueueHighWaterMark:(XMPPStream *)sender;
+- (void)xmppStreamDidClearSendQueueHighWaterMark:(XMPPStream *)sender;
+
 /**
  * This method is called if the XMPP Stream's jid changes.
 **/
@@ -747,3 +1065,29 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 - (void)xmppStream:(XMPPStream *)sender didReceiveCustomElement:(NSXMLElement *)element;
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The methods of an inline filter are the counterparts of the
+ * xmppStream:willSendX: and xmppStream:willReceiveX: delegate methods, and follow the same rules:
+ * the given element may be modified (and returned), or filtered (by returning nil).
+ * 
+ * Unlike the delegate methods, they are invoked on the xmppStream's internal queue.
+ * 
+ * @see addInlineFilter:
+**/
+@protocol XMPPStreamInlineFilter <NSObject>
+@optional
+
+- (XMPPIQ *)xmppStream:(XMPPStream *)sender filterOutgoingIQ:(XMPPIQ *)iq;
+- (XMPPMessage *)xmppStream:(XMPPStream *)sender filterOutgoingMessage:(XMPPMessage *)message;
+- (XMPPPresence *)xmppStream:(XMPPStream *)sender filterOutgoingPresence:(XMPPPresence *)presence;
+
+- (XMPPIQ *)xmppStream:(XMPPStream *)sender filterIncomingIQ:(XMPPIQ *)iq;
+- (XMPPMessage *)xmppStream:(XMPPStream *)sender filterIncomingMessage:(XMPPMessage *)message;
+- (XMPPPresence *)xmppStream:(XMPPStream *)sender filterIncomingPresence:(XMPPPresence *)presence;
+
+@end
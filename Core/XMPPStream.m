@@ -6,6 +6,10 @@
 #import "XMPPSRVResolver.h"
 #import "NSData+XMPP.h"
 #import "XMPPStreamManagement.h"
+#import "XMPPStanzaSerializer.h"
+#import "XMPPStanzaArena.h"
+#import "XMPPStreamPrivate.h"
+#import "XMPPTimer.h"
 
 #import <objc/runtime.h>
 #import <libkern/OSAtomic.h>
@@ -44,7 +48,22 @@
 #define TAG_XMPP_WRITE_START        200
 #define TAG_XMPP_WRITE_STOP         201
 #define TAG_XMPP_WRITE_STREAM       202
-#define TAG_XMPP_WRITE_RECEIPT      203
+#define TAG_XMPP_WRITE_CORKED       204
+
+// Define the default maximum number of stanzas in a batch delivered to the delegates
+#define XMPP_DEFAULT_DELIVERY_BATCH_MAX_SIZE 64
+
+// Define the initial capacity of a cork buffer, and the size at which it's flushed regardless of the corkInterval
+#define XMPP_CORK_INITIAL_CAPACITY  (8 * 1024)
+#define XMPP_CORK_MAX_LENGTH        (64 * 1024)
+
+// Define the default amount of data that may be in flight on the socket before stanzas are held in the send queue
+#define XMPP_DEFAULT_SEND_WINDOW_SIZE  (64 * 1024)
+#define XMPP_SEND_PRIORITY_COUNT       (XMPPSendPriorityBulk + 1)
+
+// Define the default send queue high-water mark, and the size at which a stanza is considered bulk
+#define XMPP_DEFAULT_SEND_QUEUE_HIGH_WATER_MARK  (1024 * 1024)
+#define XMPP_DEFAULT_BULK_STANZA_THRESHOLD       (32 * 1024)
 
 // Define the timeouts (in seconds) for SRV
 #define TIMEOUT_SRV_RESOLUTION 30.0
@@ -72,6 +91,21 @@ enum XMPPStreamConfig
 #pragma mark -
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * The hooks at which inline filters may be invoked.
+ * Each hook has its own chain, containing only the filters that implement the corresponding method.
+**/
+typedef NS_ENUM(NSUInteger, XMPPInlineFilterHook) {
+	XMPPInlineFilterHookOutgoingIQ = 0,
+	XMPPInlineFilterHookOutgoingMessage,
+	XMPPInlineFilterHookOutgoingPresence,
+	XMPPInlineFilterHookIncomingIQ,
+	XMPPInlineFilterHookIncomingMessage,
+	XMPPInlineFilterHookIncomingPresence,
+	
+	XMPPInlineFilterHookCount
+};
+
 @interface XMPPStream ()
 {
 	dispatch_queue_t xmppQueue;
@@ -83,11 +117,15 @@ enum XMPPStreamConfig
 	
 	dispatch_queue_t willReceiveStanzaQueue;
 	
-	dispatch_queue_t didReceiveIqQueue;
+	NSMutableDictionary *iqHandlers;
+	
+	NSPointerArray *inlineFilters;
+	NSPointerArray *inlineFilterChains[XMPPInlineFilterHookCount];
     
 	dispatch_source_t connectTimer;
 	
 	GCDMulticastDelegate <XMPPStreamDelegate> *multicastDelegate;
+	XMPPStanzaRoutingTable *routingTable;
 	
 	XMPPStreamState state;
 	
@@ -98,6 +136,11 @@ enum XMPPStreamConfig
 	
 	XMPPParser *parser;
 	NSError *parserError;
+	
+	XMPPParserBackend parserBackend;
+	NSUInteger receivePipelineDepth;
+	NSUInteger pendingParseChunks;
+	BOOL isReadingStream;
 	NSError *otherError;
 	
 	Byte flags;
@@ -118,7 +161,7 @@ enum XMPPStreamConfig
 	NSXMLElement *rootElement;
 	
 	NSTimeInterval keepAliveInterval;
-	dispatch_source_t keepAliveTimer;
+	XMPPTimer *keepAliveTimer;
 	NSTimeInterval lastSendReceiveTime;
 	NSData *keepAliveData;
 	
@@ -131,9 +174,41 @@ enum XMPPStreamConfig
     
     XMPPIDTracker *idTracker;
 	
-	NSMutableArray *receipts;
+	uint64_t elementIDBase;
+	volatile int64_t elementIDCounter;
+	
+	XMPPSendReceiptRing *receiptRing;
 	NSCountedSet *customElementNames;
 	
+	NSMutableArray *earlyElements;
+	
+	XMPPOutputBufferPool *outputBufferPool;
+	XMPPPendingWriteQueue *pendingWrites;
+	NSUInteger bytesInFlight;
+	NSUInteger sendWindowSize;
+	
+	BOOL corksWrites;
+	BOOL corksBatch;
+	NSMutableIndexSet *batchCorkTags;
+	NSTimeInterval corkInterval;
+	XMPPOutputBuffer *corkBuffer;
+	NSMutableArray *corkTags;
+	NSUInteger corkGeneration;
+	
+	XMPPPendingWriteQueue *sendQueues[XMPP_SEND_PRIORITY_COUNT];
+	NSUInteger sendQueueCounts[XMPP_SEND_PRIORITY_COUNT];
+	NSUInteger sendQueueBytes[XMPP_SEND_PRIORITY_COUNT];
+	NSUInteger totalSendQueueBytes;
+	NSUInteger sendQueueHighWaterMark;
+	NSUInteger bulkStanzaThreshold;
+	BOOL isAboveSendQueueHighWaterMark;
+	
+	NSMutableArray *deliveryBatches;
+	NSUInteger deliveryBatchMaxSize;
+	NSTimeInterval deliveryBatchLatency;
+	NSUInteger deliveryBatchGeneration;
+	BOOL deliveryBatchFlushScheduled;
+	
 	id userTag;
     
     XMPPStreamManagement *streamMgmt;
@@ -141,10 +216,48 @@ enum XMPPStreamConfig
 
 @end
 
-@interface XMPPElementReceipt (PrivateAPI)
+/**
+ * An entry in the iqHandlers dictionary (keyed by xmlns).
+**/
+@interface XMPPIQHandlerEntry : NSObject
+{
+  @public
+	__weak id handler;
+	dispatch_queue_t handlerQueue;
+}
+@end
+
+/**
+ * The stanzas pending delivery to a single batched delegate (on a particular delegate queue).
+**/
+@interface XMPPDeliveryBatch : NSObject
+{
+  @public
+	__weak id delegate;
+	dispatch_queue_t delegateQueue;
+	XMPPStanzaKind kind;
+	NSMutableArray *stanzas;
+}
+@end
+
+@interface XMPPElementReceipt (PrivateAPI) <XMPPSendObserver>
+@end
+
+/**
+ * Invokes a completion handler once its element has been written (or has failed to send).
+ * A batch completion is shared by all the elements of the batch, and is invoked once all of them have resolved.
+**/
+@interface XMPPSendCompletion : NSObject <XMPPSendObserver>
+{
+  @public
+	dispatch_queue_t completionQueue;
+	XMPPSendCompletionBlock completionBlock;
+	XMPPBatchSendCompletionBlock batchCompletionBlock;
+	NSUInteger numberOfPendingElements;
+	NSUInteger numberOfSentElements;
+}
 
-- (void)signalSuccess;
-- (void)signalFailure;
+- (id)initWithQueue:(dispatch_queue_t)queue;
 
 @end
 
@@ -170,9 +283,11 @@ enum XMPPStreamConfig
 	willSendMessageQueue = dispatch_queue_create("xmpp.willSendMessage", DISPATCH_QUEUE_SERIAL);
 	willSendPresenceQueue = dispatch_queue_create("xmpp.willSendPresence", DISPATCH_QUEUE_SERIAL);
 	
-	didReceiveIqQueue = dispatch_queue_create("xmpp.didReceiveIq", DISPATCH_QUEUE_SERIAL);
+	iqHandlers = [[NSMutableDictionary alloc] init];
+	inlineFilters = [NSPointerArray weakObjectsPointerArray];
 	
 	multicastDelegate = (GCDMulticastDelegate <XMPPStreamDelegate> *)[[GCDMulticastDelegate alloc] init];
+	routingTable = [[XMPPStanzaRoutingTable alloc] init];
 	
 	state = STATE_XMPP_DISCONNECTED;
 	
@@ -182,6 +297,8 @@ enum XMPPStreamConfig
 	numberOfBytesSent = 0;
 	numberOfBytesReceived = 0;
 	
+	receivePipelineDepth = 1;
+	
 	hostPort = 5222;
 	keepAliveInterval = DEFAULT_KEEPALIVE_INTERVAL;
 	keepAliveData = [@" " dataUsingEncoding:NSUTF8StringEncoding];
@@ -191,7 +308,28 @@ enum XMPPStreamConfig
     
     idTracker = [[XMPPIDTracker alloc] initWithStream:self dispatchQueue:xmppQueue];
 	
-	receipts = [[NSMutableArray alloc] init];
+	// Element ids are a random per-stream prefix (in the upper 23 bits) plus a counter (in the lower 40 bits).
+	// The prefix keeps ids from different streams and app launches apart.
+	elementIDBase = ((uint64_t)(arc4random_uniform((1 << 23) - 1) + 1)) << 40;
+	elementIDCounter = 0;
+	
+	receiptRing = [[XMPPSendReceiptRing alloc] init];
+	
+	outputBufferPool = [[XMPPOutputBufferPool alloc] init];
+	pendingWrites = [[XMPPPendingWriteQueue alloc] init];
+	sendWindowSize = XMPP_DEFAULT_SEND_WINDOW_SIZE;
+	batchCorkTags = [[NSMutableIndexSet alloc] init];
+	
+	for (NSUInteger priority = 0; priority < XMPP_SEND_PRIORITY_COUNT; priority++)
+	{
+		sendQueues[priority] = [[XMPPPendingWriteQueue alloc] init];
+	}
+	sendQueueHighWaterMark = XMPP_DEFAULT_SEND_QUEUE_HIGH_WATER_MARK;
+	bulkStanzaThreshold = XMPP_DEFAULT_BULK_STANZA_THRESHOLD;
+	
+	deliveryBatches = [[NSMutableArray alloc] init];
+	deliveryBatchMaxSize = XMPP_DEFAULT_DELIVERY_BATCH_MAX_SIZE;
+	
     preferIPv6 = YES;
     
     [self setShouldSendInitialPresence:YES];
@@ -234,8 +372,6 @@ enum XMPPStreamConfig
 	if (willReceiveStanzaQueue) {
 		dispatch_release(willReceiveStanzaQueue);
 	}
-	
-	dispatch_release(didReceiveIqQueue);
 	#endif
 	
 	[asyncSocket setDelegate:nil delegateQueue:NULL];
@@ -243,16 +379,13 @@ enum XMPPStreamConfig
 	
 	[parser setDelegate:nil delegateQueue:NULL];
 	
-	if (keepAliveTimer)
-	{
-		dispatch_source_cancel(keepAliveTimer);
-	}
+	[keepAliveTimer cancel];
     
     [idTracker removeAllIDs];
     
-	for (XMPPElementReceipt *receipt in receipts)
+	for (id <XMPPSendObserver> observer in [receiptRing removeAllObservers])
 	{
-		[receipt signalFailure];
+		[observer signalFailure];
 	}
 }
 
@@ -618,12 +751,12 @@ enum XMPPStreamConfig
         dispatch_async(xmppQueue, block);
 }
 
-- (BOOL)resetByteCountPerConnection
+- (XMPPParserBackend)parserBackend
 {
-	__block BOOL result = NO;
+	__block XMPPParserBackend result = XMPPParserBackendLibxml;
 	
 	dispatch_block_t block = ^{
-		result = (config & kResetByteCountPerConnection) ? YES : NO;
+		result = parserBackend;
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -634,13 +767,10 @@ enum XMPPStreamConfig
 	return result;
 }
 
-- (void)setResetByteCountPerConnection:(BOOL)flag
+- (void)setParserBackend:(XMPPParserBackend)backend
 {
 	dispatch_block_t block = ^{
-		if (flag)
-			config |= kResetByteCountPerConnection;
-		else
-			config &= ~kResetByteCountPerConnection;
+		parserBackend = backend;
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -649,42 +779,44 @@ enum XMPPStreamConfig
 		dispatch_async(xmppQueue, block);
 }
 
-- (BOOL)validatesResponses
+- (NSUInteger)receivePipelineDepth
 {
-    __block BOOL result = NO;
-    
-    dispatch_block_t block = ^{
-        result = validatesResponses;
-    };
-    
-    if (dispatch_get_specific(xmppQueueTag))
-        block();
-    else
-        dispatch_sync(xmppQueue, block);
-    
-    return result;
+	__block NSUInteger result = 0;
+	
+	dispatch_block_t block = ^{
+		result = receivePipelineDepth;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
 }
 
-- (void)setValidatesResponses:(BOOL)flag
+- (void)setReceivePipelineDepth:(NSUInteger)depth
 {
-    dispatch_block_t block = ^{
-        validatesResponses = flag;
-    };
-    
-    if (dispatch_get_specific(xmppQueueTag))
-        block();
-    else
-        dispatch_async(xmppQueue, block);
+	dispatch_block_t block = ^{
+		
+		receivePipelineDepth = MAX(depth, (NSUInteger)1);
+		
+		// If the window just grew, the socket may be able to resume reading immediately.
+		[self maybeReadStreamData];
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
 }
 
-#if TARGET_OS_IPHONE
-
-- (BOOL)enableBackgroundingOnSocket
+- (BOOL)corksWrites
 {
 	__block BOOL result = NO;
 	
 	dispatch_block_t block = ^{
-		result = (config & kEnableBackgroundingOnSocket) ? YES : NO;
+		result = corksWrites;
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -695,13 +827,16 @@ enum XMPPStreamConfig
 	return result;
 }
 
-- (void)setEnableBackgroundingOnSocket:(BOOL)flag
+- (void)setCorksWrites:(BOOL)flag
 {
 	dispatch_block_t block = ^{
-		if (flag)
-			config |= kEnableBackgroundingOnSocket;
-		else
-			config &= ~kEnableBackgroundingOnSocket;
+		
+		corksWrites = flag;
+		
+		if (!corksWrites)
+		{
+			[self flushCorkedWrites];
+		}
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -710,18 +845,58 @@ enum XMPPStreamConfig
 		dispatch_async(xmppQueue, block);
 }
 
-#endif
+- (NSTimeInterval)corkInterval
+{
+	__block NSTimeInterval result = 0.0;
+	
+	dispatch_block_t block = ^{
+		result = corkInterval;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma mark Configuration
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+- (void)setCorkInterval:(NSTimeInterval)interval
+{
+	dispatch_block_t block = ^{
+		corkInterval = MAX(interval, 0.0);
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
 
-- (void)addDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue
+- (NSUInteger)sendWindowSize
 {
-	// Asynchronous operation (if outside xmppQueue)
+	__block NSUInteger result = 0;
 	
 	dispatch_block_t block = ^{
-		[multicastDelegate addDelegate:delegate delegateQueue:delegateQueue];
+		result = sendWindowSize;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+- (void)setSendWindowSize:(NSUInteger)windowSize
+{
+	dispatch_block_t block = ^{
+		
+		// At least one write is always allowed in flight
+		sendWindowSize = MAX(windowSize, (NSUInteger)1);
+		
+		[self pumpSendQueues];
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -730,48 +905,71 @@ enum XMPPStreamConfig
 		dispatch_async(xmppQueue, block);
 }
 
-- (void)removeDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue
+- (NSUInteger)sendQueueHighWaterMark
 {
-	// Synchronous operation
+	__block NSUInteger result = 0;
 	
 	dispatch_block_t block = ^{
-		[multicastDelegate removeDelegate:delegate delegateQueue:delegateQueue];
+		result = sendQueueHighWaterMark;
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
 		block();
 	else
 		dispatch_sync(xmppQueue, block);
+	
+	return result;
 }
 
-- (void)removeDelegate:(id)delegate
+- (void)setSendQueueHighWaterMark:(NSUInteger)highWaterMark
 {
-	// Synchronous operation
+	dispatch_block_t block = ^{
+		
+		sendQueueHighWaterMark = highWaterMark;
+		
+		[self updateSendQueueHighWaterMark];
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (NSUInteger)bulkStanzaThreshold
+{
+	__block NSUInteger result = 0;
 	
 	dispatch_block_t block = ^{
-		[multicastDelegate removeDelegate:delegate];
+		result = bulkStanzaThreshold;
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
 		block();
 	else
 		dispatch_sync(xmppQueue, block);
+	
+	return result;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma mark Connection State
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+- (void)setBulkStanzaThreshold:(NSUInteger)threshold
+{
+	dispatch_block_t block = ^{
+		bulkStanzaThreshold = threshold;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
 
-/**
- * Returns YES if the connection is closed, and thus no stream is open.
- * If the stream is neither disconnected, nor connected, then a connection is currently being established.
-**/
-- (BOOL)isDisconnected
+- (BOOL)isAboveSendQueueHighWaterMark
 {
 	__block BOOL result = NO;
 	
 	dispatch_block_t block = ^{
-		result = (state == STATE_XMPP_DISCONNECTED);
+		result = isAboveSendQueueHighWaterMark;
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -782,19 +980,15 @@ enum XMPPStreamConfig
 	return result;
 }
 
-/**
- * Returns YES is the connection is currently connecting
- **/
-
-- (BOOL)isConnecting
+- (NSUInteger)numberOfQueuedStanzasForPriority:(XMPPSendPriority)priority
 {
-	XMPPLogTrace();
+	if (priority >= XMPP_SEND_PRIORITY_COUNT) return 0;
 	
-	__block BOOL result = NO;
+	__block NSUInteger result = 0;
 	
-	dispatch_block_t block = ^{ @autoreleasepool {
-		result = (state == STATE_XMPP_CONNECTING);
-	}};
+	dispatch_block_t block = ^{
+		result = sendQueueCounts[priority];
+	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
 		block();
@@ -803,16 +997,15 @@ enum XMPPStreamConfig
 	
 	return result;
 }
-/**
- * Returns YES if the connection is open, and the stream has been properly established.
- * If the stream is neither disconnected, nor connected, then a connection is currently being established.
-**/
-- (BOOL)isConnected
+
+- (NSUInteger)numberOfQueuedBytesForPriority:(XMPPSendPriority)priority
 {
-	__block BOOL result = NO;
+	if (priority >= XMPP_SEND_PRIORITY_COUNT) return 0;
+	
+	__block NSUInteger result = 0;
 	
 	dispatch_block_t block = ^{
-		result = (state == STATE_XMPP_CONNECTED);
+		result = sendQueueBytes[priority];
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -823,286 +1016,71 @@ enum XMPPStreamConfig
 	return result;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma mark Connect Timeout
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-/**
- * Start Connect Timeout
-**/
-- (void)startConnectTimeout:(NSTimeInterval)timeout
+- (NSUInteger)numberOfUnsentBytes
 {
-    XMPPLogTrace();
-
-	if (timeout >= 0.0 && !connectTimer)
-	{
-		connectTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, xmppQueue);
-		
-		dispatch_source_set_event_handler(connectTimer, ^{ @autoreleasepool {
-			
-			[self doConnectTimeout];
-		}});
-		
-#if !OS_OBJECT_USE_OBJC
-		dispatch_source_t theConnectTimer = connectTimer;
-		dispatch_source_set_cancel_handler(connectTimer, ^{            
-            XMPPLogVerbose(@"%@: dispatch_release(connectTimer)", THIS_FILE);
-			dispatch_release(theConnectTimer);
-		});
-#endif
-		
-		dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (timeout * NSEC_PER_SEC));
-		dispatch_source_set_timer(connectTimer, tt, DISPATCH_TIME_FOREVER, 0);
-		
-		dispatch_resume(connectTimer);
-	}
+	__block NSUInteger result = 0;
+	
+	dispatch_block_t block = ^{
+		result = totalSendQueueBytes + bytesInFlight;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
 }
 
-/**
- * End Connect Timeout
-**/
-- (void)endConnectTimeout
+- (NSUInteger)deliveryBatchMaxSize
 {
-	XMPPLogTrace();
+	__block NSUInteger result = 0;
 	
-	if (connectTimer)
-	{
-		dispatch_source_cancel(connectTimer);
-		connectTimer = NULL;
-	}
-}
-
-/**
- * Connect has timed out, so inform the delegates and close the connection
-**/
-- (void)doConnectTimeout
-{
-	XMPPLogTrace();
-	
-	[self endConnectTimeout];
-    		
-    if (state != STATE_XMPP_DISCONNECTED)
-    {
-        [multicastDelegate xmppStreamConnectDidTimeout:self];
-
-        if (state == STATE_XMPP_RESOLVING_SRV)
-        {
-            [srvResolver stop];
-            srvResolver = nil;
-            
-            state = STATE_XMPP_DISCONNECTED;
-        }
-        else
-        {
-            [asyncSocket disconnect];
-            
-            // Everthing will be handled in socketDidDisconnect:withError:
-        }
-    }
-
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma mark C2S Connection
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-- (BOOL)connectToHost:(NSString *)host onPort:(UInt16)port withTimeout:(NSTimeInterval)timeout error:(NSError **)errPtr
-{
-	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
-	
-	XMPPLogTrace();
-	
-	BOOL result = [asyncSocket connectToHost:host onPort:port error:errPtr];
-	
-	if (result && [self resetByteCountPerConnection])
-	{
-		numberOfBytesSent = 0;
-		numberOfBytesReceived = 0;
-	}
+	dispatch_block_t block = ^{
+		result = deliveryBatchMaxSize;
+	};
 	
-	if(result)
-    {
-        [self startConnectTimeout:timeout];
-    }
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
 	
 	return result;
 }
 
-- (BOOL)connectWithTimeout:(NSTimeInterval)timeout error:(NSError **)errPtr
+- (void)setDeliveryBatchMaxSize:(NSUInteger)maxSize
 {
-	XMPPLogTrace();
-	
-	__block BOOL result = NO;
-	__block NSError *err = nil;
-	
-	dispatch_block_t block = ^{ @autoreleasepool {
-	
-		if (state != STATE_XMPP_DISCONNECTED)
-		{
-			NSString *errMsg = @"Attempting to connect while already connected or connecting.";
-			NSDictionary *info = @{NSLocalizedDescriptionKey : errMsg};
-			
-			err = [NSError errorWithDomain:XMPPStreamErrorDomain code:XMPPStreamInvalidState userInfo:info];
-			
-			result = NO;
-			return_from_block;
-		}
-		
-		if (myJID == nil)
-		{
-			// Note: If you wish to use anonymous authentication, you should still set myJID prior to calling connect.
-			// You can simply set it to something like "anonymous@<domain>", where "<domain>" is the proper domain.
-			// After the authentication process, you can query the myJID property to see what your assigned JID is.
-			// 
-			// Setting myJID allows the framework to follow the xmpp protocol properly,
-			// and it allows the framework to connect to servers without a DNS entry.
-			// 
-			// For example, one may setup a private xmpp server for internal testing on their local network.
-			// The xmpp domain of the server may be something like "testing.mycompany.com",
-			// but since the server is internal, an IP (192.168.1.22) is used as the hostname to connect.
-			// 
-			// Proper connection requires a TCP connection to the IP (192.168.1.22),
-			// but the xmpp handshake requires the xmpp domain (testing.mycompany.com).
-			
-			NSString *errMsg = @"You must set myJID before calling connect.";
-			NSDictionary *info = @{NSLocalizedDescriptionKey : errMsg};
-			
-			err = [NSError errorWithDomain:XMPPStreamErrorDomain code:XMPPStreamInvalidProperty userInfo:info];
-			
-			result = NO;
-			return_from_block;
-		}
-
-		// Notify delegates
-		[multicastDelegate xmppStreamWillConnect:self];
-
-		if ([hostName length] == 0)
-		{
-			// Resolve the hostName via myJID SRV resolution
-			
-			state = STATE_XMPP_RESOLVING_SRV;
-			
-			srvResolver = [[XMPPSRVResolver alloc] initWithdDelegate:self delegateQueue:xmppQueue resolverQueue:NULL];
-			
-			srvResults = nil;
-			srvResultsIndex = 0;
-			
-			NSString *srvName = [XMPPSRVResolver srvNameFromXMPPDomain:[myJID domain]];
-			
-			[srvResolver startWithSRVName:srvName timeout:TIMEOUT_SRV_RESOLUTION];
-			
-			result = YES;
-		}
-		else
-		{
-			// Open TCP connection to the configured hostName.
-			
-			state = STATE_XMPP_CONNECTING;
-			
-			NSError *connectErr = nil;
-			result = [self connectToHost:hostName onPort:hostPort withTimeout:XMPPStreamTimeoutNone error:&connectErr];
-			
-			if (!result)
-			{
-				err = connectErr;
-				state = STATE_XMPP_DISCONNECTED;
-			}
-		}
-        
-        if(result)
-        {
-            [self startConnectTimeout:timeout];
-        }
-	}};
+	dispatch_block_t block = ^{
+		deliveryBatchMaxSize = MAX(maxSize, (NSUInteger)1);
+	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
 		block();
 	else
-		dispatch_sync(xmppQueue, block);
-	
-	if (errPtr)
-		*errPtr = err;
-	
-	return result;
+		dispatch_async(xmppQueue, block);
 }
 
-
-
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma mark Disconnect
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-/**
- * Closes the connection to the remote host.
-**/
-- (void)disconnect
+- (NSTimeInterval)deliveryBatchLatency
 {
-	XMPPLogTrace();
+	__block NSTimeInterval result = 0.0;
 	
-	dispatch_block_t block = ^{ @autoreleasepool {
-		
-		if (state != STATE_XMPP_DISCONNECTED)
-		{
-			[multicastDelegate xmppStreamWasToldToDisconnect:self];
-			
-			if (state == STATE_XMPP_RESOLVING_SRV)
-			{
-				[srvResolver stop];
-				srvResolver = nil;
-				
-				state = STATE_XMPP_DISCONNECTED;
-				
-				[multicastDelegate xmppStreamDidDisconnect:self withError:nil];
-			}
-			else
-			{
-				[asyncSocket disconnect];
-				
-				// Everthing will be handled in socketDidDisconnect:withError:
-			}
-		}
-	}};
+	dispatch_block_t block = ^{
+		result = deliveryBatchLatency;
+	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
 		block();
 	else
 		dispatch_sync(xmppQueue, block);
+	
+	return result;
 }
 
-- (void)disconnectAfterSending
+- (void)setDeliveryBatchLatency:(NSTimeInterval)latency
 {
-	XMPPLogTrace();
-	
-	dispatch_block_t block = ^{ @autoreleasepool {
-		
-		if (state != STATE_XMPP_DISCONNECTED)
-		{
-			[multicastDelegate xmppStreamWasToldToDisconnect:self];
-			
-			if (state == STATE_XMPP_RESOLVING_SRV)
-			{
-				[srvResolver stop];
-				srvResolver = nil;
-				
-				state = STATE_XMPP_DISCONNECTED;
-				
-				[multicastDelegate xmppStreamDidDisconnect:self withError:nil];
-			}
-			else
-			{
-				NSString *termStr = @"</stream:stream>";
-				NSData *termData = [termStr dataUsingEncoding:NSUTF8StringEncoding];
-				
-				XMPPLogSend(@"SEND: %@", termStr);
-				numberOfBytesSent += [termData length];
-				
-				[asyncSocket writeData:termData withTimeout:TIMEOUT_XMPP_WRITE tag:TAG_XMPP_WRITE_STOP];
-				[asyncSocket disconnectAfterWriting];
-				
-				// Everthing will be handled in socketDidDisconnect:withError:
-			}
-		}
-	}};
+	dispatch_block_t block = ^{
+		deliveryBatchLatency = MAX(latency, 0.0);
+	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
 		block();
@@ -1110,16 +1088,12 @@ enum XMPPStreamConfig
 		dispatch_async(xmppQueue, block);
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma mark Authentication
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-- (BOOL)isAuthenticated
+- (BOOL)resetByteCountPerConnection
 {
 	__block BOOL result = NO;
 	
 	dispatch_block_t block = ^{
-		result = (flags & kIsAuthenticated) ? YES : NO;
+		result = (config & kResetByteCountPerConnection) ? YES : NO;
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -1130,19 +1104,13 @@ enum XMPPStreamConfig
 	return result;
 }
 
-- (void)setIsAuthenticated:(BOOL)flag
+- (void)setResetByteCountPerConnection:(BOOL)flag
 {
 	dispatch_block_t block = ^{
-		if(flag)
-		{
-			flags |= kIsAuthenticated;
-			authenticationDate = [NSDate date];
-		}
+		if (flag)
+			config |= kResetByteCountPerConnection;
 		else
-		{
-			flags &= ~kIsAuthenticated;
-			authenticationDate = nil;
-		}
+			config &= ~kResetByteCountPerConnection;
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -1151,322 +1119,1548 @@ enum XMPPStreamConfig
 		dispatch_async(xmppQueue, block);
 }
 
-- (NSDate *)authenticationDate
+- (BOOL)validatesResponses
 {
-	__block NSDate *result = nil;
-	
-	dispatch_block_t block = ^{
-		if(flags & kIsAuthenticated)
+    __block BOOL result = NO;
+    
+    dispatch_block_t block = ^{
+        result = validatesResponses;
+    };
+    
+    if (dispatch_get_specific(xmppQueueTag))
+        block();
+    else
+        dispatch_sync(xmppQueue, block);
+    
+    return result;
+}
+
+- (void)setValidatesResponses:(BOOL)flag
+{
+    dispatch_block_t block = ^{
+        validatesResponses = flag;
+    };
+    
+    if (dispatch_get_specific(xmppQueueTag))
+        block();
+    else
+        dispatch_async(xmppQueue, block);
+}
+
+#if TARGET_OS_IPHONE
+
+- (BOOL)enableBackgroundingOnSocket
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = (config & kEnableBackgroundingOnSocket) ? YES : NO;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+- (void)setEnableBackgroundingOnSocket:(BOOL)flag
+{
+	dispatch_block_t block = ^{
+		if (flag)
+			config |= kEnableBackgroundingOnSocket;
+		else
+			config &= ~kEnableBackgroundingOnSocket;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Configuration
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)addDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue
+{
+	// Asynchronous operation (if outside xmppQueue)
+	
+	dispatch_block_t block = ^{
+		[multicastDelegate addDelegate:delegate delegateQueue:delegateQueue];
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (void)removeDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue
+{
+	// Synchronous operation
+	
+	dispatch_block_t block = ^{
+		[multicastDelegate removeDelegate:delegate delegateQueue:delegateQueue];
+		
+		// The delegate may still be registered on other queues
+		
+		id del;
+		dispatch_queue_t dq;
+		
+		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq])
 		{
-			result =  authenticationDate;
+			if (del == delegate) return;
 		}
+		
+		[routingTable removeInterestsForDelegate:delegate];
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+}
+
+- (void)removeDelegate:(id)delegate
+{
+	// Synchronous operation
+	
+	dispatch_block_t block = ^{
+		[multicastDelegate removeDelegate:delegate];
+		[routingTable removeInterestsForDelegate:delegate];
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
 		block();
 	else
 		dispatch_sync(xmppQueue, block);
+}
+
+- (void)addStanzaInterest:(XMPPStanzaInterest *)interest forDelegate:(id)delegate
+{
+	// Asynchronous operation (if outside xmppQueue)
 	
-	return result;
+	XMPPStanzaInterest *interestCopy = [interest copy];
+	
+	dispatch_block_t block = ^{
+		[routingTable addInterest:interestCopy forDelegate:delegate];
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (void)removeStanzaInterestsForDelegate:(id)delegate
+{
+	// Synchronous operation
+	
+	dispatch_block_t block = ^{
+		[routingTable removeInterestsForDelegate:delegate];
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+}
+
+- (void)registerIQHandler:(id)handler handlerQueue:(dispatch_queue_t)handlerQueue forXmlns:(NSString *)xmlns
+{
+	// Asynchronous operation (if outside xmppQueue)
+	
+	if (handler == nil || handlerQueue == NULL || xmlns == nil) return;
+	
+	XMPPIQHandlerEntry *entry = [[XMPPIQHandlerEntry alloc] init];
+	entry->handler = handler;
+	entry->handlerQueue = handlerQueue;
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_retain(handlerQueue);
+	#endif
+	
+	NSString *xmlnsCopy = [xmlns copy];
+	
+	dispatch_block_t block = ^{
+		
+		XMPPIQHandlerEntry *existingEntry = iqHandlers[xmlnsCopy];
+		id existingHandler = existingEntry ? existingEntry->handler : nil;
+		
+		if (existingHandler && existingHandler != handler)
+		{
+			XMPPLogWarn(@"%@: Replacing IQ handler for %@ (%@ -> %@)", THIS_FILE, xmlnsCopy, existingHandler, handler);
+		}
+		
+		iqHandlers[xmlnsCopy] = entry;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (void)unregisterIQHandler:(id)handler forXmlns:(NSString *)xmlns
+{
+	// Synchronous operation
+	
+	dispatch_block_t block = ^{
+		
+		NSArray *keys = xmlns ? @[xmlns] : [iqHandlers allKeys];
+		
+		for (NSString *key in keys)
+		{
+			XMPPIQHandlerEntry *entry = iqHandlers[key];
+			id entryHandler = entry ? entry->handler : nil;
+			
+			if (entry && (entryHandler == handler || entryHandler == nil))
+			{
+				[iqHandlers removeObjectForKey:key];
+			}
+		}
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+}
+
+static SEL XMPPInlineFilterSelector(XMPPInlineFilterHook hook)
+{
+	switch (hook)
+	{
+		case XMPPInlineFilterHookOutgoingIQ       : return @selector(xmppStream:filterOutgoingIQ:);
+		case XMPPInlineFilterHookOutgoingMessage  : return @selector(xmppStream:filterOutgoingMessage:);
+		case XMPPInlineFilterHookOutgoingPresence : return @selector(xmppStream:filterOutgoingPresence:);
+		case XMPPInlineFilterHookIncomingIQ       : return @selector(xmppStream:filterIncomingIQ:);
+		case XMPPInlineFilterHookIncomingMessage  : return @selector(xmppStream:filterIncomingMessage:);
+		default                                   : return @selector(xmppStream:filterIncomingPresence:);
+	}
+}
+
+/**
+ * Rebuilds the per-hook chains from the list of inline filters.
+ * A hook without any filters gets a nil chain, so the stanza paths only pay for a nil check.
+**/
+- (void)compileInlineFilterChains
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	[inlineFilters compact];
+	
+	for (NSUInteger hook = 0; hook < XMPPInlineFilterHookCount; hook++)
+	{
+		SEL selector = XMPPInlineFilterSelector(hook);
+		NSPointerArray *chain = nil;
+		
+		for (id filter in inlineFilters)
+		{
+			if (filter && [filter respondsToSelector:selector])
+			{
+				if (chain == nil)
+					chain = [NSPointerArray weakObjectsPointerArray];
+				
+				[chain addPointer:(__bridge void *)filter];
+			}
+		}
+		
+		inlineFilterChains[hook] = chain;
+	}
+}
+
+- (void)addInlineFilter:(id <XMPPStreamInlineFilter>)filter
+{
+	// Asynchronous operation (if outside xmppQueue)
+	
+	if (filter == nil) return;
+	
+	dispatch_block_t block = ^{
+		
+		for (id existingFilter in inlineFilters)
+		{
+			if (existingFilter == filter) return;
+		}
+		
+		[inlineFilters addPointer:(__bridge void *)filter];
+		[self compileInlineFilterChains];
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (void)removeInlineFilter:(id <XMPPStreamInlineFilter>)filter
+{
+	// Synchronous operation
+	
+	if (filter == nil) return;
+	
+	dispatch_block_t block = ^{
+		
+		NSUInteger count = [inlineFilters count];
+		for (NSUInteger i = 0; i < count; i++)
+		{
+			if ([inlineFilters pointerAtIndex:i] == (__bridge void *)filter)
+			{
+				[inlineFilters removePointerAtIndex:i];
+				break;
+			}
+		}
+		
+		[self compileInlineFilterChains];
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma mark General Methods
+#pragma mark Connection State
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
- * This method will return the root element of the document.
- * This element contains the opening <stream:stream/> and <stream:features/> tags received from the server
- * when the XML stream was opened.
- * 
- * Note: The rootElement is empty, and does not contain all the XML elements the stream has received during it's
- * connection.  This is done for performance reasons and for the obvious benefit of being more memory efficient.
+ * Returns YES if the connection is closed, and thus no stream is open.
+ * If the stream is neither disconnected, nor connected, then a connection is currently being established.
+**/
+- (BOOL)isDisconnected
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = (state == STATE_XMPP_DISCONNECTED);
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+/**
+ * Returns YES is the connection is currently connecting
+ **/
+
+- (BOOL)isConnecting
+{
+	XMPPLogTrace();
+	
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		result = (state == STATE_XMPP_CONNECTING);
+	}};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+/**
+ * Returns YES if the connection is open, and the stream has been properly established.
+ * If the stream is neither disconnected, nor connected, then a connection is currently being established.
+**/
+- (BOOL)isConnected
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = (state == STATE_XMPP_CONNECTED);
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Connect Timeout
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Start Connect Timeout
+**/
+- (void)startConnectTimeout:(NSTimeInterval)timeout
+{
+    XMPPLogTrace();
+
+	if (timeout >= 0.0 && !connectTimer)
+	{
+		connectTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, xmppQueue);
+		
+		dispatch_source_set_event_handler(connectTimer, ^{ @autoreleasepool {
+			
+			[self doConnectTimeout];
+		}});
+		
+#if !OS_OBJECT_USE_OBJC
+		dispatch_source_t theConnectTimer = connectTimer;
+		dispatch_source_set_cancel_handler(connectTimer, ^{            
+            XMPPLogVerbose(@"%@: dispatch_release(connectTimer)", THIS_FILE);
+			dispatch_release(theConnectTimer);
+		});
+#endif
+		
+		dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (timeout * NSEC_PER_SEC));
+		dispatch_source_set_timer(connectTimer, tt, DISPATCH_TIME_FOREVER, 0);
+		
+		dispatch_resume(connectTimer);
+	}
+}
+
+/**
+ * End Connect Timeout
+**/
+- (void)endConnectTimeout
+{
+	XMPPLogTrace();
+	
+	if (connectTimer)
+	{
+		dispatch_source_cancel(connectTimer);
+		connectTimer = NULL;
+	}
+}
+
+/**
+ * Connect has timed out, so inform the delegates and close the connection
+**/
+- (void)doConnectTimeout
+{
+	XMPPLogTrace();
+	
+	[self endConnectTimeout];
+    		
+    if (state != STATE_XMPP_DISCONNECTED)
+    {
+        [multicastDelegate xmppStreamConnectDidTimeout:self];
+
+        if (state == STATE_XMPP_RESOLVING_SRV)
+        {
+            [srvResolver stop];
+            srvResolver = nil;
+            
+            state = STATE_XMPP_DISCONNECTED;
+            
+            [self failEarlyElements];
+        }
+        else
+        {
+            [asyncSocket disconnect];
+            
+            // Everthing will be handled in socketDidDisconnect:withError:
+        }
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark C2S Connection
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)connectToHost:(NSString *)host onPort:(UInt16)port withTimeout:(NSTimeInterval)timeout error:(NSError **)errPtr
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPLogTrace();
+	
+	BOOL result = [asyncSocket connectToHost:host onPort:port error:errPtr];
+	
+	if (result && [self resetByteCountPerConnection])
+	{
+		numberOfBytesSent = 0;
+		numberOfBytesReceived = 0;
+	}
+	
+	if(result)
+    {
+        [self startConnectTimeout:timeout];
+    }
+	
+	return result;
+}
+
+- (BOOL)connectWithTimeout:(NSTimeInterval)timeout error:(NSError **)errPtr
+{
+	XMPPLogTrace();
+	
+	__block BOOL result = NO;
+	__block NSError *err = nil;
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+	
+		if (state != STATE_XMPP_DISCONNECTED)
+		{
+			NSString *errMsg = @"Attempting to connect while already connected or connecting.";
+			NSDictionary *info = @{NSLocalizedDescriptionKey : errMsg};
+			
+			err = [NSError errorWithDomain:XMPPStreamErrorDomain code:XMPPStreamInvalidState userInfo:info];
+			
+			result = NO;
+			return_from_block;
+		}
+		
+		if (myJID == nil)
+		{
+			// Note: If you wish to use anonymous authentication, you should still set myJID prior to calling connect.
+			// You can simply set it to something like "anonymous@<domain>", where "<domain>" is the proper domain.
+			// After the authentication process, you can query the myJID property to see what your assigned JID is.
+			// 
+			// Setting myJID allows the framework to follow the xmpp protocol properly,
+			// and it allows the framework to connect to servers without a DNS entry.
+			// 
+			// For example, one may setup a private xmpp server for internal testing on their local network.
+			// The xmpp domain of the server may be something like "testing.mycompany.com",
+			// but since the server is internal, an IP (192.168.1.22) is used as the hostname to connect.
+			// 
+			// Proper connection requires a TCP connection to the IP (192.168.1.22),
+			// but the xmpp handshake requires the xmpp domain (testing.mycompany.com).
+			
+			NSString *errMsg = @"You must set myJID before calling connect.";
+			NSDictionary *info = @{NSLocalizedDescriptionKey : errMsg};
+			
+			err = [NSError errorWithDomain:XMPPStreamErrorDomain code:XMPPStreamInvalidProperty userInfo:info];
+			
+			result = NO;
+			return_from_block;
+		}
+
+		// Notify delegates
+		[multicastDelegate xmppStreamWillConnect:self];
+
+		if ([hostName length] == 0)
+		{
+			// Resolve the hostName via myJID SRV resolution
+			
+			state = STATE_XMPP_RESOLVING_SRV;
+			
+			srvResolver = [[XMPPSRVResolver alloc] initWithdDelegate:self delegateQueue:xmppQueue resolverQueue:NULL];
+			
+			srvResults = nil;
+			srvResultsIndex = 0;
+			
+			NSString *srvName = [XMPPSRVResolver srvNameFromXMPPDomain:[myJID domain]];
+			
+			[srvResolver startWithSRVName:srvName timeout:TIMEOUT_SRV_RESOLUTION];
+			
+			result = YES;
+		}
+		else
+		{
+			// Open TCP connection to the configured hostName.
+			
+			state = STATE_XMPP_CONNECTING;
+			
+			NSError *connectErr = nil;
+			result = [self connectToHost:hostName onPort:hostPort withTimeout:XMPPStreamTimeoutNone error:&connectErr];
+			
+			if (!result)
+			{
+				err = connectErr;
+				state = STATE_XMPP_DISCONNECTED;
+			}
+		}
+        
+        if(result)
+        {
+            [self startConnectTimeout:timeout];
+        }
+	}};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	if (errPtr)
+		*errPtr = err;
+	
+	return result;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Disconnect
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Closes the connection to the remote host.
+**/
+- (void)disconnect
+{
+	XMPPLogTrace();
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		if (state != STATE_XMPP_DISCONNECTED)
+		{
+			[multicastDelegate xmppStreamWasToldToDisconnect:self];
+			
+			if (state == STATE_XMPP_RESOLVING_SRV)
+			{
+				[srvResolver stop];
+				srvResolver = nil;
+				
+				state = STATE_XMPP_DISCONNECTED;
+				
+				[self failEarlyElements];
+				
+				[multicastDelegate xmppStreamDidDisconnect:self withError:nil];
+			}
+			else
+			{
+				[asyncSocket disconnect];
+				
+				// Everthing will be handled in socketDidDisconnect:withError:
+			}
+		}
+	}};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+}
+
+- (void)disconnectAfterSending
+{
+	XMPPLogTrace();
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		if (state != STATE_XMPP_DISCONNECTED)
+		{
+			[multicastDelegate xmppStreamWasToldToDisconnect:self];
+			
+			if (state == STATE_XMPP_RESOLVING_SRV)
+			{
+				[srvResolver stop];
+				srvResolver = nil;
+				
+				state = STATE_XMPP_DISCONNECTED;
+				
+				[self failEarlyElements];
+				
+				[multicastDelegate xmppStreamDidDisconnect:self withError:nil];
+			}
+			else
+			{
+				NSString *termStr = @"</stream:stream>";
+				NSData *termData = [termStr dataUsingEncoding:NSUTF8StringEncoding];
+				
+				XMPPLogSend(@"SEND: %@", termStr);
+				numberOfBytesSent += [termData length];
+				
+				// Everything queued was sent before the closing tag
+				[self drainSendQueues];
+				
+				[self writeData:termData withTag:TAG_XMPP_WRITE_STOP outputBuffer:nil];
+				[asyncSocket disconnectAfterWriting];
+				
+				// Everthing will be handled in socketDidDisconnect:withError:
+			}
+		}
+	}};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Authentication
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)isAuthenticated
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = (flags & kIsAuthenticated) ? YES : NO;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+- (void)setIsAuthenticated:(BOOL)flag
+{
+	dispatch_block_t block = ^{
+		if(flag)
+		{
+			flags |= kIsAuthenticated;
+			authenticationDate = [NSDate date];
+		}
+		else
+		{
+			flags &= ~kIsAuthenticated;
+			authenticationDate = nil;
+		}
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (NSDate *)authenticationDate
+{
+	__block NSDate *result = nil;
+	
+	dispatch_block_t block = ^{
+		if(flags & kIsAuthenticated)
+		{
+			result =  authenticationDate;
+		}
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark General Methods
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * This method will return the root element of the document.
+ * This element contains the opening <stream:stream/> and <stream:features/> tags received from the server
+ * when the XML stream was opened.
+ * 
+ * Note: The rootElement is empty, and does not contain all the XML elements the stream has received during it's
+ * connection.  This is done for performance reasons and for the obvious benefit of being more memory efficient.
+**/
+- (NSXMLElement *)rootElement
+{
+	if (dispatch_get_specific(xmppQueueTag))
+	{
+		return rootElement;
+	}
+	else
+	{
+		__block NSXMLElement *result = nil;
+		
+		dispatch_sync(xmppQueue, ^{
+			result = [rootElement copy];
+		});
+		
+		return result;
+	}
+}
+
+/**
+ * Passes the given stanza through the inline filters of the given hook.
+ * Returns the (possibly modified) stanza, or nil if it was filtered.
+**/
+- (id)runInlineFilterChain:(XMPPInlineFilterHook)hook withStanza:(id)stanza
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	for (id filter in inlineFilterChains[hook])
+	{
+		if (filter == nil) continue; // Deallocated
+		
+		switch (hook)
+		{
+			case XMPPInlineFilterHookOutgoingIQ       : stanza = [filter xmppStream:self filterOutgoingIQ:stanza];       break;
+			case XMPPInlineFilterHookOutgoingMessage  : stanza = [filter xmppStream:self filterOutgoingMessage:stanza];  break;
+			case XMPPInlineFilterHookOutgoingPresence : stanza = [filter xmppStream:self filterOutgoingPresence:stanza]; break;
+			case XMPPInlineFilterHookIncomingIQ       : stanza = [filter xmppStream:self filterIncomingIQ:stanza];       break;
+			case XMPPInlineFilterHookIncomingMessage  : stanza = [filter xmppStream:self filterIncomingMessage:stanza];  break;
+			default                                   : stanza = [filter xmppStream:self filterIncomingPresence:stanza]; break;
+		}
+		
+		if (stanza == nil) break;
+	}
+	
+	return stanza;
+}
+
+/**
+ * Invoked when an inline filter drops an incoming stanza.
+ * If the delegate filters are in use, the notification goes through the willReceiveStanzaQueue,
+ * in order to maintain the in-order delivery of received stanzas.
+**/
+- (void)notifyInlineFilteredIncomingStanza
+{
+	if (willReceiveStanzaQueue)
+	{
+		dispatch_async(willReceiveStanzaQueue, ^{
+			dispatch_async(xmppQueue, ^{ @autoreleasepool {
+				
+				if (state == STATE_XMPP_CONNECTED) {
+					[multicastDelegate xmppStreamDidFilterStanza:self];
+				}
+			}});
+		});
+	}
+	else
+	{
+		[multicastDelegate xmppStreamDidFilterStanza:self];
+	}
+}
+
+- (void)sendIQ:(XMPPIQ *)iq withTag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
+	
+	if (inlineFilterChains[XMPPInlineFilterHookOutgoingIQ])
+	{
+		iq = [self runInlineFilterChain:XMPPInlineFilterHookOutgoingIQ withStanza:iq];
+		if (iq == nil)
+		{
+			[self resolveObserverForTag:tag success:NO];
+			return;
+		}
+	}
+	
+	// We're getting ready to send an IQ.
+	// Notify delegates to allow them to optionally alter/filter the outgoing IQ.
+	
+	SEL selector = @selector(xmppStream:willSendIQ:);
+	
+	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
+	{
+		// None of the delegates implement the method.
+		// Use a shortcut.
+		
+		[self continueSendIQ:iq withTag:tag];
+	}
+	else
+	{
+		// Notify all interested delegates.
+		// This must be done serially to allow them to alter the element in a thread-safe manner.
+		
+		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		
+		dispatch_async(willSendIqQueue, ^{ @autoreleasepool {
+			
+			// Allow delegates to modify and/or filter outgoing element
+			
+			__block XMPPIQ *modifiedIQ = iq;
+			
+			id del;
+			dispatch_queue_t dq;
+			
+			while (modifiedIQ && [delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+			{
+				#if DEBUG
+				{
+					char methodReturnType[32];
+				
+					Method method = class_getInstanceMethod([del class], selector);
+					method_getReturnType(method, methodReturnType, sizeof(methodReturnType));
+				
+					if (strcmp(methodReturnType, @encode(XMPPIQ*)) != 0)
+					{
+						NSAssert(NO, @"Method xmppStream:willSendIQ: is no longer void (see XMPPStream.h). "
+						             @"Culprit = %@", NSStringFromClass([del class]));
+					}
+				}
+				#endif
+				
+				dispatch_sync(dq, ^{ @autoreleasepool {
+					
+					modifiedIQ = [del xmppStream:self willSendIQ:modifiedIQ];
+					
+				}});
+			}
+			
+			if (modifiedIQ)
+			{
+				dispatch_async(xmppQueue, ^{ @autoreleasepool {
+					
+					if (state == STATE_XMPP_CONNECTED) {
+						[self continueSendIQ:modifiedIQ withTag:tag];
+					} else {
+						[self failToSendIQ:modifiedIQ];
+					}
+				}});
+			}
+			else
+			{
+				dispatch_async(xmppQueue, ^{ @autoreleasepool {
+					
+					[self resolveObserverForTag:tag success:NO];
+				}});
+			}
+		}});
+	}
+}
+
+- (void)sendMessage:(XMPPMessage *)message withTag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
+	
+	if (inlineFilterChains[XMPPInlineFilterHookOutgoingMessage])
+	{
+		message = [self runInlineFilterChain:XMPPInlineFilterHookOutgoingMessage withStanza:message];
+		if (message == nil)
+		{
+			[self resolveObserverForTag:tag success:NO];
+			return;
+		}
+	}
+	
+	// We're getting ready to send a message.
+	// Notify delegates to allow them to optionally alter/filter the outgoing message.
+	
+	SEL selector = @selector(xmppStream:willSendMessage:);
+	
+	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
+	{
+		// None of the delegates implement the method.
+		// Use a shortcut.
+		
+		[self continueSendMessage:message withTag:tag];
+	}
+	else
+	{
+		// Notify all interested delegates.
+		// This must be done serially to allow them to alter the element in a thread-safe manner.
+		
+		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		
+		dispatch_async(willSendMessageQueue, ^{ @autoreleasepool {
+			
+			// Allow delegates to modify outgoing element
+			
+			__block XMPPMessage *modifiedMessage = message;
+			
+			id del;
+			dispatch_queue_t dq;
+			
+			while (modifiedMessage && [delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+			{
+				#if DEBUG
+				{
+					char methodReturnType[32];
+				
+					Method method = class_getInstanceMethod([del class], selector);
+					method_getReturnType(method, methodReturnType, sizeof(methodReturnType));
+				
+					if (strcmp(methodReturnType, @encode(XMPPMessage*)) != 0)
+					{
+						NSAssert(NO, @"Method xmppStream:willSendMessage: is no longer void (see XMPPStream.h). "
+						             @"Culprit = %@", NSStringFromClass([del class]));
+					}
+				}
+				#endif
+				
+				dispatch_sync(dq, ^{ @autoreleasepool {
+					
+					modifiedMessage = [del xmppStream:self willSendMessage:modifiedMessage];
+					
+				}});
+			}
+			
+			if (modifiedMessage)
+			{
+				dispatch_async(xmppQueue, ^{ @autoreleasepool {
+					
+					if (state == STATE_XMPP_CONNECTED) {
+						[self continueSendMessage:modifiedMessage withTag:tag];
+					}
+					else {
+						[self failToSendMessage:modifiedMessage];
+					}
+				}});
+			}
+			else
+			{
+				dispatch_async(xmppQueue, ^{ @autoreleasepool {
+					
+					[self resolveObserverForTag:tag success:NO];
+				}});
+			}
+		}});
+	}
+}
+
+- (void)sendPresence:(XMPPPresence *)presence withTag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
+	
+	if (inlineFilterChains[XMPPInlineFilterHookOutgoingPresence])
+	{
+		presence = [self runInlineFilterChain:XMPPInlineFilterHookOutgoingPresence withStanza:presence];
+		if (presence == nil)
+		{
+			[self resolveObserverForTag:tag success:NO];
+			return;
+		}
+	}
+	
+	// We're getting ready to send a presence element.
+	// Notify delegates to allow them to optionally alter/filter the outgoing presence.
+	
+	SEL selector = @selector(xmppStream:willSendPresence:);
+	
+	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
+	{
+		// None of the delegates implement the method.
+		// Use a shortcut.
+		
+		[self continueSendPresence:presence withTag:tag];
+	}
+	else
+	{
+		// Notify all interested delegates.
+		// This must be done serially to allow them to alter the element in a thread-safe manner.
+		
+		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		
+		dispatch_async(willSendPresenceQueue, ^{ @autoreleasepool {
+			
+			// Allow delegates to modify outgoing element
+			
+			__block XMPPPresence *modifiedPresence = presence;
+			
+			id del;
+			dispatch_queue_t dq;
+			
+			while (modifiedPresence && [delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+			{
+				#if DEBUG
+				{
+					char methodReturnType[32];
+				
+					Method method = class_getInstanceMethod([del class], selector);
+					method_getReturnType(method, methodReturnType, sizeof(methodReturnType));
+				
+					if (strcmp(methodReturnType, @encode(XMPPPresence*)) != 0)
+					{
+						NSAssert(NO, @"Method xmppStream:willSendPresence: is no longer void (see XMPPStream.h). "
+						             @"Culprit = %@", NSStringFromClass([del class]));
+					}
+				}
+				#endif
+				
+				dispatch_sync(dq, ^{ @autoreleasepool {
+					
+					modifiedPresence = [del xmppStream:self willSendPresence:modifiedPresence];
+					
+				}});
+			}
+			
+			if (modifiedPresence)
+			{
+				dispatch_async(xmppQueue, ^{ @autoreleasepool {
+					
+					if (state == STATE_XMPP_CONNECTED) {
+						[self continueSendPresence:modifiedPresence withTag:tag];
+					} else {
+						[self failToSendPresence:modifiedPresence];
+					}
+				}});
+			}
+			else
+			{
+				dispatch_async(xmppQueue, ^{ @autoreleasepool {
+					
+					[self resolveObserverForTag:tag success:NO];
+				}});
+			}
+		}});
+	}
+}
+
+/**
+ * Private method.
+ * All raw (non-stanza) writes to the socket go through this method.
+ *
+ * If the data references the bytes of a pooled output buffer, the buffer must be passed along.
+ * It will be returned to the pool once the socket reports the data as written.
+**/
+- (void)writeData:(NSData *)data withTag:(long)tag outputBuffer:(XMPPOutputBuffer *)outputBuffer
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+
+	// Anything corked was sent before this data, and must hit the socket first.
+	[self flushCorkedWrites];
+
+	XMPPPendingWrite *write = [[XMPPPendingWrite alloc] init];
+	write->data = data;
+	write->outputBuffer = outputBuffer;
+	write->tag = tag;
+
+	[self startWrite:write];
+}
+
+/**
+ * Private method.
+ * Hands the given write to the socket.
+**/
+- (void)startWrite:(XMPPPendingWrite *)write
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+
+	[pendingWrites addWrite:write];
+	bytesInFlight += [write->data length];
+
+	[asyncSocket writeData:write->data
+	           withTimeout:TIMEOUT_XMPP_WRITE
+	                   tag:write->tag];
+}
+
+/**
+ * Private method.
+ * Writes the element to the socket, unless the socket is backed up (or other stanzas are already waiting),
+ * in which case the element is placed in the send queue.
+ * 
+ * The didSend delegate methods are invoked once the element is handed to the socket (or joins a cork),
+ * so they're always invoked in the order the elements are written. (See enqueueWrite:priority:)
+**/
+- (void)writeElement:(NSXMLElement *)element withTag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+
+	BOOL isBatchElement = [self removeBatchCorkTag:tag];
+
+	if (totalSendQueueBytes == 0 && bytesInFlight < sendWindowSize)
+	{
+		if (corksWrites || corksBatch || isBatchElement || [batchCorkTags count] > 0 || corkBuffer)
+		{
+			if ([self corkElement:element withTag:tag])
+				[self notifyDidSendElement:element];
+			else
+				[self failToSendElement:element];
+
+			if (isBatchElement)
+			{
+				[self maybeFlushBatchCork];
+			}
+			return;
+		}
+
+		XMPPPendingWrite *write = [self serializeElement:element withTag:tag];
+
+		[self flushCorkedWrites];
+		[self startWrite:write];
+
+		[self notifyDidSendElement:element];
+	}
+	else
+	{
+		XMPPPendingWrite *write = [self serializeElement:element withTag:tag];
+		write->element = element;
+
+		[self enqueueWrite:write priority:[self sendPriorityForElement:element length:[write->data length]]];
+
+		if (isBatchElement)
+		{
+			[self maybeFlushBatchCork];
+		}
+	}
+
+	[self updateSendQueueHighWaterMark];
+}
+
+/**
+ * Private method.
+ * Serializes the element directly into a pooled UTF-8 buffer.
+**/
+- (XMPPPendingWrite *)serializeElement:(NSXMLElement *)element withTag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+
+	XMPPPendingWrite *write = [[XMPPPendingWrite alloc] init];
+	write->tag = tag;
+
+	XMPPOutputBuffer *outputBuffer = [outputBufferPool bufferWithMinimumCapacity:0];
+	NSUInteger length = [XMPPStanzaSerializer serializeElement:element intoBuffer:outputBuffer];
+
+	if (length == 0)
+	{
+		// The serializer is strict about malformed strings (e.g. unpaired surrogates).
+		// Fallback to the traditional route, which handles such strings with its own (lossy) conversion.
+
+		[outputBufferPool recycleBuffer:outputBuffer];
+
+		NSString *outgoingStr = [element compactXMLString];
+		NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding allowLossyConversion:YES];
+
+		XMPPLogSend(@"SEND: %@", outgoingStr);
+		numberOfBytesSent += [outgoingData length];
+
+		write->data = outgoingData;
+		return write;
+	}
+
+	NSData *outgoingData = [outputBuffer data];
+
+	XMPPLogSend(@"SEND: %@", [[NSString alloc] initWithData:outgoingData encoding:NSUTF8StringEncoding]);
+	numberOfBytesSent += length;
+
+	write->data = outgoingData;
+	write->outputBuffer = outputBuffer;
+	return write;
+}
+
+/**
+ * Private method.
+ * Serializes the element onto the end of the current cork buffer.
+ * The first element added to an empty cork schedules the flush.
+ * 
+ * Returns NO if the element had to be dropped (in which case its observer has been failed).
+**/
+- (BOOL)corkElement:(NSXMLElement *)element withTag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+
+	if (corkBuffer == nil)
+	{
+		corkBuffer = [outputBufferPool bufferWithMinimumCapacity:XMPP_CORK_INITIAL_CAPACITY];
+		corkTags = [[NSMutableArray alloc] init];
+
+		[self scheduleCorkFlush];
+	}
+
+	NSUInteger offset = [corkBuffer length];
+	NSUInteger length = [XMPPStanzaSerializer serializeElement:element intoBuffer:corkBuffer];
+
+	if (length == 0)
+	{
+		// See serializeElement:withTag:
+		NSData *outgoingData = [[element compactXMLString] dataUsingEncoding:NSUTF8StringEncoding
+		                                                allowLossyConversion:YES];
+
+		if (![corkBuffer appendBytes:[outgoingData bytes] length:[outgoingData length]])
+		{
+			XMPPLogWarn(@"%@: Unable to grow cork buffer. Dropping element: %@", THIS_FILE, [element compactXMLString]);
+
+			[self resolveObserverForTag:tag success:NO];
+			return NO;
+		}
+
+		length = [outgoingData length];
+	}
+
+	XMPPLogSend(@"SEND: %@", [[NSString alloc] initWithData:[[corkBuffer data] subdataWithRange:NSMakeRange(offset, length)]
+	                                                encoding:NSUTF8StringEncoding]);
+	numberOfBytesSent += length;
+
+	[corkTags addObject:@(tag)];
+
+	if ([corkBuffer length] >= XMPP_CORK_MAX_LENGTH)
+	{
+		[self flushCorkedWrites];
+	}
+
+	return YES;
+}
+
+/**
+ * Private method.
+ * Arranges for the current cork to be flushed at the end of this queue turn, or after the corkInterval.
+**/
+- (void)scheduleCorkFlush
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+
+	// The generation ensures that a stale flush (for a cork that was already flushed for some other reason)
+	// doesn't prematurely flush a newer cork.
+	NSUInteger generation = corkGeneration;
+
+	dispatch_block_t block = ^{ @autoreleasepool {
+
+		// An open batch flushes the cork itself, once its last element has been written (see maybeFlushBatchCork)
+		if (corkGeneration == generation && [batchCorkTags count] == 0)
+		{
+			[self flushCorkedWrites];
+		}
+	}};
+
+	if (corkInterval > 0.0)
+	{
+		dispatch_time_t when = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(corkInterval * NSEC_PER_SEC));
+		dispatch_after(when, xmppQueue, block);
+	}
+	else
+	{
+		dispatch_async(xmppQueue, block);
+	}
+}
+
+/**
+ * Private method.
+ * Hands all corked stanzas to the socket as a single write.
+**/
+- (void)flushCorkedWrites
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+
+	if (corkBuffer == nil) return;
+
+	XMPPPendingWrite *write = [[XMPPPendingWrite alloc] init];
+	write->outputBuffer = corkBuffer;
+	write->tag = TAG_XMPP_WRITE_CORKED;
+	write->stanzaTags = corkTags;
+
+	corkBuffer = nil;
+	corkTags = nil;
+	corkGeneration++;
+
+	if ([write->stanzaTags count] == 0)
+	{
+		[outputBufferPool recycleBuffer:write->outputBuffer];
+		return;
+	}
+
+	write->data = [write->outputBuffer data];
+
+	[self startWrite:write];
+}
+
+/**
+ * Private method.
+ * Writes the stream header followed by the given early elements, as a single write.
+ * 
+ * The header is placed into a fresh cork, which the early elements then join (see writeElement:withTag:).
+**/
+- (void)writeStreamHeader:(NSData *)headerData withEarlyElements:(NSArray *)elements
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+
+	[self flushCorkedWrites];
+
+	corkBuffer = [outputBufferPool bufferWithMinimumCapacity:([headerData length] + XMPP_CORK_INITIAL_CAPACITY)];
+	corkTags = [[NSMutableArray alloc] init];
+
+	if (![corkBuffer appendBytes:[headerData bytes] length:[headerData length]])
+	{
+		// Fallback to separate writes
+		[outputBufferPool recycleBuffer:corkBuffer];
+		corkBuffer = nil;
+		corkTags = nil;
+
+		[self writeData:headerData withTag:TAG_XMPP_WRITE_START outputBuffer:nil];
+	}
+	else
+	{
+		[corkTags addObject:@(TAG_XMPP_WRITE_START)];
+	}
+
+	for (NSXMLElement *element in elements)
+	{
+		[self sendEarlyElement:element];
+	}
+
+	[self flushCorkedWrites];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Send Queue
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Private method.
+ * Returns the send queue class for the given (serialized) element.
+**/
+- (XMPPSendPriority)sendPriorityForElement:(NSXMLElement *)element length:(NSUInteger)length
+{
+	if (bulkStanzaThreshold > 0 && length >= bulkStanzaThreshold)
+		return XMPPSendPriorityBulk;
+	
+	if ([element isKindOfClass:[XMPPIQ class]])
+		return XMPPSendPriorityIQ;
+	
+	if ([element isKindOfClass:[XMPPMessage class]])
+		return XMPPSendPriorityMessage;
+	
+	if ([element isKindOfClass:[XMPPPresence class]])
+		return XMPPSendPriorityPresence;
+	
+	return XMPPSendPriorityControl;
+}
+
+/**
+ * Private method.
+ * Places the given write at the end of the queue for its class.
+ * 
+ * The queues are drained in strict priority order (control, IQ, message, presence, bulk),
+ * and each queue in FIFO order. So a queued stanza may overtake queued stanzas of lower classes.
+ * 
+ * This is safe for stream management (XEP-0198), whose 'h' values count stanzas in the order they're written:
+ * the didSend delegate methods of a queued element are only invoked once it's dequeued and handed to the socket
+ * (see startQueuedWrite:), and thus always in the order the elements hit the wire.
+**/
+- (void)enqueueWrite:(XMPPPendingWrite *)write priority:(XMPPSendPriority)priority
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+
+	NSUInteger length = [write->data length];
+
+	write->priority = priority;
+
+	[sendQueues[priority] addWrite:write];
+
+	sendQueueCounts[priority] += 1;
+	sendQueueBytes[priority] += length;
+	totalSendQueueBytes += length;
+
+	// If nothing is in flight (e.g. only a cork is pending), nothing would otherwise pump the queue.
+	[self pumpSendQueues];
+}
+
+/**
+ * Private method.
+ * Removes and returns the oldest write of the highest class with anything queued.
+**/
+- (XMPPPendingWrite *)dequeueWrite
+{
+	for (NSUInteger priority = 0; priority < XMPP_SEND_PRIORITY_COUNT; priority++)
+	{
+		if (sendQueueCounts[priority] == 0) continue;
+
+		XMPPPendingWrite *write = [sendQueues[priority] removeFirstWrite];
+
+		NSUInteger length = [write->data length];
+		sendQueueCounts[priority] -= 1;
+		sendQueueBytes[priority] -= length;
+		totalSendQueueBytes -= length;
+
+		return write;
+	}
+
+	return nil;
+}
+
+/**
+ * Private method.
+ * Hands a dequeued write to the socket, and only then notifies the delegates that its element was sent.
 **/
-- (NSXMLElement *)rootElement
+- (void)startQueuedWrite:(XMPPPendingWrite *)write
 {
-	if (dispatch_get_specific(xmppQueueTag))
-	{
-		return rootElement;
-	}
-	else
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+
+	NSXMLElement *element = write->element;
+	write->element = nil;
+
+	[self startWrite:write];
+
+	if (element)
 	{
-		__block NSXMLElement *result = nil;
-		
-		dispatch_sync(xmppQueue, ^{
-			result = [rootElement copy];
-		});
-		
-		return result;
+		[self notifyDidSendElement:element];
 	}
 }
 
-- (void)sendIQ:(XMPPIQ *)iq withTag:(long)tag
+/**
+ * Private method.
+ * Hands queued writes to the socket (see dequeueWrite) until the send window is full.
+**/
+- (void)pumpSendQueues
 {
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
-	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
-	
-	// We're getting ready to send an IQ.
-	// Notify delegates to allow them to optionally alter/filter the outgoing IQ.
-	
-	SEL selector = @selector(xmppStream:willSendIQ:);
-	
-	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
-	{
-		// None of the delegates implement the method.
-		// Use a shortcut.
-		
-		[self continueSendIQ:iq withTag:tag];
-	}
-	else
+
+	if (totalSendQueueBytes == 0 || bytesInFlight >= sendWindowSize) return;
+
+	// Anything corked was accepted before the queued stanzas.
+	[self flushCorkedWrites];
+
+	while (totalSendQueueBytes > 0 && bytesInFlight < sendWindowSize)
 	{
-		// Notify all interested delegates.
-		// This must be done serially to allow them to alter the element in a thread-safe manner.
-		
-		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
-		
-		dispatch_async(willSendIqQueue, ^{ @autoreleasepool {
-			
-			// Allow delegates to modify and/or filter outgoing element
-			
-			__block XMPPIQ *modifiedIQ = iq;
-			
-			id del;
-			dispatch_queue_t dq;
-			
-			while (modifiedIQ && [delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
-			{
-				#if DEBUG
-				{
-					char methodReturnType[32];
-				
-					Method method = class_getInstanceMethod([del class], selector);
-					method_getReturnType(method, methodReturnType, sizeof(methodReturnType));
-				
-					if (strcmp(methodReturnType, @encode(XMPPIQ*)) != 0)
-					{
-						NSAssert(NO, @"Method xmppStream:willSendIQ: is no longer void (see XMPPStream.h). "
-						             @"Culprit = %@", NSStringFromClass([del class]));
-					}
-				}
-				#endif
-				
-				dispatch_sync(dq, ^{ @autoreleasepool {
-					
-					modifiedIQ = [del xmppStream:self willSendIQ:modifiedIQ];
-					
-				}});
-			}
-			
-			if (modifiedIQ)
-			{
-				dispatch_async(xmppQueue, ^{ @autoreleasepool {
-					
-					if (state == STATE_XMPP_CONNECTED) {
-						[self continueSendIQ:modifiedIQ withTag:tag];
-					} else {
-						[self failToSendIQ:modifiedIQ];
-					}
-				}});
-			}
-		}});
+		[self startQueuedWrite:[self dequeueWrite]];
 	}
 }
 
-- (void)sendMessage:(XMPPMessage *)message withTag:(long)tag
+/**
+ * Private method.
+ * Hands everything queued to the socket, regardless of the send window.
+**/
+- (void)drainSendQueues
 {
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
-	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
-	
-	// We're getting ready to send a message.
-	// Notify delegates to allow them to optionally alter/filter the outgoing message.
-	
-	SEL selector = @selector(xmppStream:willSendMessage:);
-	
-	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
-	{
-		// None of the delegates implement the method.
-		// Use a shortcut.
-		
-		[self continueSendMessage:message withTag:tag];
-	}
-	else
+
+	[self flushCorkedWrites];
+
+	while (totalSendQueueBytes > 0)
 	{
-		// Notify all interested delegates.
-		// This must be done serially to allow them to alter the element in a thread-safe manner.
-		
-		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
-		
-		dispatch_async(willSendMessageQueue, ^{ @autoreleasepool {
-			
-			// Allow delegates to modify outgoing element
-			
-			__block XMPPMessage *modifiedMessage = message;
-			
-			id del;
-			dispatch_queue_t dq;
-			
-			while (modifiedMessage && [delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
-			{
-				#if DEBUG
-				{
-					char methodReturnType[32];
-				
-					Method method = class_getInstanceMethod([del class], selector);
-					method_getReturnType(method, methodReturnType, sizeof(methodReturnType));
-				
-					if (strcmp(methodReturnType, @encode(XMPPMessage*)) != 0)
-					{
-						NSAssert(NO, @"Method xmppStream:willSendMessage: is no longer void (see XMPPStream.h). "
-						             @"Culprit = %@", NSStringFromClass([del class]));
-					}
-				}
-				#endif
-				
-				dispatch_sync(dq, ^{ @autoreleasepool {
-					
-					modifiedMessage = [del xmppStream:self willSendMessage:modifiedMessage];
-					
-				}});
-			}
-			
-			if (modifiedMessage)
-			{
-				dispatch_async(xmppQueue, ^{ @autoreleasepool {
-					
-					if (state == STATE_XMPP_CONNECTED) {
-						[self continueSendMessage:modifiedMessage withTag:tag];
-					}
-					else {
-						[self failToSendMessage:modifiedMessage];
-					}
-				}});
-			}
-		}});
+		[self startQueuedWrite:[self dequeueWrite]];
 	}
 }
 
-- (void)sendPresence:(XMPPPresence *)presence withTag:(long)tag
+/**
+ * Private method.
+ * Invokes the high-water mark delegate methods as the number of unsent bytes crosses the mark.
+ * The mark is only cleared once the number of unsent bytes has dropped to half the mark,
+ * so producers hovering around the mark don't cause a storm of callbacks.
+**/
+- (void)updateSendQueueHighWaterMark
 {
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
-	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
-	
-	// We're getting ready to send a presence element.
-	// Notify delegates to allow them to optionally alter/filter the outgoing presence.
-	
-	SEL selector = @selector(xmppStream:willSendPresence:);
-	
-	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
+
+	NSUInteger unsentBytes = totalSendQueueBytes + bytesInFlight;
+
+	if (!isAboveSendQueueHighWaterMark)
 	{
-		// None of the delegates implement the method.
-		// Use a shortcut.
-		
-		[self continueSendPresence:presence withTag:tag];
+		if (sendQueueHighWaterMark > 0 && unsentBytes >= sendQueueHighWaterMark)
+		{
+			isAboveSendQueueHighWaterMark = YES;
+			[multicastDelegate xmppStreamDidReachSendQueueHighWaterMark:self];
+		}
 	}
 	else
 	{
-		// Notify all interested delegates.
-		// This must be done serially to allow them to alter the element in a thread-safe manner.
-		
-		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
-		
-		dispatch_async(willSendPresenceQueue, ^{ @autoreleasepool {
-			
-			// Allow delegates to modify outgoing element
-			
-			__block XMPPPresence *modifiedPresence = presence;
-			
-			id del;
-			dispatch_queue_t dq;
-			
-			while (modifiedPresence && [delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
-			{
-				#if DEBUG
-				{
-					char methodReturnType[32];
-				
-					Method method = class_getInstanceMethod([del class], selector);
-					method_getReturnType(method, methodReturnType, sizeof(methodReturnType));
-				
-					if (strcmp(methodReturnType, @encode(XMPPPresence*)) != 0)
-					{
-						NSAssert(NO, @"Method xmppStream:willSendPresence: is no longer void (see XMPPStream.h). "
-						             @"Culprit = %@", NSStringFromClass([del class]));
-					}
-				}
-				#endif
-				
-				dispatch_sync(dq, ^{ @autoreleasepool {
-					
-					modifiedPresence = [del xmppStream:self willSendPresence:modifiedPresence];
-					
-				}});
-			}
-			
-			if (modifiedPresence)
-			{
-				dispatch_async(xmppQueue, ^{ @autoreleasepool {
-					
-					if (state == STATE_XMPP_CONNECTED) {
-						[self continueSendPresence:modifiedPresence withTag:tag];
-					} else {
-						[self failToSendPresence:modifiedPresence];
-					}
-				}});
-			}
-		}});
+		if (sendQueueHighWaterMark == 0 || unsentBytes <= (sendQueueHighWaterMark / 2))
+		{
+			isAboveSendQueueHighWaterMark = NO;
+			[multicastDelegate xmppStreamDidClearSendQueueHighWaterMark:self];
+		}
 	}
 }
 
 - (void)continueSendIQ:(XMPPIQ *)iq withTag:(long)tag
 {
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
-	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
-	
-	NSString *outgoingStr = [iq compactXMLString];
-	NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
+	NSAssert(state == STATE_XMPP_CONNECTED || state == STATE_XMPP_OPENING, @"Invoked with incorrect state");
 	
-	XMPPLogSend(@"SEND: %@", outgoingStr);
-	numberOfBytesSent += [outgoingData length];
-	
-	[asyncSocket writeData:outgoingData
-	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
-	
-	[multicastDelegate xmppStream:self didSendIQ:iq];
+	[self writeElement:iq withTag:tag];
 }
 
 - (void)continueSendMessage:(XMPPMessage *)message withTag:(long)tag
 {
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
-	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
+	NSAssert(state == STATE_XMPP_CONNECTED || state == STATE_XMPP_OPENING, @"Invoked with incorrect state");
 	
-	NSString *outgoingStr = [message compactXMLString];
-	NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-	
-	XMPPLogSend(@"SEND: %@", outgoingStr);
-	numberOfBytesSent += [outgoingData length];
-	
-	[asyncSocket writeData:outgoingData
-	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
-	
-	[multicastDelegate xmppStream:self didSendMessage:message];
+	[self writeElement:message withTag:tag];
 }
 
 - (void)continueSendPresence:(XMPPPresence *)presence withTag:(long)tag
 {
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
-	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
-	
-	NSString *outgoingStr = [presence compactXMLString];
-	NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-	
-	XMPPLogSend(@"SEND: %@", outgoingStr);
-	numberOfBytesSent += [outgoingData length];
-	
-	[asyncSocket writeData:outgoingData
-	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
+	NSAssert(state == STATE_XMPP_CONNECTED || state == STATE_XMPP_OPENING, @"Invoked with incorrect state");
 	
 	// Update myPresence if this is a normal presence element.
 	// In other words, ignore presence subscription stuff, MUC room stuff, etc.
@@ -1483,25 +2677,51 @@ enum XMPPStreamConfig
 		}
 	}
 	
-	[multicastDelegate xmppStream:self didSendPresence:presence];
+	[self writeElement:presence withTag:tag];
 }
 
 - (void)continueSendElement:(NSXMLElement *)element withTag:(long)tag
 {
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
-	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
-	
-	NSString *outgoingStr = [element compactXMLString];
-	NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-	
-	XMPPLogSend(@"SEND: %@", outgoingStr);
-	numberOfBytesSent += [outgoingData length];
+	NSAssert(state == STATE_XMPP_CONNECTED || state == STATE_XMPP_OPENING, @"Invoked with incorrect state");
+	
+	[self writeElement:element withTag:tag];
+}
+
+/**
+ * Private method.
+ * Invokes the didSend delegate method for the given element, once it's been handed to the socket.
+ * (See writeElement:withTag:)
+**/
+- (void)notifyDidSendElement:(NSXMLElement *)element
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	
-	[asyncSocket writeData:outgoingData
-	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
-	
-	if ([customElementNames countForObject:[element name]])
+	if ([element isKindOfClass:[XMPPIQ class]])
+	{
+		XMPPIQ *iq = (XMPPIQ *)element;
+		
+		[multicastDelegate invokeSelector:@selector(xmppStream:didSendIQ:) withBlock:^(id del) {
+			[del xmppStream:self didSendIQ:iq];
+		}];
+	}
+	else if ([element isKindOfClass:[XMPPMessage class]])
+	{
+		XMPPMessage *message = (XMPPMessage *)element;
+		
+		[multicastDelegate invokeSelector:@selector(xmppStream:didSendMessage:) withBlock:^(id del) {
+			[del xmppStream:self didSendMessage:message];
+		}];
+	}
+	else if ([element isKindOfClass:[XMPPPresence class]])
+	{
+		XMPPPresence *presence = (XMPPPresence *)element;
+		
+		[multicastDelegate invokeSelector:@selector(xmppStream:didSendPresence:) withBlock:^(id del) {
+			[del xmppStream:self didSendPresence:presence];
+		}];
+	}
+	else if ([customElementNames countForObject:[element name]])
 	{
 		[multicastDelegate xmppStream:self didSendCustomElement:element];
 	}
@@ -1601,9 +2821,8 @@ enum XMPPStreamConfig
 			if (state == STATE_XMPP_CONNECTED)
 			{
 				receipt = [[XMPPElementReceipt alloc] init];
-				[receipts addObject:receipt];
 				
-				[self sendElement:element withTag:TAG_XMPP_WRITE_RECEIPT];
+				[self sendElement:element withTag:[receiptRing addObserver:receipt]];
 			}
             else
             {
@@ -1620,6 +2839,360 @@ enum XMPPStreamConfig
 	}
 }
 
+/**
+ * This method handles sending an XML stanza.
+ * If the XMPPStream is not connected, the completion handler is invoked (with NO) right away.
+ * 
+ * The completion handler is invoked once the element has been written to the socket,
+ * or once it's clear the element won't be sent (e.g. due to a disconnection).
+**/
+- (void)sendElement:(NSXMLElement *)element completion:(XMPPSendCompletionBlock)completion
+{
+	[self sendElement:element completionQueue:NULL completion:completion];
+}
+
+- (void)sendElement:(NSXMLElement *)element
+    completionQueue:(dispatch_queue_t)completionQueue
+         completion:(XMPPSendCompletionBlock)completion
+{
+	if (element == nil) return;
+	
+	if (completion == nil)
+	{
+		[self sendElement:element];
+		return;
+	}
+	
+	XMPPSendCompletion *sendCompletion = [[XMPPSendCompletion alloc] initWithQueue:completionQueue];
+	sendCompletion->completionBlock = [completion copy];
+	sendCompletion->numberOfPendingElements = 1;
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		if (state == STATE_XMPP_CONNECTED)
+		{
+			[self sendElement:element withTag:[receiptRing addObserver:sendCompletion]];
+		}
+		else
+		{
+			[self failToSendElement:element];
+			[sendCompletion signalFailure];
+		}
+	}};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+/**
+ * This method handles sending a batch of XML stanzas, with a single completion handler.
+ * See the header file for details.
+**/
+- (void)sendElements:(NSArray *)elements
+     completionQueue:(dispatch_queue_t)completionQueue
+          completion:(XMPPBatchSendCompletionBlock)completion
+{
+	if ([elements count] == 0)
+	{
+		if (completion)
+		{
+			dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{ @autoreleasepool {
+				completion(0);
+			}});
+		}
+		return;
+	}
+	
+	// Even without a completion handler, every element needs a receipt tag,
+	// so the batch cork can tell when the last of them has been written (see sendCorkedBatch:).
+	
+	XMPPSendCompletion *sendCompletion = [[XMPPSendCompletion alloc] initWithQueue:completionQueue];
+	sendCompletion->batchCompletionBlock = [completion copy];
+	sendCompletion->numberOfPendingElements = [elements count];
+	
+	NSArray *elementsCopy = [elements copy];
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		[self sendCorkedBatch:^{
+			
+			for (NSXMLElement *element in elementsCopy)
+			{
+				if (state == STATE_XMPP_CONNECTED)
+				{
+					long tag = [receiptRing addObserver:sendCompletion];
+					[batchCorkTags addIndex:(NSUInteger)tag];
+					
+					[self sendElement:element withTag:tag];
+				}
+				else
+				{
+					[self failToSendElement:element];
+					[sendCompletion signalFailure];
+				}
+			}
+		}];
+	}};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (void)sendElements:(NSArray *)elements
+     completionQueue:(dispatch_queue_t)completionQueue
+   elementCompletion:(XMPPElementSendCompletionBlock)completion
+{
+	if (completion == nil)
+	{
+		[self sendElements:elements completionQueue:completionQueue completion:nil];
+		return;
+	}
+	
+	// One completion per element, each reporting its own index
+	
+	NSUInteger count = [elements count];
+	NSMutableArray *sendCompletions = [NSMutableArray arrayWithCapacity:count];
+	
+	XMPPElementSendCompletionBlock completionCopy = [completion copy];
+	
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		XMPPSendCompletion *sendCompletion = [[XMPPSendCompletion alloc] initWithQueue:completionQueue];
+		sendCompletion->completionBlock = [^(BOOL sent){
+			completionCopy(i, sent);
+		} copy];
+		sendCompletion->numberOfPendingElements = 1;
+		
+		[sendCompletions addObject:sendCompletion];
+	}
+	
+	NSArray *elementsCopy = [elements copy];
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		[self sendCorkedBatch:^{
+			
+			NSUInteger i = 0;
+			for (NSXMLElement *element in elementsCopy)
+			{
+				XMPPSendCompletion *sendCompletion = sendCompletions[i++];
+				
+				if (state == STATE_XMPP_CONNECTED)
+				{
+					long tag = [receiptRing addObserver:sendCompletion];
+					[batchCorkTags addIndex:(NSUInteger)tag];
+					
+					[self sendElement:element withTag:tag];
+				}
+				else
+				{
+					[self failToSendElement:element];
+					[sendCompletion signalFailure];
+				}
+			}
+		}];
+	}};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+/**
+ * Private method.
+ * Invokes the given block (which sends a batch of elements) with corking enabled,
+ * so the elements that go straight to the socket are written together.
+ * 
+ * The block adds the receipt tag of each element it sends to batchCorkTags.
+ * Elements may reach writeElement:withTag: after the block returns (e.g. via the willSend delegate methods),
+ * so the cork stays open until each tagged element has been written or has failed.
+ * Unless corksWrites is enabled, the cork is then flushed.
+**/
+- (void)sendCorkedBatch:(dispatch_block_t)sendBlock
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	BOOL wasCorkingBatch = corksBatch;
+	corksBatch = YES;
+	
+	sendBlock();
+	
+	corksBatch = wasCorkingBatch;
+	
+	[self maybeFlushBatchCork];
+}
+
+/**
+ * Private method.
+ * If the given tag belongs to an element of an open batch, removes it and returns YES.
+**/
+- (BOOL)removeBatchCorkTag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (tag < TAG_XMPP_WRITE_RECEIPT_BASE) return NO;
+	if (![batchCorkTags containsIndex:(NSUInteger)tag]) return NO;
+	
+	[batchCorkTags removeIndex:(NSUInteger)tag];
+	return YES;
+}
+
+/**
+ * Private method.
+ * Flushes the cork once every element of the open batches has been written (or has failed).
+**/
+- (void)maybeFlushBatchCork
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (!corksWrites && !corksBatch && [batchCorkTags count] == 0)
+	{
+		[self flushCorkedWrites];
+	}
+}
+
+/**
+ * Private method.
+ * Signals the receipt (or completion handler) associated with the given write tag, if there is one.
+**/
+- (void)resolveObserverForTag:(long)tag success:(BOOL)success
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (tag < TAG_XMPP_WRITE_RECEIPT_BASE) return;
+	
+	if ([self removeBatchCorkTag:tag])
+	{
+		// The element failed before reaching the cork
+		[self maybeFlushBatchCork];
+	}
+	
+	id <XMPPSendObserver> observer = [receiptRing removeObserverForTag:tag];
+	
+	if (success)
+		[observer signalSuccess];
+	else
+		[observer signalFailure];
+}
+
+/**
+ * This method handles sending an XML stanza as early data.
+ * See the header file for details.
+**/
+- (void)sendElementAsEarlyData:(NSXMLElement *)element
+{
+	if (element == nil) return;
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		if (state == STATE_XMPP_CONNECTED)
+		{
+			[self sendElement:element withTag:TAG_XMPP_WRITE_STREAM];
+		}
+		else if (state == STATE_XMPP_OPENING)
+		{
+			// The stream header is already out, so the element can follow it right away.
+			[self sendEarlyElement:element];
+		}
+		else if (state == STATE_XMPP_RESOLVING_SRV || state == STATE_XMPP_CONNECTING)
+		{
+			if (earlyElements == nil)
+				earlyElements = [[NSMutableArray alloc] init];
+			
+			[earlyElements addObject:element];
+		}
+		else
+		{
+			[self failToSendElement:element];
+		}
+	}};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+/**
+ * Private method.
+ * Sends an early element while the stream is opening.
+ * 
+ * The outgoing inline filters are applied, but the willSend delegate methods are not invoked,
+ * as they're asynchronous and the element would miss the flight of the stream header.
+**/
+- (void)sendEarlyElement:(NSXMLElement *)element
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	NSAssert(state == STATE_XMPP_OPENING, @"Invoked with incorrect state");
+	
+	NSString *elementName = [element name];
+	
+	if ([element isKindOfClass:[XMPPIQ class]] || [elementName isEqualToString:@"iq"])
+	{
+		XMPPIQ *iq = [element isKindOfClass:[XMPPIQ class]] ? (XMPPIQ *)element : [XMPPIQ iqFromElement:element];
+		
+		if (inlineFilterChains[XMPPInlineFilterHookOutgoingIQ])
+		{
+			iq = [self runInlineFilterChain:XMPPInlineFilterHookOutgoingIQ withStanza:iq];
+			if (iq == nil) return;
+		}
+		
+		[self continueSendIQ:iq withTag:TAG_XMPP_WRITE_STREAM];
+	}
+	else if ([element isKindOfClass:[XMPPMessage class]] || [elementName isEqualToString:@"message"])
+	{
+		XMPPMessage *message = [element isKindOfClass:[XMPPMessage class]] ? (XMPPMessage *)element
+		                                                                   : [XMPPMessage messageFromElement:element];
+		
+		if (inlineFilterChains[XMPPInlineFilterHookOutgoingMessage])
+		{
+			message = [self runInlineFilterChain:XMPPInlineFilterHookOutgoingMessage withStanza:message];
+			if (message == nil) return;
+		}
+		
+		[self continueSendMessage:message withTag:TAG_XMPP_WRITE_STREAM];
+	}
+	else if ([element isKindOfClass:[XMPPPresence class]] || [elementName isEqualToString:@"presence"])
+	{
+		XMPPPresence *presence = [element isKindOfClass:[XMPPPresence class]] ? (XMPPPresence *)element
+		                                                                      : [XMPPPresence presenceFromElement:element];
+		
+		if (inlineFilterChains[XMPPInlineFilterHookOutgoingPresence])
+		{
+			presence = [self runInlineFilterChain:XMPPInlineFilterHookOutgoingPresence withStanza:presence];
+			if (presence == nil) return;
+		}
+		
+		[self continueSendPresence:presence withTag:TAG_XMPP_WRITE_STREAM];
+	}
+	else
+	{
+		[self continueSendElement:element withTag:TAG_XMPP_WRITE_STREAM];
+	}
+}
+
+/**
+ * Private method.
+ * Fails any early elements that were waiting for the stream to open.
+**/
+- (void)failEarlyElements
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	NSArray *elements = earlyElements;
+	earlyElements = nil;
+	
+	for (NSXMLElement *element in elements)
+	{
+		[self failToSendElement:element];
+	}
+}
+
 - (void)failToSendElement:(NSXMLElement *)element
 {
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
@@ -1663,7 +3236,9 @@ enum XMPPStreamConfig
 	                                     code:XMPPStreamInvalidState
 	                                 userInfo:nil];
 	
-	[multicastDelegate xmppStream:self didFailToSendIQ:iq error:error];
+	[multicastDelegate invokeSelector:@selector(xmppStream:didFailToSendIQ:error:) withBlock:^(id del) {
+		[del xmppStream:self didFailToSendIQ:iq error:error];
+	}];
 }
 
 - (void)failToSendMessage:(XMPPMessage *)message
@@ -1674,7 +3249,9 @@ enum XMPPStreamConfig
 	                                     code:XMPPStreamInvalidState
 	                                 userInfo:nil];
 	
-	[multicastDelegate xmppStream:self didFailToSendMessage:message error:error];
+	[multicastDelegate invokeSelector:@selector(xmppStream:didFailToSendMessage:error:) withBlock:^(id del) {
+		[del xmppStream:self didFailToSendMessage:message error:error];
+	}];
 }
 
 - (void)failToSendPresence:(XMPPPresence *)presence
@@ -1685,7 +3262,9 @@ enum XMPPStreamConfig
 	                                     code:XMPPStreamInvalidState
 	                                 userInfo:nil];
 	
-	[multicastDelegate xmppStream:self didFailToSendPresence:presence error:error];
+	[multicastDelegate invokeSelector:@selector(xmppStream:didFailToSendPresence:error:) withBlock:^(id del) {
+		[del xmppStream:self didFailToSendPresence:presence error:error];
+	}];
 }
 
 /**
@@ -1715,6 +3294,16 @@ enum XMPPStreamConfig
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
 	
+	if (inlineFilterChains[XMPPInlineFilterHookIncomingIQ])
+	{
+		iq = [self runInlineFilterChain:XMPPInlineFilterHookIncomingIQ withStanza:iq];
+		if (iq == nil)
+		{
+			[self notifyInlineFilteredIncomingStanza];
+			return;
+		}
+	}
+	
 	// We're getting ready to receive an IQ.
 	// Notify delegates to allow them to optionally alter/filter the incoming IQ element.
 	
@@ -1789,6 +3378,16 @@ enum XMPPStreamConfig
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
 	
+	if (inlineFilterChains[XMPPInlineFilterHookIncomingMessage])
+	{
+		message = [self runInlineFilterChain:XMPPInlineFilterHookIncomingMessage withStanza:message];
+		if (message == nil)
+		{
+			[self notifyInlineFilteredIncomingStanza];
+			return;
+		}
+	}
+	
 	// We're getting ready to receive a message.
 	// Notify delegates to allow them to optionally alter/filter the incoming message.
 	
@@ -1864,6 +3463,16 @@ enum XMPPStreamConfig
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
 	
+	if (inlineFilterChains[XMPPInlineFilterHookIncomingPresence])
+	{
+		presence = [self runInlineFilterChain:XMPPInlineFilterHookIncomingPresence withStanza:presence];
+		if (presence == nil)
+		{
+			[self notifyInlineFilteredIncomingStanza];
+			return;
+		}
+	}
+	
 	// We're getting ready to receive a presence element.
 	// Notify delegates to allow them to optionally alter/filter the incoming presence.
 	
@@ -1934,114 +3543,407 @@ enum XMPPStreamConfig
 	}
 }
 
+/**
+ * Enumerates the delegates that implement the given selector, and should receive the given stanza.
+ * That is, delegates that have registered interests for the given kind of stanza are skipped,
+ * unless the stanza matches one of their interests.
+**/
+- (void)enumerateReceiversOfStanza:(XMPPElement *)stanza
+                            ofKind:(XMPPStanzaKind)kind
+                       forSelector:(SEL)selector
+                        usingBlock:(void (^)(id del, dispatch_queue_t dq))block
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+	NSHashTable *matchingDelegates = nil;
+	
+	id del;
+	dispatch_queue_t dq;
+	
+	while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+	{
+		if ([routingTable isDelegate:del routedForKind:kind])
+		{
+			if (matchingDelegates == nil)
+				matchingDelegates = [routingTable delegatesMatchingStanza:stanza ofKind:kind];
+			
+			if (![matchingDelegates containsObject:del]) continue;
+		}
+		
+		block(del, dq);
+	}
+}
+
+/**
+ * An entity that receives an IQ request of type "get" or "set" MUST reply
+ * with an IQ response of type "result" or "error".
+ * This method sends the error response for an IQ request that nobody handled.
+ * 
+ * The response MUST preserve the 'id' attribute of the request.
+ * 
+ * This method may be invoked on any queue.
+**/
+- (void)sendErrorResponseForUnhandledIQ:(XMPPIQ *)iq
+{
+	// Return error message:
+	//
+	// <iq to="jid" type="error" id="id">
+	//   <query xmlns="ns"/>
+	//   <error type="cancel" code="501">
+	//     <feature-not-implemented xmlns="urn:ietf:params:xml:ns:xmpp-stanzas"/>
+	//   </error>
+	// </iq>
+	
+	NSXMLElement *reason = [NSXMLElement elementWithName:@"feature-not-implemented"
+	                                               xmlns:@"urn:ietf:params:xml:ns:xmpp-stanzas"];
+	
+	NSXMLElement *error = [NSXMLElement elementWithName:@"error"];
+	[error addAttributeWithName:@"type" stringValue:@"cancel"];
+	[error addAttributeWithName:@"code" stringValue:@"501"];
+	[error addChild:reason];
+	
+	XMPPIQ *iqResponse = [XMPPIQ iqWithType:@"error"
+	                                     to:[iq from]
+	                              elementID:[iq elementID]
+	                                  child:error];
+	
+	NSXMLElement *iqChild = [iq childElement];
+	if (iqChild)
+	{
+		NSXMLNode *iqChildCopy = [iqChild copy];
+		[iqResponse insertChild:iqChildCopy atIndex:0];
+	}
+	
+	// Purposefully go through the sendElement: method
+	// so that it gets dispatched onto the xmppQueue,
+	// and so that modules may get notified of the outgoing error message.
+	
+	[self sendElement:iqResponse];
+}
+
 - (void)continueReceiveIQ:(XMPPIQ *)iq
 {
+	// Batched messages and presences must not be overtaken by this IQ
+	[self flushDeliveryBatches];
+	
 	if ([iq requiresResponse])
 	{
 		// As per the XMPP specificiation, if the IQ requires a response,
 		// and we don't have any delegates or modules that can properly respond to the IQ,
 		// we MUST send back and error IQ.
 		//
-		// So we notifiy all interested delegates and modules about the received IQ,
-		// keeping track of whether or not any of them have handled it.
+		// If a handler has claimed the namespace of the IQ, then it alone receives it.
+		// The other delegates are told that a stanza was consumed by the stack, just as for a filtered stanza,
+		// so stream management still counts it as handled.
 		
-		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		NSString *xmlns = [[iq childElement] xmlns];
+		XMPPIQHandlerEntry *entry = xmlns ? iqHandlers[xmlns] : nil;
+		id handler = entry ? entry->handler : nil;
 		
-		id del;
-		dispatch_queue_t dq;
+		if (handler)
+		{
+			dispatch_async(entry->handlerQueue, ^{ @autoreleasepool {
+				
+				if (![handler xmppStream:self didReceiveIQ:iq])
+				{
+					[self sendErrorResponseForUnhandledIQ:iq];
+				}
+			}});
+			
+			[multicastDelegate xmppStreamDidFilterStanza:self];
+			return;
+		}
+		else if (entry)
+		{
+			// The handler has been deallocated
+			[iqHandlers removeObjectForKey:xmlns];
+		}
+		
+		// Otherwise we notifiy all interested delegates and modules about the received IQ,
+		// keeping track of whether or not any of them have handled it.
+		//
+		// Nothing waits on the delegates.
+		// The group notification fires once the last of them has returned.
 		
 		SEL selector = @selector(xmppStream:didReceiveIQ:);
 		
-		dispatch_semaphore_t delSemaphore = dispatch_semaphore_create(0);
 		dispatch_group_t delGroup = dispatch_group_create();
+		__block volatile uint32_t handled = 0;
 		
-		while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
-		{
+		[self enumerateReceiversOfStanza:iq
+		                          ofKind:XMPPStanzaKindIQ
+		                     forSelector:selector
+		                      usingBlock:^(id del, dispatch_queue_t dq) {
+			
 			dispatch_group_async(delGroup, dq, ^{ @autoreleasepool {
 				
 				if ([del xmppStream:self didReceiveIQ:iq])
 				{
-					dispatch_semaphore_signal(delSemaphore);
+					OSAtomicOr32Barrier(1, &handled);
 				}
 				
 			}});
-		}
+		}];
 		
-		dispatch_async(didReceiveIqQueue, ^{ @autoreleasepool {
-			
-			dispatch_group_wait(delGroup, DISPATCH_TIME_FOREVER);
+		dispatch_group_notify(delGroup, xmppQueue, ^{ @autoreleasepool {
 			
 			// Did any of the delegates handle the IQ? (handle == will response)
 			
-			BOOL handled = (dispatch_semaphore_wait(delSemaphore, DISPATCH_TIME_NOW) == 0);
-			
-			// An entity that receives an IQ request of type "get" or "set" MUST reply
-			// with an IQ response of type "result" or "error".
-			//
-			// The response MUST preserve the 'id' attribute of the request.
-			
-			if (!handled)
+			if (OSAtomicOr32Barrier(0, &handled) == 0)
 			{
-				// Return error message:
-				//
-				// <iq to="jid" type="error" id="id">
-				//   <query xmlns="ns"/>
-				//   <error type="cancel" code="501">
-				//     <feature-not-implemented xmlns="urn:ietf:params:xml:ns:xmpp-stanzas"/>
-				//   </error>
-				// </iq>
-				
-				NSXMLElement *reason = [NSXMLElement elementWithName:@"feature-not-implemented"
-				                                               xmlns:@"urn:ietf:params:xml:ns:xmpp-stanzas"];
-				
-				NSXMLElement *error = [NSXMLElement elementWithName:@"error"];
-				[error addAttributeWithName:@"type" stringValue:@"cancel"];
-				[error addAttributeWithName:@"code" stringValue:@"501"];
-				[error addChild:reason];
-				
-				XMPPIQ *iqResponse = [XMPPIQ iqWithType:@"error"
-				                                     to:[iq from]
-				                              elementID:[iq elementID]
-				                                  child:error];
-				
-				NSXMLElement *iqChild = [iq childElement];
-				if (iqChild)
-				{
-					NSXMLNode *iqChildCopy = [iqChild copy];
-					[iqResponse insertChild:iqChildCopy atIndex:0];
-				}
-				
-				// Purposefully go through the sendElement: method
-				// so that it gets dispatched onto the xmppQueue,
-				// and so that modules may get notified of the outgoing error message.
-				
-				[self sendElement:iqResponse];
+				[self sendErrorResponseForUnhandledIQ:iq];
 			}
-			
-			#if !OS_OBJECT_USE_OBJC
-			dispatch_release(delSemaphore);
-			dispatch_release(delGroup);
-			#endif
-			
 		}});
+		
+		#if !OS_OBJECT_USE_OBJC
+		dispatch_release(delGroup);
+		#endif
 	}
 	else
 	{
 		// The IQ doesn't require a response.
 		// So we can just fire the delegate method and ignore the responses.
 		
-		[multicastDelegate xmppStream:self didReceiveIQ:iq];
+		if (![routingTable hasInterestsForKind:XMPPStanzaKindIQ])
+		{
+			[multicastDelegate invokeSelector:@selector(xmppStream:didReceiveIQ:) withBlock:^(id del) {
+				[del xmppStream:self didReceiveIQ:iq];
+			}];
+			return;
+		}
+		
+		[self enumerateReceiversOfStanza:iq
+		                          ofKind:XMPPStanzaKindIQ
+		                     forSelector:@selector(xmppStream:didReceiveIQ:)
+		                      usingBlock:^(id del, dispatch_queue_t dq) {
+			
+			dispatch_async(dq, ^{ @autoreleasepool {
+				
+				[del xmppStream:self didReceiveIQ:iq];
+			}});
+		}];
 	}
 }
 
 - (void)continueReceiveMessage:(XMPPMessage *)message
 {
-	[multicastDelegate xmppStream:self didReceiveMessage:message];
+	[self deliverReceivedStanza:message ofKind:XMPPStanzaKindMessage];
 }
 
 - (void)continueReceivePresence:(XMPPPresence *)presence
 {
-	[multicastDelegate xmppStream:self didReceivePresence:presence];
+	[self deliverReceivedStanza:presence ofKind:XMPPStanzaKindPresence];
+}
+
+/**
+ * Delivers a received message or presence to the delegates.
+ * 
+ * Delegates that implement the batched variant of the delegate method
+ * get the stanza appended to their pending batch, instead of a separate invocation.
+**/
+- (void)deliverReceivedStanza:(XMPPElement *)stanza ofKind:(XMPPStanzaKind)kind
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	BOOL isMessage = (kind == XMPPStanzaKindMessage);
+	
+	SEL selector;
+	SEL batchSelector;
+	
+	if (isMessage)
+	{
+		selector = @selector(xmppStream:didReceiveMessage:);
+		batchSelector = @selector(xmppStream:didReceiveMessages:);
+	}
+	else
+	{
+		selector = @selector(xmppStream:didReceivePresence:);
+		batchSelector = @selector(xmppStream:didReceivePresences:);
+	}
+	
+	BOOL batching = [multicastDelegate hasDelegateThatRespondsToSelector:batchSelector];
+	
+	if (!batching && ![routingTable hasInterestsForKind:kind])
+	{
+		[multicastDelegate invokeSelector:selector withBlock:^(id del) {
+			
+			if (isMessage)
+				[del xmppStream:self didReceiveMessage:(XMPPMessage *)stanza];
+			else
+				[del xmppStream:self didReceivePresence:(XMPPPresence *)stanza];
+		}];
+		return;
+	}
+	
+	if (batching)
+	{
+		[self enumerateReceiversOfStanza:stanza
+		                          ofKind:kind
+		                     forSelector:batchSelector
+		                      usingBlock:^(id del, dispatch_queue_t dq) {
+			
+			[self addStanza:stanza ofKind:kind toDeliveryBatchForDelegate:del delegateQueue:dq];
+		}];
+	}
+	
+	[self enumerateReceiversOfStanza:stanza
+	                          ofKind:kind
+	                     forSelector:selector
+	                      usingBlock:^(id del, dispatch_queue_t dq) {
+		
+		if (batching && [del respondsToSelector:batchSelector]) return; // Already batched
+		
+		dispatch_async(dq, ^{ @autoreleasepool {
+			
+			if (isMessage)
+				[del xmppStream:self didReceiveMessage:(XMPPMessage *)stanza];
+			else
+				[del xmppStream:self didReceivePresence:(XMPPPresence *)stanza];
+		}});
+	}];
+}
+
+/**
+ * Appends the given stanza to the pending batch of the given delegate.
+ * If the pending batch contains stanzas of a different kind, it's delivered first.
+**/
+- (void)addStanza:(XMPPElement *)stanza
+           ofKind:(XMPPStanzaKind)kind
+    toDeliveryBatchForDelegate:(id)delegate
+    delegateQueue:(dispatch_queue_t)delegateQueue
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPDeliveryBatch *batch = nil;
+	
+	for (XMPPDeliveryBatch *existingBatch in deliveryBatches)
+	{
+		if (existingBatch->delegate == delegate && existingBatch->delegateQueue == delegateQueue)
+		{
+			batch = existingBatch;
+			break;
+		}
+	}
+	
+	if (batch == nil)
+	{
+		batch = [[XMPPDeliveryBatch alloc] init];
+		batch->delegate = delegate;
+		batch->delegateQueue = delegateQueue;
+		#if !OS_OBJECT_USE_OBJC
+		dispatch_retain(delegateQueue);
+		#endif
+		batch->kind = kind;
+		batch->stanzas = [[NSMutableArray alloc] init];
+		
+		[deliveryBatches addObject:batch];
+	}
+	else if (batch->kind != kind)
+	{
+		[self deliverBatch:batch];
+		batch->kind = kind;
+	}
+	
+	[batch->stanzas addObject:stanza];
+	
+	if ([batch->stanzas count] >= deliveryBatchMaxSize)
+		[self deliverBatch:batch];
+	else
+		[self scheduleDeliveryBatchFlush];
+}
+
+/**
+ * Hands the pending stanzas of the given batch to its delegate.
+**/
+- (void)deliverBatch:(XMPPDeliveryBatch *)batch
+{
+	if ([batch->stanzas count] == 0) return;
+	
+	NSArray *stanzas = batch->stanzas;
+	batch->stanzas = [[NSMutableArray alloc] init];
+	
+	id del = batch->delegate;
+	if (del == nil) return;
+	
+	XMPPStanzaKind kind = batch->kind;
+	
+	dispatch_async(batch->delegateQueue, ^{ @autoreleasepool {
+		
+		if (kind == XMPPStanzaKindMessage)
+			[del xmppStream:self didReceiveMessages:stanzas];
+		else
+			[del xmppStream:self didReceivePresences:stanzas];
+	}});
+}
+
+/**
+ * Arranges for the pending batches to be delivered after the deliveryBatchLatency.
+ * 
+ * With a latency of zero, batches are delivered once the parser is done with the current chunk of data
+ * (see xmppParserDidParseData:), or else at the end of this queue turn.
+**/
+- (void)scheduleDeliveryBatchFlush
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (deliveryBatchFlushScheduled) return;
+	
+	if (deliveryBatchLatency <= 0.0 && pendingParseChunks > 0 && willReceiveStanzaQueue == NULL)
+	{
+		// xmppParserDidParseData: will flush
+		return;
+	}
+	
+	deliveryBatchFlushScheduled = YES;
+	
+	NSUInteger generation = deliveryBatchGeneration;
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		if (deliveryBatchGeneration == generation)
+		{
+			[self flushDeliveryBatches];
+		}
+	}};
+	
+	if (deliveryBatchLatency > 0.0)
+	{
+		dispatch_time_t when = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(deliveryBatchLatency * NSEC_PER_SEC));
+		dispatch_after(when, xmppQueue, block);
+	}
+	else if (willReceiveStanzaQueue)
+	{
+		// Go through the stanzaQueue, so stanzas that are still being filtered can join the batch.
+		
+		dispatch_async(willReceiveStanzaQueue, ^{
+			dispatch_async(xmppQueue, block);
+		});
+	}
+	else
+	{
+		dispatch_async(xmppQueue, block);
+	}
+}
+
+/**
+ * Delivers all pending batches.
+**/
+- (void)flushDeliveryBatches
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if ([deliveryBatches count] == 0) return;
+	
+	for (XMPPDeliveryBatch *batch in deliveryBatches)
+	{
+		[self deliverBatch:batch];
+	}
+	
+	[deliveryBatches removeAllObjects];
+	
+	deliveryBatchFlushScheduled = NO;
+	deliveryBatchGeneration++;
 }
 
 /**
@@ -2190,21 +4092,30 @@ enum XMPPStreamConfig
                             [myJID domain],
                             session];
     
+    NSData *outgoingData = [openStanza dataUsingEncoding:NSUTF8StringEncoding];
+    
     XMPPLogSend(@"SEND: %@", openStanza);
-    numberOfBytesSent += [openStanza length];
+    numberOfBytesSent += [outgoingData length];
     
-    NSData *outgoingData = [openStanza dataUsingEncoding:NSUTF8StringEncoding];
+    state = STATE_XMPP_OPENING;
     
-    [asyncSocket writeData:outgoingData
-               withTimeout:TIMEOUT_XMPP_WRITE
-                       tag:TAG_XMPP_WRITE_START];
+    if ([earlyElements count] > 0)
+    {
+        [self writeStreamHeader:outgoingData withEarlyElements:earlyElements];
+        earlyElements = nil;
+    }
+    else
+    {
+        [self writeData:outgoingData withTag:TAG_XMPP_WRITE_START outputBuffer:nil];
+    }
 	
     XMPPLogVerbose(@"%@: Initializing parser...", THIS_FILE);
     
-    state = STATE_XMPP_OPENING;
-    
     // Need to create the parser.
-    parser = [[XMPPParser alloc] initWithDelegate:self delegateQueue:xmppQueue];
+    parser = [[XMPPParser alloc] initWithDelegate:self
+                                    delegateQueue:xmppQueue
+                                      parserQueue:NULL
+                                          backend:parserBackend];
 	
     NSString *recvFormat =
         @"<?xml version='1.0'?>"
@@ -2216,6 +4127,9 @@ enum XMPPStreamConfig
     [parser parseData:recvData];
 	
     // And start reading in the server's XML stream
+    pendingParseChunks = 0;
+    isReadingStream = YES;
+    
     [asyncSocket readDataWithTimeout:TIMEOUT_XMPP_READ_START tag:TAG_XMPP_READ_START];
 }
 
@@ -2269,6 +4183,8 @@ enum XMPPStreamConfig
 		
 		state = STATE_XMPP_DISCONNECTED;
 		
+		[self failEarlyElements];
+		
 		[multicastDelegate xmppStreamDidDisconnect:self withError:connectError];
 	}
 }
@@ -2359,8 +4275,14 @@ enum XMPPStreamConfig
 	
 	XMPPLogRecvPre(@"RECV: %@", [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding]);
 	
+	isReadingStream = NO;
+	pendingParseChunks++;
+	
 	// Asynchronously parse the xml data
 	[parser parseData:data];
+	
+	// If the receive pipeline has room, keep draining the socket while the parser works on this chunk.
+	[self maybeReadStreamData];
 }
 
 /**
@@ -2374,17 +4296,55 @@ enum XMPPStreamConfig
 	
 	lastSendReceiveTime = [NSDate timeIntervalSinceReferenceDate];
 	
-	if (tag == TAG_XMPP_WRITE_RECEIPT)
+	// GCDAsyncSocket completes writes in the order they were queued.
+	// So the head of the pendingWrites queue always corresponds to this write.
+	
+	XMPPPendingWrite *write = [pendingWrites removeFirstWrite];
+	
+	if (write)
+	{
+		bytesInFlight -= [write->data length];
+		
+		if (write->outputBuffer)
+		{
+			[outputBufferPool recycleBuffer:write->outputBuffer];
+		}
+	}
+	
+	// Keep the socket busy before notifying anybody
+	[self pumpSendQueues];
+	
+	if (tag == TAG_XMPP_WRITE_CORKED)
 	{
-		if ([receipts count] == 0)
+		if (write == nil)
 		{
-			XMPPLogWarn(@"%@: Found TAG_XMPP_WRITE_RECEIPT with no pending receipts!", THIS_FILE);
+			XMPPLogWarn(@"%@: Found TAG_XMPP_WRITE_CORKED with no pending corked writes!", THIS_FILE);
 			return;
 		}
 		
-		XMPPElementReceipt *receipt = receipts[0];
-		[receipt signalSuccess];
-		[receipts removeObjectAtIndex:0];
+		// Process the individual stanzas in the order they were corked
+		for (NSNumber *stanzaTag in write->stanzaTags)
+		{
+			[self handleWriteCompletionWithTag:[stanzaTag longValue]];
+		}
+	}
+	else
+	{
+		[self handleWriteCompletionWithTag:tag];
+	}
+	
+	[self updateSendQueueHighWaterMark];
+}
+
+/**
+ * Private method.
+ * Handles the completion of an individual write (which may have been part of a corked write).
+**/
+- (void)handleWriteCompletionWithTag:(long)tag
+{
+	if (tag >= TAG_XMPP_WRITE_RECEIPT_BASE)
+	{
+		[self resolveObserverForTag:tag success:YES];
 	}
 	else if (tag == TAG_XMPP_WRITE_STOP)
 	{
@@ -2392,6 +4352,74 @@ enum XMPPStreamConfig
 	}
 }
 
+/**
+ * Private method.
+ * Fails the receipts of everything that was sent but not yet written, and drops the send queue.
+**/
+- (void)discardUnsentWrites
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	for (id <XMPPSendObserver> observer in [receiptRing removeAllObservers])
+	{
+		[observer signalFailure];
+	}
+	
+	// Drop any in-flight writes.
+	// This is only invoked from socketDidDisconnect:withError:, and GCDAsyncSocket drops its write queue
+	// before reporting the disconnect. So nothing references the bytes of their output buffers anymore
+	// (the data handed to the socket doesn't copy them), and the buffers can go back to the pool.
+	for (XMPPPendingWrite *write in [pendingWrites removeAllWrites])
+	{
+		if (write->outputBuffer)
+		{
+			[outputBufferPool recycleBuffer:write->outputBuffer];
+		}
+	}
+	bytesInFlight = 0;
+	
+	// Drop anything still queued (these buffers were never handed to the socket).
+	// The delegates were never told these elements were sent, so they're told they failed instead.
+	NSMutableArray *unsentElements = [NSMutableArray array];
+	
+	for (NSUInteger priority = 0; priority < XMPP_SEND_PRIORITY_COUNT; priority++)
+	{
+		for (XMPPPendingWrite *write in [sendQueues[priority] removeAllWrites])
+		{
+			if (write->outputBuffer)
+			{
+				[outputBufferPool recycleBuffer:write->outputBuffer];
+			}
+			if (write->element)
+			{
+				[unsentElements addObject:write->element];
+			}
+		}
+		sendQueueCounts[priority] = 0;
+		sendQueueBytes[priority] = 0;
+	}
+	totalSendQueueBytes = 0;
+	
+	for (NSXMLElement *element in unsentElements)
+	{
+		[self failToSendElement:element];
+	}
+	
+	// Discard anything still corked
+	if (corkBuffer)
+	{
+		[outputBufferPool recycleBuffer:corkBuffer];
+	}
+	
+	corkBuffer = nil;
+	corkTags = nil;
+	corkGeneration++;
+	
+	[batchCorkTags removeAllIndexes];
+	
+	[self updateSendQueueHighWaterMark];
+}
+
 /**
  * Called when a socket disconnects with or without error.
 **/
@@ -2416,6 +4444,9 @@ enum XMPPStreamConfig
 		[parser setDelegate:nil delegateQueue:NULL];
 		parser = nil;
 		
+		pendingParseChunks = 0;
+		isReadingStream = NO;
+		
 		// Clear any saved authentication information
         
 		authenticationDate = nil;
@@ -2425,11 +4456,8 @@ enum XMPPStreamConfig
 		rootElement = nil;
 		
 		// Stop the keep alive timer
-		if (keepAliveTimer)
-		{
-			dispatch_source_cancel(keepAliveTimer);
-			keepAliveTimer = NULL;
-		}
+		[keepAliveTimer cancel];
+		keepAliveTimer = nil;
 		
 		// Clear srv results
 		srvResolver = nil;
@@ -2438,12 +4466,12 @@ enum XMPPStreamConfig
         // Stop tracking IDs
         [idTracker removeAllIDs];
 		
-		// Clear any pending receipts
-		for (XMPPElementReceipt *receipt in receipts)
-		{
-			[receipt signalFailure];
-		}
-		[receipts removeAllObjects];
+		// Fail any pending receipts, and drop the send queue
+		[self discardUnsentWrites];
+		[self failEarlyElements];
+		
+		// Deliver anything still batched (it was received before the disconnect)
+		[self flushDeliveryBatches];
 		
 		// Clear flags
 		flags = 0;
@@ -2563,6 +4591,96 @@ enum XMPPStreamConfig
     }
 }
 
+/**
+ * Called (instead of xmppParser:didReadElement:) when using one of the arena parser backends.
+ * 
+ * This gives us a chance to route the stanza based on its top-level information,
+ * before creating the full NSXMLElement representation.
+ * In particular, a message or presence stanza that nobody is listening for is never materialized.
+**/
+- (void)xmppParser:(XMPPParser *)sender didReadArenaElement:(XMPPArenaElement *)arenaElement
+{
+	// This method is invoked on the xmppQueue.
+	
+	if (sender != parser) return;
+	
+	if (state == STATE_XMPP_CONNECTED && ![self hasInterestInArenaElement:arenaElement])
+	{
+		XMPPLogTrace();
+		XMPPLogRecvPost(@"RECV: %@", arenaElement);
+		
+		XMPPLogVerbose(@"%@: Dropping unobserved <%@/> without materializing it", THIS_FILE, [arenaElement name]);
+		
+		// The stanza was still received, and counts as handled (e.g. for stream management)
+		[multicastDelegate xmppStreamDidFilterStanza:self];
+		return;
+	}
+	
+	[self xmppParser:sender didReadElement:[arenaElement element]];
+}
+
+/**
+ * Returns NO if the given stanza may be dropped without being materialized:
+ * either it can't match any of the registered interests for its kind,
+ * or (without interests) no delegate implements the corresponding didReceive method.
+ * 
+ * IQ stanzas are always of interest, since unhandled IQs need a response.
+ * And stanzas are always of interest while someone may be waiting on the willReceiveStanzaQueue,
+ * in order to maintain the in-order delivery of received stanzas.
+**/
+- (BOOL)hasInterestInArenaElement:(XMPPArenaElement *)arenaElement
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (willReceiveStanzaQueue) return YES;
+	
+	NSString *elementName = [arenaElement name];
+	
+	SEL willReceiveSelector;
+	SEL didReceiveSelector;
+	SEL didReceiveBatchSelector;
+	XMPPStanzaKind kind;
+	
+	if ([elementName isEqualToString:@"message"])
+	{
+		willReceiveSelector = @selector(xmppStream:willReceiveMessage:);
+		didReceiveSelector = @selector(xmppStream:didReceiveMessage:);
+		didReceiveBatchSelector = @selector(xmppStream:didReceiveMessages:);
+		kind = XMPPStanzaKindMessage;
+	}
+	else if ([elementName isEqualToString:@"presence"])
+	{
+		willReceiveSelector = @selector(xmppStream:willReceivePresence:);
+		didReceiveSelector = @selector(xmppStream:didReceivePresence:);
+		didReceiveBatchSelector = @selector(xmppStream:didReceivePresences:);
+		kind = XMPPStanzaKindPresence;
+	}
+	else
+	{
+		return YES;
+	}
+	
+	if ([multicastDelegate hasDelegateThatRespondsToSelector:willReceiveSelector]) return YES;
+	
+	if ([routingTable hasInterestsForKind:kind])
+	{
+		// Routed interests filter first.
+		// Once interests are registered for this kind of stanza, a stanza that can't match any of them isn't materialized,
+		// even though delegates without interests (e.g. stream management) implement the didReceive methods.
+		// They're sent xmppStreamDidFilterStanza: instead.
+		// 
+		// Only the from attribute is available prior to materialization.
+		// So interests that depend on the children of the stanza are assumed to match.
+		
+		NSString *fromStr = [arenaElement fromStr];
+		
+		return [routingTable mayMatchStanzaOfKind:kind from:(fromStr ? [XMPPJID jidWithString:fromStr] : nil)];
+	}
+	
+	return [multicastDelegate hasDelegateThatRespondsToSelector:didReceiveSelector] ||
+	       [multicastDelegate hasDelegateThatRespondsToSelector:didReceiveBatchSelector];
+}
+
 - (void)xmppParserDidParseData:(XMPPParser *)sender
 {
 	// This method is invoked on the xmppQueue.
@@ -2571,8 +4689,36 @@ enum XMPPStreamConfig
 	
 	XMPPLogTrace();
 	
+	if (pendingParseChunks > 0)
+		pendingParseChunks--;
+	
+	if (deliveryBatchLatency <= 0.0 && !deliveryBatchFlushScheduled)
+	{
+		[self flushDeliveryBatches];
+	}
+	
     // Continue reading for XML elements
-    [asyncSocket readDataWithTimeout:TIMEOUT_XMPP_READ_STREAM tag:TAG_XMPP_READ_STREAM];
+    [self maybeReadStreamData];
+}
+
+/**
+ * Issues the next socket read, unless one is already outstanding or the receive pipeline is full.
+ * 
+ * Each chunk read from the socket is handed to the parser, and counts against the receivePipelineDepth
+ * until the parser reports it has finished with it (xmppParserDidParseData:).
+ * With a depth of 1 this is the classic stop-and-wait loop.
+ * With a larger depth the socket keeps reading while the parser queue works through the backlog,
+ * and backpressure is only applied (by not reading) once the pipeline is full.
+**/
+- (void)maybeReadStreamData
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (parser == nil || isReadingStream) return;
+	if (pendingParseChunks >= receivePipelineDepth) return;
+	
+	isReadingStream = YES;
+	[asyncSocket readDataWithTimeout:TIMEOUT_XMPP_READ_STREAM tag:TAG_XMPP_READ_STREAM];
 }
 
 - (void)xmppParserDidEnd:(XMPPParser *)sender
@@ -2608,43 +4754,30 @@ enum XMPPStreamConfig
 	
 	XMPPLogTrace();
 	
-	if (keepAliveTimer)
-	{
-		dispatch_source_cancel(keepAliveTimer);
-		keepAliveTimer = NULL;
-	}
+	[keepAliveTimer cancel];
+	keepAliveTimer = nil;
 	
 	if (state == STATE_XMPP_CONNECTED)
 	{
 		if (keepAliveInterval > 0)
 		{
-			keepAliveTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, xmppQueue);
-			
-			dispatch_source_set_event_handler(keepAliveTimer, ^{ @autoreleasepool {
-				
-				[self keepAlive];
-			}});
+			// A single periodic timer, so it uses its own dispatch_source rather than the shared timing wheel.
 			
-			#if !OS_OBJECT_USE_OBJC
-			dispatch_source_t theKeepAliveTimer = keepAliveTimer;
+			__weak XMPPStream *weakSelf = self;
 			
-			dispatch_source_set_cancel_handler(keepAliveTimer, ^{
-				XMPPLogVerbose(@"dispatch_release(keepAliveTimer)");
-				dispatch_release(theKeepAliveTimer);
-			});
-			#endif
+			keepAliveTimer = [[XMPPTimer alloc] initWithQueue:xmppQueue eventHandler:^{ @autoreleasepool {
+				
+				[weakSelf keepAlive];
+			}}];
 			
 			// Everytime we send or receive data, we update our lastSendReceiveTime.
 			// We set our timer to fire several times per keepAliveInterval.
 			// This allows us to maintain a single timer,
 			// and an acceptable timer resolution (assuming larger keepAliveIntervals).
 			
-			uint64_t interval = ((keepAliveInterval / 4.0) * NSEC_PER_SEC);
+			NSTimeInterval interval = keepAliveInterval / 4.0;
 			
-			dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, interval);
-			
-			dispatch_source_set_timer(keepAliveTimer, tt, interval, 1.0);
-			dispatch_resume(keepAliveTimer);
+			[keepAliveTimer startWithTimeout:interval interval:interval];
 		}
 	}
 }
@@ -2662,9 +4795,7 @@ enum XMPPStreamConfig
 		{
 			numberOfBytesSent += [keepAliveData length];
 			
-			[asyncSocket writeData:keepAliveData
-			           withTimeout:TIMEOUT_XMPP_WRITE
-			                   tag:TAG_XMPP_WRITE_STREAM];
+			[self writeData:keepAliveData withTag:TAG_XMPP_WRITE_STREAM outputBuffer:nil];
 			
 			// Force update the lastSendReceiveTime here just to be safe.
 			// 
@@ -2977,6 +5108,15 @@ enum XMPPStreamConfig
 	return [[self class] generateUUID];
 }
 
+- (NSString *)generateElementID
+{
+	// This method may be invoked on any thread/queue.
+	
+	uint64_t counter = (uint64_t)OSAtomicIncrement64Barrier(&elementIDCounter);
+	
+	return [XMPPIDTracker compactIDWithValue:(elementIDBase | (counter & 0xFFFFFFFFFFULL))];
+}
+
 /** Allocates and configures a new socket */
 - (GCDAsyncSocket*) newSocket {
     GCDAsyncSocket *socket = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:xmppQueue];
@@ -2990,6 +5130,327 @@ enum XMPPStreamConfig
 #pragma mark -
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+@implementation XMPPDeliveryBatch
+
+- (void)dealloc
+{
+	#if !OS_OBJECT_USE_OBJC
+	if (delegateQueue)
+		dispatch_release(delegateQueue);
+	#endif
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPPendingWrite
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPSendCompletion
+
+- (id)initWithQueue:(dispatch_queue_t)queue
+{
+	if ((self = [super init]))
+	{
+		if (queue)
+		{
+			completionQueue = queue;
+			#if !OS_OBJECT_USE_OBJC
+			dispatch_retain(completionQueue);
+			#endif
+		}
+		else
+		{
+			completionQueue = dispatch_get_main_queue();
+		}
+	}
+	return self;
+}
+
+- (void)signalSuccess
+{
+	numberOfSentElements++;
+	[self signalAny];
+}
+
+- (void)signalFailure
+{
+	[self signalAny];
+}
+
+- (void)signalAny
+{
+	// All signals are delivered on the xmppQueue, so no synchronization is needed here.
+	
+	if (numberOfPendingElements == 0) return;
+	if (--numberOfPendingElements > 0) return;
+	
+	XMPPSendCompletionBlock block = completionBlock;
+	XMPPBatchSendCompletionBlock batchBlock = batchCompletionBlock;
+	NSUInteger sent = numberOfSentElements;
+	
+	completionBlock = nil;
+	batchCompletionBlock = nil;
+	
+	dispatch_async(completionQueue, ^{ @autoreleasepool {
+		
+		if (block)
+			block(sent > 0);
+		else if (batchBlock)
+			batchBlock(sent);
+	}});
+}
+
+- (void)dealloc
+{
+	#if !OS_OBJECT_USE_OBJC
+	if (completionQueue != dispatch_get_main_queue())
+		dispatch_release(completionQueue);
+	#endif
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPSendReceiptRing
+{
+	void **slots;          // Retained observers (or NULL), indexed by (sequence & (capacity - 1))
+	NSUInteger capacity;   // Always a power of 2
+	NSUInteger head;       // The oldest sequence number that may still be pending
+	NSUInteger next;       // The sequence number of the next observer
+}
+
+- (id)init
+{
+	return [self initWithSequence:0];
+}
+
+- (id)initWithSequence:(NSUInteger)sequence
+{
+	if ((self = [super init]))
+	{
+		capacity = XMPP_RECEIPT_RING_MIN_CAPACITY;
+		slots = calloc(capacity, sizeof(void *));
+		
+		head = sequence;
+		next = sequence;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	for (NSUInteger seq = head; seq != next; seq++)
+	{
+		void *slot = slots[seq & (capacity - 1)];
+		if (slot) CFRelease(slot);
+	}
+	
+	free(slots);
+}
+
+- (void)grow
+{
+	NSAssert(capacity <= (XMPP_RECEIPT_SEQUENCE_MASK >> 1), @"Receipt ring overflow");
+	
+	NSUInteger newCapacity = capacity * 2;
+	void **newSlots = calloc(newCapacity, sizeof(void *));
+	
+	for (NSUInteger seq = head; seq != next; seq++)
+	{
+		newSlots[seq & (newCapacity - 1)] = slots[seq & (capacity - 1)];
+	}
+	
+	free(slots);
+	slots = newSlots;
+	capacity = newCapacity;
+}
+
+- (long)addObserver:(id <XMPPSendObserver>)observer
+{
+	if ((next - head) == capacity)
+	{
+		[self grow];
+	}
+	
+	NSUInteger seq = next++;
+	slots[seq & (capacity - 1)] = (void *)CFBridgingRetain(observer);
+	
+	return TAG_XMPP_WRITE_RECEIPT_BASE + (long)(seq & XMPP_RECEIPT_SEQUENCE_MASK);
+}
+
+- (id <XMPPSendObserver>)removeObserverForTag:(long)tag
+{
+	// The tag only carries the lower bits of the sequence number.
+	// Reconstruct the full sequence number relative to the head, and ignore stale tags.
+	
+	NSUInteger tagSeq = (NSUInteger)(tag - TAG_XMPP_WRITE_RECEIPT_BASE);
+	NSUInteger seq = head + ((tagSeq - head) & XMPP_RECEIPT_SEQUENCE_MASK);
+	
+	if ((seq - head) >= (next - head)) return nil;
+	
+	NSUInteger index = seq & (capacity - 1);
+	void *slot = slots[index];
+	
+	if (slot == NULL) return nil;
+	
+	slots[index] = NULL;
+	
+	while (head != next && slots[head & (capacity - 1)] == NULL)
+	{
+		head++;
+	}
+	
+	return CFBridgingRelease(slot);
+}
+
+- (NSArray *)removeAllObservers
+{
+	NSMutableArray *observers = [NSMutableArray arrayWithCapacity:(next - head)];
+	
+	for (NSUInteger seq = head; seq != next; seq++)
+	{
+		NSUInteger index = seq & (capacity - 1);
+		
+		if (slots[index])
+		{
+			[observers addObject:CFBridgingRelease(slots[index])];
+			slots[index] = NULL;
+		}
+	}
+	
+	head = next;
+	
+	return observers;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPPendingWriteQueue
+{
+	void **slots;          // Retained writes, indexed by ((head + i) & (capacity - 1))
+	NSUInteger capacity;   // Always a power of 2
+	NSUInteger head;
+	NSUInteger count;
+}
+
+@synthesize count;
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		capacity = XMPP_WRITE_QUEUE_MIN_CAPACITY;
+		slots = calloc(capacity, sizeof(void *));
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		CFRelease(slots[(head + i) & (capacity - 1)]);
+	}
+	
+	free(slots);
+}
+
+- (void)grow
+{
+	NSUInteger newCapacity = capacity * 2;
+	void **newSlots = calloc(newCapacity, sizeof(void *));
+	
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		newSlots[i] = slots[(head + i) & (capacity - 1)];
+	}
+	
+	free(slots);
+	slots = newSlots;
+	capacity = newCapacity;
+	head = 0;
+}
+
+- (void)addWrite:(XMPPPendingWrite *)write
+{
+	if (count == capacity)
+	{
+		[self grow];
+	}
+	
+	slots[(head + count) & (capacity - 1)] = (void *)CFBridgingRetain(write);
+	count++;
+}
+
+- (XMPPPendingWrite *)firstWrite
+{
+	if (count == 0) return nil;
+	
+	return (__bridge XMPPPendingWrite *)slots[head];
+}
+
+- (XMPPPendingWrite *)removeFirstWrite
+{
+	if (count == 0) return nil;
+	
+	void *slot = slots[head];
+	slots[head] = NULL;
+	
+	head = (head + 1) & (capacity - 1);
+	count--;
+	
+	return CFBridgingRelease(slot);
+}
+
+- (NSArray *)removeAllWrites
+{
+	NSMutableArray *writes = [NSMutableArray arrayWithCapacity:count];
+	
+	while (count > 0)
+	{
+		[writes addObject:[self removeFirstWrite]];
+	}
+	
+	return writes;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPIQHandlerEntry
+
+- (void)dealloc
+{
+	#if !OS_OBJECT_USE_OBJC
+	if (handlerQueue)
+		dispatch_release(handlerQueue);
+	#endif
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 @implementation XMPPElementReceipt
 
 static const uint32_t receipt_unknown = 0 << 0;
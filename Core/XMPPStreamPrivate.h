@@ -0,0 +1,105 @@
+//
+//  This file is for XMPPStream and its tests.
+//
+
+#import <Foundation/Foundation.h>
+#import "XMPPStream.h"
+
+@class XMPPOutputBuffer;
+
+// Define the initial capacity of a write queue (must be a power of 2)
+#define XMPP_WRITE_QUEUE_MIN_CAPACITY  16
+
+// Writes that carry a receipt (or completion handler) are tagged with their sequence number (within the receipt ring),
+// offset by this base. Only the lower 30 bits of the sequence number are used, so the tag always fits in a long.
+#define TAG_XMPP_WRITE_RECEIPT_BASE     (1L << 16)
+#define XMPP_RECEIPT_SEQUENCE_MASK      ((NSUInteger)0x3FFFFFFF)
+#define XMPP_RECEIPT_RING_MIN_CAPACITY  16
+
+/**
+ * A single write to the socket (either queued, or in flight).
+ * A corked write carries the tags of all the stanzas it contains.
+ * A queued write carries its element, as the didSend delegate methods are only invoked once it's dequeued.
+**/
+@interface XMPPPendingWrite : NSObject
+{
+  @public
+	NSData *data;
+	XMPPOutputBuffer *outputBuffer;
+	long tag;
+	NSArray *stanzaTags;
+	NSXMLElement *element;
+	XMPPSendPriority priority;
+}
+@end
+
+/**
+ * A FIFO of writes.
+ * 
+ * A ring that grows as needed, so adding and removing writes is O(1) (amortized).
+**/
+@interface XMPPPendingWriteQueue : NSObject
+
+@property (nonatomic, readonly) NSUInteger count;
+
+- (void)addWrite:(XMPPPendingWrite *)write;
+
+/**
+ * Returns the oldest write (or nil if the queue is empty), without removing it.
+**/
+- (XMPPPendingWrite *)firstWrite;
+
+/**
+ * Removes and returns the oldest write (or nil if the queue is empty).
+**/
+- (XMPPPendingWrite *)removeFirstWrite;
+
+/**
+ * Removes and returns all writes, oldest first.
+**/
+- (NSArray *)removeAllWrites;
+
+@end
+
+/**
+ * Anything waiting for an element to be written to the socket.
+ * (An XMPPElementReceipt, or a completion handler.)
+**/
+@protocol XMPPSendObserver <NSObject>
+
+- (void)signalSuccess;
+- (void)signalFailure;
+
+@end
+
+/**
+ * The send observers awaiting the write of their element, keyed by sequence number.
+ * 
+ * Observers are added in send order, but may resolve in any order
+ * (the send queue may reorder elements of different classes, and filters may drop elements).
+ * The ring grows as needed, and each operation is O(1) (amortized).
+**/
+@interface XMPPSendReceiptRing : NSObject
+
+/**
+ * The first observer gets the given sequence number (zero with init).
+ * Only the lower bits of the sequence number make it into the write tags, which wrap around accordingly.
+**/
+- (id)initWithSequence:(NSUInteger)sequence;
+
+/**
+ * Adds the observer, and returns the write tag for its element.
+**/
+- (long)addObserver:(id <XMPPSendObserver>)observer;
+
+/**
+ * Removes and returns the observer for the given write tag (or nil if it's no longer pending).
+**/
+- (id <XMPPSendObserver>)removeObserverForTag:(long)tag;
+
+/**
+ * Removes and returns all pending observers, in send order.
+**/
+- (NSArray *)removeAllObservers;
+
+@end
@@ -13,6 +13,7 @@
 #import "idn-int.h"
 #import "NSNumber+XMPP.h"
 #import "NSData+XMPP.h"
+#import "XMPPTimer.h"
 
 #if DEBUG
 static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN; // XMPP_LOG_LEVEL_VERBOSE | XMPP_LOG_FLAG_TRACE;
@@ -59,7 +60,7 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
   NSUInteger _totalDataSize;
   NSUInteger _receivedDataSize;
 
-  dispatch_source_t _ibbTimer;
+  XMPPTimer *_ibbTimer;
 }
 
 @end
@@ -89,12 +90,8 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
     XMPPLogWarn(@"%@: Deallocating prior to completion or cancellation.", THIS_FILE);
   }
 
-  if (_ibbTimer)
-    dispatch_source_cancel(_ibbTimer);
-#if !OS_OBJECT_USE_OBJC
-  dispatch_release(_ibbTimer);
-  #endif
-  _ibbTimer = NULL;
+  [_ibbTimer cancel];
+  _ibbTimer = nil;
 
   if (_asyncSocket.delegate == self) {
     [_asyncSocket setDelegate:nil delegateQueue:NULL];
@@ -532,38 +529,29 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
 {
   NSAssert(dispatch_get_specific(moduleQueueTag), @"Invoked on incorrect queue.");
 
-  if (_ibbTimer == NULL) {
-    _ibbTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, moduleQueue);
+  // The timer is reset for every chunk, and rarely fires, so it's scheduled on the shared timing wheel.
 
-    dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, timeout * NSEC_PER_SEC);
+  if (_ibbTimer == nil) {
+    _ibbTimer = [[XMPPTimer alloc] initWithQueue:moduleQueue timingWheel:nil eventHandler:^{
+        @autoreleasepool {
+          NSString *errMsg = @"The IBB transfer timed out. It's likely that the sender canceled the"
+              @" transfer or has gone offline.";
+          [self failWithReason:errMsg error:nil];
+        }
+    }];
 
-    dispatch_source_set_timer(_ibbTimer, tt, DISPATCH_TIME_FOREVER, 1);
-    dispatch_resume(_ibbTimer);
+    [_ibbTimer startWithTimeout:timeout interval:0];
   } else {
-    dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, timeout * NSEC_PER_SEC);
-    dispatch_source_set_timer(_ibbTimer, tt, DISPATCH_TIME_FOREVER, 1);
+    [_ibbTimer updateTimeout:timeout fromOriginalStartTime:NO];
   }
-
-  dispatch_source_set_event_handler(_ibbTimer, ^{
-      @autoreleasepool {
-        NSString *errMsg = @"The IBB transfer timed out. It's likely that the sender canceled the"
-            @" transfer or has gone offline.";
-        [self failWithReason:errMsg error:nil];
-      }
-  });
 }
 
 - (void)cancelIBBTimer
 {
   NSAssert(dispatch_get_specific(moduleQueueTag), @"Invoked on incorrect queue.");
 
-  if (_ibbTimer) {
-    dispatch_source_cancel(_ibbTimer);
-#if !OS_OBJECT_USE_OBJC
-    dispatch_release(_ibbTimer);
-    #endif
-    _ibbTimer = NULL;
-  }
+  [_ibbTimer cancel];
+  _ibbTimer = nil;
 }
 
 
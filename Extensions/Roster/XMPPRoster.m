@@ -715,7 +715,7 @@ enum XMPPRosterFlags
         if (version)
             [query addAttributeWithName:@"ver" stringValue:version];
 		
-		XMPPIQ *iq = [XMPPIQ iqWithType:@"get" elementID:[xmppStream generateUUID]];
+		XMPPIQ *iq = [XMPPIQ iqWithType:@"get" elementID:[xmppStream generateElementID]];
 		[iq addChild:query];
         
         [xmppIDTracker addElement:iq
@@ -11,6 +11,7 @@
 #import "XMPPIQ+JabberRPCResonse.h"
 #import "XMPPLogging.h"
 #import "XMPPFramework.h"
+#import "XMPPTimer.h"
 
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
@@ -33,13 +34,13 @@ NSString *const XMPPJabberRPCErrorDomain = @"XMPPJabberRPCErrorDomain";
 @interface RPCID : NSObject
 {
 	NSString *rpcID;
-	dispatch_source_t timer;
+	XMPPTimer *timer;
 }
 
 @property (nonatomic, readonly) NSString *rpcID;
-@property (nonatomic, readonly) dispatch_source_t timer;
+@property (nonatomic, readonly) XMPPTimer *timer;
 
-- (id)initWithRpcID:(NSString *)rpcID timer:(dispatch_source_t)timer;
+- (id)initWithRpcID:(NSString *)rpcID timer:(XMPPTimer *)timer;
 
 - (void)cancelTimer;
 
@@ -50,16 +51,12 @@ NSString *const XMPPJabberRPCErrorDomain = @"XMPPJabberRPCErrorDomain";
 @synthesize rpcID;
 @synthesize timer;
 
-- (id)initWithRpcID:(NSString *)aRpcID timer:(dispatch_source_t)aTimer
+- (id)initWithRpcID:(NSString *)aRpcID timer:(XMPPTimer *)aTimer
 {
 	if ((self = [super init]))
 	{
 		rpcID = [aRpcID copy];
-		
 		timer = aTimer;
-		#if !OS_OBJECT_USE_OBJC
-		dispatch_retain(timer);
-		#endif
 	}
 	return self;
 }
@@ -76,14 +73,8 @@ NSString *const XMPPJabberRPCErrorDomain = @"XMPPJabberRPCErrorDomain";
 
 - (void)cancelTimer
 {
-	if (timer)
-	{
-		dispatch_source_cancel(timer);
-		#if !OS_OBJECT_USE_OBJC
-		dispatch_release(timer);
-		#endif
-		timer = NULL;
-	}
+	[timer cancel];
+	timer = nil;
 }
 
 - (void)dealloc
@@ -200,17 +191,14 @@ NSString *const XMPPJabberRPCErrorDomain = @"XMPPJabberRPCErrorDomain";
 	
 	NSString *elementID = [iq elementID];
 	
-	dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, moduleQueue);
+	// The timer is scheduled on the shared timing wheel, as most calls are answered long before they time out.
 	
-	dispatch_source_set_event_handler(timer, ^{ @autoreleasepool {
+	XMPPTimer *timer = [[XMPPTimer alloc] initWithQueue:moduleQueue timingWheel:nil eventHandler:^{ @autoreleasepool {
 		
-			[self timeoutRemoveRpcID:elementID];
-	}});
-	
-	dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (timeout * NSEC_PER_SEC));
+		[self timeoutRemoveRpcID:elementID];
+	}}];
 	
-	dispatch_source_set_timer(timer, tt, DISPATCH_TIME_FOREVER, 0);
-	dispatch_resume(timer);
+	[timer startWithTimeout:timeout interval:0];
 	
 	RPCID *rpcID = [[RPCID alloc] initWithRpcID:elementID timer:timer];
 	
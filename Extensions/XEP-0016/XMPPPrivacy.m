@@ -2,6 +2,7 @@
 #import "XMPPLogging.h"
 #import "XMPPPrivacy.h"
 #import "NSNumber+XMPP.h"
+#import "XMPPTimer.h"
 
 // Log levels: off, error, warn, info, verbose
 // Log flags: trace
@@ -34,14 +35,14 @@ typedef enum XMPPPrivacyQueryInfoType {
 	NSString *privacyListName;
 	NSArray *privacyListItems;
 	
-	dispatch_source_t timer;
+	XMPPTimer *timer;
 }
 
 @property (nonatomic, readonly) XMPPPrivacyQueryInfoType type;
 @property (nonatomic, readonly) NSString *privacyListName;
 @property (nonatomic, readonly) NSArray *privacyListItems;
 
-@property (nonatomic, readwrite) dispatch_source_t timer;
+@property (nonatomic, strong, readwrite) XMPPTimer *timer;
 
 - (void)cancel;
 
@@ -466,18 +467,14 @@ typedef enum XMPPPrivacyQueryInfoType {
 - (void)addQueryInfo:(XMPPPrivacyQueryInfo *)queryInfo withKey:(NSString *)uuid
 {
 	// Setup timer
+	// (on the shared timing wheel, as queries are usually answered long before they time out)
 	
-	dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, moduleQueue);
-	
-	dispatch_source_set_event_handler(timer, ^{ @autoreleasepool {
+	XMPPTimer *timer = [[XMPPTimer alloc] initWithQueue:moduleQueue timingWheel:nil eventHandler:^{ @autoreleasepool {
 		
 		[self queryTimeout:uuid];
-	}});
-	
-	dispatch_time_t fireTime = dispatch_time(DISPATCH_TIME_NOW, (QUERY_TIMEOUT * NSEC_PER_SEC));
+	}}];
 	
-	dispatch_source_set_timer(timer, fireTime, DISPATCH_TIME_FOREVER, 1.0);
-	dispatch_resume(timer);
+	[timer startWithTimeout:QUERY_TIMEOUT interval:0];
 	
 	queryInfo.timer = timer;
 	
@@ -968,14 +965,8 @@ NSInteger sortItems(id itemOne, id itemTwo, void *context)
 
 - (void)cancel
 {
-	if (timer)
-	{
-		dispatch_source_cancel(timer);
-		#if !OS_OBJECT_USE_OBJC
-		dispatch_release(timer);
-		#endif
-		timer = NULL;
-	}
+	[timer cancel];
+	timer = nil;
 }
 
 - (void)dealloc
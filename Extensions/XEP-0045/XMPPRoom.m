@@ -82,6 +82,16 @@ enum XMPPRoomState
 	{
 		responseTracker = [[XMPPIDTracker alloc] initWithDispatchQueue:moduleQueue];
 		
+		// We only care about messages and presences from our room.
+		// The interest is dropped automatically when super's deactivate removes us as a delegate.
+		
+		XMPPStanzaInterest *roomInterest =
+		    [XMPPStanzaInterest interestInKind:(XMPPStanzaKindMessage | XMPPStanzaKindPresence)
+		                               fromJID:roomJID
+		                               options:XMPPJIDCompareBare];
+		
+		[xmppStream addStanzaInterest:roomInterest forDelegate:self];
+		
 		return YES;
 	}
 	
@@ -359,7 +369,7 @@ enum XMPPRoomState
 		//   <query xmlns='http://jabber.org/protocol/muc#owner'/>
 		// </iq>
 		
-		NSString *fetchID = [xmppStream generateUUID];
+		NSString *fetchID = [xmppStream generateElementID];
 		
 		NSXMLElement *query = [NSXMLElement elementWithName:@"query" xmlns:XMPPMUCOwnerNamespace];
 		XMPPIQ *iq = [XMPPIQ iqWithType:@"get" to:roomJID elementID:fetchID child:query];
@@ -428,7 +438,7 @@ enum XMPPRoomState
 			NSXMLElement *query = [NSXMLElement elementWithName:@"query" xmlns:XMPPMUCOwnerNamespace];
 			[query addChild:x];
 			
-			NSString *iqID = [xmppStream generateUUID];
+			NSString *iqID = [xmppStream generateElementID];
 			
 			XMPPIQ *iq = [XMPPIQ iqWithType:@"set" to:roomJID elementID:iqID child:query];
 			
@@ -458,7 +468,7 @@ enum XMPPRoomState
 			NSXMLElement *query = [NSXMLElement elementWithName:@"query" xmlns:XMPPMUCOwnerNamespace];
 			[query addChild:x];
 			
-			NSString *iqID = [xmppStream generateUUID];
+			NSString *iqID = [xmppStream generateElementID];
 			
 			XMPPIQ *iq = [XMPPIQ iqWithType:@"set" to:roomJID elementID:iqID child:query];
 			
@@ -536,7 +546,7 @@ enum XMPPRoomState
 		//   </query>
 		// </iq>
 		
-		NSString *fetchID = [xmppStream generateUUID];
+		NSString *fetchID = [xmppStream generateElementID];
 		
 		NSXMLElement *item = [NSXMLElement elementWithName:@"item"];
 		[item addAttributeWithName:@"affiliation" stringValue:@"outcast"];
@@ -597,7 +607,7 @@ enum XMPPRoomState
 		//   </query>
 		// </iq>
 		
-		NSString *fetchID = [xmppStream generateUUID];
+		NSString *fetchID = [xmppStream generateElementID];
 		
 		NSXMLElement *item = [NSXMLElement elementWithName:@"item"];
 		[item addAttributeWithName:@"affiliation" stringValue:@"member"];
@@ -658,7 +668,7 @@ enum XMPPRoomState
 		//   </query>
 		// </iq>
 		
-		NSString *fetchID = [xmppStream generateUUID];
+		NSString *fetchID = [xmppStream generateElementID];
 		
 		NSXMLElement *item = [NSXMLElement elementWithName:@"item"];
 		[item addAttributeWithName:@"role" stringValue:@"moderator"];
@@ -697,7 +707,7 @@ enum XMPPRoomState
 
 - (NSString *)editRoomPrivileges:(NSArray *)items
 {
-	NSString *iqID = [xmppStream generateUUID];
+	NSString *iqID = [xmppStream generateElementID];
 	
 	dispatch_block_t block = ^{ @autoreleasepool {
 		
@@ -798,7 +808,7 @@ enum XMPPRoomState
 		NSXMLElement *query = [NSXMLElement elementWithName:@"query" xmlns:XMPPMUCOwnerNamespace];
 		[query addChild:destroy];
 		
-		NSString *iqID = [xmppStream generateUUID];
+		NSString *iqID = [xmppStream generateElementID];
 		
 		XMPPIQ *iq = [XMPPIQ iqWithType:@"set" to:roomJID elementID:iqID child:query];
 		
@@ -186,7 +186,7 @@
 
         XMPPvCardTemp *newvCardTemp = [vCardTemp copy];
         
-        XMPPIQ *iq = [XMPPIQ iqWithType:@"set" to:nil elementID:[xmppStream generateUUID] child:newvCardTemp];
+        XMPPIQ *iq = [XMPPIQ iqWithType:@"set" to:nil elementID:[xmppStream generateElementID] child:newvCardTemp];
         [xmppStream sendElement:iq];
         
         [_myvCardTracker addElement:iq
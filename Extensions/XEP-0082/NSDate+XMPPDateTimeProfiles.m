@@ -15,10 +15,6 @@
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
 #endif
 
-@interface NSDate(XMPPDateTimeProfilesPrivate)
-- (NSString *)xmppStringWithDateFormat:(NSString *)dateFormat;
-@end
-
 #pragma mark -
 
 @implementation NSDate(XMPPDateTimeProfiles)
@@ -46,34 +42,17 @@
 
 
 - (NSString *)xmppDateString {	
-	return [self xmppStringWithDateFormat:@"yyyy-MM-dd"];
+	return [XMPPDateTimeProfiles dateStringWithTimeInterval:[self timeIntervalSinceReferenceDate]];
 }
 
 
 - (NSString *)xmppTimeString {
-	return [self xmppStringWithDateFormat:@"HH:mm:ss'Z'"];
+	return [XMPPDateTimeProfiles timeStringWithTimeInterval:[self timeIntervalSinceReferenceDate]];
 }
 
 
 - (NSString *)xmppDateTimeString {
-	return [self xmppStringWithDateFormat:@"yyyy-MM-dd'T'HH:mm:ss'Z'"];
-}
-
-
-#pragma mark XMPPDateTimeProfilesPrivate methods
-
-
-- (NSString *)xmppStringWithDateFormat:(NSString *)dateFormat
-{
-	NSDateFormatter *dateFormatter = [[NSDateFormatter alloc] init];
-	[dateFormatter setFormatterBehavior:NSDateFormatterBehavior10_4];
-    [dateFormatter setLocale:[[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"]];
-	[dateFormatter setDateFormat:dateFormat];
-	[dateFormatter setTimeZone:[NSTimeZone timeZoneForSecondsFromGMT:0]];
-	
-	NSString *str = [dateFormatter stringFromDate:self];
-	
-	return str;
+	return [XMPPDateTimeProfiles dateTimeStringWithTimeInterval:[self timeIntervalSinceReferenceDate]];
 }
 
 
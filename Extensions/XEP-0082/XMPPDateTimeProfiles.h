@@ -12,6 +12,30 @@
 + (NSDate *)parseTime:(NSString *)timeStr;
 + (NSDate *)parseDateTime:(NSString *)dateTimeStr;
 
+/**
+ * Same as above, but produce a time interval (since the reference date, i.e. NSDate's timeIntervalSinceReferenceDate)
+ * instead of a date object. They return NO if the given string doesn't follow the spec.
+ * 
+ * These methods parse the string directly, without using date formatters,
+ * and are therefore suitable for hot paths (e.g. parsing the delay stamps of a large history sync).
+**/
+
++ (BOOL)parseDate:(NSString *)dateStr timeInterval:(NSTimeInterval *)tiPtr;
++ (BOOL)parseTime:(NSString *)timeStr timeInterval:(NSTimeInterval *)tiPtr;
++ (BOOL)parseDateTime:(NSString *)dateTimeStr timeInterval:(NSTimeInterval *)tiPtr;
+
 + (NSTimeZone *)parseTimeZoneOffset:(NSString *)tzo;
 
+/**
+ * The following methods format the given time interval (since the reference date) following XEP-0082, in UTC.
+ * 
+ * dateString     : CCYY-MM-DD
+ * timeString     : hh:mm:ssZ
+ * dateTimeString : CCYY-MM-DDThh:mm:ssZ
+**/
+
++ (NSString *)dateStringWithTimeInterval:(NSTimeInterval)ti;
++ (NSString *)timeStringWithTimeInterval:(NSTimeInterval)ti;
++ (NSString *)dateTimeStringWithTimeInterval:(NSTimeInterval)ti;
+
 @end
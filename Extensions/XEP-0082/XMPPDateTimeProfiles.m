@@ -5,11 +5,234 @@
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
 #endif
 
-static NSString * const kXEP0082SharedDateFormatterKey = @"xep0082_shared_date_formatter_key";
+// Seconds between the unix epoch (1970-01-01) and the reference date (2001-01-01)
+#define XMPP_REFERENCE_DATE_UNIX_OFFSET 978307200.0
 
-@interface XMPPDateTimeProfiles (PrivateAPI)
-+ (NSDate *)parseDateTime:(NSString *)dateTimeStr withMandatoryTimeZone:(BOOL)mandatoryTZ;
-@end
+#define XMPP_SECONDS_PER_DAY 86400
+
+/**
+ * The parsing below reads the characters straight out of the string (via an inline buffer),
+ * and computes the time interval arithmetically, without any date formatters, calendars or temporary strings.
+**/
+
+typedef struct {
+	CFStringInlineBuffer buffer;
+	CFIndex length;
+	CFIndex index;
+} XMPPDateTimeScanner;
+
+static inline void XMPPDateTimeScannerInit(XMPPDateTimeScanner *scanner, NSString *str)
+{
+	scanner->length = (CFIndex)[str length];
+	scanner->index = 0;
+	CFStringInitInlineBuffer((__bridge CFStringRef)str, &scanner->buffer, CFRangeMake(0, scanner->length));
+}
+
+static inline BOOL XMPPDateTimeScanChar(XMPPDateTimeScanner *scanner, unichar c)
+{
+	if (scanner->index >= scanner->length) return NO;
+	if (CFStringGetCharacterFromInlineBuffer(&scanner->buffer, scanner->index) != c) return NO;
+	
+	scanner->index++;
+	return YES;
+}
+
+static inline BOOL XMPPDateTimeScanDigits(XMPPDateTimeScanner *scanner, int count, int *value)
+{
+	if (scanner->index + count > scanner->length) return NO;
+	
+	int result = 0;
+	for (int i = 0; i < count; i++)
+	{
+		unichar c = CFStringGetCharacterFromInlineBuffer(&scanner->buffer, scanner->index + i);
+		if (c < '0' || c > '9') return NO;
+		
+		result = (result * 10) + (c - '0');
+	}
+	
+	scanner->index += count;
+	*value = result;
+	return YES;
+}
+
+static inline BOOL XMPPIsLeapYear(int year)
+{
+	return ((year % 4 == 0) && (year % 100 != 0)) || (year % 400 == 0);
+}
+
+static inline int XMPPDaysInMonth(int year, int month)
+{
+	static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	
+	return (month == 2 && XMPPIsLeapYear(year)) ? 29 : days[month - 1];
+}
+
+/**
+ * Returns the number of days since 1970-01-01 for the given (proleptic Gregorian) date.
+ * See Howard Hinnant's "chrono-Compatible Low-Level Date Algorithms".
+**/
+static int64_t XMPPDaysFromCivil(int year, int month, int day)
+{
+	year -= (month <= 2);
+	
+	int64_t era = (year >= 0 ? year : year - 399) / 400;
+	int64_t yoe = year - (era * 400);
+	int64_t doy = ((153 * (month + (month > 2 ? -3 : 9)) + 2) / 5) + day - 1;
+	int64_t doe = (yoe * 365) + (yoe / 4) - (yoe / 100) + doy;
+	
+	return (era * 146097) + doe - 719468;
+}
+
+/**
+ * The inverse of XMPPDaysFromCivil.
+**/
+static void XMPPCivilFromDays(int64_t days, int *year, int *month, int *day)
+{
+	days += 719468;
+	
+	int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	int64_t doe = days - (era * 146097);
+	int64_t yoe = (doe - (doe / 1460) + (doe / 36524) - (doe / 146096)) / 365;
+	int64_t doy = doe - ((365 * yoe) + (yoe / 4) - (yoe / 100));
+	int64_t mp = ((5 * doy) + 2) / 153;
+	
+	int d = (int)(doy - (((153 * mp) + 2) / 5) + 1);
+	int m = (int)(mp < 10 ? mp + 3 : mp - 9);
+	
+	*year = (int)(yoe + (era * 400) + (m <= 2));
+	*month = m;
+	*day = d;
+}
+
+/**
+ * Scans CCYY-MM-DD, and returns the number of days since 1970-01-01.
+**/
+static BOOL XMPPDateTimeScanDate(XMPPDateTimeScanner *scanner, int64_t *days)
+{
+	int year, month, day;
+	
+	if (!XMPPDateTimeScanDigits(scanner, 4, &year)) return NO;
+	if (!XMPPDateTimeScanChar(scanner, '-')) return NO;
+	if (!XMPPDateTimeScanDigits(scanner, 2, &month)) return NO;
+	if (!XMPPDateTimeScanChar(scanner, '-')) return NO;
+	if (!XMPPDateTimeScanDigits(scanner, 2, &day)) return NO;
+	
+	if (month < 1 || month > 12) return NO;
+	if (day < 1 || day > XMPPDaysInMonth(year, month)) return NO;
+	
+	*days = XMPPDaysFromCivil(year, month, day);
+	return YES;
+}
+
+/**
+ * Scans hh:mm:ss[.sss][TZD] up to the end of the string.
+ * The offset is the number of seconds to add to the local time to get UTC.
+**/
+static BOOL XMPPDateTimeScanTime(XMPPDateTimeScanner *scanner,
+                                 NSTimeInterval *secondsOfDay,
+                                 BOOL *hasTimeZone,
+                                 int *utcOffset)
+{
+	int hours, minutes, seconds;
+	
+	if (!XMPPDateTimeScanDigits(scanner, 2, &hours)) return NO;
+	if (!XMPPDateTimeScanChar(scanner, ':')) return NO;
+	if (!XMPPDateTimeScanDigits(scanner, 2, &minutes)) return NO;
+	if (!XMPPDateTimeScanChar(scanner, ':')) return NO;
+	if (!XMPPDateTimeScanDigits(scanner, 2, &seconds)) return NO;
+	
+	if (hours > 23 || minutes > 59 || seconds > 59) return NO;
+	
+	NSTimeInterval fraction = 0.0;
+	
+	if (XMPPDateTimeScanChar(scanner, '.'))
+	{
+		// The fraction MAY contain any number of digits, but at least one
+		
+		NSTimeInterval scale = 0.1;
+		int digit;
+		int count = 0;
+		
+		while (XMPPDateTimeScanDigits(scanner, 1, &digit))
+		{
+			fraction += digit * scale;
+			scale /= 10.0;
+			count++;
+		}
+		
+		if (count == 0) return NO;
+	}
+	
+	*secondsOfDay = (hours * 3600) + (minutes * 60) + seconds + fraction;
+	*hasTimeZone = NO;
+	*utcOffset = 0;
+	
+	if (XMPPDateTimeScanChar(scanner, 'Z'))
+	{
+		*hasTimeZone = YES;
+	}
+	else if (scanner->index < scanner->length)
+	{
+		unichar sign = CFStringGetCharacterFromInlineBuffer(&scanner->buffer, scanner->index);
+		if (sign != '+' && sign != '-') return NO;
+		
+		scanner->index++;
+		
+		int tzHours, tzMinutes;
+		
+		if (!XMPPDateTimeScanDigits(scanner, 2, &tzHours)) return NO;
+		if (!XMPPDateTimeScanChar(scanner, ':')) return NO;
+		if (!XMPPDateTimeScanDigits(scanner, 2, &tzMinutes)) return NO;
+		
+		if (tzHours > 23 || tzMinutes > 59) return NO;
+		
+		int offset = (tzHours * 3600) + (tzMinutes * 60);
+		
+		// A local time of 21:56-05:00 is 02:56 UTC
+		*utcOffset = (sign == '-') ? offset : -offset;
+		*hasTimeZone = YES;
+	}
+	
+	return (scanner->index == scanner->length);
+}
+
+/**
+ * Converts a wall clock time in the default time zone (expressed as if it were UTC) into an actual time interval.
+ * 
+ * Near a DST transition the wall clock time may occur twice, or (inside the gap) not at all.
+ * Like NSDateFormatter, we then use the later instant, i.e. the one using the offset from before the transition.
+**/
+static NSTimeInterval XMPPTimeIntervalFromLocalWallClock(NSTimeInterval wallClock)
+{
+	NSTimeZone *tz = [NSTimeZone defaultTimeZone];
+	
+	// The actual instant is within a day of the wall clock time (as UTC),
+	// so the offsets a day either side cover any transition near it.
+	
+	NSDate *dayBefore = [NSDate dateWithTimeIntervalSinceReferenceDate:(wallClock - XMPP_SECONDS_PER_DAY)];
+	NSDate *dayAfter  = [NSDate dateWithTimeIntervalSinceReferenceDate:(wallClock + XMPP_SECONDS_PER_DAY)];
+	
+	NSInteger offsetBefore = [tz secondsFromGMTForDate:dayBefore];
+	NSInteger offsetAfter  = [tz secondsFromGMTForDate:dayAfter];
+	
+	NSTimeInterval resultBefore = wallClock - offsetBefore;
+	NSTimeInterval resultAfter  = wallClock - offsetAfter;
+	
+	if (offsetBefore == offsetAfter) return resultBefore;
+	
+	BOOL validBefore = ([tz secondsFromGMTForDate:[NSDate dateWithTimeIntervalSinceReferenceDate:resultBefore]] == offsetBefore);
+	BOOL validAfter  = ([tz secondsFromGMTForDate:[NSDate dateWithTimeIntervalSinceReferenceDate:resultAfter]]  == offsetAfter);
+	
+	if (validBefore && !validAfter) return resultBefore;
+	if (validAfter && !validBefore) return resultAfter;
+	
+	return MAX(resultBefore, resultAfter);
+}
+
+static inline NSTimeInterval XMPPReferenceIntervalFromDays(int64_t days)
+{
+	return ((NSTimeInterval)days * XMPP_SECONDS_PER_DAY) - XMPP_REFERENCE_DATE_UNIX_OFFSET;
+}
 
 
 @implementation XMPPDateTimeProfiles
@@ -34,8 +257,33 @@ static NSString * const kXEP0082SharedDateFormatterKey = @"xep0082_shared_date_f
 
 + (NSDate *)parseDate:(NSString *)dateStr
 {
-	if ([dateStr length] < 10) return nil;
-	
+	NSTimeInterval ti;
+	if ([self parseDate:dateStr timeInterval:&ti])
+		return [NSDate dateWithTimeIntervalSinceReferenceDate:ti];
+	else
+		return nil;
+}
+
++ (NSDate *)parseTime:(NSString *)timeStr
+{
+	NSTimeInterval ti;
+	if ([self parseTime:timeStr timeInterval:&ti])
+		return [NSDate dateWithTimeIntervalSinceReferenceDate:ti];
+	else
+		return nil;
+}
+
++ (NSDate *)parseDateTime:(NSString *)dateTimeStr
+{
+	NSTimeInterval ti;
+	if ([self parseDateTime:dateTimeStr timeInterval:&ti])
+		return [NSDate dateWithTimeIntervalSinceReferenceDate:ti];
+	else
+		return nil;
+}
+
++ (BOOL)parseDate:(NSString *)dateStr timeInterval:(NSTimeInterval *)tiPtr
+{
 	// The Date profile defines a date without including the time of day.
 	// The lexical representation is as follows:
 	// 
@@ -44,18 +292,22 @@ static NSString * const kXEP0082SharedDateFormatterKey = @"xep0082_shared_date_f
 	// Example:
 	// 
 	// 1776-07-04
+	// 
+	// The result is the start of the day in the default time zone.
+	
+	if ([dateStr length] != 10) return NO;
 	
-	NSDateFormatter *df = [self threadDateFormatter];
-	[df setFormatterBehavior:NSDateFormatterBehavior10_4]; // Use unicode patterns (as opposed to 10_3)
-    [df setLocale:[[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"]];
-	[df setDateFormat:@"yyyy-MM-dd"];
+	XMPPDateTimeScanner scanner;
+	XMPPDateTimeScannerInit(&scanner, dateStr);
 	
-	NSDate *result = [df dateFromString:dateStr];
+	int64_t days;
+	if (!XMPPDateTimeScanDate(&scanner, &days)) return NO;
 	
-	return result;
+	if (tiPtr) *tiPtr = XMPPTimeIntervalFromLocalWallClock(XMPPReferenceIntervalFromDays(days));
+	return YES;
 }
 
-+ (NSDate *)parseTime:(NSString *)timeStr
++ (BOOL)parseTime:(NSString *)timeStr timeInterval:(NSTimeInterval *)tiPtr
 {
 	// The Time profile is used to specify an instant of time that recurs (e.g., every day).
 	// The lexical representation is as follows:
@@ -75,8 +327,18 @@ static NSString * const kXEP0082SharedDateFormatterKey = @"xep0082_shared_date_f
 	// 16:00:00.123Z
 	// 16:00:00.123+07:00
 	
+	if ([timeStr length] < 8) return NO;
+	
+	XMPPDateTimeScanner scanner;
+	XMPPDateTimeScannerInit(&scanner, timeStr);
+	
+	NSTimeInterval secondsOfDay;
+	BOOL hasTimeZone;
+	int utcOffset;
 	
-	// Extract the current day so the result can be on the current day.
+	if (!XMPPDateTimeScanTime(&scanner, &secondsOfDay, &hasTimeZone, &utcOffset)) return NO;
+	
+	// The result is on the current (local) day.
 	// Why do we bother doing this?
 	// 
 	// First, it is rather intuitive.
@@ -85,19 +347,23 @@ static NSString * const kXEP0082SharedDateFormatterKey = @"xep0082_shared_date_f
 	// For example, -0800 instead of the current -0700.
 	// This can be rather confusing when printing the result.
 	
-	NSDateFormatter *df = [self threadDateFormatter];
-	[df setFormatterBehavior:NSDateFormatterBehavior10_4]; // Use unicode patterns (as opposed to 10_3)
-    [df setLocale:[[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"]];
-	[df setDateFormat:@"yyyy-MM-dd"];
+	NSDate *now = [NSDate date];
+	NSTimeInterval localNow = [now timeIntervalSinceReferenceDate] + [[NSTimeZone defaultTimeZone] secondsFromGMTForDate:now];
 	
-	NSString *today = [df stringFromDate:[NSDate date]];
-    
-	NSString *dateTimeStr = [NSString stringWithFormat:@"%@T%@", today, timeStr];
+	int64_t days = (int64_t)floor((localNow + XMPP_REFERENCE_DATE_UNIX_OFFSET) / XMPP_SECONDS_PER_DAY);
+	NSTimeInterval wallClock = XMPPReferenceIntervalFromDays(days) + secondsOfDay;
 	
-	return [self parseDateTime:dateTimeStr withMandatoryTimeZone:NO];
+	if (tiPtr)
+	{
+		if (hasTimeZone)
+			*tiPtr = wallClock + utcOffset;
+		else
+			*tiPtr = XMPPTimeIntervalFromLocalWallClock(wallClock);
+	}
+	return YES;
 }
 
-+ (NSDate *)parseDateTime:(NSString *)dateTimeStr
++ (BOOL)parseDateTime:(NSString *)dateTimeStr timeInterval:(NSTimeInterval *)tiPtr
 {
 	// The DateTime profile is used to specify a non-recurring moment in time to an accuracy of seconds (or,
 	// optionally, fractions of a second). The format is as follows:
@@ -115,129 +381,24 @@ static NSString * const kXEP0082SharedDateFormatterKey = @"xep0082_shared_date_f
 	// 1969-07-21T02:56:15.123Z
 	// 1969-07-20T21:56:15.123-05:00
 	
-	return [self parseDateTime:dateTimeStr withMandatoryTimeZone:YES];
-}
-
-+ (NSDate *)parseDateTime:(NSString *)dateTimeStr withMandatoryTimeZone:(BOOL)mandatoryTZ
-{
-	if ([dateTimeStr length] < 19) return nil;
+	if ([dateTimeStr length] < 20) return NO;
 	
-	// The DateTime profile is used to specify a non-recurring moment in time to an accuracy of seconds (or,
-	// optionally, fractions of a second). The format is as follows:
-	// 
-	// CCYY-MM-DDThh:mm:ss[.sss]{TZD}
-	// 
-	// Examples:
-	// 
-	// 1969-07-21T02:56:15
-	// 1969-07-21T02:56:15Z
-	// 1969-07-20T21:56:15-05:00
-	// 1969-07-21T02:56:15.123
-	// 1969-07-21T02:56:15.123Z
-	// 1969-07-20T21:56:15.123-05:00
+	XMPPDateTimeScanner scanner;
+	XMPPDateTimeScannerInit(&scanner, dateTimeStr);
 	
-	BOOL hasMilliseconds = NO;
-	BOOL hasTimeZoneInfo = NO;
-	BOOL hasTimeZoneOffset = NO;
-	NSInteger fractionalDigits = 0;
+	int64_t days;
+	if (!XMPPDateTimeScanDate(&scanner, &days)) return NO;
+	if (!XMPPDateTimeScanChar(&scanner, 'T')) return NO;
 	
-	if ([dateTimeStr length] > 19)
-	{
-		unichar c = [dateTimeStr characterAtIndex:19];
-		
-		// Check for optional milliseconds
-		if (c == '.')
-		{
-			hasMilliseconds = YES;
-
-			// At least one fractional digit?
-			if ([dateTimeStr length] < 21) return nil;
-		}
-		
-		// Check for optional time zone info, which is at the last char (Z), or the
-		// char 6 chars from the end
-		if ([dateTimeStr characterAtIndex:[dateTimeStr length] - 1] == 'Z')
-		{
-			hasTimeZoneInfo = YES;
-			hasTimeZoneOffset = NO;
-			if (hasMilliseconds)
-			{
-				// 1969-07-21T02:56:15.1234Z -> 25 - 1 - 20 = 4
-				fractionalDigits = [dateTimeStr length] - 1 - 20;
-			}
-		}
-		else
-		{
-			c = [dateTimeStr characterAtIndex:[dateTimeStr length] - 6];
-			if (c == '+' || c == '-')
-			{
-				hasTimeZoneInfo = YES;
-				hasTimeZoneOffset = YES;
-				if (hasMilliseconds)
-				{
-					// 1969-07-21T02:56:15.1234+00:00 -> 30 - 6 - 20 = 4
-					fractionalDigits = [dateTimeStr length] - 6 - 20;
-				}
-			}
-			else if (hasMilliseconds)
-			{
-				// 1969-07-21T02:56:15.1234 -> 24 - 20 = 4
-				fractionalDigits = [dateTimeStr length] - 20;
-			}
-		}
-	}
+	NSTimeInterval secondsOfDay;
+	BOOL hasTimeZone;
+	int utcOffset;
 	
-	if (mandatoryTZ && !hasTimeZoneInfo) return nil;
+	if (!XMPPDateTimeScanTime(&scanner, &secondsOfDay, &hasTimeZone, &utcOffset)) return NO;
+	if (!hasTimeZone) return NO;
 	
-	NSDateFormatter *df = [self threadDateFormatter];
-	[df setFormatterBehavior:NSDateFormatterBehavior10_4]; // Use unicode patterns (as opposed to 10_3)
-    [df setLocale:[[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"]];
-	[df setDateFormat:@"yyyy-MM-dd'T'HH:mm:ss"];
-
-	NSDate *result = nil;
-	NSString *dateAndTime = [dateTimeStr substringToIndex:19];
-	NSString *fraction = fractionalDigits != 0 ? [NSString stringWithFormat:@"0%@", [dateTimeStr substringWithRange:NSMakeRange(19, fractionalDigits + 1)]] : nil;
-
-	if (hasTimeZoneInfo && !hasTimeZoneOffset)
-	{
-		[df setTimeZone:[NSTimeZone timeZoneForSecondsFromGMT:0]];
-		result = [df dateFromString:dateAndTime];
-	}
-	else if (hasTimeZoneInfo && hasTimeZoneOffset)
-	{
-		NSString *timeZone = [dateTimeStr substringFromIndex:[dateTimeStr length] - 6];
-		NSTimeZone *tz = [self parseTimeZoneOffset:timeZone];
-		if (tz == nil)
-		{
-			result = nil;
-		}
-		else
-		{
-			[df setTimeZone:tz];
-			result = [df dateFromString:dateAndTime];
-		}
-	}
-	else
-	{
-		result = [df dateFromString:dateAndTime];
-	}
-
-	if (result && fraction)
-	{
-		static NSNumberFormatter *numberFormatter = nil;
-		static dispatch_once_t onceToken;
-		dispatch_once(&onceToken, ^{
-			numberFormatter = [[NSNumberFormatter alloc] init];
-			[numberFormatter setFormatterBehavior:NSNumberFormatterBehavior10_4];
-			[numberFormatter setDecimalSeparator:@"."];
-		});
-
-		NSTimeInterval fractionInterval = [[numberFormatter numberFromString:fraction] doubleValue];
-		NSTimeInterval current = [result timeIntervalSinceReferenceDate];
-		result = [NSDate dateWithTimeIntervalSinceReferenceDate:floor(current) + fractionInterval];
-	}
-
-	return result;
+	if (tiPtr) *tiPtr = XMPPReferenceIntervalFromDays(days) + secondsOfDay + utcOffset;
+	return YES;
 }
 
 + (NSTimeZone *)parseTimeZoneOffset:(NSString *)tzo
@@ -281,15 +442,59 @@ static NSString * const kXEP0082SharedDateFormatterKey = @"xep0082_shared_date_f
 	return [NSTimeZone timeZoneForSecondsFromGMT:secondsOffset];
 }
 
-+ (NSDateFormatter *)threadDateFormatter {
-  NSMutableDictionary *currentThreadStorage = [[NSThread currentThread] threadDictionary];
-  NSDateFormatter *sharedDateFormatter = currentThreadStorage[kXEP0082SharedDateFormatterKey];
-  if (!sharedDateFormatter) {
-    sharedDateFormatter = [NSDateFormatter new];
-    currentThreadStorage[kXEP0082SharedDateFormatterKey] = sharedDateFormatter;
-  }
-  
-  return sharedDateFormatter;
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Formatting
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
++ (NSString *)dateStringWithTimeInterval:(NSTimeInterval)ti
+{
+	return [self stringWithTimeInterval:ti includeDate:YES includeTime:NO];
+}
+
++ (NSString *)timeStringWithTimeInterval:(NSTimeInterval)ti
+{
+	return [self stringWithTimeInterval:ti includeDate:NO includeTime:YES];
+}
+
++ (NSString *)dateTimeStringWithTimeInterval:(NSTimeInterval)ti
+{
+	return [self stringWithTimeInterval:ti includeDate:YES includeTime:YES];
+}
+
++ (NSString *)stringWithTimeInterval:(NSTimeInterval)ti includeDate:(BOOL)includeDate includeTime:(BOOL)includeTime
+{
+	// All strings are in UTC, and truncated to whole seconds (just like the date formatters we used to use)
+	
+	int64_t unixSeconds = (int64_t)floor(ti + XMPP_REFERENCE_DATE_UNIX_OFFSET);
+	
+	int64_t days = unixSeconds / XMPP_SECONDS_PER_DAY;
+	int64_t secondsOfDay = unixSeconds % XMPP_SECONDS_PER_DAY;
+	if (secondsOfDay < 0)
+	{
+		secondsOfDay += XMPP_SECONDS_PER_DAY;
+		days -= 1;
+	}
+	
+	int year, month, day;
+	XMPPCivilFromDays(days, &year, &month, &day);
+	
+	int hours   = (int)(secondsOfDay / 3600);
+	int minutes = (int)((secondsOfDay / 60) % 60);
+	int seconds = (int)(secondsOfDay % 60);
+	
+	char buffer[32];
+	int length;
+	
+	if (includeDate && includeTime)
+		length = snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02d:%02dZ", year, month, day, hours, minutes, seconds);
+	else if (includeDate)
+		length = snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d", year, month, day);
+	else
+		length = snprintf(buffer, sizeof(buffer), "%02d:%02d:%02dZ", hours, minutes, seconds);
+	
+	if (length < 0 || length >= (int)sizeof(buffer)) return nil;
+	
+	return [[NSString alloc] initWithBytes:buffer length:(NSUInteger)length encoding:NSASCIIStringEncoding];
 }
 
 @end
@@ -4,7 +4,7 @@
 #define _XMPP_CAPABILITIES_H
 
 @protocol XMPPCapabilitiesStorage;
-@class GCDTimerWrapper;
+@class XMPPTimer;
 
 /**
  * This class provides support for capabilities discovery.
@@ -29,7 +29,7 @@
 	
 	NSMutableSet *discoRequestJidSet;
 	NSMutableDictionary *discoRequestHashDict;
-	NSMutableDictionary<XMPPJID*,GCDTimerWrapper*> *discoTimerJidDict;
+	NSMutableDictionary<XMPPJID*,XMPPTimer*> *discoTimerJidDict;
 	
 	BOOL autoFetchHashedCapabilities;
 	BOOL autoFetchNonHashedCapabilities;
@@ -2,6 +2,7 @@
 #import "XMPPLogging.h"
 #import "XMPPCapabilities.h"
 #import "NSData+XMPP.h"
+#import "XMPPTimer.h"
 
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
@@ -46,16 +47,6 @@
 	#define DISCO_NODE @"https://github.com/robbiehanson/XMPPFramework"
 #endif
 
-@interface GCDTimerWrapper : NSObject
-{
-	dispatch_source_t timer;
-}
-
-- (id)initWithDispatchTimer:(dispatch_source_t)aTimer;
-- (void)cancel;
-
-@end
-
 @interface XMPPCapabilities (PrivateAPI)
 
 - (void)continueCollectMyCapabilities:(NSXMLElement *)query;
@@ -153,7 +144,7 @@
 
 - (void)dealloc
 {
-    [discoTimerJidDict enumerateKeysAndObjectsUsingBlock:^(XMPPJID * _Nonnull key, GCDTimerWrapper * _Nonnull obj, BOOL * _Nonnull stop) {
+    [discoTimerJidDict enumerateKeysAndObjectsUsingBlock:^(XMPPJID * _Nonnull key, XMPPTimer * _Nonnull obj, BOOL * _Nonnull stop) {
         [obj cancel];
     }];
 }
@@ -1632,29 +1623,21 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 	// If we eventually get a response (after the timeout) we will still be able to process it.
 	// The timeout simply prevents the set from growing infinitely.
 	
-	dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, moduleQueue);
+	// The timer is scheduled on the shared timing wheel, as most disco requests are answered long before this.
 	
-	dispatch_source_set_event_handler(timer, ^{ @autoreleasepool {
+	XMPPTimer *timer = [[XMPPTimer alloc] initWithQueue:moduleQueue timingWheel:nil eventHandler:^{ @autoreleasepool {
 		
-		[self processTimeoutWithJID:jid];
+		[discoTimerJidDict removeObjectForKey:jid];
 		
-		dispatch_source_cancel(timer);
-		#if !OS_OBJECT_USE_OBJC
-		dispatch_release(timer);
-		#endif
-	}});
-	
-	dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (CAPABILITIES_REQUEST_TIMEOUT * NSEC_PER_SEC));
+		[self processTimeoutWithJID:jid];
+	}}];
 	
-	dispatch_source_set_timer(timer, tt, DISPATCH_TIME_FOREVER, 0);
-	dispatch_resume(timer);
+	[timer startWithTimeout:CAPABILITIES_REQUEST_TIMEOUT interval:0];
 	
 	// We also keep a reference to the timer in the discoTimerJidDict.
 	// This allows us to cancel the timer when we get a response to the disco request.
 	
-	GCDTimerWrapper *timerWrapper = [[GCDTimerWrapper alloc] initWithDispatchTimer:timer];
-	
-	discoTimerJidDict[jid] = timerWrapper;
+	discoTimerJidDict[jid] = timer;
 }
 
 - (void)setupTimeoutForDiscoRequestFromJID:(XMPPJID *)jid withHashKey:(NSString *)key
@@ -1668,29 +1651,21 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 	// This list of jids is stored in the discoRequestHashDict.
 	// The key will allow us to fetch the jid list.
 		
-	dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, moduleQueue);
+	// The timer is scheduled on the shared timing wheel, as most disco requests are answered long before this.
 	
-	dispatch_source_set_event_handler(timer, ^{ @autoreleasepool {
+	XMPPTimer *timer = [[XMPPTimer alloc] initWithQueue:moduleQueue timingWheel:nil eventHandler:^{ @autoreleasepool {
 		
-		[self processTimeoutWithHashKey:key];
+		[discoTimerJidDict removeObjectForKey:jid];
 		
-		dispatch_source_cancel(timer);
-		#if !OS_OBJECT_USE_OBJC
-		dispatch_release(timer);
-		#endif
-	}});
-	
-	dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (CAPABILITIES_REQUEST_TIMEOUT * NSEC_PER_SEC));
+		[self processTimeoutWithHashKey:key];
+	}}];
 	
-	dispatch_source_set_timer(timer, tt, DISPATCH_TIME_FOREVER, 0);
-	dispatch_resume(timer);
+	[timer startWithTimeout:CAPABILITIES_REQUEST_TIMEOUT interval:0];
 	
 	// We also keep a reference to the timer in the discoTimerJidDict.
 	// This allows us to cancel the timer when we get a response to the disco request.
 	
-	GCDTimerWrapper *timerWrapper = [[GCDTimerWrapper alloc] initWithDispatchTimer:timer];
-	
-	discoTimerJidDict[jid] = timerWrapper;
+	discoTimerJidDict[jid] = timer;
 }
 
 - (void)cancelTimeoutForDiscoRequestFromJID:(XMPPJID *)jid
@@ -1700,10 +1675,10 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 	
 	XMPPLogTrace();
 	
-	GCDTimerWrapper *timerWrapper = discoTimerJidDict[jid];
-	if (timerWrapper)
+	XMPPTimer *timer = discoTimerJidDict[jid];
+	if (timer)
 	{
-		[timerWrapper cancel];
+		[timer cancel];
 		[discoTimerJidDict removeObjectForKey:jid];
 	}
 }
@@ -1740,40 +1715,3 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 }
 
 @end
-
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma mark -
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-@implementation GCDTimerWrapper
-
-- (id)initWithDispatchTimer:(dispatch_source_t)aTimer
-{
-	if ((self = [super init]))
-	{
-		timer = aTimer;
-		#if !OS_OBJECT_USE_OBJC
-		dispatch_retain(timer);
-		#endif
-	}
-	return self;
-}
-
-- (void)cancel
-{
-	if (timer)
-	{
-		dispatch_source_cancel(timer);
-		#if !OS_OBJECT_USE_OBJC
-		dispatch_release(timer);
-		#endif
-		timer = NULL;
-	}
-}
-
-- (void)dealloc
-{
-	[self cancel];
-}
-
-@end
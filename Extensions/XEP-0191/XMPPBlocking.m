@@ -2,6 +2,7 @@
 #import "XMPPLogging.h"
 #import "XMPPBlocking.h"
 #import "NSNumber+XMPP.h"
+#import "XMPPTimer.h"
 
 // Log levels: off, error, warn, info, verbose
 // Log flags: trace
@@ -33,14 +34,14 @@ typedef enum XMPPBlockingQueryInfoType {
     XMPPJID *blockingXMPPJID;
 	NSArray *blockingListItems;
 	
-	dispatch_source_t timer;
+	XMPPTimer *timer;
 }
 
 @property (nonatomic, readonly) XMPPBlockingQueryInfoType type;
 @property (nonatomic, readonly) NSArray *blockingListItems;
 
 @property (nonatomic, readwrite) XMPPJID *blockingXMPPJID;
-@property (nonatomic, readwrite) dispatch_source_t timer;
+@property (nonatomic, strong, readwrite) XMPPTimer *timer;
 
 - (void)cancel;
 
@@ -333,18 +334,14 @@ typedef enum XMPPBlockingQueryInfoType {
 - (void)addQueryInfo:(XMPPBlockingQueryInfo *)queryInfo withKey:(NSString *)uuid
 {
 	// Setup timer
+	// (on the shared timing wheel, as queries are usually answered long before they time out)
 	
-	dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, moduleQueue);
-	
-	dispatch_source_set_event_handler(timer, ^{ @autoreleasepool {
+	XMPPTimer *timer = [[XMPPTimer alloc] initWithQueue:moduleQueue timingWheel:nil eventHandler:^{ @autoreleasepool {
 		
 		[self queryTimeout:uuid];
-	}});
-	
-	dispatch_time_t fireTime = dispatch_time(DISPATCH_TIME_NOW, (QUERY_TIMEOUT * NSEC_PER_SEC));
+	}}];
 	
-	dispatch_source_set_timer(timer, fireTime, DISPATCH_TIME_FOREVER, 1.0);
-	dispatch_resume(timer);
+	[timer startWithTimeout:QUERY_TIMEOUT interval:0];
 	
 	queryInfo.timer = timer;
 	
@@ -611,14 +608,8 @@ typedef enum XMPPBlockingQueryInfoType {
 
 - (void)cancel
 {
-	if (timer)
-	{
-		dispatch_source_cancel(timer);
-#if !OS_OBJECT_USE_OBJC
-		dispatch_release(timer);
-#endif
-		timer = NULL;
-	}
+	[timer cancel];
+	timer = nil;
 }
 
 - (void)dealloc
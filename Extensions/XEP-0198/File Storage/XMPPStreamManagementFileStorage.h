@@ -0,0 +1,62 @@
+#import <Foundation/Foundation.h>
+#import "XMPPStreamManagement.h"
+
+/**
+ * This class provides a persistent, file based storage system for XMPPStreamManagement.
+ * Unlike the memory storage, the resumptionId, 'h' values and pendingOutgoingStanzas survive an app restart,
+ * so a stream can be resumed after the application was terminated (or crashed).
+ *
+ * Every change is appended to a journal file as a small checksummed record.
+ * Appends are buffered in memory, and written & synced to disk together (a "group commit")
+ * once per syncInterval, so a chatty stream results in a handful of fsync calls rather than one per stanza.
+ * The journal is periodically compacted into a single snapshot record (written to a temp file & renamed into place).
+ *
+ * On init, the journal is replayed to rebuild the state.
+ * A torn or corrupt record at the tail (e.g. from a crash mid-write) is discarded, along with anything after it.
+ *
+ * This implementation only supports a single xmppStream.
+ * You must create multiple instances (with different paths) for multiple xmppStreams.
+**/
+@interface XMPPStreamManagementFileStorage : NSObject <XMPPStreamManagementStorage>
+
+/**
+ * Creates a storage instance backed by the journal file at the given path.
+ * The directory must already exist. If the file exists, its state is recovered immediately.
+ *
+ * Returns nil if the file cannot be opened.
+**/
+- (instancetype)initWithPath:(NSString *)path;
+
+@property (nonatomic, copy, readonly) NSString *path;
+
+/**
+ * How long changes may sit in memory before being written & synced to disk.
+ * Changes made within this interval are committed together.
+ *
+ * A value of zero syncs after each burst of changes (i.e. as soon as the storage queue goes idle).
+ *
+ * The default value is 1.0 seconds.
+**/
+@property (atomic, assign, readwrite) NSTimeInterval syncInterval;
+
+/**
+ * The journal is compacted once it grows beyond this size (in bytes),
+ * and beyond twice the size it had after the last compaction.
+ *
+ * The default value is 256 KB.
+**/
+@property (atomic, assign, readwrite) NSUInteger compactionThreshold;
+
+/**
+ * Synchronously writes & syncs any buffered changes.
+ *
+ * Invoke this when the app is backgrounded, or about to quit.
+**/
+- (void)flush;
+
+/**
+ * Synchronously rewrites the journal as a single snapshot record.
+**/
+- (void)compact;
+
+@end
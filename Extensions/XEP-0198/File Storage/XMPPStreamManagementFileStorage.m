@@ -0,0 +1,1105 @@
+#import "XMPPStreamManagementFileStorage.h"
+#import "XMPPStreamManagementFileStoragePrivate.h"
+#import "XMPPStreamManagementStanzas.h"
+#import "XMPPLogging.h"
+#import <libkern/OSAtomic.h>
+#import <libkern/OSByteOrder.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+// Log flags: trace
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+#define JOURNAL_MAX_RECORD_SIZE (64 * 1024 * 1024)
+
+#define JOURNAL_RETRY_INTERVAL  5.0 // seconds between attempts to repair the journal after an I/O error
+
+enum XMPPStreamManagementJournalRecord
+{
+	JOURNAL_RECORD_SNAPSHOT = 1,  // Full state
+	JOURNAL_RECORD_RESUMPTION,    // setResumptionId:timeout:lastDisconnect:
+	JOURNAL_RECORD_CLIENT_H,      // setLastDisconnect:lastHandledByClient:
+	JOURNAL_RECORD_SERVER_H,      // setLastDisconnect:lastHandledByServer:pendingOutgoingStanzas:
+	JOURNAL_RECORD_DISCONNECT,    // setLastDisconnect:lastHandledByClient:lastHandledByServer:pendingOutgoingStanzas:
+	JOURNAL_RECORD_APPEND,        // setLastDisconnect:appendingPendingOutgoingStanza:
+	JOURNAL_RECORD_REPLACE,       // replacePendingOutgoingStanzaAtIndex:withStanza:
+	JOURNAL_RECORD_TRIM,          // setLastDisconnect:lastHandledByServer:removingPendingOutgoingStanzas:
+	JOURNAL_RECORD_REMOVE_ALL,    // removeAllForStream:
+};
+
+enum XMPPStreamManagementJournalStanzaId
+{
+	JOURNAL_STANZA_ID_NONE = 0,
+	JOURNAL_STANZA_ID_STRING,
+	JOURNAL_STANZA_ID_ARCHIVED,
+};
+
+#define JOURNAL_NIL_LENGTH UINT32_MAX
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Encoding
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t JournalChecksum(const uint8_t *bytes, NSUInteger length)
+{
+	// FNV-1a
+
+	uint32_t hash = 2166136261u;
+	for (NSUInteger i = 0; i < length; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void JournalAppendUInt8(NSMutableData *data, uint8_t value)
+{
+	[data appendBytes:&value length:1];
+}
+
+static void JournalAppendUInt32(NSMutableData *data, uint32_t value)
+{
+	uint32_t le = OSSwapHostToLittleInt32(value);
+	[data appendBytes:&le length:4];
+}
+
+static void JournalAppendBytes(NSMutableData *data, NSData *bytes)
+{
+	if (bytes == nil)
+	{
+		JournalAppendUInt32(data, JOURNAL_NIL_LENGTH);
+	}
+	else
+	{
+		JournalAppendUInt32(data, (uint32_t)[bytes length]);
+		[data appendData:bytes];
+	}
+}
+
+static void JournalAppendString(NSMutableData *data, NSString *string)
+{
+	JournalAppendBytes(data, [string dataUsingEncoding:NSUTF8StringEncoding]);
+}
+
+static void JournalAppendDate(NSMutableData *data, NSDate *date)
+{
+	// A nil date is stored as NaN
+
+	Float64 interval = date ? [date timeIntervalSinceReferenceDate] : NAN;
+
+	CFSwappedFloat64 swapped = CFConvertFloat64HostToSwapped(interval);
+	[data appendBytes:&swapped length:8];
+}
+
+static void JournalAppendStanza(NSMutableData *data, XMPPStreamManagementOutgoingStanza *stanza)
+{
+	JournalAppendUInt8(data, stanza.awaitingStanzaId ? 1 : 0);
+
+	id stanzaId = stanza.stanzaId;
+
+	if ([stanzaId isKindOfClass:[NSString class]])
+	{
+		JournalAppendUInt8(data, JOURNAL_STANZA_ID_STRING);
+		JournalAppendString(data, (NSString *)stanzaId);
+	}
+	else if ([stanzaId conformsToProtocol:@protocol(NSCoding)])
+	{
+		JournalAppendUInt8(data, JOURNAL_STANZA_ID_ARCHIVED);
+		JournalAppendBytes(data, [NSKeyedArchiver archivedDataWithRootObject:stanzaId]);
+	}
+	else
+	{
+		if (stanzaId) {
+			XMPPLogCWarn(@"%@: Unable to persist stanzaId of class %@ (doesn't support NSCoding)",
+			             THIS_FILE, NSStringFromClass([stanzaId class]));
+		}
+		JournalAppendUInt8(data, JOURNAL_STANZA_ID_NONE);
+	}
+}
+
+static void JournalAppendStanzas(NSMutableData *data, NSArray *stanzas)
+{
+	JournalAppendUInt32(data, (uint32_t)[stanzas count]);
+
+	for (XMPPStreamManagementOutgoingStanza *stanza in stanzas)
+	{
+		JournalAppendStanza(data, stanza);
+	}
+}
+
+/**
+ * Records are built in place: JournalBeginRecord reserves the length & checksum,
+ * and JournalEndRecord fills them in once the payload has been appended.
+**/
+static NSUInteger JournalBeginRecord(NSMutableData *data, uint8_t type)
+{
+	NSUInteger offset = [data length];
+
+	JournalAppendUInt32(data, 0); // length, filled in by JournalEndRecord
+	JournalAppendUInt32(data, 0); // checksum, filled in by JournalEndRecord
+	JournalAppendUInt8(data, type);
+
+	return offset;
+}
+
+static void JournalEndRecord(NSMutableData *data, NSUInteger offset)
+{
+	uint8_t *record = (uint8_t *)[data mutableBytes] + offset;
+	NSUInteger length = [data length] - offset - JOURNAL_RECORD_OVERHEAD;
+
+	OSWriteLittleInt32(record, 0, (uint32_t)length);
+	OSWriteLittleInt32(record, 4, JournalChecksum(record + JOURNAL_RECORD_OVERHEAD, length));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Decoding
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	const uint8_t *bytes;
+	NSUInteger length;
+	NSUInteger offset;
+	BOOL failed;
+} XMPPJournalReader;
+
+static BOOL JournalCanRead(XMPPJournalReader *reader, NSUInteger length)
+{
+	if (reader->failed || (reader->length - reader->offset) < length)
+	{
+		reader->failed = YES;
+		return NO;
+	}
+	return YES;
+}
+
+static uint8_t JournalReadUInt8(XMPPJournalReader *reader)
+{
+	if (!JournalCanRead(reader, 1)) return 0;
+
+	return reader->bytes[reader->offset++];
+}
+
+static uint32_t JournalReadUInt32(XMPPJournalReader *reader)
+{
+	if (!JournalCanRead(reader, 4)) return 0;
+
+	uint32_t value = OSReadLittleInt32(reader->bytes, reader->offset);
+	reader->offset += 4;
+	return value;
+}
+
+static NSData *JournalReadBytes(XMPPJournalReader *reader)
+{
+	uint32_t length = JournalReadUInt32(reader);
+	if (reader->failed || length == JOURNAL_NIL_LENGTH) return nil;
+
+	if (!JournalCanRead(reader, length)) return nil;
+
+	NSData *data = [NSData dataWithBytes:(reader->bytes + reader->offset) length:length];
+	reader->offset += length;
+	return data;
+}
+
+static NSString *JournalReadString(XMPPJournalReader *reader)
+{
+	NSData *data = JournalReadBytes(reader);
+	if (data == nil) return nil;
+
+	return [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+}
+
+static NSDate *JournalReadDate(XMPPJournalReader *reader)
+{
+	if (!JournalCanRead(reader, 8)) return nil;
+
+	CFSwappedFloat64 swapped;
+	memcpy(&swapped, reader->bytes + reader->offset, 8);
+	reader->offset += 8;
+
+	Float64 interval = CFConvertFloat64SwappedToHost(swapped);
+	if (isnan(interval)) return nil;
+
+	return [NSDate dateWithTimeIntervalSinceReferenceDate:interval];
+}
+
+static XMPPStreamManagementOutgoingStanza *JournalReadStanza(XMPPJournalReader *reader)
+{
+	BOOL awaitingStanzaId = (JournalReadUInt8(reader) != 0);
+	uint8_t stanzaIdType = JournalReadUInt8(reader);
+
+	id stanzaId = nil;
+
+	if (stanzaIdType == JOURNAL_STANZA_ID_STRING)
+	{
+		stanzaId = JournalReadString(reader);
+	}
+	else if (stanzaIdType == JOURNAL_STANZA_ID_ARCHIVED)
+	{
+		NSData *archive = JournalReadBytes(reader);
+		if (archive)
+		{
+			@try {
+				stanzaId = [NSKeyedUnarchiver unarchiveObjectWithData:archive];
+			}
+			@catch (NSException *exception) {
+				XMPPLogCWarn(@"%@: Unable to unarchive stanzaId: %@", THIS_FILE, exception);
+			}
+		}
+	}
+	else if (stanzaIdType != JOURNAL_STANZA_ID_NONE)
+	{
+		reader->failed = YES;
+	}
+
+	if (reader->failed) return nil;
+
+	XMPPStreamManagementOutgoingStanza *stanza = [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:stanzaId];
+	stanza.awaitingStanzaId = awaitingStanzaId;
+
+	return stanza;
+}
+
+static XMPPStreamManagementOutgoingQueue *JournalReadStanzas(XMPPJournalReader *reader)
+{
+	uint32_t count = JournalReadUInt32(reader);
+
+	XMPPStreamManagementOutgoingQueue *queue = [[XMPPStreamManagementOutgoingQueue alloc] init];
+
+	for (uint32_t i = 0; i < count && !reader->failed; i++)
+	{
+		XMPPStreamManagementOutgoingStanza *stanza = JournalReadStanza(reader);
+		if (stanza) {
+			[queue addStanza:stanza];
+		}
+	}
+
+	return reader->failed ? nil : queue;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPStreamManagementFileStorage
+{
+	int32_t isConfigured;
+
+	dispatch_queue_t storageQueue;
+	void *storageQueueTag;
+
+	int fd;
+	unsigned long long journalLength;
+	unsigned long long compactedLength;
+
+	NSMutableData *pendingJournalData;
+	BOOL syncScheduled;
+	BOOL needsCompaction;
+
+	NSTimeInterval syncInterval;
+	NSUInteger compactionThreshold;
+
+	NSString *resumptionId;
+	uint32_t timeout;
+
+	NSDate *lastDisconnect;
+	uint32_t lastHandledByClient;
+	uint32_t lastHandledByServer;
+	XMPPStreamManagementOutgoingQueue *pendingOutgoingStanzas;
+}
+
+@synthesize path = path;
+
+- (instancetype)init
+{
+	return [self initWithPath:nil];
+}
+
+- (instancetype)initWithPath:(NSString *)inPath
+{
+	if ((self = [super init]))
+	{
+		fd = -1;
+
+		if ([inPath length] == 0)
+		{
+			return nil;
+		}
+
+		path = [inPath copy];
+
+		fd = open([path fileSystemRepresentation], O_RDWR | O_CREAT, 0600);
+		if (fd < 0)
+		{
+			XMPPLogError(@"%@: Unable to open journal at %@: %s", THIS_FILE, path, strerror(errno));
+			return nil;
+		}
+
+		storageQueue = dispatch_queue_create("XMPPStreamManagementFileStorage", NULL);
+
+		storageQueueTag = &storageQueueTag;
+		dispatch_queue_set_specific(storageQueue, storageQueueTag, storageQueueTag, NULL);
+
+		pendingJournalData = [[NSMutableData alloc] init];
+
+		syncInterval = 1.0;
+		compactionThreshold = 256 * 1024;
+
+		pendingOutgoingStanzas = [[XMPPStreamManagementOutgoingQueue alloc] init];
+
+		[self recoverJournal];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	// No other references exist at this point, so we can touch the file directly.
+
+	if (fd >= 0)
+	{
+		[self writePendingJournalData];
+		close(fd);
+	}
+
+	#if !OS_OBJECT_USE_OBJC
+	if (storageQueue)
+		dispatch_release(storageQueue);
+	#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Configuration
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSTimeInterval)syncInterval
+{
+	__block NSTimeInterval result = 0.0;
+
+	dispatch_block_t block = ^{
+		result = syncInterval;
+	};
+
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_sync(storageQueue, block);
+
+	return result;
+}
+
+- (void)setSyncInterval:(NSTimeInterval)interval
+{
+	dispatch_block_t block = ^{
+		syncInterval = MAX(interval, 0.0);
+	};
+
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_async(storageQueue, block);
+}
+
+- (NSUInteger)compactionThreshold
+{
+	__block NSUInteger result = 0;
+
+	dispatch_block_t block = ^{
+		result = compactionThreshold;
+	};
+
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_sync(storageQueue, block);
+
+	return result;
+}
+
+- (void)setCompactionThreshold:(NSUInteger)threshold
+{
+	dispatch_block_t block = ^{
+		compactionThreshold = threshold;
+	};
+
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_async(storageQueue, block);
+}
+
+- (void)flush
+{
+	dispatch_block_t block = ^{
+		[self syncJournal];
+	};
+
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_sync(storageQueue, block);
+}
+
+- (void)compact
+{
+	dispatch_block_t block = ^{
+		[self compactJournal];
+	};
+
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_sync(storageQueue, block);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Journal
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Rebuilds the state by replaying the journal.
+ *
+ * Replay stops at the first record that is truncated, or fails its checksum.
+ * That's what a crash in the middle of a write looks like, so the file is truncated at that point.
+**/
+- (void)recoverJournal
+{
+	NSData *journal = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+
+	const uint8_t *bytes = [journal bytes];
+	NSUInteger length = [journal length];
+
+	if (length < JOURNAL_HEADER_SIZE ||
+	    OSReadLittleInt32(bytes, 0) != JOURNAL_MAGIC ||
+	    OSReadLittleInt32(bytes, 4) != JOURNAL_VERSION)
+	{
+		if (length > 0) {
+			XMPPLogWarn(@"%@: Discarding unrecognized journal at %@", THIS_FILE, path);
+		}
+
+		NSMutableData *header = [NSMutableData dataWithCapacity:JOURNAL_HEADER_SIZE];
+		JournalAppendUInt32(header, JOURNAL_MAGIC);
+		JournalAppendUInt32(header, JOURNAL_VERSION);
+
+		if (ftruncate(fd, 0) != 0 || ![self writeData:header toFileDescriptor:fd] || ![self syncFileDescriptor:fd])
+		{
+			XMPPLogError(@"%@: Unable to initialize journal at %@: %s", THIS_FILE, path, strerror(errno));
+		}
+
+		journalLength = JOURNAL_HEADER_SIZE;
+		compactedLength = JOURNAL_HEADER_SIZE;
+		return;
+	}
+
+	NSUInteger offset = JOURNAL_HEADER_SIZE;
+	NSUInteger recordCount = 0;
+
+	while ((length - offset) >= JOURNAL_RECORD_OVERHEAD)
+	{
+		uint32_t recordLength = OSReadLittleInt32(bytes, offset);
+		uint32_t checksum = OSReadLittleInt32(bytes, offset + 4);
+
+		if (recordLength == 0 || recordLength > JOURNAL_MAX_RECORD_SIZE) break;
+		if ((length - offset - JOURNAL_RECORD_OVERHEAD) < recordLength) break;
+
+		const uint8_t *record = bytes + offset + JOURNAL_RECORD_OVERHEAD;
+
+		if (JournalChecksum(record, recordLength) != checksum) break;
+
+		XMPPJournalReader reader = { record + 1, recordLength - 1, 0, NO };
+
+		if (![self applyRecordType:record[0] reader:&reader]) break;
+
+		offset += JOURNAL_RECORD_OVERHEAD + recordLength;
+		recordCount++;
+	}
+
+	if (offset < length)
+	{
+		XMPPLogWarn(@"%@: Discarding %lu corrupt or truncated bytes at the end of the journal",
+		            THIS_FILE, (unsigned long)(length - offset));
+
+		if (ftruncate(fd, (off_t)offset) != 0)
+		{
+			XMPPLogError(@"%@: Unable to truncate journal: %s", THIS_FILE, strerror(errno));
+		}
+	}
+
+	XMPPLogVerbose(@"%@: Recovered %lu journal records", THIS_FILE, (unsigned long)recordCount);
+
+	// We don't know how much of the journal is redundant, so let the compactionThreshold decide.
+	journalLength = offset;
+	compactedLength = JOURNAL_HEADER_SIZE;
+}
+
+/**
+ * Applies a single journal record to the in-memory state.
+ * Returns NO if the record couldn't be decoded.
+ *
+ * The record is fully decoded before any state is modified.
+**/
+- (BOOL)applyRecordType:(uint8_t)type reader:(XMPPJournalReader *)reader
+{
+	switch (type)
+	{
+		case JOURNAL_RECORD_SNAPSHOT:
+		{
+			NSString *rId  = JournalReadString(reader);
+			uint32_t  t    = JournalReadUInt32(reader);
+			NSDate   *date = JournalReadDate(reader);
+			uint32_t  hc   = JournalReadUInt32(reader);
+			uint32_t  hs   = JournalReadUInt32(reader);
+			XMPPStreamManagementOutgoingQueue *stanzas = JournalReadStanzas(reader);
+
+			if (reader->failed) return NO;
+
+			resumptionId = rId;
+			timeout = t;
+			lastDisconnect = date;
+			lastHandledByClient = hc;
+			lastHandledByServer = hs;
+			pendingOutgoingStanzas = stanzas;
+			return YES;
+		}
+		case JOURNAL_RECORD_RESUMPTION:
+		{
+			NSString *rId  = JournalReadString(reader);
+			uint32_t  t    = JournalReadUInt32(reader);
+			NSDate   *date = JournalReadDate(reader);
+
+			if (reader->failed) return NO;
+
+			resumptionId = rId;
+			timeout = t;
+			lastDisconnect = date;
+			lastHandledByClient = 0;
+			lastHandledByServer = 0;
+			[pendingOutgoingStanzas removeAllStanzas];
+			return YES;
+		}
+		case JOURNAL_RECORD_CLIENT_H:
+		{
+			NSDate  *date = JournalReadDate(reader);
+			uint32_t hc   = JournalReadUInt32(reader);
+
+			if (reader->failed) return NO;
+
+			lastDisconnect = date;
+			lastHandledByClient = hc;
+			return YES;
+		}
+		case JOURNAL_RECORD_SERVER_H:
+		{
+			NSDate  *date = JournalReadDate(reader);
+			uint32_t hs   = JournalReadUInt32(reader);
+			XMPPStreamManagementOutgoingQueue *stanzas = JournalReadStanzas(reader);
+
+			if (reader->failed) return NO;
+
+			lastDisconnect = date;
+			lastHandledByServer = hs;
+			pendingOutgoingStanzas = stanzas;
+			return YES;
+		}
+		case JOURNAL_RECORD_DISCONNECT:
+		{
+			NSDate  *date = JournalReadDate(reader);
+			uint32_t hc   = JournalReadUInt32(reader);
+			uint32_t hs   = JournalReadUInt32(reader);
+			XMPPStreamManagementOutgoingQueue *stanzas = JournalReadStanzas(reader);
+
+			if (reader->failed) return NO;
+
+			lastDisconnect = date;
+			lastHandledByClient = hc;
+			lastHandledByServer = hs;
+			pendingOutgoingStanzas = stanzas;
+			return YES;
+		}
+		case JOURNAL_RECORD_APPEND:
+		{
+			NSDate *date = JournalReadDate(reader);
+			XMPPStreamManagementOutgoingStanza *stanza = JournalReadStanza(reader);
+
+			if (reader->failed) return NO;
+
+			lastDisconnect = date;
+			[pendingOutgoingStanzas addStanza:stanza];
+			return YES;
+		}
+		case JOURNAL_RECORD_REPLACE:
+		{
+			uint32_t index = JournalReadUInt32(reader);
+			XMPPStreamManagementOutgoingStanza *stanza = JournalReadStanza(reader);
+
+			if (reader->failed) return NO;
+
+			if (index < [pendingOutgoingStanzas count]) {
+				[pendingOutgoingStanzas replaceStanzaAtIndex:index withStanza:stanza];
+			}
+			return YES;
+		}
+		case JOURNAL_RECORD_TRIM:
+		{
+			NSDate  *date  = JournalReadDate(reader);
+			uint32_t hs    = JournalReadUInt32(reader);
+			uint32_t count = JournalReadUInt32(reader);
+
+			if (reader->failed) return NO;
+
+			lastDisconnect = date;
+			lastHandledByServer = hs;
+			[pendingOutgoingStanzas removeFirstStanzas:MIN(count, [pendingOutgoingStanzas count])];
+			return YES;
+		}
+		case JOURNAL_RECORD_REMOVE_ALL:
+		{
+			resumptionId = nil;
+			timeout = 0;
+			lastDisconnect = nil;
+			lastHandledByClient = 0;
+			lastHandledByServer = 0;
+			[pendingOutgoingStanzas removeAllStanzas];
+			return YES;
+		}
+		default:
+		{
+			XMPPLogWarn(@"%@: Unknown journal record type: %u", THIS_FILE, (unsigned)type);
+			return NO;
+		}
+	}
+}
+
+/**
+ * Appends an encoded record to the journal.
+ *
+ * The record is encoded on the caller's thread (the stanzas may be mutated once we return),
+ * and then applied to the in-memory state, and buffered for the next group commit, on the storage queue.
+**/
+- (void)appendRecord:(NSData *)record
+{
+	dispatch_async(storageQueue, ^{ @autoreleasepool {
+
+		XMPPJournalReader reader = {
+			(const uint8_t *)[record bytes] + JOURNAL_RECORD_OVERHEAD + 1,
+			[record length] - JOURNAL_RECORD_OVERHEAD - 1,
+			0,
+			NO
+		};
+
+		uint8_t type = ((const uint8_t *)[record bytes])[JOURNAL_RECORD_OVERHEAD];
+
+		[self applyRecordType:type reader:&reader];
+
+		[pendingJournalData appendData:record];
+		[self scheduleSync];
+	}});
+}
+
+- (void)scheduleSync
+{
+	[self scheduleSyncAfter:syncInterval];
+}
+
+- (void)scheduleSyncAfter:(NSTimeInterval)delay
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+
+	if (syncScheduled) return;
+	syncScheduled = YES;
+
+	__weak id weakSelf = self;
+
+	dispatch_time_t when = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC));
+	dispatch_after(when, storageQueue, ^{ @autoreleasepool {
+
+		[weakSelf syncJournal];
+	}});
+}
+
+/**
+ * Group commit: writes all buffered records, then syncs the file once.
+**/
+- (void)syncJournal
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+
+	syncScheduled = NO;
+
+	if (!needsCompaction && [pendingJournalData length] == 0) return;
+
+	if (needsCompaction || ![self writePendingJournalData])
+	{
+		// The file may be in an unknown state (e.g. a partial write).
+		// A compaction rewrites it from scratch, from the in-memory state.
+		// Until one succeeds, the buffered records are kept, and it's retried periodically.
+
+		needsCompaction = YES;
+		[self compactJournal];
+
+		if (needsCompaction)
+		{
+			[self scheduleSyncAfter:MAX(syncInterval, JOURNAL_RETRY_INTERVAL)];
+		}
+		return;
+	}
+
+	if (journalLength > compactionThreshold && journalLength > (compactedLength * 2))
+	{
+		[self compactJournal];
+	}
+}
+
+/**
+ * Appends the buffered records to the journal.
+ *
+ * On failure, the buffered records are kept, and the file is truncated back to its last known good length,
+ * so that a torn record can't end up in front of the records appended later (where recovery would discard them).
+**/
+- (BOOL)writePendingJournalData
+{
+	NSUInteger length = [pendingJournalData length];
+	if (length == 0) return YES;
+
+	BOOL result = (ftruncate(fd, (off_t)journalLength) == 0) &&
+	              [self writeData:pendingJournalData toFileDescriptor:fd] &&
+	              [self syncFileDescriptor:fd];
+
+	if (result)
+	{
+		journalLength += length;
+		[pendingJournalData setLength:0];
+	}
+	else
+	{
+		XMPPLogError(@"%@: Unable to write journal: %s", THIS_FILE, strerror(errno));
+
+		ftruncate(fd, (off_t)journalLength);
+	}
+
+	return result;
+}
+
+/**
+ * Rewrites the journal as a single snapshot record.
+ *
+ * The snapshot is written to a temp file, synced, and then atomically renamed over the journal.
+ * So a crash at any point leaves either the old journal, or the new one.
+**/
+- (void)compactJournal
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+
+	NSMutableData *snapshot = [NSMutableData dataWithCapacity:256];
+	JournalAppendUInt32(snapshot, JOURNAL_MAGIC);
+	JournalAppendUInt32(snapshot, JOURNAL_VERSION);
+
+	NSUInteger offset = JournalBeginRecord(snapshot, JOURNAL_RECORD_SNAPSHOT);
+	JournalAppendString(snapshot, resumptionId);
+	JournalAppendUInt32(snapshot, timeout);
+	JournalAppendDate(snapshot, lastDisconnect);
+	JournalAppendUInt32(snapshot, lastHandledByClient);
+	JournalAppendUInt32(snapshot, lastHandledByServer);
+	JournalAppendStanzas(snapshot, [pendingOutgoingStanzas stanzasCopyingItems:NO]);
+	JournalEndRecord(snapshot, offset);
+
+	NSString *tempPath = [path stringByAppendingString:@".tmp"];
+
+	int tempFd = open([tempPath fileSystemRepresentation], O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (tempFd < 0)
+	{
+		XMPPLogError(@"%@: Unable to create %@: %s", THIS_FILE, tempPath, strerror(errno));
+		return;
+	}
+
+	if (![self writeData:snapshot toFileDescriptor:tempFd] ||
+	    ![self syncFileDescriptor:tempFd] ||
+	    rename([tempPath fileSystemRepresentation], [path fileSystemRepresentation]) != 0)
+	{
+		XMPPLogError(@"%@: Unable to compact journal: %s", THIS_FILE, strerror(errno));
+
+		close(tempFd);
+		unlink([tempPath fileSystemRepresentation]);
+		return;
+	}
+
+	close(fd);
+	fd = tempFd;
+
+	// The snapshot includes everything in the pending buffer
+	[pendingJournalData setLength:0];
+	needsCompaction = NO;
+
+	journalLength = [snapshot length];
+	compactedLength = journalLength;
+
+	// Make the rename itself durable
+	[self syncDirectory];
+}
+
+- (void)syncDirectory
+{
+	NSString *directory = [path stringByDeletingLastPathComponent];
+	if ([directory length] == 0) directory = @".";
+
+	int dirFd = open([directory fileSystemRepresentation], O_RDONLY);
+	if (dirFd < 0 || ![self syncFileDescriptor:dirFd])
+	{
+		XMPPLogWarn(@"%@: Unable to sync directory %@: %s", THIS_FILE, directory, strerror(errno));
+	}
+
+	if (dirFd >= 0) close(dirFd);
+}
+
+- (BOOL)writeData:(NSData *)data toFileDescriptor:(int)fileDescriptor
+{
+	const uint8_t *bytes = [data bytes];
+	NSUInteger remaining = [data length];
+
+	if (lseek(fileDescriptor, 0, SEEK_END) < 0) return NO;
+
+	while (remaining > 0)
+	{
+		ssize_t result = write(fileDescriptor, bytes, remaining);
+		if (result < 0)
+		{
+			if (errno == EINTR) continue;
+			return NO;
+		}
+
+		bytes += result;
+		remaining -= result;
+	}
+
+	return YES;
+}
+
+- (BOOL)syncFileDescriptor:(int)fileDescriptor
+{
+	// On Apple platforms, fsync only pushes the data to the drive, which may hold it in its cache.
+	// F_FULLFSYNC asks the drive to flush it to permanent storage.
+
+	#ifdef F_FULLFSYNC
+	if (fcntl(fileDescriptor, F_FULLFSYNC) == 0) return YES;
+	#endif
+
+	return (fsync(fileDescriptor) == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark XMPPStreamManagementStorage
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)configureWithParent:(XMPPStreamManagement *)parent queue:(dispatch_queue_t)queue
+{
+	// This implementation only supports a single xmppStream.
+	// You must create multiple instances for multiple xmppStreams.
+
+	return OSAtomicCompareAndSwap32(0, 1, &isConfigured);
+}
+
+- (void)setResumptionId:(NSString *)inResumptionId
+                timeout:(uint32_t)inTimeout
+         lastDisconnect:(NSDate *)inLastDisconnect
+              forStream:(XMPPStream *)stream
+{
+	NSMutableData *record = [NSMutableData dataWithCapacity:64];
+
+	NSUInteger offset = JournalBeginRecord(record, JOURNAL_RECORD_RESUMPTION);
+	JournalAppendString(record, inResumptionId);
+	JournalAppendUInt32(record, inTimeout);
+	JournalAppendDate(record, inLastDisconnect);
+	JournalEndRecord(record, offset);
+
+	[self appendRecord:record];
+}
+
+- (void)setLastDisconnect:(NSDate *)inLastDisconnect
+      lastHandledByClient:(uint32_t)inLastHandledByClient
+                forStream:(XMPPStream *)stream
+{
+	NSMutableData *record = [NSMutableData dataWithCapacity:32];
+
+	NSUInteger offset = JournalBeginRecord(record, JOURNAL_RECORD_CLIENT_H);
+	JournalAppendDate(record, inLastDisconnect);
+	JournalAppendUInt32(record, inLastHandledByClient);
+	JournalEndRecord(record, offset);
+
+	[self appendRecord:record];
+}
+
+- (void)setLastDisconnect:(NSDate *)inLastDisconnect
+      lastHandledByServer:(uint32_t)inLastHandledByServer
+   pendingOutgoingStanzas:(NSArray *)inPendingOutgoingStanzas
+                forStream:(XMPPStream *)stream
+{
+	NSMutableData *record = [NSMutableData dataWithCapacity:128];
+
+	NSUInteger offset = JournalBeginRecord(record, JOURNAL_RECORD_SERVER_H);
+	JournalAppendDate(record, inLastDisconnect);
+	JournalAppendUInt32(record, inLastHandledByServer);
+	JournalAppendStanzas(record, inPendingOutgoingStanzas);
+	JournalEndRecord(record, offset);
+
+	[self appendRecord:record];
+}
+
+- (void)setLastDisconnect:(NSDate *)inLastDisconnect
+      lastHandledByClient:(uint32_t)inLastHandledByClient
+      lastHandledByServer:(uint32_t)inLastHandledByServer
+   pendingOutgoingStanzas:(NSArray *)inPendingOutgoingStanzas
+                forStream:(XMPPStream *)stream
+{
+	NSMutableData *record = [NSMutableData dataWithCapacity:128];
+
+	NSUInteger offset = JournalBeginRecord(record, JOURNAL_RECORD_DISCONNECT);
+	JournalAppendDate(record, inLastDisconnect);
+	JournalAppendUInt32(record, inLastHandledByClient);
+	JournalAppendUInt32(record, inLastHandledByServer);
+	JournalAppendStanzas(record, inPendingOutgoingStanzas);
+	JournalEndRecord(record, offset);
+
+	[self appendRecord:record];
+
+	// This is invoked after a disconnect, which may be followed by the app getting suspended or killed.
+	// So don't leave it waiting for the next group commit.
+	[self flushAsync];
+}
+
+/**
+ * Delta updates of the pendingOutgoingStanzas.
+ * See the note [in XMPPStreamManagement.h]: "Delta updates of the pendingOutgoingStanzas"
+ *
+ * These keep the journal records small (one stanza, or a count), regardless of the number of pending stanzas.
+**/
+- (void)setLastDisconnect:(NSDate *)inLastDisconnect
+appendingPendingOutgoingStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+                forStream:(XMPPStream *)stream
+{
+	NSMutableData *record = [NSMutableData dataWithCapacity:64];
+
+	NSUInteger offset = JournalBeginRecord(record, JOURNAL_RECORD_APPEND);
+	JournalAppendDate(record, inLastDisconnect);
+	JournalAppendStanza(record, stanza);
+	JournalEndRecord(record, offset);
+
+	[self appendRecord:record];
+}
+
+- (void)replacePendingOutgoingStanzaAtIndex:(NSUInteger)index
+                                 withStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+                                  forStream:(XMPPStream *)stream
+{
+	NSMutableData *record = [NSMutableData dataWithCapacity:64];
+
+	NSUInteger offset = JournalBeginRecord(record, JOURNAL_RECORD_REPLACE);
+	JournalAppendUInt32(record, (uint32_t)index);
+	JournalAppendStanza(record, stanza);
+	JournalEndRecord(record, offset);
+
+	[self appendRecord:record];
+}
+
+- (void)setLastDisconnect:(NSDate *)inLastDisconnect
+      lastHandledByServer:(uint32_t)inLastHandledByServer
+removingPendingOutgoingStanzas:(NSUInteger)count
+                forStream:(XMPPStream *)stream
+{
+	NSMutableData *record = [NSMutableData dataWithCapacity:32];
+
+	NSUInteger offset = JournalBeginRecord(record, JOURNAL_RECORD_TRIM);
+	JournalAppendDate(record, inLastDisconnect);
+	JournalAppendUInt32(record, inLastHandledByServer);
+	JournalAppendUInt32(record, (uint32_t)MIN(count, (NSUInteger)UINT32_MAX));
+	JournalEndRecord(record, offset);
+
+	[self appendRecord:record];
+}
+
+- (void)getResumptionId:(NSString **)resumptionIdPtr
+                timeout:(uint32_t *)timeoutPtr
+         lastDisconnect:(NSDate **)lastDisconnectPtr
+              forStream:(XMPPStream *)stream
+{
+	__block NSString *result_resumptionId = nil;
+	__block uint32_t result_timeout = 0;
+	__block NSDate *result_lastDisconnect = nil;
+
+	dispatch_block_t block = ^{
+
+		result_resumptionId = resumptionId;
+		result_timeout = timeout;
+		result_lastDisconnect = lastDisconnect;
+	};
+
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_sync(storageQueue, block);
+
+	if (resumptionIdPtr)   *resumptionIdPtr   = result_resumptionId;
+	if (timeoutPtr)        *timeoutPtr        = result_timeout;
+	if (lastDisconnectPtr) *lastDisconnectPtr = result_lastDisconnect;
+}
+
+- (void)getLastHandledByClient:(uint32_t *)lastHandledByClientPtr
+           lastHandledByServer:(uint32_t *)lastHandledByServerPtr
+        pendingOutgoingStanzas:(NSArray **)pendingOutgoingStanzasPtr
+                     forStream:(XMPPStream *)stream
+{
+	__block uint32_t result_lastHandledByClient = 0;
+	__block uint32_t result_lastHandledByServer = 0;
+	__block NSArray *result_pendingOutgoingStanzas = nil;
+
+	dispatch_block_t block = ^{
+
+		result_lastHandledByClient = lastHandledByClient;
+		result_lastHandledByServer = lastHandledByServer;
+		result_pendingOutgoingStanzas = [pendingOutgoingStanzas stanzasCopyingItems:YES];
+	};
+
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_sync(storageQueue, block);
+
+	if (lastHandledByClientPtr)    *lastHandledByClientPtr    = result_lastHandledByClient;
+	if (lastHandledByServerPtr)    *lastHandledByServerPtr    = result_lastHandledByServer;
+	if (pendingOutgoingStanzasPtr) *pendingOutgoingStanzasPtr = result_pendingOutgoingStanzas;
+}
+
+- (void)removeAllForStream:(XMPPStream *)stream
+{
+	NSMutableData *record = [NSMutableData dataWithCapacity:16];
+
+	NSUInteger offset = JournalBeginRecord(record, JOURNAL_RECORD_REMOVE_ALL);
+	JournalEndRecord(record, offset);
+
+	[self appendRecord:record];
+
+	// Nothing is worth keeping, so start over with an empty snapshot.
+	// If that fails, the record above still gets written with the next group commit.
+	dispatch_async(storageQueue, ^{ @autoreleasepool {
+
+		[self compactJournal];
+	}});
+}
+
+- (void)flushAsync
+{
+	dispatch_async(storageQueue, ^{ @autoreleasepool {
+
+		[self syncJournal];
+	}});
+}
+
+@end
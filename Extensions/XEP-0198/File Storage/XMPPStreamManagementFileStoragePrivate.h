@@ -0,0 +1,20 @@
+//
+//  This file is for XMPPStreamManagementFileStorage and its tests.
+//
+
+#import <Foundation/Foundation.h>
+#import "XMPPStreamManagementFileStorage.h"
+
+/**
+ * The journal file starts with a header: magic (4 bytes) + version (4 bytes).
+ *
+ * It's followed by any number of records:
+ * length (4 bytes) + checksum (4 bytes) + type (1 byte) + payload (length - 1 bytes)
+ *
+ * The checksum covers the type & payload.
+ * All integers are little endian.
+**/
+#define JOURNAL_MAGIC           0x4A4D5358 // "XSMJ"
+#define JOURNAL_VERSION         1
+#define JOURNAL_HEADER_SIZE     8
+#define JOURNAL_RECORD_OVERHEAD 8
@@ -1,4 +1,5 @@
 #import "XMPPStreamManagementMemoryStorage.h"
+#import "XMPPStreamManagementStanzas.h"
 #import <libkern/OSAtomic.h>
 
 
@@ -19,7 +20,7 @@
 	NSDate *lastDisconnect;
 	uint32_t lastHandledByClient;
 	uint32_t lastHandledByServer;
-	NSArray *pendingOutgoingStanzas;
+	XMPPStreamManagementOutgoingQueue *pendingOutgoingStanzas;
 	
 }
 
@@ -120,7 +121,7 @@
 {
 	lastDisconnect = inLastDisconnect;
 	lastHandledByServer = inLastHandledByServer;
-	pendingOutgoingStanzas = inPendingOutgoingStanzas;
+	pendingOutgoingStanzas = [[XMPPStreamManagementOutgoingQueue alloc] initWithStanzas:inPendingOutgoingStanzas];
 }
 
 /**
@@ -161,7 +162,42 @@
 	lastDisconnect = inLastDisconnect;
 	lastHandledByClient = inLastHandledByClient;
 	lastHandledByServer = inLastHandledByServer;
-	pendingOutgoingStanzas = inPendingOutgoingStanzas;
+	pendingOutgoingStanzas = [[XMPPStreamManagementOutgoingQueue alloc] initWithStanzas:inPendingOutgoingStanzas];
+}
+
+/**
+ * Delta updates of the pendingOutgoingStanzas.
+ * See the note [in XMPPStreamManagement.h]: "Delta updates of the pendingOutgoingStanzas"
+**/
+- (void)setLastDisconnect:(NSDate *)inLastDisconnect
+appendingPendingOutgoingStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+                forStream:(XMPPStream *)stream
+{
+	lastDisconnect = inLastDisconnect;
+	
+	if (pendingOutgoingStanzas == nil) {
+		pendingOutgoingStanzas = [[XMPPStreamManagementOutgoingQueue alloc] init];
+	}
+	[pendingOutgoingStanzas addStanza:stanza];
+}
+
+- (void)replacePendingOutgoingStanzaAtIndex:(NSUInteger)index
+                                 withStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+                                  forStream:(XMPPStream *)stream
+{
+	if (index < [pendingOutgoingStanzas count]) {
+		[pendingOutgoingStanzas replaceStanzaAtIndex:index withStanza:stanza];
+	}
+}
+
+- (void)setLastDisconnect:(NSDate *)inLastDisconnect
+      lastHandledByServer:(uint32_t)inLastHandledByServer
+removingPendingOutgoingStanzas:(NSUInteger)count
+                forStream:(XMPPStream *)stream
+{
+	lastDisconnect = inLastDisconnect;
+	lastHandledByServer = inLastHandledByServer;
+	[pendingOutgoingStanzas removeFirstStanzas:count];
 }
 
 /**
@@ -189,7 +225,7 @@
 {
 	if (lastHandledByClientPtr)    *lastHandledByClientPtr    = lastHandledByClient;
 	if (lastHandledByServerPtr)    *lastHandledByServerPtr    = lastHandledByServer;
-	if (pendingOutgoingStanzasPtr) *pendingOutgoingStanzasPtr = pendingOutgoingStanzas;
+	if (pendingOutgoingStanzasPtr) *pendingOutgoingStanzasPtr = [pendingOutgoingStanzas stanzasCopyingItems:NO];
 }
 
 /**
@@ -19,6 +19,46 @@
 
 #pragma mark -
 
+// Define the initial capacity of an outgoing queue (must be a power of 2)
+#define OUTGOING_QUEUE_MIN_CAPACITY 16
+
+/**
+ * A FIFO of outgoing stanzas (those not yet acked by the server), stored in a ring buffer.
+ *
+ * Stanzas are appended as they're sent, and removed from the front as acks arrive.
+ * Both operations are O(1) (amortized), regardless of the number of pending stanzas.
+**/
+@interface XMPPStreamManagementOutgoingQueue : NSObject
+
+- (instancetype)init;
+- (instancetype)initWithStanzas:(NSArray *)stanzas;
+
+@property (nonatomic, readonly) NSUInteger count;
+
+- (void)addStanza:(XMPPStreamManagementOutgoingStanza *)stanza;
+
+- (XMPPStreamManagementOutgoingStanza *)stanzaAtIndex:(NSUInteger)index;
+- (void)replaceStanzaAtIndex:(NSUInteger)index withStanza:(XMPPStreamManagementOutgoingStanza *)stanza;
+
+/**
+ * Returns the index of the given stanza (compared by identity), or NSNotFound.
+ * The search starts at the end, as that's where recently sent stanzas are.
+**/
+- (NSUInteger)indexOfStanza:(XMPPStreamManagementOutgoingStanza *)stanza;
+
+- (void)removeFirstStanzas:(NSUInteger)count;
+- (void)removeAllStanzas;
+
+/**
+ * Returns the pending stanzas (in order) as an array.
+ * If copyItems is YES, each stanza is copied (e.g. for handing a snapshot to the storage layer).
+**/
+- (NSArray *)stanzasCopyingItems:(BOOL)copyItems;
+
+@end
+
+#pragma mark -
+
 /**
  * An incoming stanza.
  * 
@@ -67,6 +67,152 @@
 #pragma mark -
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+@implementation XMPPStreamManagementOutgoingQueue
+{
+	void **slots;          // Retained stanzas
+	NSUInteger capacity;   // Always a power of 2
+	NSUInteger head;       // Index of the first stanza (within slots)
+	NSUInteger count;
+}
+
+@synthesize count = count;
+
+- (instancetype)init
+{
+	return [self initWithStanzas:nil];
+}
+
+- (instancetype)initWithStanzas:(NSArray *)stanzas
+{
+	if ((self = [super init]))
+	{
+		capacity = OUTGOING_QUEUE_MIN_CAPACITY;
+		while (capacity < [stanzas count]) {
+			capacity <<= 1;
+		}
+		
+		slots = calloc(capacity, sizeof(void *));
+		
+		for (XMPPStreamManagementOutgoingStanza *stanza in stanzas)
+		{
+			slots[count++] = (void *)CFBridgingRetain(stanza);
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[self removeAllStanzas];
+	free(slots);
+}
+
+- (void)grow
+{
+	NSUInteger newCapacity = capacity * 2;
+	void **newSlots = calloc(newCapacity, sizeof(void *));
+	
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		newSlots[i] = slots[(head + i) & (capacity - 1)];
+	}
+	
+	free(slots);
+	slots = newSlots;
+	capacity = newCapacity;
+	head = 0;
+}
+
+- (void)addStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+{
+	NSParameterAssert(stanza != nil);
+	
+	if (count == capacity)
+	{
+		[self grow];
+	}
+	
+	slots[(head + count) & (capacity - 1)] = (void *)CFBridgingRetain(stanza);
+	count++;
+}
+
+- (XMPPStreamManagementOutgoingStanza *)stanzaAtIndex:(NSUInteger)index
+{
+	NSAssert(index < count, @"Index out of bounds");
+	
+	return (__bridge XMPPStreamManagementOutgoingStanza *)slots[(head + index) & (capacity - 1)];
+}
+
+- (void)replaceStanzaAtIndex:(NSUInteger)index withStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+{
+	NSAssert(index < count, @"Index out of bounds");
+	NSParameterAssert(stanza != nil);
+	
+	NSUInteger slot = (head + index) & (capacity - 1);
+	
+	CFRelease(slots[slot]);
+	slots[slot] = (void *)CFBridgingRetain(stanza);
+}
+
+- (NSUInteger)indexOfStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+{
+	NSUInteger i = count;
+	while (i > 0)
+	{
+		i--;
+		if (slots[(head + i) & (capacity - 1)] == (__bridge void *)stanza) {
+			return i;
+		}
+	}
+	
+	return NSNotFound;
+}
+
+- (void)removeFirstStanzas:(NSUInteger)n
+{
+	n = MIN(n, count);
+	
+	for (NSUInteger i = 0; i < n; i++)
+	{
+		NSUInteger slot = (head + i) & (capacity - 1);
+		
+		CFRelease(slots[slot]);
+		slots[slot] = NULL;
+	}
+	
+	head = (head + n) & (capacity - 1);
+	count -= n;
+	
+	if (count == 0) {
+		head = 0;
+	}
+}
+
+- (void)removeAllStanzas
+{
+	[self removeFirstStanzas:count];
+}
+
+- (NSArray *)stanzasCopyingItems:(BOOL)copyItems
+{
+	NSMutableArray *stanzas = [NSMutableArray arrayWithCapacity:count];
+	
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		XMPPStreamManagementOutgoingStanza *stanza = [self stanzaAtIndex:i];
+		
+		[stanzas addObject:(copyItems ? [stanza copy] : stanza)];
+	}
+	
+	return stanzas;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 @implementation XMPPStreamManagementIncomingStanza
 
 @synthesize stanzaId = stanzaId;
@@ -4,6 +4,14 @@
 #define _XMPP_STREAM_MANAGEMENT_H
 
 @protocol XMPPStreamManagementStorage;
+@class XMPPStreamManagementOutgoingStanza;
+
+/**
+ * Blocks for replayUnackedStanzasWithElementBlock:rewriteIds:completionQueue:stanzaCompletion:completion:
+**/
+typedef XMPPElement * (^XMPPStreamManagementReplayElementBlock)(id stanzaId);
+typedef void (^XMPPStreamManagementReplayStanzaCompletionBlock)(id stanzaId, XMPPElement *element, BOOL sent);
+typedef void (^XMPPStreamManagementReplayCompletionBlock)(NSUInteger numberOfSentStanzas, NSError *error);
 
 
 @interface XMPPStreamManagement : XMPPModule
@@ -142,6 +150,115 @@
 **/
 - (void)getAutomaticallySendAcksAfterStanzaCount:(NSUInteger *)stanzaCountPtr orTimeout:(NSTimeInterval *)timeoutPtr;
 
+
+#pragma mark Adaptive Acks
+
+/**
+ * Instead of fixed thresholds, the module can tune the auto request & auto ack configuration itself,
+ * based on the measured round trip time (from <r/> to <a/>), the rate at which stanzas are sent & received,
+ * and the number of stanzas not yet acked by the server.
+ *
+ * For requests <r/>:
+ * - The stanzaCount is as large as possible while keeping the stanzas at risk within maxStanzasAtRisk.
+ *   That is, stanzaCount plus the stanzas expected to be sent during one round trip.
+ *   A request is also sent whenever the number of unacked stanzas reaches maxStanzasAtRisk.
+ * - The timeout is as short as possible while keeping the overhead within maxAckOverhead.
+ *
+ * For acks <a/>:
+ * - The stanzaCount is as small as possible while keeping the overhead within maxAckOverhead,
+ *   but never more than maxStanzasAtRisk.
+ * - The timeout is as short as possible while keeping the overhead within maxAckOverhead.
+ *
+ * The overhead is the number of <r/> & <a/> elements, as a percentage of the number of stanzas.
+ * Should the two targets conflict (e.g. on a high latency link), maxStanzasAtRisk wins.
+ *
+ * The configuration is re-evaluated as acks arrive, and requests are sent.
+ * While a request awaits its ack, the time it has been outstanding is used as the round trip time (if longer),
+ * so acks that are late (or lost) shrink the request stanzaCount.
+ * The adapted values are reported by the getters above, and via the delegate methods
+ * xmppStreamManagement:didAdaptAutoRequestStanzaCount:timeout:roundTripTime:stanzaRate: and
+ * xmppStreamManagement:didAdaptAutoAckStanzaCount:timeout:stanzaRate:
+ *
+ * While enabled, the adapted values override those set via
+ * automaticallyRequestAcksAfterStanzaCount:orTimeout: & automaticallySendAcksAfterStanzaCount:orTimeout:
+ * Disabling leaves the most recently adapted values in place.
+ *
+ * @param maxStanzasAtRisk
+ *   The target maximum number of sent stanzas that haven't been acked by the server.
+ *   If maxStanzasAtRisk is zero, adaptive acks are disabled.
+ *
+ * @param maxAckOverhead
+ *   The target maximum overhead, in percent.
+ *   For example, 10.0 means at most 1 <r/> or <a/> element for every 10 stanzas.
+ *
+ * Adaptive acks are disabled by default.
+**/
+- (void)automaticallyAdaptAcksWithMaxStanzasAtRisk:(NSUInteger)maxStanzasAtRisk maxAckOverhead:(double)maxAckOverhead;
+
+/**
+ * Returns the current adaptive ack configuration.
+ *
+ * @see automaticallyAdaptAcksWithMaxStanzasAtRisk:maxAckOverhead:
+**/
+- (void)getAutomaticallyAdaptAcksWithMaxStanzasAtRisk:(NSUInteger *)maxStanzasAtRiskPtr
+                                       maxAckOverhead:(double *)maxAckOverheadPtr;
+
+/**
+ * The smoothed round trip time, from sending a request <r/> to receiving the ack <a/>.
+ * Returns zero if no round trip has been measured yet.
+ *
+ * This is only measured while adaptive acks are enabled.
+**/
+@property (atomic, readonly) NSTimeInterval roundTripTime;
+
+
+#pragma mark Replay
+
+/**
+ * If a previous session can't be resumed (the server replies with <enabled/> or <failed/> instead of <resumed/>),
+ * the stanzas that were still unacked when that session ended may never have reached the server.
+ * Neither have the stanzas sent along with the stream header, if the server replies <failed/>.
+ * The module keeps their stanzaIds, and informs the delegate(s) via
+ * xmppStreamManagement:didFailToResumeWithUnackedStanzaIds:
+ * 
+ * This method re-sends them on the new session, in their original order:
+ * 
+ * - Stanzas the server reported as handled (the 'h' attribute of <enabled/> or <failed/>, if present)
+ *   have already been removed.
+ * - Stanzas without a stanzaId are skipped (there's no way to look them up),
+ *   as are duplicate stanzaIds, and stanzaIds that are already pending on the new session.
+ * - The elementBlock is asked for the element of each remaining stanzaId (e.g. from your database).
+ *   It's invoked on a global (concurrent) queue, never on the moduleQueue or the completionQueue,
+ *   once per stanzaId, one at a time, in order. Return nil to skip the stanza.
+ * - If rewriteIds is YES, each element is copied and given a new id (via generateElementID).
+ * - The elements are sent as a single corked batch (see XMPPStream's sendElements:completionQueue:elementCompletion:).
+ * 
+ * The stanzaCompletion block is invoked once for each stanzaId handed to the elementBlock,
+ * with the element that was sent (nil if skipped), and whether it was written to the socket.
+ * 
+ * The completion block is always invoked exactly once, after the last stanzaCompletion,
+ * with the number of stanzas that were written to the socket.
+ * If there was nothing to replay, that's zero.
+ * If the replay couldn't start (stream management hasn't been enabled on the new session, or elementBlock is nil),
+ * the error is set (XMPPStreamErrorDomain, XMPPStreamInvalidState or XMPPStreamInvalidParameter),
+ * and the stanzaIds are kept for a later attempt.
+ * 
+ * Both blocks are invoked on the given queue, or on the main queue if NULL.
+ * 
+ * The replayed stanzas are tracked like any other sent stanza (and acked via didReceiveAckForStanzaIds:).
+ * Each unacked stanza is only replayed once.
+**/
+- (void)replayUnackedStanzasWithElementBlock:(XMPPStreamManagementReplayElementBlock)elementBlock
+                                  rewriteIds:(BOOL)rewriteIds
+                             completionQueue:(dispatch_queue_t)completionQueue
+                            stanzaCompletion:(XMPPStreamManagementReplayStanzaCompletionBlock)stanzaCompletion
+                                  completion:(XMPPStreamManagementReplayCompletionBlock)completion;
+
+/**
+ * The stanzaIds that would currently be replayed (before de-duplication).
+**/
+- (NSArray *)unackedStanzaIdsToReplay;
+
 /**
  * If an explicit request <r/> is received from the server, should we delay sending the ack <a/> ?
  * From XEP-0198 :
@@ -219,6 +336,16 @@
 - (void)xmppStreamManagement:(XMPPStreamManagement *)sender wasEnabled:(NSXMLElement *)enabled;
 - (void)xmppStreamManagement:(XMPPStreamManagement *)sender wasNotEnabled:(NSXMLElement *)failed;
 
+/**
+ * Invoked after the server replied <enabled/> or <failed/> to a stream that had unacked stanzas,
+ * either from a previous session, or sent along with the stream header.
+ * That is, the previous session couldn't be resumed, so these stanzas might never have reached the server.
+ * Stanzas the server reported as handled (via the 'h' attribute) are acked instead.
+ * 
+ * @see replayUnackedStanzasWithElementBlock:rewriteIds:completionQueue:stanzaCompletion:completion:
+**/
+- (void)xmppStreamManagement:(XMPPStreamManagement *)sender didFailToResumeWithUnackedStanzaIds:(NSArray *)stanzaIds;
+
 /**
  * Notifies delegates that a request <r/> for an ack from the server was sent.
 **/
@@ -240,6 +367,36 @@
 **/
 - (void)xmppStreamManagement:(XMPPStreamManagement *)sender didReceiveAckForStanzaIds:(NSArray *)stanzaIds;
 
+/**
+ * Invoked when adaptive acks change the auto request configuration.
+ *
+ * @param roundTripTime
+ *   The smoothed round trip time the decision was based on.
+ *
+ * @param stanzaRate
+ *   The measured rate of outgoing stanzas (per second) the decision was based on.
+ *
+ * @see automaticallyAdaptAcksWithMaxStanzasAtRisk:maxAckOverhead:
+**/
+- (void)xmppStreamManagement:(XMPPStreamManagement *)sender
+    didAdaptAutoRequestStanzaCount:(NSUInteger)stanzaCount
+                           timeout:(NSTimeInterval)timeout
+                     roundTripTime:(NSTimeInterval)roundTripTime
+                        stanzaRate:(double)stanzaRate;
+
+/**
+ * Invoked when adaptive acks change the auto ack configuration.
+ *
+ * @param stanzaRate
+ *   The measured rate of incoming stanzas (per second) the decision was based on.
+ *
+ * @see automaticallyAdaptAcksWithMaxStanzasAtRisk:maxAckOverhead:
+**/
+- (void)xmppStreamManagement:(XMPPStreamManagement *)sender
+    didAdaptAutoAckStanzaCount:(NSUInteger)stanzaCount
+                       timeout:(NSTimeInterval)timeout
+                    stanzaRate:(double)stanzaRate;
+
 /**
  * XEP-0198 reports the following regarding duplicate stanzas:
  *
@@ -274,6 +431,27 @@
 **/
 - (id)xmppStreamManagement:(XMPPStreamManagement *)sender stanzaIdForSentElement:(XMPPElement *)element;
 
+/**
+ * A synchronous alternative to xmppStreamManagement:stanzaIdForSentElement:
+ *
+ * The method above is invoked asynchronously (on a background queue, in batches),
+ * so until it returns, the sent element is tracked with a placeholder.
+ * This method is instead invoked inline as the element is sent,
+ * so implement it if you can answer immediately (e.g. the stanzaId is derived from the element itself).
+ * 
+ * Unlike the other delegate methods, it's invoked synchronously on the module's internal queue,
+ * NOT on the delegateQueue you registered. The delegates are asked one at a time, in the order they were added.
+ * So it must be fast and thread-safe: don't block, don't hit the database,
+ * and don't synchronously wait on any queue that may itself be waiting on the module (e.g. the xmppStream's queue).
+ *
+ * Return YES if you've answered, in which case *stanzaIdPtr is used as the stanzaId
+ * (if you set it to nil, the elementId is used).
+ * Return NO to defer to the other delegates, and then to xmppStreamManagement:stanzaIdForSentElement:
+**/
+- (BOOL)xmppStreamManagement:(XMPPStreamManagement *)sender
+                 getStanzaId:(id *)stanzaIdPtr
+              forSentElement:(XMPPElement *)element;
+
 /**
  * It's critically important to understand what an ACK means.
  *
@@ -521,6 +699,43 @@
 **/
 - (void)removeAllForStream:(XMPPStream *)stream;
 
+@optional
+
+/// ***** Delta updates of the pendingOutgoingStanzas *****
+///
+/// By default, every change to the pending outgoing stanzas hands the storage layer a full snapshot
+/// (via setLastDisconnect:lastHandledByServer:pendingOutgoingStanzas:forStream:).
+/// With thousands of unacked stanzas (e.g. a burst of messages on a slow link) that's a lot of copying.
+///
+/// If the storage class implements ALL of the methods below, then during stream operation
+/// it instead receives the individual changes: stanzas appended as they're sent,
+/// stanzaIds filled in as they're determined, and stanzas removed from the front as acks arrive.
+/// The snapshot methods are still used to (re)establish the full list,
+/// e.g. after a disconnect, or when a session is enabled or resumed.
+
+/**
+ * Appends the given stanza to the end of the pendingOutgoingStanzas.
+ * The stanza may still be awaiting its stanzaId, in which case the replace method below will follow.
+**/
+- (void)setLastDisconnect:(NSDate *)date
+appendingPendingOutgoingStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+                forStream:(XMPPStream *)stream;
+
+/**
+ * Replaces the stanza at the given index (from the front) of the pendingOutgoingStanzas.
+**/
+- (void)replacePendingOutgoingStanzaAtIndex:(NSUInteger)index
+                                 withStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+                                  forStream:(XMPPStream *)stream;
+
+/**
+ * Updates the lastHandledByServer, and removes the given number of stanzas from the front of the pendingOutgoingStanzas.
+**/
+- (void)setLastDisconnect:(NSDate *)date
+      lastHandledByServer:(uint32_t)lastHandledByServer
+removingPendingOutgoingStanzas:(NSUInteger)count
+                forStream:(XMPPStream *)stream;
+
 @end
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -5,6 +5,7 @@
 #import "XMPPLogging.h"
 #import "NSNumber+XMPP.h"
 #import "XMPPStreamManagementMemoryStorage.h"
+#import <libkern/OSAtomic.h>
 
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
@@ -23,6 +24,45 @@
 **/
 #define XMLNS_STREAM_MANAGEMENT  @"urn:xmpp:sm:3"
 
+/**
+ * Adaptive acks.
+**/
+#define ADAPTIVE_RATE_WINDOW   5.0 // Time constant (in seconds) of the stanza rate estimates
+#define ADAPTIVE_DEFAULT_RTT   1.0 // Used until the first round trip has been measured
+#define ADAPTIVE_MIN_TIMEOUT   0.5
+#define ADAPTIVE_MAX_TIMEOUT  30.0
+
+/**
+ * An exponentially decaying count of events, which converges on the event rate (per second).
+ * Updating it is O(1), and it doesn't need a timer.
+**/
+typedef struct {
+	double rate;
+	NSTimeInterval lastUpdate;
+} XMPPStanzaRate;
+
+static double XMPPStanzaRateAtTime(const XMPPStanzaRate *stanzaRate, NSTimeInterval now)
+{
+	if (stanzaRate->lastUpdate == 0.0) return 0.0;
+	
+	return stanzaRate->rate * exp(-(now - stanzaRate->lastUpdate) / ADAPTIVE_RATE_WINDOW);
+}
+
+static void XMPPStanzaRateAddStanza(XMPPStanzaRate *stanzaRate, NSTimeInterval now)
+{
+	stanzaRate->rate = XMPPStanzaRateAtTime(stanzaRate, now) + (1.0 / ADAPTIVE_RATE_WINDOW);
+	stanzaRate->lastUpdate = now;
+}
+
+/**
+ * Adapted values are only applied (and reported) if they differ by more than 10%,
+ * so the configuration doesn't flap with every small fluctuation in the measurements.
+**/
+static BOOL XMPPAdaptedValueDiffers(double newValue, double oldValue)
+{
+	return fabs(newValue - oldValue) > (0.1 * MAX(newValue, oldValue));
+}
+
 /**
  * Seeing a return statements within an inner block
  * can sometimes be mistaken for a return point of the enclosing method.
@@ -36,10 +76,12 @@
 	// Storage module (may be nil)
 	
 	id <XMPPStreamManagementStorage> storage;
+	BOOL storageSupportsDeltas;
 	
 	// State machine
 	
 	BOOL isStarted;    // either <enabled/> or <resumed/> received from server
+	BOOL isOpening;    // stream header (which requests enable/resume) sent, awaiting <enabled/> or <resumed/>
 	
 	BOOL wasCleanDisconnect; // xmppStream sent </stream:stream>
 			
@@ -55,6 +97,17 @@
 	
 	NSTimeInterval ackResponseDelay;
 	
+	NSUInteger adaptive_maxStanzasAtRisk; // zero if adaptive acks are disabled
+	double adaptive_maxAckOverhead;       // in percent
+	
+	// Adaptive acks
+	
+	NSTimeInterval smoothedRoundTripTime; // zero until the first round trip has been measured
+	NSTimeInterval ackRequestTime;        // when the outstanding request <r/> was sent (zero if none)
+	
+	XMPPStanzaRate outgoingStanzaRate;
+	XMPPStanzaRate incomingStanzaRate;
+	
 	// Enable
 	
 	uint32_t requestedMax;
@@ -63,15 +116,19 @@
 	
 	uint32_t lastHandledByServer; // last h value received from server
 	
-	NSMutableArray *unackedByServer;              // array of XMPPStreamManagementOutgoingStanza objects
+	XMPPStreamManagementOutgoingQueue *unackedByServer; // queue of XMPPStreamManagementOutgoingStanza objects
 	NSUInteger unackedByServer_lastRequestOffset; // represents point at which we last sent a request
 	
 	NSArray *prev_unackedByServer;                // from previous connection, used when resuming session
+	NSMutableArray *unackedStanzaIdsToReplay;     // from previous connection(s), that couldn't be resumed
 	
 	NSMutableArray *unprocessedReceivedAcks; // acks received from server that we haven't processed yet
 	
 	XMPPTimer *autoRequestTimer;                  // timer to fire a request
 	
+	NSMutableArray *stanzaIdLookupStanzas;  // placeholders awaiting the (batched) stanzaId lookup
+	NSMutableArray *stanzaIdLookupElements; // the corresponding sent elements
+	
 	// Tracking incoming stanzas
 	
 	uint32_t lastHandledByClient; // latest h value we can send to the server
@@ -126,7 +183,12 @@
 			XMPPLogError(@"%@: %@ - Unable to configure storage!", THIS_FILE, THIS_METHOD);
 		}
 		
-		unackedByServer = [[NSMutableArray alloc] init];
+		storageSupportsDeltas =
+		  [storage respondsToSelector:@selector(setLastDisconnect:appendingPendingOutgoingStanza:forStream:)] &&
+		  [storage respondsToSelector:@selector(replacePendingOutgoingStanzaAtIndex:withStanza:forStream:)] &&
+		  [storage respondsToSelector:@selector(setLastDisconnect:lastHandledByServer:removingPendingOutgoingStanzas:forStream:)];
+		
+		unackedByServer = [[XMPPStreamManagementOutgoingQueue alloc] init];
 		unackedByClient = [[NSMutableArray alloc] init];
 	}
 	return self;
@@ -242,6 +304,75 @@
 	if (timeoutPtr) *timeoutPtr = timeout;
 }
 
+- (void)automaticallyAdaptAcksWithMaxStanzasAtRisk:(NSUInteger)maxStanzasAtRisk maxAckOverhead:(double)maxAckOverhead
+{
+	XMPPLogTrace();
+	
+	dispatch_block_t block = ^{ @autoreleasepool{
+		
+		adaptive_maxStanzasAtRisk = maxStanzasAtRisk;
+		adaptive_maxAckOverhead = MAX(0.0, maxAckOverhead);
+		
+		if (adaptive_maxStanzasAtRisk == 0)
+		{
+			ackRequestTime = 0.0;
+			return_from_block;
+		}
+		
+		[self adaptAckCadence];
+		
+		if (isStarted) {
+			[self maybeRequestAck];
+			[self maybeSendAck];
+		}
+	}};
+	
+	if (dispatch_get_specific(moduleQueueTag))
+		block();
+	else
+		dispatch_async(moduleQueue, block);
+}
+
+- (void)getAutomaticallyAdaptAcksWithMaxStanzasAtRisk:(NSUInteger *)maxStanzasAtRiskPtr
+                                       maxAckOverhead:(double *)maxAckOverheadPtr
+{
+	XMPPLogTrace();
+	
+	__block NSUInteger maxStanzasAtRisk = 0;
+	__block double maxAckOverhead = 0.0;
+	
+	dispatch_block_t block = ^{
+		
+		maxStanzasAtRisk = adaptive_maxStanzasAtRisk;
+		maxAckOverhead = adaptive_maxAckOverhead;
+	};
+	
+	if (dispatch_get_specific(moduleQueueTag))
+		block();
+	else
+		dispatch_sync(moduleQueue, block);
+	
+	if (maxStanzasAtRiskPtr) *maxStanzasAtRiskPtr = maxStanzasAtRisk;
+	if (maxAckOverheadPtr) *maxAckOverheadPtr = maxAckOverhead;
+}
+
+- (NSTimeInterval)roundTripTime
+{
+	__block NSTimeInterval rtt = 0.0;
+	
+	dispatch_block_t block = ^{
+		
+		rtt = smoothedRoundTripTime;
+	};
+	
+	if (dispatch_get_specific(moduleQueueTag))
+		block();
+	else
+		dispatch_sync(moduleQueue, block);
+	
+	return rtt;
+}
+
 - (NSTimeInterval)ackResponseDelay
 {
 	XMPPLogTrace();
@@ -311,7 +442,7 @@
     dispatch_block_t block = ^{ @autoreleasepool{
         // State transition cleanup
         
-        [unackedByServer removeAllObjects];
+        [unackedByServer removeAllStanzas];
         unackedByServer_lastRequestOffset = 0;
         
         [unackedByClient removeAllObjects];
@@ -324,6 +455,10 @@
     
         isStarted = NO;
         
+        // The stream header requests <enabled/> or <resumed/>,
+        // so the server counts the stanzas sent after it, including the early elements sent along with it.
+        isOpening = YES;
+        
         uint32_t newLastHandledByClient = 0;
         uint32_t newLastHandledByServer = 0;
         NSArray *pendingOutgoingStanzas = nil;
@@ -470,19 +605,326 @@
 		XMPPLogVerbose(@"%@: processResumed: lastHandledByServer(%u)", THIS_FILE, lastHandledByServer);
 		
 		isStarted = YES;
+		isOpening = NO;
 		
 		prev_unackedByServer = nil;
 				
 		// Update storage
+		// 
+		// Any stanzas sent along with the stream header were recorded in unackedByServer,
+		// and are counted by the server on top of the resumed 'h' value.
 		
 		[storage setLastDisconnect:[NSDate date]
 		       lastHandledByServer:lastHandledByServer
-		    pendingOutgoingStanzas:nil
+		    pendingOutgoingStanzas:[unackedByServer stanzasCopyingItems:YES]
 		                 forStream:xmppStream];
 		
 		// Notify delegate
 		
 		[multicastDelegate xmppStreamManagement:self didReceiveAckForStanzaIds:stanzaIds];
+		
+		[self maybeRequestAck];
+	}};
+	
+	if (dispatch_get_specific(moduleQueueTag))
+		block();
+	else
+		dispatch_async(moduleQueue, block);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Replay
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Invoked when the server replies <enabled/> or <failed/>, meaning the previous session (if any) wasn't resumed.
+ * Moves the stanzas left unacked by the previous session to the replay list,
+ * followed by the given stanzas of this session that will never be acked (those sent along with the stream header,
+ * if stream management couldn't be enabled).
+ * 
+ * Both responses may carry the 'h' value of the previous session,
+ * i.e. how many of its unacked stanzas the server did handle.
+**/
+- (void)prepareReplayWithResponse:(NSXMLElement *)response unackedStanzas:(NSArray *)currentUnacked
+{
+	XMPPLogTrace();
+	
+	NSArray *unacked = prev_unackedByServer;
+	prev_unackedByServer = nil;
+	
+	if (([unacked count] + [currentUnacked count]) == 0) return;
+	
+	// The server may report how many of them it handled (the 'h' value)
+	
+	NSUInteger handled = 0;
+	
+	uint32_t h = 0;
+	if ([unacked count] > 0 && [NSNumber xmpp_parseString:[response attributeStringValueForName:@"h"] intoUInt32:&h])
+	{
+		uint32_t diff;
+		if (h >= lastHandledByServer)
+			diff = h - lastHandledByServer;
+		else
+			diff = (UINT32_MAX - lastHandledByServer) + h;
+		
+		handled = MIN((NSUInteger)diff, [unacked count]);
+	}
+	
+	if ([currentUnacked count] > 0) {
+		unacked = [(unacked ?: @[]) arrayByAddingObjectsFromArray:currentUnacked];
+	}
+	
+	NSMutableArray *ackedStanzaIds = [NSMutableArray arrayWithCapacity:handled];
+	NSMutableArray *stanzaIds = [NSMutableArray arrayWithCapacity:([unacked count] - handled)];
+	
+	NSUInteger i = 0;
+	for (XMPPStreamManagementOutgoingStanza *stanza in unacked)
+	{
+		if (stanza.stanzaId)
+		{
+			if (i < handled)
+				[ackedStanzaIds addObject:stanza.stanzaId];
+			else
+				[stanzaIds addObject:stanza.stanzaId];
+		}
+		i++;
+	}
+	
+	XMPPLogVerbose(@"%@: Unable to resume: acked(%lu) unacked(%lu)", THIS_FILE,
+	               (unsigned long)[ackedStanzaIds count], (unsigned long)[stanzaIds count]);
+	
+	if ([ackedStanzaIds count] > 0)
+	{
+		[multicastDelegate xmppStreamManagement:self didReceiveAckForStanzaIds:ackedStanzaIds];
+	}
+	
+	if ([stanzaIds count] > 0)
+	{
+		if (unackedStanzaIdsToReplay == nil)
+			unackedStanzaIdsToReplay = [[NSMutableArray alloc] initWithCapacity:[stanzaIds count]];
+		
+		[unackedStanzaIdsToReplay addObjectsFromArray:stanzaIds];
+		
+		[multicastDelegate xmppStreamManagement:self didFailToResumeWithUnackedStanzaIds:stanzaIds];
+	}
+}
+
+- (NSArray *)unackedStanzaIdsToReplay
+{
+	XMPPLogTrace();
+	
+	__block NSArray *result = nil;
+	
+	dispatch_block_t block = ^{
+		
+		result = [unackedStanzaIdsToReplay copy];
+	};
+	
+	if (dispatch_get_specific(moduleQueueTag))
+		block();
+	else
+		dispatch_sync(moduleQueue, block);
+	
+	return result;
+}
+
+/**
+ * Removes & returns the stanzaIds to replay,
+ * skipping duplicates, and those already pending on this session (e.g. re-sent by the app itself).
+**/
+- (NSArray *)dequeueUnackedStanzaIdsToReplay
+{
+	NSArray *candidates = unackedStanzaIdsToReplay;
+	unackedStanzaIdsToReplay = nil;
+	
+	NSMutableSet *seen = [NSMutableSet setWithCapacity:([candidates count] + [unackedByServer count])];
+	
+	for (XMPPStreamManagementOutgoingStanza *stanza in [unackedByServer stanzasCopyingItems:NO])
+	{
+		if (stanza.stanzaId) {
+			[seen addObject:stanza.stanzaId];
+		}
+	}
+	
+	NSMutableArray *stanzaIds = [NSMutableArray arrayWithCapacity:[candidates count]];
+	
+	for (id stanzaId in candidates)
+	{
+		if (![seen containsObject:stanzaId])
+		{
+			[seen addObject:stanzaId];
+			[stanzaIds addObject:stanzaId];
+		}
+	}
+	
+	return stanzaIds;
+}
+
+- (void)replayUnackedStanzasWithElementBlock:(XMPPStreamManagementReplayElementBlock)elementBlock
+                                  rewriteIds:(BOOL)rewriteIds
+                             completionQueue:(dispatch_queue_t)completionQueue
+                            stanzaCompletion:(XMPPStreamManagementReplayStanzaCompletionBlock)stanzaCompletion
+                                  completion:(XMPPStreamManagementReplayCompletionBlock)completion
+{
+	XMPPLogTrace();
+	
+	// This is a PUBLIC method
+	
+	XMPPStreamManagementReplayElementBlock elementBlockCopy = [elementBlock copy];
+	XMPPStreamManagementReplayStanzaCompletionBlock stanzaCompletionCopy = [stanzaCompletion copy];
+	XMPPStreamManagementReplayCompletionBlock completionCopy = [completion copy];
+	
+	dispatch_queue_t callbackQueue = completionQueue ?: dispatch_get_main_queue();
+	
+	if (elementBlockCopy == nil)
+	{
+		if (completionCopy)
+		{
+			NSError *error = [NSError errorWithDomain:XMPPStreamErrorDomain
+			                                     code:XMPPStreamInvalidParameter
+			                                 userInfo:@{ NSLocalizedDescriptionKey : @"elementBlock is nil" }];
+			
+			dispatch_async(callbackQueue, ^{ @autoreleasepool {
+				completionCopy(0, error);
+			}});
+		}
+		return;
+	}
+	
+	dispatch_block_t block = ^{ @autoreleasepool{
+		
+		if (!isStarted)
+		{
+			XMPPLogWarn(@"%@: Cannot replay unacked stanzas: stream management isn't enabled", THIS_FILE);
+			
+			if (completionCopy)
+			{
+				NSError *error = [NSError errorWithDomain:XMPPStreamErrorDomain
+				                                     code:XMPPStreamInvalidState
+				                                 userInfo:@{ NSLocalizedDescriptionKey : @"Stream management isn't enabled" }];
+				
+				dispatch_async(callbackQueue, ^{ @autoreleasepool {
+					completionCopy(0, error);
+				}});
+			}
+			return_from_block;
+		}
+		
+		NSArray *stanzaIds = [self dequeueUnackedStanzaIdsToReplay];
+		if ([stanzaIds count] == 0)
+		{
+			if (completionCopy)
+			{
+				dispatch_async(callbackQueue, ^{ @autoreleasepool {
+					completionCopy(0, nil);
+				}});
+			}
+			return_from_block;
+		}
+		
+		XMPPStream *stream = xmppStream;
+		
+		// Looking up the elements may be slow (e.g. a database fetch), so do it off the moduleQueue.
+		
+		dispatch_queue_t concurrentQ = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+		dispatch_async(concurrentQ, ^{ @autoreleasepool {
+			
+			NSMutableArray *elements = [NSMutableArray arrayWithCapacity:[stanzaIds count]];
+			NSMutableArray *elementStanzaIds = [NSMutableArray arrayWithCapacity:[stanzaIds count]];
+			NSMutableArray *skippedStanzaIds = [NSMutableArray arrayWithCapacity:0];
+			
+			for (id stanzaId in stanzaIds)
+			{
+				XMPPElement *element = elementBlockCopy(stanzaId);
+				if (element == nil)
+				{
+					[skippedStanzaIds addObject:stanzaId];
+					continue;
+				}
+				
+				if (rewriteIds)
+				{
+					element = [element copy];
+					
+					[element removeAttributeForName:@"id"];
+					[element addAttributeWithName:@"id" stringValue:[stream generateElementID]];
+				}
+				
+				[elements addObject:element];
+				[elementStanzaIds addObject:stanzaId];
+			}
+			
+			XMPPLogVerbose(@"%@: Replaying unacked stanzas: replayed(%lu) skipped(%lu)", THIS_FILE,
+			               (unsigned long)[elements count], (unsigned long)[skippedStanzaIds count]);
+			
+			// The completion follows every stanzaCompletion, which may run concurrently (on a concurrent queue)
+			
+			dispatch_group_t group = dispatch_group_create();
+			__block int32_t numberOfSentStanzas = 0;
+			
+			if ([skippedStanzaIds count] > 0)
+			{
+				dispatch_group_async(group, callbackQueue, ^{ @autoreleasepool {
+					
+					if (stanzaCompletionCopy)
+					{
+						for (id stanzaId in skippedStanzaIds)
+						{
+							stanzaCompletionCopy(stanzaId, nil, NO);
+						}
+					}
+				}});
+			}
+			
+			if ([elements count] > 0)
+			{
+				for (NSUInteger i = 0; i < [elements count]; i++)
+				{
+					dispatch_group_enter(group);
+				}
+				
+				XMPPElementSendCompletionBlock elementCompletion = ^(NSUInteger index, BOOL sent) {
+					
+					if (sent) {
+						OSAtomicIncrement32(&numberOfSentStanzas);
+					}
+					if (stanzaCompletionCopy) {
+						stanzaCompletionCopy(elementStanzaIds[index], elements[index], sent);
+					}
+					
+					dispatch_group_leave(group);
+				};
+				
+				if (stream)
+				{
+					[stream sendElements:elements completionQueue:callbackQueue elementCompletion:elementCompletion];
+				}
+				else
+				{
+					// The module was deactivated in the meantime
+					
+					dispatch_async(callbackQueue, ^{ @autoreleasepool {
+						
+						for (NSUInteger i = 0; i < [elements count]; i++)
+						{
+							elementCompletion(i, NO);
+						}
+					}});
+				}
+			}
+			
+			if (completionCopy)
+			{
+				dispatch_group_notify(group, callbackQueue, ^{ @autoreleasepool {
+					
+					completionCopy((NSUInteger)numberOfSentStanzas, nil);
+				}});
+			}
+			
+			#if !OS_OBJECT_USE_OBJC
+			dispatch_release(group);
+			#endif
+		}});
 	}};
 	
 	if (dispatch_get_specific(moduleQueueTag))
@@ -538,6 +980,17 @@
 		// Reset offset
 		
 		unackedByServer_lastRequestOffset = [unackedByServer count];
+		
+		// Adaptive acks: time the round trip (only one request is timed at a time),
+		// and take the latest stanza rate into account, as acks may be slow to arrive on a lossy link.
+		
+		if (adaptive_maxStanzasAtRisk > 0)
+		{
+			if (ackRequestTime == 0.0) {
+				ackRequestTime = [NSDate timeIntervalSinceReferenceDate];
+			}
+			[self adaptAckCadence];
+		}
 	}
 	
 	[autoRequestTimer cancel];
@@ -566,6 +1019,14 @@
 		return NO;
 	}
 	
+	if ((adaptive_maxStanzasAtRisk > 0) && (ackRequestTime == 0.0) &&
+	    ([unackedByServer count] >= adaptive_maxStanzasAtRisk))
+	{
+		// Too many stanzas at risk, and no outstanding request
+		[self _requestAck];
+		return YES;
+	}
+	
 	if ((autoRequest_stanzaCount > 0) && (pending >= autoRequest_stanzaCount))
 	{
 		[self _requestAck];
@@ -592,20 +1053,35 @@
 {
 	XMPPLogTrace();
 	
+	if (adaptive_maxStanzasAtRisk > 0)
+	{
+		XMPPStanzaRateAddStanza(&outgoingStanzaRate, [NSDate timeIntervalSinceReferenceDate]);
+	}
+	
 	SEL selector = @selector(xmppStreamManagement:stanzaIdForSentElement:);
 	
-	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
+	id stanzaId = nil;
+	BOOL hasStanzaId = [self getInlineStanzaId:&stanzaId forSentElement:element];
+	
+	if (hasStanzaId || ![multicastDelegate hasDelegateThatRespondsToSelector:selector])
 	{
-		// There are not any delegates that respond to the selector.
-		// So the stanzaId is the elementId (if there is one).
+		// Either a delegate answered inline,
+		// or there are not any delegates that respond to the (asynchronous) selector.
+		// If there's no stanzaId, then it's the elementId (if there is one).
 		
-		NSString *elementId = [element elementID];
+		if (stanzaId == nil)
+		{
+			stanzaId = [element elementID];
+		}
 		
 		XMPPStreamManagementOutgoingStanza *stanza =
-		  [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:elementId];
-		[unackedByServer addObject:stanza];
+		  [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:stanzaId];
+		[unackedByServer addStanza:stanza];
 		
-		[self updateStoredPendingOutgoingStanzas];
+		if (storageSupportsDeltas)
+			[self storeAppendedOutgoingStanza:stanza];
+		else
+			[self updateStoredPendingOutgoingStanzas];
 		
 		// At bottom of this method:
 		// [self maybeRequestAck];
@@ -617,23 +1093,124 @@
 		
 		XMPPStreamManagementOutgoingStanza *stanza =
 		  [[XMPPStreamManagementOutgoingStanza alloc] initAwaitingStanzaId];
-		[unackedByServer addObject:stanza];
+		[unackedByServer addStanza:stanza];
 		
-		// Start the asynchronous process to find the proper stanzaId
+		// A storage class that receives deltas must see the placeholder now, to keep the indexes in sync.
+		if (storageSupportsDeltas)
+		{
+			[self storeAppendedOutgoingStanza:stanza];
+		}
 		
-		GCDMulticastDelegateEnumerator *enumerator = [multicastDelegate delegateEnumerator];
+		// Start the asynchronous process to find the proper stanzaId
 		
-		dispatch_queue_t concurrentQ = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-		dispatch_async(concurrentQ, ^{ @autoreleasepool {
+		[self enqueueStanzaIdLookupForStanza:stanza element:element];
+	}
+	
+	XMPPLogVerbose(@"%@: processSentElement (%@): lastHandledByServer(%u) pending(%lu)",
+	               THIS_FILE, [element name], lastHandledByServer, (unsigned long)[unackedByServer count]);
+	
+	[self maybeRequestAck];
+}
+
+/**
+ * Asks the delegate(s) that implement xmppStreamManagement:getStanzaId:forSentElement: for the stanzaId,
+ * inline on the moduleQueue (not on their delegate queues, as documented in the header).
+ * 
+ * Returns YES if one of them answered (in which case the stanzaId may still be nil).
+**/
+- (BOOL)getInlineStanzaId:(id *)stanzaIdPtr forSentElement:(XMPPElement *)element
+{
+	SEL selector = @selector(xmppStreamManagement:getStanzaId:forSentElement:);
+	
+	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
+	{
+		return NO;
+	}
+	
+	GCDMulticastDelegateEnumerator *enumerator = [multicastDelegate delegateEnumerator];
+	
+	id delegate = nil;
+	dispatch_queue_t dq = NULL;
+	
+	while ([enumerator getNextDelegate:&delegate delegateQueue:&dq forSelector:selector])
+	{
+		id stanzaId = nil;
+		if ([delegate xmppStreamManagement:self getStanzaId:&stanzaId forSentElement:element])
+		{
+			*stanzaIdPtr = stanzaId;
+			return YES;
+		}
+	}
+	
+	return NO;
+}
+
+/**
+ * Queues a placeholder stanza for the asynchronous stanzaId lookup.
+ * 
+ * Lookups are batched: all the elements sent during the current moduleQueue turn (and any turns already queued)
+ * are resolved by a single block on the concurrent queue, with a single hop back to the moduleQueue.
+**/
+- (void)enqueueStanzaIdLookupForStanza:(XMPPStreamManagementOutgoingStanza *)stanza element:(XMPPElement *)element
+{
+	if (stanzaIdLookupStanzas == nil)
+	{
+		stanzaIdLookupStanzas = [[NSMutableArray alloc] init];
+		stanzaIdLookupElements = [[NSMutableArray alloc] init];
+	}
+	
+	[stanzaIdLookupStanzas addObject:stanza];
+	[stanzaIdLookupElements addObject:element];
+	
+	if ([stanzaIdLookupStanzas count] == 1)
+	{
+		dispatch_async(moduleQueue, ^{ @autoreleasepool {
 			
+			[self lookupQueuedStanzaIds];
+		}});
+	}
+}
+
+- (void)lookupQueuedStanzaIds
+{
+	XMPPLogTrace();
+	
+	NSArray *stanzas = stanzaIdLookupStanzas;
+	NSArray *elements = stanzaIdLookupElements;
+	
+	stanzaIdLookupStanzas = nil;
+	stanzaIdLookupElements = nil;
+	
+	if ([stanzas count] == 0) return;
+	
+	SEL selector = @selector(xmppStreamManagement:stanzaIdForSentElement:);
+	
+	GCDMulticastDelegateEnumerator *enumerator = [multicastDelegate delegateEnumerator];
+	
+	dispatch_queue_t concurrentQ = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+	dispatch_async(concurrentQ, ^{ @autoreleasepool {
+		
+		// The enumerator can only be walked once, so take the delegates out of it first.
+		
+		NSMutableArray *delegates = [NSMutableArray arrayWithCapacity:1];
+		
+		id delegate = nil;
+		dispatch_queue_t dq = NULL;
+		
+		while ([enumerator getNextDelegate:&delegate delegateQueue:&dq forSelector:selector])
+		{
+			[delegates addObject:delegate];
+		}
+		
+		NSMutableArray *stanzaIds = [NSMutableArray arrayWithCapacity:[elements count]];
+		
+		for (XMPPElement *element in elements)
+		{
 			id stanzaId = nil;
 			
-			id delegate = nil;
-			dispatch_queue_t dq = NULL;
-			
-			while ([enumerator getNextDelegate:&delegate delegateQueue:&dq forSelector:selector])
+			for (id stanzaIdDelegate in delegates)
 			{
-				stanzaId = [delegate xmppStreamManagement:self stanzaIdForSentElement:element];
+				stanzaId = [stanzaIdDelegate xmppStreamManagement:self stanzaIdForSentElement:element];
 				if (stanzaId)
 				{
 					break;
@@ -645,46 +1222,59 @@
 				stanzaId = [element elementID];
 			}
 			
-			dispatch_async(moduleQueue, ^{ @autoreleasepool{
-				
-				// Set the stanzaId.
-				stanza.stanzaId = stanzaId;
-				stanza.awaitingStanzaId = NO;
-				
-				// It's possible that we received an ack from the sever (acking our stanza)
-				// before we were able to determine its stanzaId.
-				// This edge case is handled by storing the ack in the pendingAcks array for later processing.
-				// We may be able to process it now.
-				
-				BOOL dequeuedPendingAck = NO;
-				
-				while ([unprocessedReceivedAcks count] > 0)
-				{
-					NSXMLElement *ack = unprocessedReceivedAcks[0];
-					
-					if ([self processReceivedAck:ack])
-					{
-						[unprocessedReceivedAcks removeObjectAtIndex:0];
-						dequeuedPendingAck = YES;
-					}
-					else
-					{
-						break;
-					}
-				}
-				
-				if (!dequeuedPendingAck)
-				{
-					[self updateStoredPendingOutgoingStanzas];
-				}
-			}});
+			[stanzaIds addObject:(stanzaId ?: [NSNull null])];
+		}
+		
+		dispatch_async(moduleQueue, ^{ @autoreleasepool{
+			
+			[self didLookupStanzaIds:stanzaIds forStanzas:stanzas];
 		}});
+	}});
+}
+
+- (void)didLookupStanzaIds:(NSArray *)stanzaIds forStanzas:(NSArray *)stanzas
+{
+	XMPPLogTrace();
+	
+	// Set the stanzaIds.
+	
+	NSUInteger i = 0;
+	for (XMPPStreamManagementOutgoingStanza *stanza in stanzas)
+	{
+		id stanzaId = stanzaIds[i++];
+		
+		stanza.stanzaId = (stanzaId == [NSNull null]) ? nil : stanzaId;
+		stanza.awaitingStanzaId = NO;
+		
+		[self storeUpdatedOutgoingStanza:stanza];
 	}
 	
-	XMPPLogVerbose(@"%@: processSentElement (%@): lastHandledByServer(%u) pending(%lu)",
-	               THIS_FILE, [element name], lastHandledByServer, (unsigned long)[unackedByServer count]);
+	// It's possible that we received an ack from the sever (acking our stanzas)
+	// before we were able to determine their stanzaIds.
+	// This edge case is handled by storing the ack in the pendingAcks array for later processing.
+	// We may be able to process it now.
 	
-	[self maybeRequestAck];
+	BOOL dequeuedPendingAck = NO;
+	
+	while ([unprocessedReceivedAcks count] > 0)
+	{
+		NSXMLElement *ack = unprocessedReceivedAcks[0];
+		
+		if ([self processReceivedAck:ack])
+		{
+			[unprocessedReceivedAcks removeObjectAtIndex:0];
+			dequeuedPendingAck = YES;
+		}
+		else
+		{
+			break;
+		}
+	}
+	
+	if (!dequeuedPendingAck)
+	{
+		[self updateStoredPendingOutgoingStanzas];
+	}
 }
 
 /**
@@ -742,7 +1332,7 @@
 	
 	for (uint32_t i = 0; i < diff; i++)
 	{
-		XMPPStreamManagementOutgoingStanza *outgoingStanza = unackedByServer[(NSUInteger) i];
+		XMPPStreamManagementOutgoingStanza *outgoingStanza = [unackedByServer stanzaAtIndex:(NSUInteger) i];
 		
 		if ([outgoingStanza awaitingStanzaId])
 		{
@@ -760,9 +1350,11 @@
 	
 	if (canProcessEntireAck || processed > 0)
 	{
+		NSUInteger removed = canProcessEntireAck ? (NSUInteger)diff : processed;
+		
 		if (canProcessEntireAck)
 		{
-			[unackedByServer removeObjectsInRange:NSMakeRange(0, (NSUInteger)diff)];
+			[unackedByServer removeFirstStanzas:(NSUInteger)diff];
 			if (unackedByServer_lastRequestOffset > diff)
 				unackedByServer_lastRequestOffset -= diff;
 			else
@@ -775,7 +1367,7 @@
 		}
 		else // if (processed > 0)
 		{
-			[unackedByServer removeObjectsInRange:NSMakeRange(0, processed)];
+			[unackedByServer removeFirstStanzas:processed];
 			if (unackedByServer_lastRequestOffset > processed)
 				unackedByServer_lastRequestOffset -= processed;
 			else
@@ -789,10 +1381,17 @@
 		
 		// Update storage
 		
-		NSArray *pending = [[NSArray alloc] initWithArray:unackedByServer copyItems:YES];
-		
-		if (isStarted)
+		if (isStarted && storageSupportsDeltas)
+		{
+			[storage setLastDisconnect:[NSDate date]
+			       lastHandledByServer:lastHandledByServer
+			removingPendingOutgoingStanzas:removed
+			                 forStream:xmppStream];
+		}
+		else if (isStarted)
 		{
+			NSArray *pending = [unackedByServer stanzasCopyingItems:YES];
+			
 			[storage setLastDisconnect:[NSDate date]
 			       lastHandledByServer:lastHandledByServer
 			    pendingOutgoingStanzas:pending
@@ -800,6 +1399,8 @@
 		}
 		else // edge case
 		{
+			NSArray *pending = [unackedByServer stanzasCopyingItems:YES];
+			
 			[storage setLastDisconnect:disconnectDate
 			       lastHandledByClient:lastHandledByClient
 			       lastHandledByServer:lastHandledByServer
@@ -820,6 +1421,128 @@
 	return canProcessEntireAck;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Adaptive Acks
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Invoked when an ack <a/> arrives.
+ * If it answers a timed request, the round trip time estimate is updated (as in RFC 6298).
+**/
+- (void)updateRoundTripTime
+{
+	if (ackRequestTime == 0.0) return;
+	
+	NSTimeInterval sample = [NSDate timeIntervalSinceReferenceDate] - ackRequestTime;
+	ackRequestTime = 0.0;
+	
+	if (smoothedRoundTripTime == 0.0)
+		smoothedRoundTripTime = sample;
+	else
+		smoothedRoundTripTime = (0.875 * smoothedRoundTripTime) + (0.125 * sample);
+}
+
+/**
+ * Recalculates the auto request & auto ack configuration from the current measurements.
+ * 
+ * @see automaticallyAdaptAcksWithMaxStanzasAtRisk:maxAckOverhead:
+**/
+- (void)adaptAckCadence
+{
+	if (adaptive_maxStanzasAtRisk == 0) return;
+	
+	NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+	NSTimeInterval rtt = (smoothedRoundTripTime > 0.0) ? smoothedRoundTripTime : ADAPTIVE_DEFAULT_RTT;
+	
+	// A request still awaiting its ack has taken at least this long.
+	// So an ack that's late (or lost) backs off the request interval, without waiting for a sample.
+	if (ackRequestTime > 0.0)
+	{
+		rtt = MAX(rtt, now - ackRequestTime);
+	}
+	
+	// The overhead as a fraction of the number of stanzas
+	double overhead = MAX(adaptive_maxAckOverhead, 0.01) / 100.0;
+	
+	// Requests
+	//
+	// Every request costs 2 elements (our <r/> plus the server's <a/>).
+	// The stanzas at risk are those sent since the last request, plus those sent while awaiting the ack.
+	
+	double outRate = XMPPStanzaRateAtTime(&outgoingStanzaRate, now);
+	double inFlight = outRate * rtt;
+	
+	NSUInteger requestCount = 1;
+	if (inFlight < (double)adaptive_maxStanzasAtRisk)
+	{
+		requestCount = MAX((NSUInteger)1, (NSUInteger)((double)adaptive_maxStanzasAtRisk - inFlight));
+	}
+	
+	NSTimeInterval requestTimeout = ADAPTIVE_MAX_TIMEOUT;
+	if (outRate > 0.0)
+	{
+		requestTimeout = 2.0 / (overhead * outRate);
+	}
+	requestTimeout = MIN(MAX(requestTimeout, MAX(ADAPTIVE_MIN_TIMEOUT, rtt)), ADAPTIVE_MAX_TIMEOUT);
+	
+	if (XMPPAdaptedValueDiffers((double)requestCount, (double)autoRequest_stanzaCount) ||
+	    XMPPAdaptedValueDiffers(requestTimeout, autoRequest_timeout))
+	{
+		autoRequest_stanzaCount = requestCount;
+		autoRequest_timeout = requestTimeout;
+		
+		if (autoRequestTimer) {
+			[autoRequestTimer updateTimeout:autoRequest_timeout fromOriginalStartTime:YES];
+		}
+		
+		XMPPLogVerbose(@"%@: Adapted auto request: stanzaCount(%lu) timeout(%.3f) rtt(%.3f) rate(%.2f)", THIS_FILE,
+		               (unsigned long)requestCount, requestTimeout, rtt, outRate);
+		
+		[multicastDelegate xmppStreamManagement:self
+		         didAdaptAutoRequestStanzaCount:requestCount
+		                                timeout:requestTimeout
+		                          roundTripTime:rtt
+		                             stanzaRate:outRate];
+	}
+	
+	// Acks
+	//
+	// Every ack costs 1 element.
+	// Acking more often than the overhead allows is pointless,
+	// but the server shouldn't be left holding more than maxStanzasAtRisk of ours.
+	
+	double inRate = XMPPStanzaRateAtTime(&incomingStanzaRate, now);
+	
+	NSUInteger ackCount = (NSUInteger)ceil(1.0 / overhead);
+	ackCount = MAX((NSUInteger)1, MIN(ackCount, adaptive_maxStanzasAtRisk));
+	
+	NSTimeInterval ackTimeout = ADAPTIVE_MAX_TIMEOUT;
+	if (inRate > 0.0)
+	{
+		ackTimeout = 1.0 / (overhead * inRate);
+	}
+	ackTimeout = MIN(MAX(ackTimeout, ADAPTIVE_MIN_TIMEOUT), ADAPTIVE_MAX_TIMEOUT);
+	
+	if (XMPPAdaptedValueDiffers((double)ackCount, (double)autoAck_stanzaCount) ||
+	    XMPPAdaptedValueDiffers(ackTimeout, autoAck_timeout))
+	{
+		autoAck_stanzaCount = ackCount;
+		autoAck_timeout = ackTimeout;
+		
+		if (autoAckTimer) {
+			[autoAckTimer updateTimeout:autoAck_timeout fromOriginalStartTime:YES];
+		}
+		
+		XMPPLogVerbose(@"%@: Adapted auto ack: stanzaCount(%lu) timeout(%.3f) rate(%.2f)", THIS_FILE,
+		               (unsigned long)ackCount, ackTimeout, inRate);
+		
+		[multicastDelegate xmppStreamManagement:self
+		             didAdaptAutoAckStanzaCount:ackCount
+		                                timeout:ackTimeout
+		                             stanzaRate:inRate];
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Sending Acks
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -889,7 +1612,7 @@
 		{
 			// An incoming stanza got markedAsHandled post-disconnect
 			
-			NSArray *pending = [[NSArray alloc] initWithArray:unackedByServer copyItems:YES];
+			NSArray *pending = [unackedByServer stanzasCopyingItems:YES];
 			
 			[storage setLastDisconnect:disconnectDate
 				   lastHandledByClient:lastHandledByClient
@@ -1107,6 +1830,11 @@
 	
 	NSAssert(isStarted, @"State machine exception");
 	
+	if (adaptive_maxStanzasAtRisk > 0)
+	{
+		XMPPStanzaRateAddStanza(&incomingStanzaRate, [NSDate timeIntervalSinceReferenceDate]);
+	}
+	
 	SEL selector = @selector(xmppStreamManagement:getIsHandled:stanzaId:forReceivedElement:);
 	
 	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
@@ -1227,7 +1955,19 @@
 {
 	XMPPLogTrace();
 	
-	NSArray *pending = [[NSArray alloc] initWithArray:unackedByServer copyItems:YES];
+	if (isOpening)
+	{
+		// The storage still holds the state of the previous session, which may yet be resumed.
+		// The stanzas sent since are stored once the server replies <enabled/> or <resumed/>.
+		return;
+	}
+	if (isStarted && storageSupportsDeltas)
+	{
+		// The storage has already been informed of the change (see storeAppendedOutgoingStanza & co)
+		return;
+	}
+	
+	NSArray *pending = [unackedByServer stanzasCopyingItems:YES];
 	
 	if (isStarted)
 	{
@@ -1246,6 +1986,34 @@
 	}
 }
 
+/**
+ * Informs a storage class that supports deltas of a newly sent stanza.
+**/
+- (void)storeAppendedOutgoingStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+{
+	if (isStarted && storageSupportsDeltas)
+	{
+		[storage setLastDisconnect:[NSDate date]
+		appendingPendingOutgoingStanza:[stanza copy]
+		                 forStream:xmppStream];
+	}
+}
+
+/**
+ * Informs a storage class that supports deltas that a pending stanza has received its stanzaId.
+**/
+- (void)storeUpdatedOutgoingStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+{
+	if (isStarted && storageSupportsDeltas)
+	{
+		NSUInteger index = [unackedByServer indexOfStanza:stanza];
+		if (index != NSNotFound)
+		{
+			[storage replacePendingOutgoingStanzaAtIndex:index withStanza:[stanza copy] forStream:xmppStream];
+		}
+	}
+}
+
 /**
  * This method is used when we can maybe increment the lastHandledByClient value,
  * but the change isn't significant enough to trigger an autoAck (or autoAck_stanzaCount is disabled).
@@ -1296,7 +2064,7 @@
 		{
 			// An incoming stanza got markedAsHandled post-disconnect
 			
-			NSArray *pending = [[NSArray alloc] initWithArray:unackedByServer copyItems:YES];
+			NSArray *pending = [unackedByServer stanzasCopyingItems:YES];
 		
 			[storage setLastDisconnect:disconnectDate
 			       lastHandledByClient:lastHandledByClient
@@ -1315,7 +2083,7 @@
 {
 	XMPPLogTrace();
 	
-	if (isStarted)
+	if (isStarted || isOpening)
 	{
 		[self processSentElement:iq];
 	}
@@ -1325,7 +2093,7 @@
 {
 	XMPPLogTrace();
 	
-	if (isStarted)
+	if (isStarted || isOpening)
 	{
 		[self processSentElement:message];
 	}
@@ -1335,7 +2103,7 @@
 {
 	XMPPLogTrace();
 	
-	if (isStarted)
+	if (isStarted || isOpening)
 	{
 		[self processSentElement:presence];
 	}
@@ -1388,6 +2156,11 @@
 		// The element was filtered/consumed by something in the stack.
 		// So it is implicitly 'handled'.
 		
+		if (adaptive_maxStanzasAtRisk > 0)
+		{
+			XMPPStanzaRateAddStanza(&incomingStanzaRate, [NSDate timeIntervalSinceReferenceDate]);
+		}
+		
 		XMPPStreamManagementIncomingStanza *stanza =
 		  [[XMPPStreamManagementIncomingStanza alloc] initWithStanzaId:nil isHandled:YES];
 		[unackedByClient addObject:stanza];
@@ -1446,6 +2219,8 @@
 	}
 	else if ([elementName isEqualToString:@"a"])
 	{
+		[self updateRoundTripTime];
+		
 		// Try to process the ack.
 		// If we can't yet, then we'll put it into the pendingAcks array.
 		
@@ -1456,6 +2231,8 @@
 			
 			[unprocessedReceivedAcks addObject:element];
 		}
+		
+		[self adaptAckCadence];
 	}
 	else if ([elementName isEqualToString:@"enabled"])
 	{
@@ -1477,6 +2254,9 @@
         [multicastDelegate xmppStreamManagement:self wasEnabled:element];
         
         isStarted = YES;
+        isOpening = NO;
+        
+        [self prepareReplayWithResponse:element unackedStanzas:nil];
         
         BOOL sendInitialPresence = [element attributeBoolValueForName:@"presence" withDefaultValue:NO];
         
@@ -1484,14 +2264,38 @@
         lastHandledByServer = sendInitialPresence ? 1 : 0;
         
         unprocessedReceivedAcks = nil;
+        
+        // Stanzas sent along with the stream header are counted by the new session
+        
+        if ([unackedByServer count] > 0)
+        {
+            [storage setLastDisconnect:[NSDate date]
+                   lastHandledByServer:lastHandledByServer
+                pendingOutgoingStanzas:[unackedByServer stanzasCopyingItems:YES]
+                             forStream:xmppStream];
+            
+            [self maybeRequestAck];
+        }
 	}
 	else if ([elementName isEqualToString:@"failed"])
 	{
+        // Neither the previous session's unacked stanzas (beyond its 'h' value, if given),
+        // nor the stanzas sent along with the stream header, will ever be acked.
+        // So hand them over to the replay list (& the delegates) before forgetting them.
+        
+        [self prepareReplayWithResponse:element unackedStanzas:[unackedByServer stanzasCopyingItems:NO]];
+        
+        [unackedByServer removeAllStanzas];
+        unackedByServer_lastRequestOffset = 0;
+        
         [storage removeAllForStream:xmppStream];
         
         [multicastDelegate xmppStreamManagement:self wasNotEnabled:element];
         
         isStarted = NO;
+        isOpening = NO;
+        
+        ackRequestTime = 0.0;
         
         [autoRequestTimer cancel];
         autoRequestTimer = nil;
@@ -1517,7 +2321,15 @@
 	else
 	{
 		disconnectDate = [NSDate date];
-		NSArray *pending = [[NSArray alloc] initWithArray:unackedByServer copyItems:YES];
+		NSArray *pending = [unackedByServer stanzasCopyingItems:YES];
+		
+		if (isOpening && prev_unackedByServer)
+		{
+			// Disconnected before the server replied to the resume request.
+			// If it did resume the previous session, its next 'h' value also counts the stanzas sent since.
+			
+			pending = [prev_unackedByServer arrayByAddingObjectsFromArray:pending];
+		}
 		
 		[storage setLastDisconnect:disconnectDate
 		       lastHandledByClient:lastHandledByClient
@@ -1528,6 +2340,9 @@
 	
 	// Reset temporary state variables
 	isStarted = NO;
+	isOpening = NO;
+	
+	ackRequestTime = 0.0;
 	
 	wasCleanDisconnect = NO;
     
@@ -5,6 +5,7 @@
 #define _XMPP_AUTO_PING_H
 
 @class XMPPJID;
+@class XMPPTimer;
 
 
 /**
@@ -23,7 +24,7 @@
 	NSString *targetJIDStr;
 	
 	NSTimeInterval lastReceiveTime;
-	dispatch_source_t pingIntervalTimer;
+	XMPPTimer *pingIntervalTimer;
 	
 	BOOL awaitingPingResponse;
 	XMPPPing *xmppPing;
@@ -2,6 +2,7 @@
 #import "XMPPPing.h"
 #import "XMPP.h"
 #import "XMPPLogging.h"
+#import "XMPPTimer.h"
 
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
@@ -277,7 +278,6 @@
 {
 	XMPPLogTrace();
 	
-	NSAssert(pingIntervalTimer != NULL, @"Broken logic (1)");
 	NSAssert(pingInterval > 0, @"Broken logic (2)");
 	
 	// The timer fires every (pingInterval / 4) seconds.
@@ -285,7 +285,7 @@
 	// and sends a ping if the elapsed time has exceeded the pingInterval.
 	// Thus the effective resolution of the timer is based on the configured pingInterval.
 	
-	uint64_t interval = ((pingInterval / 4.0) * NSEC_PER_SEC);
+	NSTimeInterval interval = pingInterval / 4.0;
 	
 	// The timer's first fire should occur 'interval' after lastReceiveTime.
 	// If there is no lastReceiveTime, then the timer's first fire should occur 'interval' after now.
@@ -294,12 +294,20 @@
 	if (lastReceiveTime == 0)
 		diff = 0.0;
 	else
-		diff = lastReceiveTime - [NSDate timeIntervalSinceReferenceDate];;
+		diff = lastReceiveTime - [NSDate timeIntervalSinceReferenceDate];
 	
-	dispatch_time_t bt = dispatch_time(DISPATCH_TIME_NOW, (diff * NSEC_PER_SEC));
-	dispatch_time_t tt = dispatch_time(bt, interval);
+	// The first fire is anchored to the lastReceiveTime, so a new timer replaces the old one.
+	// (This is a single periodic timer, which uses its own dispatch_source rather than the shared timing wheel.)
 	
-	dispatch_source_set_timer(pingIntervalTimer, tt, interval, 0);
+	[pingIntervalTimer cancel];
+	
+	pingIntervalTimer = [[XMPPTimer alloc] initWithQueue:moduleQueue eventHandler:^{ @autoreleasepool {
+		
+		[self handlePingIntervalTimerFire];
+		
+	}}];
+	
+	[pingIntervalTimer startWithTimeout:MAX(diff + interval, 0.0) interval:interval];
 }
 
 - (void)startPingIntervalTimer
@@ -312,39 +320,15 @@
 		return;
 	}
 	
-	BOOL newTimer = NO;
-	
-	if (pingIntervalTimer == NULL)
-	{
-		newTimer = YES;
-		pingIntervalTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, moduleQueue);
-		
-		dispatch_source_set_event_handler(pingIntervalTimer, ^{ @autoreleasepool {
-			
-			[self handlePingIntervalTimerFire];
-			
-		}});
-	}
-	
 	[self updatePingIntervalTimer];
-	
-	if (newTimer)
-	{
-		dispatch_resume(pingIntervalTimer);
-	}
 }
 
 - (void)stopPingIntervalTimer
 {
 	XMPPLogTrace();
 	
-	if (pingIntervalTimer)
-	{
-		#if !OS_OBJECT_USE_OBJC
-		dispatch_release(pingIntervalTimer);
-		#endif
-		pingIntervalTimer = NULL;
-	}
+	[pingIntervalTimer cancel];
+	pingIntervalTimer = nil;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -405,6 +389,17 @@
 	}
 }
 
+- (void)xmppStreamDidFilterStanza:(XMPPStream *)sender
+{
+	// E.g. an incoming ping, which only goes to the XMPPPing module that claimed its namespace.
+	// The sender is unknown, so this only counts when pinging the server.
+
+	if (targetJID == nil)
+	{
+		lastReceiveTime = [NSDate timeIntervalSinceReferenceDate];
+	}
+}
+
 - (void)xmppStreamDidDisconnect:(XMPPStream *)sender withError:(NSError *)error
 {
 	[self stopPingIntervalTimer];
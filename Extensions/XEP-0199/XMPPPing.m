@@ -54,6 +54,10 @@
 		
 		pingTracker = [[XMPPIDTracker alloc] initWithDispatchQueue:moduleQueue];
 		
+		// Incoming pings are ours alone, so there's no need to broadcast them to every other delegate.
+		
+		[xmppStream registerIQHandler:self handlerQueue:moduleQueue forXmlns:@"urn:xmpp:ping"];
+		
 		return YES;
 	}
 	
@@ -66,6 +70,8 @@
 	[xmppStream removeAutoDelegate:self delegateQueue:moduleQueue fromModulesOfClass:[XMPPCapabilities class]];
 #endif
 	
+	[xmppStream unregisterIQHandler:self forXmlns:@"urn:xmpp:ping"];
+	
 	dispatch_block_t block = ^{ @autoreleasepool {
 		
 		[pingTracker removeAllIDs];
@@ -129,7 +135,7 @@
 	// Generate unique ID for Ping packet
 	// It's important the ID be unique as the ID is the only thing that distinguishes a pong packet
 	
-	NSString *pingID = [xmppStream generateUUID];
+	NSString *pingID = [xmppStream generateElementID];
 	
 	dispatch_async(moduleQueue, ^{ @autoreleasepool {
 		
@@ -130,7 +130,7 @@
 	// It's important the ID be unique as the ID is the
 	// only thing that distinguishes multiple queries from each other.
 	
-	NSString *queryID = [xmppStream generateUUID];
+	NSString *queryID = [xmppStream generateElementID];
 	
 	dispatch_async(moduleQueue, ^{ @autoreleasepool {
 		
@@ -0,0 +1,203 @@
+#import <XCTest/XCTest.h>
+#import "GCDMulticastDelegate.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+@protocol GCDMulticastDelegateTestsDelegate
+@optional
+- (void)multicastDelegateTestsPing:(id)sender;
+@end
+
+/**
+ * Doesn't respond to the ping.
+**/
+@interface GCDMulticastDelegateTestsIgnorer : NSObject
+@end
+
+@implementation GCDMulticastDelegateTestsIgnorer
+@end
+
+/**
+ * Counts its pings.
+**/
+@interface GCDMulticastDelegateTestsResponder : NSObject <GCDMulticastDelegateTestsDelegate>
+@property (nonatomic, assign) NSUInteger numberOfPings;
+@end
+
+@implementation GCDMulticastDelegateTestsResponder
+
+- (void)multicastDelegateTestsPing:(id)sender
+{
+	self.numberOfPings++;
+}
+
+@end
+
+/**
+ * GCDMulticastDelegate caches the responding delegates per selector.
+ * These tests warm the cache before every change, so a stale list would show up.
+**/
+@interface GCDMulticastDelegateTests : XCTestCase
+{
+	GCDMulticastDelegate *multicastDelegate;
+	dispatch_queue_t delegateQueue;
+}
+@end
+
+@implementation GCDMulticastDelegateTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	multicastDelegate = [[GCDMulticastDelegate alloc] init];
+	delegateQueue = dispatch_queue_create("GCDMulticastDelegateTests", NULL);
+}
+
+- (void)tearDown
+{
+	[multicastDelegate removeAllDelegates];
+	multicastDelegate = nil;
+
+	[super tearDown];
+}
+
+- (SEL)ping
+{
+	return @selector(multicastDelegateTestsPing:);
+}
+
+- (void)invokePing
+{
+	[multicastDelegate invokeSelector:[self ping] withBlock:^(id delegate) {
+		[delegate multicastDelegateTestsPing:nil];
+	}];
+
+	dispatch_sync(delegateQueue, ^{});
+}
+
+- (void)testAddInvalidatesCache
+{
+	XCTAssertFalse([multicastDelegate hasDelegateThatRespondsToSelector:[self ping]]);
+
+	GCDMulticastDelegateTestsIgnorer *ignorer = [[GCDMulticastDelegateTestsIgnorer alloc] init];
+	[multicastDelegate addDelegate:ignorer delegateQueue:delegateQueue];
+
+	XCTAssertFalse([multicastDelegate hasDelegateThatRespondsToSelector:[self ping]]);
+	XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)0);
+
+	GCDMulticastDelegateTestsResponder *responder = [[GCDMulticastDelegateTestsResponder alloc] init];
+	[multicastDelegate addDelegate:responder delegateQueue:delegateQueue];
+
+	XCTAssertTrue([multicastDelegate hasDelegateThatRespondsToSelector:[self ping]]);
+	XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)1);
+
+	[self invokePing];
+	XCTAssertEqual(responder.numberOfPings, (NSUInteger)1);
+
+	GCDMulticastDelegateTestsResponder *another = [[GCDMulticastDelegateTestsResponder alloc] init];
+	[multicastDelegate addDelegate:another delegateQueue:delegateQueue];
+
+	XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)2);
+
+	[self invokePing];
+	XCTAssertEqual(responder.numberOfPings, (NSUInteger)2);
+	XCTAssertEqual(another.numberOfPings, (NSUInteger)1);
+}
+
+- (void)testRemoveInvalidatesCache
+{
+	GCDMulticastDelegateTestsResponder *a = [[GCDMulticastDelegateTestsResponder alloc] init];
+	GCDMulticastDelegateTestsResponder *b = [[GCDMulticastDelegateTestsResponder alloc] init];
+
+	[multicastDelegate addDelegate:a delegateQueue:delegateQueue];
+	[multicastDelegate addDelegate:b delegateQueue:delegateQueue];
+
+	XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)2);
+
+	[multicastDelegate removeDelegate:a];
+
+	XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)1);
+
+	[self invokePing];
+	XCTAssertEqual(a.numberOfPings, (NSUInteger)0);
+	XCTAssertEqual(b.numberOfPings, (NSUInteger)1);
+
+	// Removing from another queue leaves the delegate in place
+
+	[multicastDelegate removeDelegate:b delegateQueue:dispatch_get_main_queue()];
+	XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)1);
+
+	[multicastDelegate removeDelegate:b delegateQueue:delegateQueue];
+	XCTAssertFalse([multicastDelegate hasDelegateThatRespondsToSelector:[self ping]]);
+
+	[multicastDelegate addDelegate:a delegateQueue:delegateQueue];
+	XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)1);
+
+	[multicastDelegate removeAllDelegates];
+	XCTAssertFalse([multicastDelegate hasDelegateThatRespondsToSelector:[self ping]]);
+	XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)0);
+}
+
+- (void)testDeallocatedDelegate
+{
+	GCDMulticastDelegateTestsResponder *survivor = [[GCDMulticastDelegateTestsResponder alloc] init];
+	[multicastDelegate addDelegate:survivor delegateQueue:delegateQueue];
+
+	__weak GCDMulticastDelegateTestsResponder *weakDelegate = nil;
+
+	@autoreleasepool {
+
+		GCDMulticastDelegateTestsResponder *delegate = [[GCDMulticastDelegateTestsResponder alloc] init];
+		weakDelegate = delegate;
+
+		[multicastDelegate addDelegate:delegate delegateQueue:delegateQueue];
+
+		// Warm the cache while the delegate is alive
+		XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)2);
+
+		delegate = nil;
+	}
+
+	XCTAssertNil(weakDelegate);
+
+	// The cached list still holds its node, but the delegate isn't counted or invoked
+
+	XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)1);
+	XCTAssertTrue([multicastDelegate hasDelegateThatRespondsToSelector:[self ping]]);
+
+	[self invokePing];
+	XCTAssertEqual(survivor.numberOfPings, (NSUInteger)1);
+
+	// Invoking pruned the node, and the cache with it
+
+	XCTAssertEqual([multicastDelegate count], (NSUInteger)1);
+	XCTAssertEqual([multicastDelegate countForSelector:[self ping]], (NSUInteger)1);
+
+	[multicastDelegate removeDelegate:survivor];
+	XCTAssertFalse([multicastDelegate hasDelegateThatRespondsToSelector:[self ping]]);
+}
+
+- (void)testOnlyDeallocatedDelegates
+{
+	@autoreleasepool {
+
+		GCDMulticastDelegateTestsResponder *delegate = [[GCDMulticastDelegateTestsResponder alloc] init];
+		[multicastDelegate addDelegate:delegate delegateQueue:delegateQueue];
+
+		XCTAssertTrue([multicastDelegate hasDelegateThatRespondsToSelector:[self ping]]);
+
+		delegate = nil;
+	}
+
+	XCTAssertFalse([multicastDelegate hasDelegateThatRespondsToSelector:[self ping]]);
+
+	// Nothing left to invoke
+	[self invokePing];
+
+	XCTAssertEqual([multicastDelegate count], (NSUInteger)0);
+}
+
+@end
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""
+Generates Tests/Resources/XMPPStringPrepCorpus.json, the expected results of the
+nodeprep & resourceprep (RFC 6122) and nameprep (RFC 3491) profiles, used by XMPPStringPrepTests.
+
+The profiles are implemented here from the RFC 3454 tables (Python's stringprep module)
+and Unicode 3.2 normalization, which is what libidn implements.
+Unassigned code points are avoided, as the results then depend on the (libidn) flags.
+
+Usage: python3 Tests/Tools/stringprep_corpus.py > Tests/Resources/XMPPStringPrepCorpus.json
+"""
+
+import json
+import random
+import stringprep
+import sys
+import unicodedata
+
+NFKC = unicodedata.ucd_3_2_0.normalize
+
+NODEPREP_SYMBOLS = set('"&\'/:<>@')
+
+COMMON_PROHIBITED = [
+    stringprep.in_table_c12, stringprep.in_table_c22,
+    stringprep.in_table_c3, stringprep.in_table_c4, stringprep.in_table_c5,
+    stringprep.in_table_c6, stringprep.in_table_c7, stringprep.in_table_c8, stringprep.in_table_c9,
+]
+
+PROFILES = {
+    'nodeprep': {
+        'map_b2': True,
+        'prohibited': COMMON_PROHIBITED + [stringprep.in_table_c11, stringprep.in_table_c21,
+                                           lambda c: c in NODEPREP_SYMBOLS],
+    },
+    'resourceprep': {
+        'map_b2': False,
+        'prohibited': COMMON_PROHIBITED + [stringprep.in_table_c21],
+    },
+    'nameprep': {
+        'map_b2': True,
+        'prohibited': COMMON_PROHIBITED,
+    },
+}
+
+
+def prep(profile, s):
+    """Returns the prepped string, or None if the string is prohibited."""
+    p = PROFILES[profile]
+
+    mapped = []
+    for c in s:
+        if stringprep.in_table_b1(c):
+            continue
+        mapped.append(stringprep.map_table_b2(c) if p['map_b2'] else c)
+
+    s = NFKC('NFKC', ''.join(mapped))
+
+    for c in s:
+        if any(table(c) for table in p['prohibited']):
+            return None
+
+    randal = [stringprep.in_table_d1(c) for c in s]
+    if any(randal):
+        if any(stringprep.in_table_d2(c) for c in s):
+            return None
+        if not randal[0] or not randal[-1]:
+            return None
+
+    return s
+
+
+def assigned(c):
+    return not stringprep.in_table_a1(c)
+
+
+def inputs():
+    # Every ASCII character (except NUL), on its own and between letters
+    for cp in range(0x01, 0x80):
+        c = chr(cp)
+        yield c
+        yield 'a' + c + 'B'
+
+    # Word boundaries of the ASCII fast path
+    for length in range(1, 41):
+        yield ''.join('AbCdEfGhIj'[i % 10] for i in range(length))
+        yield 'x' * (length - 1) + '@'
+        yield 'x' * (length - 1) + '\u00c9'
+    yield 'A' * 1023
+
+    # Case folding and compatibility mappings
+    yield from [
+        '\u00c0\u00c9\u00ce\u00d5\u00dc',  # Latin-1 capitals
+        'Stra\u00dfe',                     # sharp s (B.2 maps it to "ss")
+        '\u0130stanbul',                   # capital I with dot above
+        '\u01c5',                          # titlecase digraph
+        '\u03a3\u0391\u03a3',              # Greek capitals
+        '\u212a\u212b',                    # Kelvin and Angstrom signs
+        '\ufb01\ufb03',                    # ligatures
+        '\uff21\uff42\uff43',              # fullwidth letters
+        '\u216b',                          # roman numeral twelve
+        '\u2460',                          # circled digit one
+        '\u00bd',                          # vulgar fraction one half
+        '\u3392',                          # square MHz
+        'e\u0301',                         # e + combining acute accent
+        '\u1100\u1161\u11a8',              # Hangul jamo
+        '\uac01',                          # Hangul syllable
+        'A\u030a',                         # A + combining ring above
+        '\u1e9b\u0323',                    # long s with dot above + dot below
+        '\u00aa\u00b2\u00b5',              # superscripts and micro sign
+        'caf\u00e9',
+        'j\u00fcrgen',
+        '\u4e2d\u6587',                    # CJK
+        '\u0434\u043e\u0431\u0440\u043e',  # Cyrillic
+        'ABC\u00c9',
+    ]
+
+    # Mapped to nothing (B.1)
+    yield from [
+        'soft\u00adhyphen',
+        'zero\u200bwidth',
+        'joiner\u200d',
+        'variation\ufe0f',
+        'bom\ufeffmark',
+        '\u00ad',
+        'a\u034fb',
+    ]
+
+    # Prohibited code points (C.1 - C.9), checked after mapping & normalization
+    yield from [
+        'non\u00a0breaking',   # C.1.2 (but NFKC maps it to a space)
+        'ideographic\u3000',   # C.1.2 (ditto)
+        'ogham\u1680space',    # C.1.2
+        'space here',          # C.1.1
+        'c1\u0080control',     # C.2.2
+        'line\u2028sep',       # C.2.2
+        'private\ue000use',    # C.3
+        'private\U000f0000',   # C.3
+        'non\ufffechar',       # C.4
+        'non\U0001fffechar',   # C.4
+        'inappropriate\ufff9', # C.6
+        'replacement\ufffd',   # C.6
+        'ideographic\u2ff0',   # C.7
+        'lrm\u200e',           # C.8
+        'combining\u0340',     # C.8 (but NFKC maps it to U+0300)
+        'deprecated\u206a',    # C.8
+        'tag\U000e0001',       # C.9
+    ]
+
+    # Bidi rules (RFC 3454 section 6)
+    yield from [
+        '\u05d0\u05d1\u05d2',        # Hebrew only
+        '\u0627\u0644\u0639',        # Arabic only
+        '\u05d01\u05d0',             # RandAL around a digit
+        '\u05d01',                   # doesn't end with RandAL
+        '1\u05d0',                   # doesn't start with RandAL
+        '\u05d0a\u05d0',             # RandAL mixed with L
+        'a\u05d0',                   # L then RandAL
+        '\u0627 \u0644',             # RandAL around a space
+        '\u0627\u200e\u0644',        # RandAL with a prohibited LRM
+        '\u05d0\u05bc\u05d1',        # RandAL with a combining mark in between
+        '\u0660\u0661',              # Arabic-Indic digits (AN, not RandAL)
+        '\u0660\u0627',              # starts with AN
+    ]
+
+    # Random strings of assigned code points from a few blocks
+    rng = random.Random(6122)
+    blocks = [(0x20, 0x7e), (0xa0, 0x24f), (0x370, 0x3ff), (0x400, 0x4ff),
+              (0x590, 0x5ff), (0x600, 0x6ff), (0x2000, 0x206f), (0x2100, 0x218f),
+              (0x3000, 0x30ff), (0xac00, 0xd7a3), (0xfb00, 0xfb4f), (0xff00, 0xffef)]
+    for _ in range(400):
+        s = []
+        for _ in range(rng.randint(1, 12)):
+            lo, hi = rng.choice(blocks)
+            c = chr(rng.randint(lo, hi))
+            if assigned(c):
+                s.append(c)
+        if s:
+            yield ''.join(s)
+
+
+def main():
+    seen = set()
+    corpus = []
+    for s in inputs():
+        if s in seen:
+            continue
+        seen.add(s)
+        if not all(assigned(c) for c in s):
+            continue
+        for profile in ('nodeprep', 'resourceprep', 'nameprep'):
+            corpus.append({'profile': profile, 'input': s, 'output': prep(profile, s)})
+
+    json.dump(corpus, sys.stdout, indent=1, ensure_ascii=True, sort_keys=True)
+    sys.stdout.write('\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,381 @@
+#import <XCTest/XCTest.h>
+#import "XMPPBase64.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+@interface XMPPBase64Encoder (Testing)
++ (BOOL)selectImplementation:(NSString *)name;
+@end
+
+/**
+ * Every test runs once per implementation available on this CPU (scalar, plus SSSE3 & AVX2 or NEON),
+ * and compares against NSData's own base64 support, or against a plain model of the lenient decoder.
+ *
+ * Lengths run well past the largest SIMD block (48 bytes in, 64 characters out),
+ * so every length mod 3 and mod 32 is covered along with every way a block can be cut short.
+**/
+@interface XMPPBase64Tests : XCTestCase
+@end
+
+@implementation XMPPBase64Tests
+
+static NSData *XMPPBase64TestsRandomData(NSUInteger length)
+{
+	NSMutableData *data = [NSMutableData dataWithLength:length];
+	uint8_t *bytes = [data mutableBytes];
+
+	for (NSUInteger i = 0; i < length; i++)
+	{
+		bytes[i] = (uint8_t)random();
+	}
+
+	return data;
+}
+
+/**
+ * The documented behaviour of the decoder, one character at a time:
+ * characters outside the alphabet are ignored, and the first padding character ends the data.
+ * A trailing partial group without padding is held back, so a one-shot decode drops it.
+**/
+static NSData *XMPPBase64TestsReferenceDecode(NSData *data)
+{
+	static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	NSMutableData *result = [NSMutableData data];
+	const uint8_t *bytes = [data bytes];
+
+	uint8_t quad[4] = { 0, 0, 0, 0 };
+	NSUInteger count = 0;
+
+	for (NSUInteger i = 0; i < [data length]; i++)
+	{
+		if (bytes[i] == '=')
+		{
+			if (count > 0)
+			{
+				uint8_t out[2];
+				out[0] = (uint8_t)((quad[0] << 2) | ((count > 1 ? quad[1] : 0) >> 4));
+				out[1] = (uint8_t)((quad[1] << 4) | (quad[2] >> 2));
+
+				[result appendBytes:out length:(count == 3) ? 2 : 1];
+			}
+			break;
+		}
+
+		const char *match = (bytes[i] != 0) ? strchr(alphabet, bytes[i]) : NULL;
+		if (match == NULL) continue;
+
+		quad[count++] = (uint8_t)(match - alphabet);
+
+		if (count == 4)
+		{
+			uint8_t out[3];
+			out[0] = (uint8_t)((quad[0] << 2) | (quad[1] >> 4));
+			out[1] = (uint8_t)((quad[1] << 4) | (quad[2] >> 2));
+			out[2] = (uint8_t)((quad[2] << 6) | (quad[3]));
+
+			[result appendBytes:out length:3];
+
+			count = 0;
+			quad[0] = quad[1] = quad[2] = quad[3] = 0;
+		}
+	}
+
+	return result;
+}
+
+- (void)runWithEachImplementation:(void (^)(NSString *implementation))block
+{
+	for (NSString *implementation in @[ @"scalar", @"ssse3", @"avx2", @"neon" ])
+	{
+		if (![XMPPBase64Encoder selectImplementation:implementation]) continue;
+
+		block(implementation);
+	}
+
+	[XMPPBase64Encoder selectImplementation:nil];
+}
+
+- (void)setUp
+{
+	[super setUp];
+
+	srandom(15);
+}
+
+- (void)tearDown
+{
+	[XMPPBase64Encoder selectImplementation:nil];
+
+	[super tearDown];
+}
+
+- (void)testImplementations
+{
+	XCTAssertTrue([XMPPBase64Encoder selectImplementation:@"scalar"]);
+	XCTAssertTrue([XMPPBase64Encoder selectImplementation:nil]);
+	XCTAssertFalse([XMPPBase64Encoder selectImplementation:@"mmx"]);
+
+#if defined(__aarch64__)
+	XCTAssertTrue([XMPPBase64Encoder selectImplementation:@"neon"]);
+#endif
+}
+
+- (void)testRoundTripEveryLength
+{
+	NSMutableArray *inputs = [NSMutableArray array];
+	for (NSUInteger length = 0; length <= 300; length++)
+	{
+		[inputs addObject:XMPPBase64TestsRandomData(length)];
+	}
+
+	[self runWithEachImplementation:^(NSString *implementation) {
+
+		for (NSData *data in inputs)
+		{
+			NSString *expected = [data base64EncodedStringWithOptions:0];
+			NSString *encoded = [XMPPBase64Encoder encodeData:data];
+
+			XCTAssertEqualObjects(encoded, expected, @"%@: encode of %lu bytes", implementation, (unsigned long)[data length]);
+			XCTAssertEqualObjects([XMPPBase64Decoder decodeString:expected], data,
+			                      @"%@: decode of %lu bytes", implementation, (unsigned long)[data length]);
+		}
+	}];
+}
+
+- (void)testRoundTripLarge
+{
+	NSData *data = XMPPBase64TestsRandomData(1024 * 1024 + 7);
+	NSString *expected = [data base64EncodedStringWithOptions:0];
+
+	[self runWithEachImplementation:^(NSString *implementation) {
+
+		XCTAssertEqualObjects([XMPPBase64Encoder encodeData:data], expected, @"%@", implementation);
+		XCTAssertEqualObjects([XMPPBase64Decoder decodeString:expected], data, @"%@", implementation);
+	}];
+}
+
+- (void)testKnownValues
+{
+	// RFC 4648, section 10
+
+	NSDictionary *vectors = @{
+		@""       : @"",
+		@"f"      : @"Zg==",
+		@"fo"     : @"Zm8=",
+		@"foo"    : @"Zm9v",
+		@"foob"   : @"Zm9vYg==",
+		@"fooba"  : @"Zm9vYmE=",
+		@"foobar" : @"Zm9vYmFy"
+	};
+
+	[self runWithEachImplementation:^(NSString *implementation) {
+
+		[vectors enumerateKeysAndObjectsUsingBlock:^(NSString *plain, NSString *encoded, BOOL *stop) {
+
+			NSData *data = [plain dataUsingEncoding:NSUTF8StringEncoding];
+
+			XCTAssertEqualObjects([XMPPBase64Encoder encodeData:data], encoded, @"%@", implementation);
+			XCTAssertEqualObjects([XMPPBase64Decoder decodeString:encoded], data, @"%@", implementation);
+		}];
+	}];
+}
+
+- (void)testUnalignedInput
+{
+	// The SIMD paths use unaligned loads, so start the input at every offset within a vector
+
+	NSData *data = XMPPBase64TestsRandomData(200);
+	NSData *encoded = [[data base64EncodedStringWithOptions:0] dataUsingEncoding:NSASCIIStringEncoding];
+
+	[self runWithEachImplementation:^(NSString *implementation) {
+
+		for (NSUInteger offset = 0; offset < 32; offset++)
+		{
+			NSMutableData *shiftedData = [NSMutableData dataWithLength:offset];
+			[shiftedData appendData:data];
+
+			XMPPBase64Encoder *encoder = [[XMPPBase64Encoder alloc] init];
+			NSString *result = [[encoder encodeBytes:((const uint8_t *)[shiftedData bytes] + offset) length:[data length]]
+			                     stringByAppendingString:[encoder finish]];
+
+			XCTAssertEqualObjects(result, [data base64EncodedStringWithOptions:0], @"%@: offset %lu", implementation, (unsigned long)offset);
+
+			NSMutableData *shiftedEncoded = [NSMutableData dataWithLength:offset];
+			[shiftedEncoded appendData:encoded];
+
+			XMPPBase64Decoder *decoder = [[XMPPBase64Decoder alloc] init];
+			NSData *decoded = [decoder decodeBytes:((const uint8_t *)[shiftedEncoded bytes] + offset) length:[encoded length]];
+
+			XCTAssertEqualObjects(decoded, data, @"%@: offset %lu", implementation, (unsigned long)offset);
+		}
+	}];
+}
+
+- (void)testIncremental
+{
+	[self runWithEachImplementation:^(NSString *implementation) {
+
+		for (int i = 0; i < 200; i++)
+		{
+			NSData *data = XMPPBase64TestsRandomData(random() % 1000);
+			NSString *expected = [data base64EncodedStringWithOptions:0];
+
+			// Encode in random chunks, including empty ones and ones shorter than a group
+
+			XMPPBase64Encoder *encoder = [[XMPPBase64Encoder alloc] init];
+			NSMutableString *encoded = [NSMutableString string];
+
+			NSUInteger offset = 0;
+			while (offset < [data length])
+			{
+				NSUInteger chunk = MIN((NSUInteger)(random() % 100), [data length] - offset);
+
+				[encoded appendString:[encoder encodeData:[data subdataWithRange:NSMakeRange(offset, chunk)]]];
+				offset += chunk;
+			}
+			[encoded appendString:[encoder finish]];
+
+			XCTAssertEqualObjects(encoded, expected, @"%@", implementation);
+
+			// Decode in random chunks
+
+			XMPPBase64Decoder *decoder = [[XMPPBase64Decoder alloc] init];
+			NSMutableData *decoded = [NSMutableData data];
+
+			offset = 0;
+			while (offset < [expected length])
+			{
+				NSUInteger chunk = MIN((NSUInteger)(random() % 100), [expected length] - offset);
+
+				[decoded appendData:[decoder decodeString:[expected substringWithRange:NSMakeRange(offset, chunk)]]];
+				offset += chunk;
+			}
+
+			XCTAssertEqualObjects(decoded, data, @"%@", implementation);
+			XCTAssertEqual(decoder.isFinished, (BOOL)(([data length] % 3) != 0), @"%@", implementation);
+		}
+	}];
+}
+
+- (void)testEncoderReuse
+{
+	XMPPBase64Encoder *encoder = [[XMPPBase64Encoder alloc] init];
+
+	XCTAssertEqualObjects([encoder encodeData:[@"f" dataUsingEncoding:NSUTF8StringEncoding]], @"");
+	XCTAssertEqualObjects([encoder finish], @"Zg==");
+	XCTAssertEqualObjects([encoder finish], @"");
+
+	XCTAssertEqualObjects([encoder encodeData:[@"foob" dataUsingEncoding:NSUTF8StringEncoding]], @"Zm9v");
+	XCTAssertEqualObjects([encoder finish], @"Yg==");
+}
+
+- (void)testLineBreaks
+{
+	NSDataBase64EncodingOptions options[] = {
+		NSDataBase64Encoding64CharacterLineLength,
+		NSDataBase64Encoding76CharacterLineLength | NSDataBase64EncodingEndLineWithLineFeed,
+		NSDataBase64Encoding64CharacterLineLength | NSDataBase64EncodingEndLineWithCarriageReturn
+	};
+
+	NSMutableArray *inputs = [NSMutableArray array];
+	for (NSUInteger length = 0; length <= 300; length += 7)
+	{
+		[inputs addObject:XMPPBase64TestsRandomData(length)];
+	}
+
+	[self runWithEachImplementation:^(NSString *implementation) {
+
+		for (NSData *data in inputs)
+		{
+			for (NSUInteger i = 0; i < sizeof(options) / sizeof(options[0]); i++)
+			{
+				NSString *encoded = [data base64EncodedStringWithOptions:options[i]];
+
+				XCTAssertEqualObjects([XMPPBase64Decoder decodeString:encoded], data, @"%@", implementation);
+			}
+		}
+	}];
+}
+
+- (void)testInvalidInput
+{
+	// Mostly alphabet characters, so the SIMD blocks are sometimes whole and sometimes broken up,
+	// mixed with whitespace, characters from the url-safe alphabet, NUL, bytes above 0x7F and padding.
+
+	const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const uint8_t junk[] = { ' ', '\t', '\r', '\n', '-', '_', '.', '*', 0x00, 0x7F, 0x80, 0xAB, 0xC3, 0xFF, '@', '[', '`', '{' };
+
+	NSMutableArray *inputs = [NSMutableArray array];
+
+	for (int i = 0; i < 2000; i++)
+	{
+		NSUInteger length = random() % 300;
+		NSUInteger junkRate = 1 + (random() % 64);
+
+		NSMutableData *input = [NSMutableData dataWithLength:length];
+		uint8_t *bytes = [input mutableBytes];
+
+		for (NSUInteger j = 0; j < length; j++)
+		{
+			long r = random();
+
+			if (r % 400 == 0)
+				bytes[j] = '=';
+			else if (r % junkRate == 0)
+				bytes[j] = junk[random() % sizeof(junk)];
+			else
+				bytes[j] = (uint8_t)alphabet[random() % 64];
+		}
+
+		[inputs addObject:input];
+	}
+
+	[self runWithEachImplementation:^(NSString *implementation) {
+
+		for (NSData *input in inputs)
+		{
+			XCTAssertEqualObjects([XMPPBase64Decoder decodeData:input], XMPPBase64TestsReferenceDecode(input),
+			                      @"%@: %@", implementation, input);
+		}
+	}];
+}
+
+- (void)testPadding
+{
+	[self runWithEachImplementation:^(NSString *implementation) {
+
+		// Padding ends the data, and anything after it is ignored
+
+		XMPPBase64Decoder *decoder = [[XMPPBase64Decoder alloc] init];
+
+		XCTAssertEqualObjects([decoder decodeString:@"Zm9vYg==Zm9v"], [@"foob" dataUsingEncoding:NSUTF8StringEncoding]);
+		XCTAssertTrue(decoder.isFinished);
+		XCTAssertEqualObjects([decoder decodeString:@"Zm9v"], [NSData data]);
+
+		[decoder reset];
+		XCTAssertFalse(decoder.isFinished);
+		XCTAssertEqualObjects([decoder decodeString:@"Zm9v"], [@"foo" dataUsingEncoding:NSUTF8StringEncoding]);
+
+		// Padding cut across chunks
+
+		[decoder reset];
+		XCTAssertEqualObjects([decoder decodeString:@"Zm9vYm"], [@"foo" dataUsingEncoding:NSUTF8StringEncoding]);
+		XCTAssertEqualObjects([decoder decodeString:@"E"], [NSData data]);
+		XCTAssertEqualObjects([decoder decodeString:@"="], [@"ba" dataUsingEncoding:NSUTF8StringEncoding]);
+		XCTAssertTrue(decoder.isFinished);
+
+		// A single padding character is enough, and a long unpadded run is decoded up to the last whole group
+
+		XCTAssertEqualObjects([XMPPBase64Decoder decodeString:@"Zg="], [@"f" dataUsingEncoding:NSUTF8StringEncoding]);
+		XCTAssertEqualObjects([XMPPBase64Decoder decodeString:@"Zm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZg"],
+		                      [@"foobarfoobarfoobarfoobarfoobar" dataUsingEncoding:NSUTF8StringEncoding]);
+
+		XCTAssertEqualObjects([XMPPBase64Decoder decodeString:@""], [NSData data]);
+		XCTAssertEqualObjects([XMPPBase64Decoder decodeString:@"===="], [NSData data]);
+	}];
+}
+
+@end
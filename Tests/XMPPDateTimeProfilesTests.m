@@ -0,0 +1,438 @@
+#import <XCTest/XCTest.h>
+#import "XMPPDateTimeProfiles.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * XMPPDateTimeProfiles parses and formats XEP-0082 strings arithmetically.
+ * These tests compare it against NSDateFormatter (which it replaced) for edge dates, time zone offsets
+ * and random instants, and check the dates NSDateFormatter can't help with:
+ * those before the Gregorian reform, which XEP-0082 (via ISO 8601) treats as proleptic Gregorian.
+**/
+@interface XMPPDateTimeProfilesTests : XCTestCase
+{
+	NSTimeZone *savedDefaultTimeZone;
+}
+@end
+
+@implementation XMPPDateTimeProfilesTests
+
+static NSDateFormatter *XMPPDateTimeProfilesTestsFormatter(NSString *format, NSTimeZone *timeZone)
+{
+	NSDateFormatter *df = [[NSDateFormatter alloc] init];
+	[df setLocale:[NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"]];
+	[df setCalendar:[[NSCalendar alloc] initWithCalendarIdentifier:NSCalendarIdentifierGregorian]];
+	[df setTimeZone:timeZone];
+	[df setDateFormat:format];
+
+	return df;
+}
+
+static NSTimeZone *XMPPDateTimeProfilesTestsUTC(void)
+{
+	return [NSTimeZone timeZoneForSecondsFromGMT:0];
+}
+
+/**
+ * Parses a DateTime string with NSDateFormatter:
+ * the date & time with a formatter in UTC, then the fraction and zone offset by hand.
+**/
+- (NSTimeInterval)referenceTimeIntervalForDateTime:(NSString *)str
+{
+	NSDateFormatter *df = XMPPDateTimeProfilesTestsFormatter(@"yyyy-MM-dd'T'HH:mm:ss", XMPPDateTimeProfilesTestsUTC());
+
+	NSDate *date = [df dateFromString:[str substringToIndex:19]];
+	XCTAssertNotNil(date, @"%@", str);
+
+	NSTimeInterval ti = [date timeIntervalSinceReferenceDate];
+	NSString *rest = [str substringFromIndex:19];
+
+	if ([rest hasPrefix:@"."])
+	{
+		NSUInteger end = [rest rangeOfCharacterFromSet:[NSCharacterSet characterSetWithCharactersInString:@"Z+-"]].location;
+
+		ti += [[@"0" stringByAppendingString:[rest substringToIndex:end]] doubleValue];
+		rest = [rest substringFromIndex:end];
+	}
+
+	if (![rest isEqualToString:@"Z"])
+	{
+		NSInteger hours = [[rest substringWithRange:NSMakeRange(1, 2)] integerValue];
+		NSInteger minutes = [[rest substringWithRange:NSMakeRange(4, 2)] integerValue];
+		NSInteger offset = (hours * 3600) + (minutes * 60);
+
+		ti -= [rest hasPrefix:@"-"] ? -offset : offset;
+	}
+
+	return ti;
+}
+
+- (void)setUp
+{
+	[super setUp];
+
+	savedDefaultTimeZone = [NSTimeZone defaultTimeZone];
+	srandom(82);
+}
+
+- (void)tearDown
+{
+	[NSTimeZone setDefaultTimeZone:savedDefaultTimeZone];
+
+	[super tearDown];
+}
+
+#pragma mark DateTime
+
+- (void)testDateTimeEdgesMatchDateFormatter
+{
+	NSArray *strings = @[
+		// The examples from XEP-0082
+		@"1969-07-21T02:56:15Z",
+		@"1969-07-20T21:56:15-05:00",
+		@"1969-07-21T02:56:15.123Z",
+		@"1969-07-20T21:56:15.123-05:00",
+
+		// Epochs, and the instants either side
+		@"1970-01-01T00:00:00Z",
+		@"1969-12-31T23:59:59Z",
+		@"2001-01-01T00:00:00Z",
+		@"2000-12-31T23:59:59.999Z",
+		@"2038-01-19T03:14:07Z",
+		@"2038-01-19T03:14:08Z",
+		@"2106-02-07T06:28:16Z",
+
+		// Leap years, and century years that aren't
+		@"2000-02-29T23:59:59Z",
+		@"2000-03-01T00:00:00+00:00",
+		@"1600-02-29T12:00:00Z",
+		@"1900-02-28T23:59:59Z",
+		@"1900-03-01T00:00:00Z",
+		@"2100-02-28T12:00:00Z",
+		@"2100-03-01T00:00:00Z",
+		@"2016-12-31T23:59:59Z",
+
+		// Offsets, including ones that cross a day, month or year boundary
+		@"2000-01-01T00:30:00+01:00",
+		@"1999-12-31T23:30:00-00:30",
+		@"2000-01-01T00:00:00-00:00",
+		@"2012-07-01T05:30:00+05:30",
+		@"2012-07-01T05:45:00+05:45",
+		@"2016-12-31T23:59:59+14:00",
+		@"2016-12-31T23:59:59-12:00",
+		@"2000-03-01T00:00:00+23:59",
+		@"2000-02-28T23:59:59-23:59",
+
+		// Fractions of any length
+		@"2012-07-01T00:00:00.5-09:30",
+		@"2012-07-01T00:00:00.000Z",
+		@"2015-06-30T23:59:59.999999999Z",
+		@"2015-06-30T23:59:59.0000001+01:00",
+
+		// The ends of the range of a four digit year
+		@"1583-01-01T00:00:00+23:59",
+		@"9999-12-31T23:59:59Z",
+		@"9999-12-31T23:59:59-23:59"
+	];
+
+	for (NSString *str in strings)
+	{
+		NSTimeInterval ti = 0;
+		XCTAssertTrue([XMPPDateTimeProfiles parseDateTime:str timeInterval:&ti], @"%@", str);
+		XCTAssertEqualWithAccuracy(ti, [self referenceTimeIntervalForDateTime:str], 0.000001, @"%@", str);
+
+		XCTAssertEqualObjects([XMPPDateTimeProfiles parseDateTime:str], [NSDate dateWithTimeIntervalSinceReferenceDate:ti], @"%@", str);
+	}
+}
+
+- (void)testDateTimeBeforeGregorianReform
+{
+	// NSDateFormatter switches to the Julian calendar before 1582-10-15, XEP-0082 doesn't
+
+	NSDictionary *expected = @{
+		@"0001-01-01T00:00:00Z" : @(-63113904000.0),
+		@"1200-02-29T12:00:00Z" : @(-25272043200.0),
+		@"1582-10-04T23:59:59Z" : @(-13198464001.0),
+		@"1582-10-15T00:00:00Z" : @(-13197600000.0)
+	};
+
+	[expected enumerateKeysAndObjectsUsingBlock:^(NSString *str, NSNumber *expectedTI, BOOL *stop) {
+
+		NSTimeInterval ti = 0;
+		XCTAssertTrue([XMPPDateTimeProfiles parseDateTime:str timeInterval:&ti], @"%@", str);
+		XCTAssertEqual(ti, [expectedTI doubleValue], @"%@", str);
+
+		XCTAssertEqualObjects([XMPPDateTimeProfiles dateTimeStringWithTimeInterval:ti], str);
+	}];
+
+	// 1582-10-10 never happened in the Julian/Gregorian calendar, but is a fine proleptic Gregorian date,
+	// and 1000-02-29 is a Julian leap day, but not a Gregorian one.
+
+	XCTAssertTrue([XMPPDateTimeProfiles parseDateTime:@"1582-10-10T00:00:00Z" timeInterval:NULL]);
+	XCTAssertFalse([XMPPDateTimeProfiles parseDateTime:@"1000-02-29T00:00:00Z" timeInterval:NULL]);
+}
+
+- (void)testRandomDateTimesMatchDateFormatter
+{
+	NSDateFormatter *localFormatter = XMPPDateTimeProfilesTestsFormatter(@"yyyy-MM-dd'T'HH:mm:ss", XMPPDateTimeProfilesTestsUTC());
+	NSDateFormatter *dateFormatter = XMPPDateTimeProfilesTestsFormatter(@"yyyy-MM-dd", XMPPDateTimeProfilesTestsUTC());
+	NSDateFormatter *timeFormatter = XMPPDateTimeProfilesTestsFormatter(@"HH:mm:ss", XMPPDateTimeProfilesTestsUTC());
+
+	// Whole seconds between 1583-01-02 (clear of the Julian calendar, whatever the offset) and 9999-12-30
+
+	NSTimeInterval start = -13190774400.0;
+	NSTimeInterval end = 252423820800.0;
+
+	for (int i = 0; i < 5000; i++)
+	{
+		NSTimeInterval ti = floor(start + ((end - start) * ((double)random() / (double)RAND_MAX)));
+
+		// Formatting (in UTC, truncated to whole seconds)
+
+		NSTimeInterval fraction = (random() % 1000) / 1000.0;
+		NSDate *date = [NSDate dateWithTimeIntervalSinceReferenceDate:ti];
+
+		NSString *expected = [[localFormatter stringFromDate:date] stringByAppendingString:@"Z"];
+
+		XCTAssertEqualObjects([XMPPDateTimeProfiles dateTimeStringWithTimeInterval:(ti + fraction)], expected);
+		XCTAssertEqualObjects([XMPPDateTimeProfiles dateStringWithTimeInterval:(ti + fraction)], [dateFormatter stringFromDate:date]);
+		XCTAssertEqualObjects([XMPPDateTimeProfiles timeStringWithTimeInterval:(ti + fraction)],
+		                      [[timeFormatter stringFromDate:date] stringByAppendingString:@"Z"]);
+
+		// Parsing, in a random zone offset
+
+		NSInteger offset = ((random() % 2879) - 1439) * 60;
+		NSString *sign = (offset < 0) ? @"-" : @"+";
+
+		NSDate *localDate = [NSDate dateWithTimeIntervalSinceReferenceDate:(ti + offset)];
+		NSString *str = [NSString stringWithFormat:@"%@%@%02ld:%02ld", [localFormatter stringFromDate:localDate], sign,
+		                 (long)(labs(offset) / 3600), (long)((labs(offset) / 60) % 60)];
+
+		NSTimeInterval parsed = 0;
+		XCTAssertTrue([XMPPDateTimeProfiles parseDateTime:str timeInterval:&parsed], @"%@", str);
+		XCTAssertEqual(parsed, ti, @"%@", str);
+	}
+}
+
+- (void)testFormattingRoundsDown
+{
+	XCTAssertEqualObjects([XMPPDateTimeProfiles dateTimeStringWithTimeInterval:0.999], @"2001-01-01T00:00:00Z");
+	XCTAssertEqualObjects([XMPPDateTimeProfiles dateTimeStringWithTimeInterval:-0.001], @"2000-12-31T23:59:59Z");
+	XCTAssertEqualObjects([XMPPDateTimeProfiles dateStringWithTimeInterval:-0.001], @"2000-12-31");
+	XCTAssertEqualObjects([XMPPDateTimeProfiles timeStringWithTimeInterval:-0.001], @"23:59:59Z");
+	XCTAssertEqualObjects([XMPPDateTimeProfiles dateTimeStringWithTimeInterval:-978307200.5], @"1969-12-31T23:59:59Z");
+}
+
+- (void)testInvalidDateTimes
+{
+	NSArray *strings = @[
+		@"",
+		@"1969-07-21T02:56:15",             // the zone is mandatory
+		@"1969-07-21 02:56:15Z",
+		@"1969-07-21t02:56:15Z",
+		@"1969-07-21T02:56:15z",
+		@"1969-7-21T02:56:15Z",
+		@"1969-07-21T2:56:15Z",
+		@"+1969-07-21T02:56:15Z",
+		@"-1969-07-21T02:56:15Z",
+		@"1969-07-21T02:56:15.Z",
+		@"1969-07-21T02:56:15,123Z",
+		@"1969-07-21T02:56:15+05",
+		@"1969-07-21T02:56:15+0500",
+		@"1969-07-21T02:56:15+5:00",
+		@"1969-07-21T02:56:15+24:00",
+		@"1969-07-21T02:56:15+05:60",
+		@"1969-07-21T02:56:15Z ",
+		@"1969-07-21T02:56:15ZZ",
+		@"1969-07-21T02:56:15Z+01:00",
+		@"1969-07-21T02:56:15+01:00Z",
+		@"1969-07-21T24:00:00Z",
+		@"1969-07-21T23:60:00Z",
+		@"1969-07-21T23:59:60Z",            // leap seconds aren't representable
+		@"1969-02-29T00:00:00Z",
+		@"1900-02-29T00:00:00Z",
+		@"2000-02-30T00:00:00Z",
+		@"2000-04-31T00:00:00Z",
+		@"2000-00-01T00:00:00Z",
+		@"2000-13-01T00:00:00Z",
+		@"2000-01-00T00:00:00Z",
+		@"2000-01-32T00:00:00Z",
+		@"2000-01-01T00:00:00−05:00",  // minus sign
+		@"２０００-01-01T00:00:00Z"  // fullwidth digits
+	];
+
+	for (NSString *str in strings)
+	{
+		NSTimeInterval ti = 12345;
+		XCTAssertFalse([XMPPDateTimeProfiles parseDateTime:str timeInterval:&ti], @"%@", str);
+		XCTAssertEqual(ti, 12345.0, @"%@", str);
+		XCTAssertNil([XMPPDateTimeProfiles parseDateTime:str], @"%@", str);
+	}
+
+	XCTAssertNil([XMPPDateTimeProfiles parseDateTime:nil]);
+}
+
+#pragma mark Date
+
+- (void)testDatesMatchDateFormatter
+{
+	NSArray *timeZoneNames = @[ @"UTC", @"America/New_York", @"America/Los_Angeles", @"Europe/Berlin", @"Asia/Kolkata",
+	                            @"Asia/Kathmandu", @"Australia/Lord_Howe", @"Pacific/Kiritimati", @"Pacific/Pago_Pago" ];
+
+	NSDateFormatter *utcFormatter = XMPPDateTimeProfilesTestsFormatter(@"yyyy-MM-dd", XMPPDateTimeProfilesTestsUTC());
+
+	for (NSString *timeZoneName in timeZoneNames)
+	{
+		NSTimeZone *timeZone = [NSTimeZone timeZoneWithName:timeZoneName];
+		XCTAssertNotNil(timeZone, @"%@", timeZoneName);
+
+		[NSTimeZone setDefaultTimeZone:timeZone];
+
+		NSDateFormatter *df = XMPPDateTimeProfilesTestsFormatter(@"yyyy-MM-dd", timeZone);
+		[df setLenient:YES];
+
+		// Every day between 1970 and 2100 is too slow, so a spread of random ones plus the year boundaries
+
+		NSMutableArray *strings = [NSMutableArray arrayWithObjects:@"1970-01-01", @"1999-12-31", @"2000-01-01", @"2000-02-29", nil];
+
+		for (int i = 0; i < 1000; i++)
+		{
+			NSTimeInterval ti = -978307200.0 + (86400.0 * (random() % 47482));
+			[strings addObject:[utcFormatter stringFromDate:[NSDate dateWithTimeIntervalSinceReferenceDate:ti]]];
+		}
+
+		for (NSString *str in strings)
+		{
+			NSTimeInterval ti = 0;
+			XCTAssertTrue([XMPPDateTimeProfiles parseDate:str timeInterval:&ti], @"%@ in %@", str, timeZoneName);
+			XCTAssertEqual(ti, [[df dateFromString:str] timeIntervalSinceReferenceDate], @"%@ in %@", str, timeZoneName);
+		}
+	}
+}
+
+- (void)testDatesAroundTimeZoneTransitions
+{
+	// Where midnight doesn't exist, the date starts when the clocks have gone forward
+
+	NSDictionary *expected = @{
+		@"America/Sao_Paulo" : @{
+			@"2018-11-04" : @"2018-11-04T03:00:00Z",    // midnight skipped, so 01:00-02:00
+			@"2018-02-18" : @"2018-02-18T03:00:00Z",    // 23:00-24:00 on the day before repeats
+			@"2018-11-03" : @"2018-11-03T03:00:00Z",
+			@"2018-11-05" : @"2018-11-05T02:00:00Z"
+		},
+		@"Pacific/Apia" : @{
+			@"2011-12-29" : @"2011-12-29T10:00:00Z",
+			@"2011-12-30" : @"2011-12-30T10:00:00Z",    // skipped entirely, so 2011-12-31T00:00+14:00
+			@"2011-12-31" : @"2011-12-30T10:00:00Z"
+		},
+		@"Europe/Berlin" : @{
+			@"2021-03-28" : @"2021-03-27T23:00:00Z",
+			@"2021-03-29" : @"2021-03-28T22:00:00Z"
+		}
+	};
+
+	[expected enumerateKeysAndObjectsUsingBlock:^(NSString *timeZoneName, NSDictionary *dates, BOOL *stop) {
+
+		[NSTimeZone setDefaultTimeZone:[NSTimeZone timeZoneWithName:timeZoneName]];
+
+		[dates enumerateKeysAndObjectsUsingBlock:^(NSString *dateStr, NSString *dateTimeStr, BOOL *stop) {
+
+			NSTimeInterval ti = 0;
+			NSTimeInterval expectedTI = 0;
+
+			XCTAssertTrue([XMPPDateTimeProfiles parseDate:dateStr timeInterval:&ti]);
+			XCTAssertTrue([XMPPDateTimeProfiles parseDateTime:dateTimeStr timeInterval:&expectedTI]);
+
+			XCTAssertEqual(ti, expectedTI, @"%@ in %@", dateStr, timeZoneName);
+		}];
+	}];
+}
+
+- (void)testInvalidDates
+{
+	NSArray *strings = @[ @"", @"2000-1-01", @"2000-01-1", @"2000/01/01", @"2000-01-01Z", @"20000-01-01",
+	                      @"2001-02-29", @"1900-02-29", @"1000-02-29", @"2000-02-30", @"2000-00-01", @"2000-13-01",
+	                      @"2000-01-00", @"2000-01-32", @"2000-06-31", @"2000-01-01T00:00:00Z", @"abcd-ef-gh" ];
+
+	for (NSString *str in strings)
+	{
+		XCTAssertFalse([XMPPDateTimeProfiles parseDate:str timeInterval:NULL], @"%@", str);
+		XCTAssertNil([XMPPDateTimeProfiles parseDate:str], @"%@", str);
+	}
+}
+
+#pragma mark Time
+
+- (void)testTimes
+{
+	[NSTimeZone setDefaultTimeZone:[NSTimeZone timeZoneWithName:@"America/New_York"]];
+
+	NSDateFormatter *utcFormatter = XMPPDateTimeProfilesTestsFormatter(@"HH:mm:ss.SSS", XMPPDateTimeProfilesTestsUTC());
+	NSDateFormatter *localFormatter = XMPPDateTimeProfilesTestsFormatter(@"HH:mm:ss.SSS", [NSTimeZone defaultTimeZone]);
+
+	NSDictionary *utcTimes = @{
+		@"16:00:00Z"          : @"16:00:00.000",
+		@"16:00:00+07:00"     : @"09:00:00.000",
+		@"16:00:00.123Z"      : @"16:00:00.123",
+		@"16:00:00.123+07:00" : @"09:00:00.123",
+		@"23:59:59-00:01"     : @"00:00:59.000",
+		@"00:00:00+23:59"     : @"00:01:00.000"
+	};
+
+	NSDate *now = [NSDate date];
+
+	[utcTimes enumerateKeysAndObjectsUsingBlock:^(NSString *str, NSString *expected, BOOL *stop) {
+
+		NSDate *date = [XMPPDateTimeProfiles parseTime:str];
+
+		XCTAssertEqualObjects([utcFormatter stringFromDate:date], expected, @"%@", str);
+		XCTAssertLessThan(fabs([date timeIntervalSinceDate:now]), 2 * 86400.0, @"%@", str);
+	}];
+
+	// Without a zone, the time is local
+
+	NSDictionary *localTimes = @{
+		@"16:00:00"     : @"16:00:00.000",
+		@"12:34:56.789" : @"12:34:56.789",
+		@"00:00:00"     : @"00:00:00.000"
+	};
+
+	[localTimes enumerateKeysAndObjectsUsingBlock:^(NSString *str, NSString *expected, BOOL *stop) {
+
+		NSDate *date = [XMPPDateTimeProfiles parseTime:str];
+
+		XCTAssertEqualObjects([localFormatter stringFromDate:date], expected, @"%@", str);
+		XCTAssertLessThan(fabs([date timeIntervalSinceDate:now]), 86400.0, @"%@", str);
+	}];
+
+	NSArray *invalid = @[ @"", @"16:00", @"16:00:0", @"16:00:00.", @"16:00:00 ", @"24:00:00", @"16:60:00", @"16:00:60",
+	                      @"16:00:00+07", @"16:00:00+0700", @"16:00:00z", @"1969-07-21T02:56:15Z" ];
+
+	for (NSString *str in invalid)
+	{
+		XCTAssertFalse([XMPPDateTimeProfiles parseTime:str timeInterval:NULL], @"%@", str);
+	}
+}
+
+#pragma mark Time Zone Offset
+
+- (void)testTimeZoneOffsets
+{
+	XCTAssertEqual([[XMPPDateTimeProfiles parseTimeZoneOffset:@"+00:00"] secondsFromGMT], (NSInteger)0);
+	XCTAssertEqual([[XMPPDateTimeProfiles parseTimeZoneOffset:@"-00:00"] secondsFromGMT], (NSInteger)0);
+	XCTAssertEqual([[XMPPDateTimeProfiles parseTimeZoneOffset:@"+05:30"] secondsFromGMT], (NSInteger)19800);
+	XCTAssertEqual([[XMPPDateTimeProfiles parseTimeZoneOffset:@"-09:30"] secondsFromGMT], (NSInteger)-34200);
+	XCTAssertEqual([[XMPPDateTimeProfiles parseTimeZoneOffset:@"+14:00"] secondsFromGMT], (NSInteger)50400);
+
+	NSArray *invalid = @[ @"", @"Z", @"05:30", @"+5:30", @"+0530", @"*05:30", @"+24:00", @"+05:60", @"+05:30Z" ];
+
+	for (NSString *str in invalid)
+	{
+		XCTAssertNil([XMPPDateTimeProfiles parseTimeZoneOffset:str], @"%@", str);
+	}
+}
+
+@end
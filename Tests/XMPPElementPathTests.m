@@ -0,0 +1,341 @@
+#import <XCTest/XCTest.h>
+#import "XMPPElementPath.h"
+#import "NSXMLElement+XMPP.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * XMPPElementPath and the first-match lookups of NSXMLElement+XMPP walk the children via nextSibling.
+ * These tests compare them against the array based KissXML methods they replaced,
+ * and against a plain recursive evaluation of the path over [element children].
+ *
+ * Every element in the test documents has a unique id attribute, since KissXML may hand out
+ * a different wrapper object for the same node.
+**/
+@interface XMPPElementPathTests : XCTestCase
+@end
+
+@implementation XMPPElementPathTests
+
+static NSXMLElement *XMPPElementPathTestsElement(NSString *xml)
+{
+	NSError *error = nil;
+	NSXMLElement *element = [[NSXMLElement alloc] initWithXMLString:xml error:&error];
+	NSCAssert(element != nil, @"Invalid XML: %@", error);
+
+	return element;
+}
+
+static NSString *XMPPElementPathTestsID(NSXMLElement *element)
+{
+	return [element attributeStringValueForName:@"id"];
+}
+
+static NSArray *XMPPElementPathTestsIDs(NSArray *elements)
+{
+	NSMutableArray *ids = [NSMutableArray arrayWithCapacity:[elements count]];
+
+	for (NSXMLElement *element in elements)
+	{
+		[ids addObject:XMPPElementPathTestsID(element)];
+	}
+
+	return ids;
+}
+
+/**
+ * Evaluates the steps (e.g. @[ @[ @"result", @"urn:xmpp:mam:2" ], @[ @"*", [NSNull null] ] ]) over the children arrays.
+**/
+static void XMPPElementPathTestsReference(NSArray *steps, NSUInteger stepIndex, NSXMLElement *element, NSMutableArray *matches)
+{
+	NSString *name = steps[stepIndex][0];
+	id xmlns = steps[stepIndex][1];
+
+	for (NSXMLNode *node in [element children])
+	{
+		if ([node kind] != NSXMLElementKind) continue;
+
+		NSXMLElement *child = (NSXMLElement *)node;
+
+		if (![name isEqualToString:@"*"] && ![[child localName] isEqualToString:name]) continue;
+		if (xmlns != [NSNull null] && ![[child URI] isEqualToString:xmlns] && ![[child xmlns] isEqualToString:xmlns]) continue;
+
+		if (stepIndex + 1 == [steps count])
+			[matches addObject:child];
+		else
+			XMPPElementPathTestsReference(steps, stepIndex + 1, child, matches);
+	}
+}
+
+- (NSArray *)matchesOfPath:(XMPPElementPath *)path inElement:(NSXMLElement *)element
+{
+	NSMutableArray *matches = [NSMutableArray array];
+
+	[path enumerateMatchesInElement:element usingBlock:^(NSXMLElement *match, BOOL *stop) {
+		[matches addObject:match];
+	}];
+
+	return matches;
+}
+
+#pragma mark Paths
+
+- (void)testMAMResult
+{
+	NSXMLElement *message = XMPPElementPathTestsElement(
+		@"<message id='0' xmlns='jabber:client'>"
+		@"  <result id='1' xmlns='urn:xmpp:mam:2' queryid='f27'>"
+		@"    <forwarded id='2' xmlns='urn:xmpp:forward:0'>"
+		@"      <delay id='3' xmlns='urn:xmpp:delay' stamp='2010-07-10T23:08:25Z'/>"
+		@"      <message id='4' xmlns='jabber:client' to='juliet@capulet.lit/balcony' from='romeo@montague.lit/orchard'>"
+		@"        <body id='5'>Call me but love, and I'll be new baptized; Henceforth I never will be Romeo.</body>"
+		@"      </message>"
+		@"    </forwarded>"
+		@"  </result>"
+		@"</message>");
+
+	NSXMLElement *body = [[XMPPElementPath pathWithString:@"result[urn:xmpp:mam:2]/forwarded/message/body"] firstMatchInElement:message];
+	XCTAssertEqualObjects(XMPPElementPathTestsID(body), @"5");
+
+	XCTAssertEqualObjects(XMPPElementPathTestsID([message elementForPath:@"result/forwarded[urn:xmpp:forward:0]/delay"]), @"3");
+	XCTAssertEqualObjects(XMPPElementPathTestsID([message elementForPath:@"*/*/*[jabber:client]/*"]), @"5");
+	XCTAssertEqualObjects(XMPPElementPathTestsID([message elementForPath:@"result"]), @"1");
+
+	// The path is relative to the given element, and the namespaces must match
+
+	XCTAssertNil([message elementForPath:@"message/result"]);
+	XCTAssertNil([message elementForPath:@"result[urn:xmpp:mam:1]/forwarded/message/body"]);
+	XCTAssertNil([message elementForPath:@"result/forwarded/message/body/text"]);
+}
+
+- (void)testBacktracking
+{
+	// The first matching child of each step leads nowhere, so its following siblings must be tried
+
+	NSXMLElement *root = XMPPElementPathTestsElement(
+		@"<root id='0'>"
+		@"  <a id='1'><b id='2'/></a>"
+		@"  <!-- a comment -->"
+		@"  <a id='3'>text<b id='4'><c id='5'/></b><b id='6'><c id='7'/><c id='8'/></b></a>"
+		@"  <a id='9' xmlns='urn:x'><b id='10'><c id='11'/></b></a>"
+		@"</root>");
+
+	XMPPElementPath *path = [XMPPElementPath pathWithString:@"a/b/c"];
+
+	XCTAssertEqualObjects(XMPPElementPathTestsID([path firstMatchInElement:root]), @"5");
+	XCTAssertEqualObjects(XMPPElementPathTestsIDs([self matchesOfPath:path inElement:root]), (@[ @"5", @"7", @"8", @"11" ]));
+
+	XMPPElementPath *nsPath = [XMPPElementPath pathWithString:@"a[urn:x]/b/c[urn:x]"];
+	XCTAssertEqualObjects(XMPPElementPathTestsIDs([self matchesOfPath:nsPath inElement:root]), (@[ @"11" ]));
+
+	// Stopping the enumeration
+
+	__block NSUInteger count = 0;
+	[path enumerateMatchesInElement:root usingBlock:^(NSXMLElement *match, BOOL *stop) {
+
+		count++;
+		*stop = [XMPPElementPathTestsID(match) isEqualToString:@"7"];
+	}];
+	XCTAssertEqual(count, (NSUInteger)2);
+
+	XCTAssertNil([path firstMatchInElement:nil]);
+	XCTAssertNil([path firstMatchInElement:XMPPElementPathTestsElement(@"<root/>")]);
+}
+
+- (void)testNamespaceWithSlashes
+{
+	NSXMLElement *iq = XMPPElementPathTestsElement(
+		@"<iq id='0' type='result'>"
+		@"  <query id='1' xmlns='http://jabber.org/protocol/disco#items'/>"
+		@"  <query id='2' xmlns='http://jabber.org/protocol/disco#info'><identity id='3' category='server'/></query>"
+		@"</iq>");
+
+	XMPPElementPath *path = [XMPPElementPath pathWithString:@"query[http://jabber.org/protocol/disco#info]/identity"];
+	XCTAssertNotNil(path);
+
+	XCTAssertEqualObjects(XMPPElementPathTestsID([path firstMatchInElement:iq]), @"3");
+	XCTAssertEqualObjects(XMPPElementPathTestsID([iq elementForPath:@"*[http://jabber.org/protocol/disco#info]"]), @"2");
+}
+
+- (void)testElementsCreatedInCode
+{
+	// Elements built with elementWithName:xmlns: only have the xmlns attribute, which must match as well
+
+	NSXMLElement *message = [NSXMLElement elementWithName:@"message"];
+	NSXMLElement *result = [NSXMLElement elementWithName:@"result" xmlns:@"urn:xmpp:mam:2"];
+	NSXMLElement *body = [NSXMLElement elementWithName:@"body" stringValue:@"hi"];
+
+	[result addChild:body];
+	[message addChild:result];
+
+	XCTAssertEqualObjects([[message elementForPath:@"result[urn:xmpp:mam:2]/body"] stringValue], @"hi");
+	XCTAssertEqualObjects([[message elementForName:@"result" xmlns:@"urn:xmpp:mam:2"] xmlns], @"urn:xmpp:mam:2");
+	XCTAssertEqualObjects([[message elementForXmlns:@"urn:xmpp:mam:2"] name], @"result");
+}
+
+- (void)testInvalidPaths
+{
+	NSArray *invalid = @[ @"", @"/", @"a/", @"/a", @"a//b", @"a[", @"a[]", @"a]", @"a[x]b", @"a[x][y]",
+	                      @"[x]", @"a[x", @"a[[x]]", @"a[x]]", @"a/[x]/b" ];
+
+	for (NSString *str in invalid)
+	{
+		XCTAssertNil([XMPPElementPath pathWithString:str], @"\"%@\"", str);
+		XCTAssertNil([XMPPElementPath cachedPathWithString:str], @"\"%@\"", str);
+	}
+
+	XCTAssertNil([XMPPElementPathTestsElement(@"<a><b/></a>") elementForPath:@"b/"]);
+}
+
+- (void)testCache
+{
+	NSString *str = @"result[urn:xmpp:mam:2]/forwarded/message/body";
+
+	XMPPElementPath *path = [XMPPElementPath cachedPathWithString:str];
+	XCTAssertEqualObjects(path.pathString, str);
+
+	XCTAssertEqual([XMPPElementPath cachedPathWithString:[str mutableCopy]], path);
+	XCTAssertNotEqual([XMPPElementPath pathWithString:str], path);
+}
+
+- (void)testRandomTreesMatchReference
+{
+	srandom(17);
+
+	NSArray *names = @[ @"a", @"b", @"c" ];
+	NSArray *namespaces = @[ [NSNull null], @"urn:x", @"urn:y" ];
+
+	for (int i = 0; i < 200; i++)
+	{
+		NSMutableString *xml = [NSMutableString string];
+		__block NSUInteger nextID = 0;
+
+		// Random documents of up to 4 levels, with namespaces (inherited by the children),
+		// text and comments between the elements.
+
+		__block void (^appendElement)(NSUInteger depth);
+		void (^appendElementBlock)(NSUInteger depth) = ^(NSUInteger depth) {
+
+			NSString *name = names[random() % [names count]];
+			id xmlns = namespaces[random() % [namespaces count]];
+
+			[xml appendFormat:@"<%@ id='%lu'", name, (unsigned long)nextID++];
+			if (xmlns != [NSNull null]) [xml appendFormat:@" xmlns='%@'", xmlns];
+			[xml appendString:@">"];
+
+			NSUInteger childCount = (depth < 4) ? (NSUInteger)(random() % 4) : 0;
+			for (NSUInteger j = 0; j < childCount; j++)
+			{
+				switch (random() % 4)
+				{
+					case 0  : [xml appendString:@"text"];       break;
+					case 1  : [xml appendString:@"<!--c-->"];   break;
+					default :                                   break;
+				}
+				appendElement(depth + 1);
+			}
+
+			[xml appendFormat:@"</%@>", name];
+		};
+		appendElement = appendElementBlock;
+
+		[xml appendString:@"<root id='root'>"];
+		for (NSUInteger j = 0; j < 4; j++)
+		{
+			appendElement(1);
+		}
+		[xml appendString:@"</root>"];
+
+		appendElement = nil;
+
+		NSXMLElement *root = XMPPElementPathTestsElement(xml);
+
+		for (int k = 0; k < 20; k++)
+		{
+			NSMutableArray *steps = [NSMutableArray array];
+			NSMutableArray *stepStrings = [NSMutableArray array];
+
+			NSUInteger stepCount = 1 + (random() % 3);
+			for (NSUInteger s = 0; s < stepCount; s++)
+			{
+				NSString *name = (random() % 4 == 0) ? @"*" : names[random() % [names count]];
+				id xmlns = namespaces[random() % [namespaces count]];
+
+				[steps addObject:@[ name, xmlns ]];
+
+				if (xmlns == [NSNull null])
+					[stepStrings addObject:name];
+				else
+					[stepStrings addObject:[NSString stringWithFormat:@"%@[%@]", name, xmlns]];
+			}
+
+			NSString *str = [stepStrings componentsJoinedByString:@"/"];
+			XMPPElementPath *path = [XMPPElementPath pathWithString:str];
+			XCTAssertNotNil(path, @"%@", str);
+
+			NSMutableArray *expected = [NSMutableArray array];
+			XMPPElementPathTestsReference(steps, 0, root, expected);
+
+			NSArray *matches = [self matchesOfPath:path inElement:root];
+
+			XCTAssertEqualObjects(XMPPElementPathTestsIDs(matches), XMPPElementPathTestsIDs(expected), @"%@ in %@", str, xml);
+			XCTAssertEqualObjects(XMPPElementPathTestsID([path firstMatchInElement:root]),
+			                      [expected count] > 0 ? XMPPElementPathTestsID(expected[0]) : nil, @"%@ in %@", str, xml);
+		}
+	}
+}
+
+#pragma mark First-match lookups
+
+- (void)testFirstMatchLookupsMatchArrayMethods
+{
+	NSXMLElement *root = XMPPElementPathTestsElement(
+		@"<root id='0' xmlns='jabber:client' xmlns:p='urn:p'>"
+		@"  text"
+		@"  <!-- comment -->"
+		@"  <x id='1' xmlns='urn:a'/>"
+		@"  <y id='2'/>"
+		@"  <x id='3' xmlns='urn:b'/>"
+		@"  <x id='4'/>"
+		@"  <p:x id='5'/>"
+		@"  <p:y id='6'/>"
+		@"  <z id='7' xmlns='urn:b'><x id='8'/></z>"
+		@"</root>");
+
+	for (NSString *name in @[ @"x", @"y", @"z", @"w", @"p:x", @"p:y", @"q:x" ])
+	{
+		NSArray *elements = [root elementsForName:name];
+
+		XCTAssertEqualObjects(XMPPElementPathTestsID([root elementForName:name]),
+		                      [elements count] > 0 ? XMPPElementPathTestsID(elements[0]) : nil, @"%@", name);
+
+		for (NSString *xmlns in @[ @"urn:a", @"urn:b", @"urn:p", @"jabber:client", @"urn:none" ])
+		{
+			NSArray *nsElements = [root elementsForLocalName:name URI:xmlns];
+
+			if ([name rangeOfString:@":"].location == NSNotFound)
+			{
+				XCTAssertEqualObjects(XMPPElementPathTestsID([root elementForName:name xmlns:xmlns]),
+				                      [nsElements count] > 0 ? XMPPElementPathTestsID(nsElements[0]) : nil, @"%@ %@", name, xmlns);
+			}
+		}
+	}
+
+	for (NSString *xmlns in @[ @"urn:a", @"urn:b", @"urn:none" ])
+	{
+		NSArray *elements = [root elementsForXmlns:xmlns];
+
+		XCTAssertEqualObjects(XMPPElementPathTestsID([root elementForXmlns:xmlns]),
+		                      [elements count] > 0 ? XMPPElementPathTestsID(elements[0]) : nil, @"%@", xmlns);
+	}
+
+	XCTAssertEqualObjects(XMPPElementPathTestsIDs([root elementsForXmlns:@"urn:b"]), (@[ @"3", @"7" ]));
+	XCTAssertEqualObjects(XMPPElementPathTestsID([root elementForName:@"x" xmlnsPrefix:@"urn:"]), @"1");
+
+	XCTAssertNil([XMPPElementPathTestsElement(@"<empty/>") elementForName:@"x"]);
+	XCTAssertNil([XMPPElementPathTestsElement(@"<empty/>") elementForXmlns:@"urn:a"]);
+}
+
+@end
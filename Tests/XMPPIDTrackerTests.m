@@ -0,0 +1,347 @@
+#import <XCTest/XCTest.h>
+#import "XMPPIDTrackerPrivate.h"
+#import "XMPPRandomOperations.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * XMPPIDTracker keeps compact (base-62 counter) ids in an open-addressed table, and any other id in a dictionary.
+ *
+ * These tests check the compact id encoding, and run the table against a dictionary model:
+ * through growth, probe sequences wrapping around the end of the table, and backward shift deletion.
+**/
+@interface XMPPIDTrackerTests : XCTestCase
+{
+	dispatch_queue_t queue;
+	XMPPIDTracker *tracker;
+}
+@end
+
+@implementation XMPPIDTrackerTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	queue = dispatch_queue_create("XMPPIDTrackerTests", NULL);
+	tracker = [[XMPPIDTracker alloc] initWithDispatchQueue:queue];
+}
+
+- (void)tearDown
+{
+	dispatch_sync(queue, ^{
+		[tracker removeAllIDs];
+	});
+	tracker = nil;
+
+	[super tearDown];
+}
+
+- (void)addID:(NSString *)elementID toModel:(NSMutableDictionary *)model
+{
+	// Each id is tracked with a block reporting the id it was added under,
+	// so a lookup that lands on the wrong slot is caught.
+
+	NSMutableArray *invoked = [NSMutableArray array];
+	model[elementID] = invoked;
+
+	[tracker addID:elementID block:^(id obj, id <XMPPTrackingInfo> info) {
+
+		[invoked addObject:elementID];
+
+	} timeout:XMPPIDTrackerTimeoutNone];
+}
+
+- (void)invokeID:(NSString *)elementID inModel:(NSMutableDictionary *)model
+{
+	NSMutableArray *invoked = model[elementID];
+	BOOL result = [tracker invokeForID:elementID withObject:nil];
+
+	if (invoked)
+	{
+		XCTAssertTrue(result, @"%@ not found", elementID);
+		XCTAssertEqualObjects(invoked, @[ elementID ]);
+
+		[model removeObjectForKey:elementID];
+	}
+	else
+	{
+		XCTAssertFalse(result, @"%@ found, but was never added", elementID);
+	}
+}
+
+- (void)checkModel:(NSMutableDictionary *)model
+{
+	XCTAssertEqual([tracker numberOfIDs], [model count]);
+
+	for (NSString *elementID in [model allKeys])
+	{
+		[self invokeID:elementID inModel:model];
+	}
+
+	XCTAssertEqual([tracker numberOfIDs], (NSUInteger)0);
+}
+
+#pragma mark Compact IDs
+
+- (void)testCompactIDRoundTrip
+{
+	uint64_t values[] = { 1, 9, 10, 35, 36, 61, 62, 63, 3843, 3844, UINT32_MAX, UINT64_MAX - 1, UINT64_MAX };
+
+	for (NSUInteger i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+	{
+		NSString *compactID = [XMPPIDTracker compactIDWithValue:values[i]];
+
+		uint64_t value = 0;
+		XCTAssertTrue([XMPPIDTracker getValue:&value fromCompactID:compactID], @"%@", compactID);
+		XCTAssertEqual(value, values[i]);
+	}
+
+	// Every power of 62 that fits
+
+	uint64_t power = 1;
+	for (NSUInteger digits = 1; digits <= 11; digits++)
+	{
+		NSString *compactID = [XMPPIDTracker compactIDWithValue:power];
+		XCTAssertEqual([compactID length], digits);
+
+		uint64_t value = 0;
+		XCTAssertTrue([XMPPIDTracker getValue:&value fromCompactID:compactID]);
+		XCTAssertEqual(value, power);
+
+		if (digits < 11) power *= 62;
+	}
+
+	srandom(12);
+	for (int i = 0; i < 10000; i++)
+	{
+		uint64_t expected = ((uint64_t)random() << 33) ^ ((uint64_t)random() << 11) ^ (uint64_t)random();
+		if (expected == 0) continue;
+
+		uint64_t value = 0;
+		XCTAssertTrue([XMPPIDTracker getValue:&value fromCompactID:[XMPPIDTracker compactIDWithValue:expected]]);
+		XCTAssertEqual(value, expected);
+	}
+}
+
+- (void)testCompactIDEncoding
+{
+	XCTAssertEqualObjects([XMPPIDTracker compactIDWithValue:1], @"1");
+	XCTAssertEqualObjects([XMPPIDTracker compactIDWithValue:10], @"A");
+	XCTAssertEqualObjects([XMPPIDTracker compactIDWithValue:61], @"z");
+	XCTAssertEqualObjects([XMPPIDTracker compactIDWithValue:62], @"10");
+	XCTAssertEqualObjects([XMPPIDTracker compactIDWithValue:UINT64_MAX], @"LygHa16AHYF");
+}
+
+- (void)testCompactIDRejects
+{
+	NSArray *rejects = @[
+		@"",
+		@"0",                  // zero is not a valid value
+		@"01",                 // leading zero, not canonical
+		@"00000000001",
+		@"LygHa16AHYG",        // UINT64_MAX + 1
+		@"zzzzzzzzzzz",        // overflows
+		@"100000000000",       // 12 digits
+		@"abc-def",
+		@"abc def",
+		@"abc_",
+		@"été",
+		@"6C1F3A02-1C3E-4A55-9E5D-5B1A1B0E2D47"
+	];
+
+	for (NSString *elementID in rejects)
+	{
+		uint64_t value = 0;
+		XCTAssertFalse([XMPPIDTracker getValue:&value fromCompactID:elementID], @"\"%@\"", elementID);
+	}
+}
+
+#pragma mark Table
+
+- (void)testGrowth
+{
+	dispatch_sync(queue, ^{
+
+		NSMutableDictionary *model = [NSMutableDictionary dictionary];
+
+		// Consecutive counter values, as the stream hands them out, through many doublings of the table
+
+		for (uint64_t value = 1; value <= 5000; value++)
+		{
+			[self addID:[XMPPIDTracker compactIDWithValue:value] toModel:model];
+
+			XCTAssertEqual([tracker numberOfIDs], (NSUInteger)value);
+		}
+
+		[self checkModel:model];
+	});
+}
+
+- (void)testWrapAroundAndBackwardShift
+{
+	// Keys that all hash to the last two slots of the initial table,
+	// so their probe sequence wraps around to the start of the table.
+	// Seven fit before the table grows.
+
+	NSMutableArray *clustered = [NSMutableArray array];
+
+	for (uint64_t key = 1; [clustered count] < 7; key++)
+	{
+		if (XMPPIDTrackerHomeIndex(key, XMPP_ID_TRACKER_INITIAL_SLOT_CAPACITY) >= XMPP_ID_TRACKER_INITIAL_SLOT_CAPACITY - 2)
+		{
+			[clustered addObject:[XMPPIDTracker compactIDWithValue:key]];
+		}
+	}
+
+	// Remove each key first, which shifts the rest of the cluster back across the wrap,
+	// then a few more in every rotation of the insertion order, and check the rest can still be found.
+
+	NSUInteger count = [clustered count];
+
+	for (NSUInteger first = 0; first < count; first++)
+	{
+		for (NSUInteger rotation = 0; rotation < count; rotation++)
+		{
+			for (NSUInteger removals = 0; removals < count; removals++)
+			{
+				dispatch_sync(queue, ^{
+
+					NSMutableDictionary *model = [NSMutableDictionary dictionary];
+
+					for (NSString *elementID in clustered)
+					{
+						[self addID:elementID toModel:model];
+					}
+					XCTAssertEqual([tracker numberOfIDs], count);
+
+					[self invokeID:clustered[first] inModel:model];
+					[self invokeID:clustered[first] inModel:model];
+
+					for (NSUInteger i = 0; i < removals; i++)
+					{
+						NSString *elementID = clustered[(rotation + i) % count];
+
+						[tracker removeID:elementID];
+						[model removeObjectForKey:elementID];
+					}
+
+					[self checkModel:model];
+				});
+			}
+		}
+	}
+}
+
+- (NSString *)randomElementID
+{
+	// Mostly compact ids from a small range, so adds, removes & invokes hit the same keys,
+	// mixed with ids that look compact but aren't, and ordinary uuid strings.
+
+	switch (random() % 8)
+	{
+		case 0  : return [NSString stringWithFormat:@"0%lx", random() % 64];
+		case 1  : return [NSString stringWithFormat:@"uuid-%ld", random() % 64];
+		default : return [XMPPIDTracker compactIDWithValue:1 + (uint64_t)(random() % 1024)];
+	}
+}
+
+- (void)testRandomOperations
+{
+	dispatch_sync(queue, ^{
+
+		NSMutableDictionary *model = [NSMutableDictionary dictionary];
+		XMPPRandomOperations *operations = [[XMPPRandomOperations alloc] init];
+
+		[operations addOperationWithWeight:2 block:^{
+			[self addID:[self randomElementID] toModel:model];
+		}];
+
+		[operations addOperationWithWeight:1 block:^{
+			[self invokeID:[self randomElementID] inModel:model];
+		}];
+
+		[operations addOperationWithWeight:1 block:^{
+
+			NSString *elementID = [self randomElementID];
+
+			[tracker removeID:elementID];
+			[model removeObjectForKey:elementID];
+		}];
+
+		operations.checkBlock = ^{
+			XCTAssertEqual([tracker numberOfIDs], [model count]);
+		};
+
+		for (NSUInteger round = 0; round < 5; round++)
+		{
+			[operations runWithSeed:(unsigned)(1012 + round) iterations:10000];
+
+			[tracker removeAllIDs];
+			[model removeAllObjects];
+
+			XCTAssertEqual([tracker numberOfIDs], (NSUInteger)0);
+		}
+
+		[operations runIterations:10000];
+
+		[self checkModel:model];
+	});
+}
+
+- (void)testReplace
+{
+	dispatch_sync(queue, ^{
+
+		__block NSUInteger oldInvoked = 0;
+		__block NSUInteger newInvoked = 0;
+
+		NSArray *ids = @[ [XMPPIDTracker compactIDWithValue:42], @"not-compact" ];
+
+		for (NSString *elementID in ids)
+		{
+			[tracker addID:elementID block:^(id obj, id <XMPPTrackingInfo> info) {
+				oldInvoked++;
+			} timeout:XMPPIDTrackerTimeoutNone];
+
+			[tracker addID:elementID block:^(id obj, id <XMPPTrackingInfo> info) {
+				newInvoked++;
+			} timeout:XMPPIDTrackerTimeoutNone];
+		}
+
+		XCTAssertEqual([tracker numberOfIDs], (NSUInteger)2);
+
+		for (NSString *elementID in ids)
+		{
+			XCTAssertTrue([tracker invokeForID:elementID withObject:nil]);
+			XCTAssertFalse([tracker invokeForID:elementID withObject:nil]);
+		}
+
+		XCTAssertEqual(oldInvoked, (NSUInteger)0);
+		XCTAssertEqual(newInvoked, (NSUInteger)2);
+		XCTAssertEqual([tracker numberOfIDs], (NSUInteger)0);
+	});
+}
+
+- (void)testTimeout
+{
+	XCTestExpectation *expectation = [self expectationWithDescription:@"timeout"];
+
+	dispatch_sync(queue, ^{
+
+		[tracker addID:[XMPPIDTracker compactIDWithValue:7] block:^(id obj, id <XMPPTrackingInfo> info) {
+
+			XCTAssertNil(obj);
+			XCTAssertEqualObjects([info elementID], @"7");
+
+			[expectation fulfill];
+
+		} timeout:0.05];
+	});
+
+	[self waitForExpectationsWithTimeout:5.0 handler:nil];
+}
+
+@end
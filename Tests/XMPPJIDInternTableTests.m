@@ -0,0 +1,176 @@
+#import <XCTest/XCTest.h>
+#import "XMPPJID.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * The intern table is process-wide, so each test starts from an empty table, and restores the capacity afterwards.
+ * An interned JID is recognized by identity: parsing its string again returns the same instance.
+**/
+@interface XMPPJIDInternTableTests : XCTestCase
+{
+	NSUInteger savedCapacity;
+}
+@end
+
+@implementation XMPPJIDInternTableTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	savedCapacity = [XMPPJID internTableCapacity];
+	[XMPPJID removeAllInternedJIDs];
+}
+
+- (void)tearDown
+{
+	[XMPPJID setInternTableCapacity:savedCapacity];
+	[XMPPJID removeAllInternedJIDs];
+
+	[super tearDown];
+}
+
+- (void)testInterning
+{
+	XMPPJID *jid = [XMPPJID jidWithString:@"alice@example.com/phone"];
+
+	XCTAssertEqual([XMPPJID jidWithString:@"alice@example.com/phone"], jid);
+
+	// The bare JID is shared with the bare string's entry
+	XCTAssertEqual([XMPPJID jidWithString:@"alice@example.com"], [jid bareJID]);
+	XCTAssertEqual([XMPPJID numberOfInternedJIDs], (NSUInteger)2);
+}
+
+- (void)testDisabled
+{
+	[XMPPJID setInternTableCapacity:0];
+
+	XMPPJID *jid = [XMPPJID jidWithString:@"alice@example.com"];
+
+	XCTAssertNotEqual([XMPPJID jidWithString:@"alice@example.com"], jid);
+	XCTAssertEqualObjects([XMPPJID jidWithString:@"alice@example.com"], jid);
+	XCTAssertEqual([XMPPJID numberOfInternedJIDs], (NSUInteger)0);
+}
+
+- (void)testClockEviction
+{
+	[XMPPJID setInternTableCapacity:4];
+
+	NSArray *strings = @[ @"a@example.com", @"b@example.com", @"c@example.com", @"d@example.com" ];
+
+	NSMutableDictionary *jids = [NSMutableDictionary dictionary];
+	for (NSString *str in strings)
+	{
+		jids[str] = [XMPPJID jidWithString:str];
+	}
+	XCTAssertEqual([XMPPJID numberOfInternedJIDs], (NSUInteger)4);
+
+	// Referencing a and b gives them a second chance,
+	// so the clock hand passes over them (clearing their flags), and evicts c instead.
+
+	XCTAssertEqual([XMPPJID jidWithString:@"a@example.com"], jids[@"a@example.com"]);
+	XCTAssertEqual([XMPPJID jidWithString:@"b@example.com"], jids[@"b@example.com"]);
+
+	XMPPJID *e = [XMPPJID jidWithString:@"e@example.com"];
+
+	XCTAssertEqual([XMPPJID numberOfInternedJIDs], (NSUInteger)4);
+
+	XCTAssertEqual([XMPPJID jidWithString:@"a@example.com"], jids[@"a@example.com"]);
+	XCTAssertEqual([XMPPJID jidWithString:@"b@example.com"], jids[@"b@example.com"]);
+	XCTAssertEqual([XMPPJID jidWithString:@"d@example.com"], jids[@"d@example.com"]);
+	XCTAssertEqual([XMPPJID jidWithString:@"e@example.com"], e);
+
+	// Checked last, as parsing c again interns it (and evicts another entry)
+
+	XMPPJID *c = [XMPPJID jidWithString:@"c@example.com"];
+
+	XCTAssertNotEqual(c, jids[@"c@example.com"]);
+	XCTAssertEqualObjects(c, jids[@"c@example.com"]);
+	XCTAssertEqual([XMPPJID numberOfInternedJIDs], (NSUInteger)4);
+}
+
+- (void)testShrinkingCapacity
+{
+	for (NSUInteger i = 0; i < 10; i++)
+	{
+		[XMPPJID jidWithString:[NSString stringWithFormat:@"user%lu@example.com", (unsigned long)i]];
+	}
+	XCTAssertEqual([XMPPJID numberOfInternedJIDs], (NSUInteger)10);
+
+	[XMPPJID setInternTableCapacity:5];
+
+	XCTAssertLessThanOrEqual([XMPPJID numberOfInternedJIDs], (NSUInteger)5);
+	XCTAssertEqual([XMPPJID internTableCapacity], (NSUInteger)5);
+}
+
+- (void)testConcurrentInternAndLookup
+{
+	// Many more distinct strings than fit, looked up from several threads at once,
+	// so lookups race with insertions and evictions.
+
+	[XMPPJID setInternTableCapacity:64];
+
+	NSMutableArray *strings = [NSMutableArray array];
+	for (NSUInteger i = 0; i < 256; i++)
+	{
+		[strings addObject:[NSString stringWithFormat:@"user%lu@example.com/resource%lu", (unsigned long)i, (unsigned long)(i % 7)]];
+	}
+
+	dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+	__block BOOL mismatch = NO;
+	NSObject *lock = [[NSObject alloc] init];
+
+	dispatch_apply(20000, queue, ^(size_t i) {
+
+		NSUInteger index = (i * 7919) % [strings count];
+		NSString *str = strings[index];
+
+		XMPPJID *jid = [XMPPJID jidWithString:str];
+
+		NSString *user = [NSString stringWithFormat:@"user%lu", (unsigned long)index];
+		NSString *resource = [NSString stringWithFormat:@"resource%lu", (unsigned long)(index % 7)];
+
+		if (![[jid full] isEqualToString:str] || ![[jid user] isEqualToString:user] ||
+		    ![[jid resource] isEqualToString:resource] || ![[[jid bareJID] bare] isEqualToString:[jid bare]])
+		{
+			@synchronized (lock) {
+				mismatch = YES;
+			}
+		}
+	});
+
+	XCTAssertFalse(mismatch);
+	XCTAssertLessThanOrEqual([XMPPJID numberOfInternedJIDs], (NSUInteger)64);
+
+	// A hot set that fits is shared by every thread
+
+	[XMPPJID removeAllInternedJIDs];
+
+	NSArray *hot = [strings subarrayWithRange:NSMakeRange(0, 16)];
+
+	NSMutableArray *expected = [NSMutableArray array];
+	for (NSString *str in hot)
+	{
+		[expected addObject:[XMPPJID jidWithString:str]];
+	}
+
+	dispatch_apply(20000, queue, ^(size_t i) {
+
+		NSUInteger index = i % [hot count];
+
+		if ([XMPPJID jidWithString:hot[index]] != expected[index])
+		{
+			@synchronized (lock) {
+				mismatch = YES;
+			}
+		}
+	});
+
+	XCTAssertFalse(mismatch);
+}
+
+@end
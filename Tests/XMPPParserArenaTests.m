@@ -0,0 +1,352 @@
+#import <XCTest/XCTest.h>
+#import "XMPPParser.h"
+#import "XMPPStanzaArena.h"
+#import "NSXMLElement+XMPP.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * Collects the elements read by a parser.
+ *
+ * With collectsArenaElements, the collector implements xmppParser:didReadArenaElement:,
+ * so the arena backends hand it the XMPPArenaElement (which isn't materialized).
+**/
+@interface XMPPParserTestsCollector : NSObject <XMPPParserDelegate>
+{
+@public
+	BOOL collectsArenaElements;
+	NSMutableArray *elements;
+	NSError *error;
+}
+@end
+
+@implementation XMPPParserTestsCollector
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		elements = [[NSMutableArray alloc] init];
+	}
+	return self;
+}
+
+- (BOOL)respondsToSelector:(SEL)selector
+{
+	if (selector == @selector(xmppParser:didReadArenaElement:)) return collectsArenaElements;
+	return [super respondsToSelector:selector];
+}
+
+- (void)xmppParser:(XMPPParser *)sender didReadElement:(NSXMLElement *)element
+{
+	[elements addObject:element];
+}
+
+- (void)xmppParser:(XMPPParser *)sender didReadArenaElement:(XMPPArenaElement *)element
+{
+	[elements addObject:element];
+}
+
+- (void)xmppParser:(XMPPParser *)sender didFail:(NSError *)inError
+{
+	error = inError;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface XMPPParserArenaTests : XCTestCase
+@end
+
+@implementation XMPPParserArenaTests
+
+static NSString *const XMPPParserTestsStreamHeader =
+  @"<?xml version='1.0'?>"
+  @"<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>";
+
+/**
+ * A canonical description of the given node: names, namespaces and attributes (sorted), children and text.
+ * Two equivalent elements have the same description, regardless of the backend that built them.
+**/
+static NSString *XMPPParserTestsDescribe(NSXMLNode *node)
+{
+	if ([node kind] != NSXMLElementKind)
+	{
+		return [NSString stringWithFormat:@"text(%@)", [node stringValue]];
+	}
+
+	NSXMLElement *element = (NSXMLElement *)node;
+	NSMutableString *result = [NSMutableString stringWithFormat:@"<%@", [element name]];
+
+	NSMutableArray *namespaces = [NSMutableArray array];
+	for (NSXMLNode *ns in [element namespaces])
+	{
+		[namespaces addObject:[NSString stringWithFormat:@" ns(%@)=%@", [ns name], [ns stringValue]]];
+	}
+	[namespaces sortUsingSelector:@selector(compare:)];
+
+	NSMutableArray *attributes = [NSMutableArray array];
+	for (NSXMLNode *attr in [element attributes])
+	{
+		[attributes addObject:[NSString stringWithFormat:@" %@=%@", [attr name], [attr stringValue]]];
+	}
+	[attributes sortUsingSelector:@selector(compare:)];
+
+	[result appendString:[namespaces componentsJoinedByString:@""]];
+	[result appendString:[attributes componentsJoinedByString:@""]];
+	[result appendString:@">"];
+
+	for (NSXMLNode *child in [element children])
+	{
+		[result appendString:XMPPParserTestsDescribe(child)];
+	}
+
+	[result appendFormat:@"</%@>", [element name]];
+	return result;
+}
+
+- (NSString *)streamBody
+{
+	NSMutableString *body = [NSMutableString string];
+
+	[body appendString:@"<stream:features>"
+	                   @"<starttls xmlns='urn:ietf:params:xml:ns:xmpp-tls'><required/></starttls>"
+	                   @"<mechanisms xmlns='urn:ietf:params:xml:ns:xmpp-sasl'>"
+	                   @"<mechanism>SCRAM-SHA-1</mechanism><mechanism>PLAIN</mechanism>"
+	                   @"</mechanisms>"
+	                   @"</stream:features>"];
+
+	[body appendString:@"<message to='romeo@example.net/orchard' from='juliet@example.com/balcony' id='m1' type='chat'>"
+	                   @"<body>Franks &amp; Beans &lt;3 &#38; &#x263A; été 中文</body>"
+	                   @"<thread parent='e0ffe42b28561960c6b12b944a092794b9683a38'>0e3141cd80894871a68e6fe6b1ec56fa</thread>"
+	                   @"<active xmlns='http://jabber.org/protocol/chatstates'/>"
+	                   @"</message>"];
+
+	[body appendString:@"\n  "];
+
+	[body appendString:@"<presence from='juliet@example.com/balcony' xml:lang='en'>"
+	                   @"<show>away</show><status>Out &amp; about</status><priority>5</priority>"
+	                   @"<c xmlns='http://jabber.org/protocol/caps' hash='sha-1' node='http://code.google.com/p/exodus'"
+	                   @" ver='QgayPKawpkPSDYmwT/WM94uAlu0='/>"
+	                   @"</presence>"];
+
+	[body appendString:@"<iq type='result' id='pubsub-1' from='pubsub.example.com'>"
+	                   @"<pubsub xmlns='http://jabber.org/protocol/pubsub'>"
+	                   @"<items node='princely_musings'>"
+	                   @"<item id='ae890ac52d0df67ed7cfdf51b644e901'>"
+	                   @"<entry xmlns='http://www.w3.org/2005/Atom'><title>Soliloquy</title>"
+	                   @"<summary>To be, or not to be: that is the question.</summary></entry>"
+	                   @"</item>"
+	                   @"</items>"
+	                   @"</pubsub>"
+	                   @"</iq>"];
+
+	[body appendString:@"<iq type='get' id='q&amp;1'><deusty:element xmlns:deusty='deusty.com' deusty:attr='v'/></iq>"];
+
+	[body appendString:@"<message id='empty'/>"];
+
+	[body appendString:@"<message id='cdata'><body><![CDATA[<not> & <markup>]]></body></message>"];
+
+	return body;
+}
+
+- (NSArray *)parseChunks:(NSArray *)chunks backend:(XMPPParserBackend)backend collectArenaElements:(BOOL)collectArena
+{
+	dispatch_queue_t parserQueue = dispatch_queue_create("XMPPParserArenaTests.parser", NULL);
+	dispatch_queue_t delegateQueue = dispatch_queue_create("XMPPParserArenaTests.delegate", NULL);
+
+	XMPPParserTestsCollector *collector = [[XMPPParserTestsCollector alloc] init];
+	collector->collectsArenaElements = collectArena;
+
+	XMPPParser *parser = [[XMPPParser alloc] initWithDelegate:collector
+	                                            delegateQueue:delegateQueue
+	                                              parserQueue:parserQueue
+	                                                  backend:backend];
+
+	for (NSData *chunk in chunks)
+	{
+		[parser parseData:chunk];
+	}
+
+	// Wait for the parser, and then for the delegate callbacks it dispatched
+	dispatch_sync(parserQueue, ^{});
+	dispatch_sync(delegateQueue, ^{});
+
+	XCTAssertNil(collector->error, @"Parse error: %@", collector->error);
+
+	return collector->elements;
+}
+
+- (NSArray *)descriptionsOfElements:(NSArray *)elements
+{
+	NSMutableArray *descriptions = [NSMutableArray arrayWithCapacity:[elements count]];
+
+	for (id element in elements)
+	{
+		NSXMLElement *xmlElement = [element isKindOfClass:[XMPPArenaElement class]] ? [element element] : element;
+		[descriptions addObject:XMPPParserTestsDescribe(xmlElement)];
+	}
+
+	return descriptions;
+}
+
+- (NSData *)streamData
+{
+	NSString *stream = [XMPPParserTestsStreamHeader stringByAppendingString:[self streamBody]];
+	return [stream dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (NSArray *)expectedDescriptions
+{
+	NSArray *elements = [self parseChunks:@[[self streamData]] backend:XMPPParserBackendLibxml collectArenaElements:NO];
+	XCTAssertEqual([elements count], (NSUInteger)7);
+
+	return [self descriptionsOfElements:elements];
+}
+
+- (void)testArenaBackendsMatchLibxml
+{
+	NSArray *expected = [self expectedDescriptions];
+
+	for (XMPPParserBackend backend = XMPPParserBackendArena; backend <= XMPPParserBackendArenaLazy; backend++)
+	{
+		NSArray *viaDidReadElement = [self parseChunks:@[[self streamData]] backend:backend collectArenaElements:NO];
+		XCTAssertEqualObjects([self descriptionsOfElements:viaDidReadElement], expected, @"backend %ld", (long)backend);
+
+		NSArray *arenaElements = [self parseChunks:@[[self streamData]] backend:backend collectArenaElements:YES];
+		XCTAssertEqualObjects([self descriptionsOfElements:arenaElements], expected, @"backend %ld", (long)backend);
+	}
+}
+
+- (void)testSplitAtEveryOffset
+{
+	// The lazy backend records the raw bytes of every stanza, which must survive any chunking of the input
+
+	NSArray *expected = [self expectedDescriptions];
+	NSData *data = [self streamData];
+
+	for (NSUInteger offset = 1; offset < [data length]; offset++)
+	{
+		NSArray *chunks = @[ [data subdataWithRange:NSMakeRange(0, offset)],
+		                     [data subdataWithRange:NSMakeRange(offset, [data length] - offset)] ];
+
+		for (XMPPParserBackend backend = XMPPParserBackendArena; backend <= XMPPParserBackendArenaLazy; backend++)
+		{
+			NSArray *elements = [self parseChunks:chunks backend:backend collectArenaElements:YES];
+			XCTAssertEqualObjects([self descriptionsOfElements:elements], expected,
+			                      @"backend %ld, split at %lu", (long)backend, (unsigned long)offset);
+		}
+	}
+}
+
+- (void)testSingleByteChunks
+{
+	NSArray *expected = [self expectedDescriptions];
+	NSData *data = [self streamData];
+
+	NSMutableArray *chunks = [NSMutableArray arrayWithCapacity:[data length]];
+	for (NSUInteger i = 0; i < [data length]; i++)
+	{
+		[chunks addObject:[data subdataWithRange:NSMakeRange(i, 1)]];
+	}
+
+	for (XMPPParserBackend backend = XMPPParserBackendArena; backend <= XMPPParserBackendArenaLazy; backend++)
+	{
+		NSArray *elements = [self parseChunks:chunks backend:backend collectArenaElements:YES];
+		XCTAssertEqualObjects([self descriptionsOfElements:elements], expected, @"backend %ld", (long)backend);
+	}
+}
+
+- (void)testArenaElementAccessors
+{
+	for (XMPPParserBackend backend = XMPPParserBackendArena; backend <= XMPPParserBackendArenaLazy; backend++)
+	{
+		NSArray *elements = [self parseChunks:@[[self streamData]] backend:backend collectArenaElements:YES];
+		XCTAssertEqual([elements count], (NSUInteger)7);
+
+		XMPPArenaElement *features = elements[0];
+		XCTAssertEqualObjects(features.name, @"stream:features");
+		XCTAssertEqualObjects(features.firstChildName, @"starttls");
+		XCTAssertEqualObjects(features.firstChildXmlns, @"urn:ietf:params:xml:ns:xmpp-tls");
+
+		XMPPArenaElement *message = elements[1];
+		XCTAssertEqual(message.isMaterialized, (BOOL)(backend != XMPPParserBackendArenaLazy));
+		XCTAssertEqualObjects(message.name, @"message");
+		XCTAssertEqualObjects(message.xmlns, @"jabber:client");
+		XCTAssertEqualObjects(message.toStr, @"romeo@example.net/orchard");
+		XCTAssertEqualObjects(message.fromStr, @"juliet@example.com/balcony");
+		XCTAssertEqualObjects(message.elementID, @"m1");
+		XCTAssertEqualObjects(message.type, @"chat");
+		XCTAssertEqualObjects(message.firstChildName, @"body");
+		XCTAssertEqualObjects([message attributeStringValueForName:@"type"], @"chat");
+		XCTAssertNil([message attributeStringValueForName:@"missing"]);
+
+		// Reading the values above must not have materialized a lazy element
+		XCTAssertEqual(message.isMaterialized, (BOOL)(backend != XMPPParserBackendArenaLazy));
+
+		NSXMLElement *messageElement = [message element];
+		XCTAssertTrue(message.isMaterialized);
+		XCTAssertEqual([message element], messageElement, @"The element should be cached");
+		XCTAssertEqualObjects([[messageElement elementForName:@"body"] stringValue],
+		                      @"Franks & Beans <3 & ☺ été 中文");
+
+		XMPPArenaElement *iq = elements[4];
+		XCTAssertEqualObjects(iq.elementID, @"q&1");
+		XCTAssertEqualObjects(iq.firstChildName, @"deusty:element");
+		XCTAssertNil(iq.firstChildXmlns);
+
+		XMPPArenaElement *empty = elements[5];
+		XCTAssertNil(empty.firstChildName);
+		XCTAssertEqual([[[empty element] children] count], (NSUInteger)0);
+
+		XCTAssertEqualObjects([[[elements[6] element] elementForName:@"body"] stringValue], @"<not> & <markup>");
+	}
+}
+
+- (void)testLargeStanza
+{
+	// Forces the arena to grow well beyond its initial block
+
+	NSMutableString *text = [NSMutableString stringWithCapacity:256 * 1024];
+	while ([text length] < 256 * 1024)
+	{
+		[text appendString:@"All the world's a stage, and all the men and women merely players. "];
+	}
+
+	NSMutableString *stream = [NSMutableString stringWithString:XMPPParserTestsStreamHeader];
+	[stream appendString:@"<message id='large'>"];
+	for (int i = 0; i < 100; i++)
+	{
+		[stream appendFormat:@"<x xmlns='urn:test:%d' n='%d'/>", i, i];
+	}
+	[stream appendFormat:@"<body>%@</body></message>", text];
+
+	NSData *data = [stream dataUsingEncoding:NSUTF8StringEncoding];
+
+	NSArray *expected = [self descriptionsOfElements:[self parseChunks:@[data]
+	                                                           backend:XMPPParserBackendLibxml
+	                                                collectArenaElements:NO]];
+
+	for (XMPPParserBackend backend = XMPPParserBackendArena; backend <= XMPPParserBackendArenaLazy; backend++)
+	{
+		NSArray *elements = [self parseChunks:@[data] backend:backend collectArenaElements:YES];
+		XCTAssertEqual([elements count], (NSUInteger)1);
+
+		XMPPArenaElement *element = [elements firstObject];
+		XCTAssertEqualObjects(element.firstChildXmlns, @"urn:test:0");
+
+		XCTAssertEqualObjects([self descriptionsOfElements:elements], expected, @"backend %ld", (long)backend);
+
+		if (backend == XMPPParserBackendArena)
+		{
+			XCTAssertGreaterThanOrEqual(element.arenaSize, [text length]);
+		}
+	}
+}
+
+@end
@@ -0,0 +1,94 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStreamPrivate.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+@interface XMPPPendingWriteQueueTests : XCTestCase
+@end
+
+@implementation XMPPPendingWriteQueueTests
+
+- (XMPPPendingWrite *)writeWithTag:(long)tag
+{
+	XMPPPendingWrite *write = [[XMPPPendingWrite alloc] init];
+	write->tag = tag;
+	return write;
+}
+
+- (void)testEmpty
+{
+	XMPPPendingWriteQueue *queue = [[XMPPPendingWriteQueue alloc] init];
+
+	XCTAssertEqual(queue.count, (NSUInteger)0);
+	XCTAssertNil([queue firstWrite]);
+	XCTAssertNil([queue removeFirstWrite]);
+	XCTAssertEqual([[queue removeAllWrites] count], (NSUInteger)0);
+}
+
+- (void)testFIFOThroughWrapAroundAndGrowth
+{
+	// Keep the queue partially drained, so the ring grows while its contents wrap around the end
+
+	XMPPPendingWriteQueue *queue = [[XMPPPendingWriteQueue alloc] init];
+
+	long nextAdded = 0;
+	long nextRemoved = 0;
+
+	for (NSUInteger round = 0; round < 8; round++)
+	{
+		for (NSUInteger i = 0; i < (XMPP_WRITE_QUEUE_MIN_CAPACITY * 3 / 4) * (round + 1); i++)
+		{
+			[queue addWrite:[self writeWithTag:nextAdded++]];
+		}
+
+		for (NSUInteger i = 0; i < (XMPP_WRITE_QUEUE_MIN_CAPACITY / 2) * (round + 1); i++)
+		{
+			XCTAssertEqual([queue firstWrite]->tag, nextRemoved);
+			XCTAssertEqual([queue removeFirstWrite]->tag, nextRemoved++);
+		}
+
+		XCTAssertEqual(queue.count, (NSUInteger)(nextAdded - nextRemoved));
+	}
+
+	NSArray *writes = [queue removeAllWrites];
+
+	XCTAssertEqual([writes count], (NSUInteger)(nextAdded - nextRemoved));
+	for (XMPPPendingWrite *write in writes)
+	{
+		XCTAssertEqual(write->tag, nextRemoved++);
+	}
+
+	XCTAssertEqual(queue.count, (NSUInteger)0);
+	XCTAssertNil([queue removeFirstWrite]);
+}
+
+- (void)testReleasesWrites
+{
+	__weak XMPPPendingWrite *removed = nil;
+	__weak XMPPPendingWrite *pending = nil;
+
+	@autoreleasepool
+	{
+		XMPPPendingWriteQueue *queue = [[XMPPPendingWriteQueue alloc] init];
+
+		XMPPPendingWrite *write = [self writeWithTag:1];
+		removed = write;
+		[queue addWrite:write];
+
+		write = [self writeWithTag:2];
+		pending = write;
+		[queue addWrite:write];
+
+		write = nil;
+
+		XCTAssertEqual([queue removeFirstWrite]->tag, 1L);
+		XCTAssertNotNil(pending);
+	}
+
+	XCTAssertNil(removed);
+	XCTAssertNil(pending);
+}
+
+@end
@@ -0,0 +1,49 @@
+#import <Foundation/Foundation.h>
+
+/**
+ * Drives a data structure through a long, random (but repeatable) sequence of operations,
+ * each of which is applied to the data structure and to a model of it (typically a Foundation collection).
+ *
+ * Every iteration performs one of the operations, picked at random in proportion to its weight.
+ * The operations may use random() for their own choices (which key, how many, ...),
+ * as the whole run is determined by the seed.
+ *
+ * A run may go through phases (e.g. one where adds dominate, so a ring grows, then one where removals dominate).
+ * An operation then has one weight per phase, and the phases take turns every phaseLength iterations.
+ *
+ * The checkBlock (if any) compares the data structure against the model,
+ * every checkInterval iterations, and after the last iteration of the run.
+**/
+@interface XMPPRandomOperations : NSObject
+
+- (void)addOperationWithWeight:(NSUInteger)weight block:(dispatch_block_t)block;
+- (void)addOperationWithPhaseWeights:(NSArray *)weights block:(dispatch_block_t)block;
+
+/**
+ * The number of iterations per phase.
+ * The default value is zero, for a single phase.
+**/
+@property (nonatomic, assign) NSUInteger phaseLength;
+
+/**
+ * The default value is 1 (every iteration).
+**/
+@property (nonatomic, assign) NSUInteger checkInterval;
+@property (nonatomic, copy) dispatch_block_t checkBlock;
+
+/**
+ * The index of the current iteration (within the current run).
+**/
+@property (nonatomic, readonly) NSUInteger iteration;
+
+/**
+ * Seeds random(), and performs the given number of operations.
+**/
+- (void)runWithSeed:(unsigned)seed iterations:(NSUInteger)iterations;
+
+/**
+ * Performs the given number of operations, carrying on from the current state of random().
+**/
+- (void)runIterations:(NSUInteger)iterations;
+
+@end
@@ -0,0 +1,104 @@
+#import "XMPPRandomOperations.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+@implementation XMPPRandomOperations
+{
+	NSMutableArray *blocks;
+	NSMutableArray *weights;  // An array of weights (one per phase) for each block
+	NSUInteger numberOfPhases;
+}
+
+@synthesize phaseLength;
+@synthesize checkInterval;
+@synthesize checkBlock;
+@synthesize iteration;
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		blocks = [[NSMutableArray alloc] init];
+		weights = [[NSMutableArray alloc] init];
+		numberOfPhases = 1;
+
+		checkInterval = 1;
+	}
+	return self;
+}
+
+- (void)addOperationWithWeight:(NSUInteger)weight block:(dispatch_block_t)block
+{
+	[self addOperationWithPhaseWeights:@[ @(weight) ] block:block];
+}
+
+- (void)addOperationWithPhaseWeights:(NSArray *)phaseWeights block:(dispatch_block_t)block
+{
+	NSParameterAssert([phaseWeights count] > 0);
+	NSParameterAssert(block != nil);
+
+	[blocks addObject:[block copy]];
+	[weights addObject:[phaseWeights copy]];
+
+	numberOfPhases = MAX(numberOfPhases, [phaseWeights count]);
+}
+
+- (NSUInteger)weightOfOperation:(NSUInteger)index inPhase:(NSUInteger)phase
+{
+	// An operation with fewer weights than there are phases keeps its last weight
+	NSArray *phaseWeights = weights[index];
+
+	return [phaseWeights[MIN(phase, [phaseWeights count] - 1)] unsignedIntegerValue];
+}
+
+- (void)runWithSeed:(unsigned)seed iterations:(NSUInteger)iterations
+{
+	srandom(seed);
+
+	[self runIterations:iterations];
+}
+
+- (void)runIterations:(NSUInteger)iterations
+{
+	NSAssert([blocks count] > 0, @"No operations");
+
+	for (iteration = 0; iteration < iterations; iteration++)
+	{
+		NSUInteger phase = (phaseLength > 0) ? (iteration / phaseLength) % numberOfPhases : 0;
+
+		NSUInteger totalWeight = 0;
+		for (NSUInteger i = 0; i < [blocks count]; i++)
+		{
+			totalWeight += [self weightOfOperation:i inPhase:phase];
+		}
+		NSAssert(totalWeight > 0, @"No operation has any weight in phase %lu", (unsigned long)phase);
+
+		NSUInteger r = (NSUInteger)random() % totalWeight;
+
+		NSUInteger index = 0;
+		for (;;)
+		{
+			NSUInteger weight = [self weightOfOperation:index inPhase:phase];
+			if (r < weight) break;
+
+			r -= weight;
+			index++;
+		}
+
+		((dispatch_block_t)blocks[index])();
+
+		if (checkBlock && ((iteration + 1) % checkInterval) == 0)
+		{
+			checkBlock();
+		}
+	}
+
+	if (checkBlock && (iterations % checkInterval) != 0)
+	{
+		checkBlock();
+	}
+}
+
+@end
@@ -0,0 +1,310 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStreamPrivate.h"
+#import "XMPPRandomOperations.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * The ring only retains and hands back its observers, so plain objects stand in for them here.
+ *
+ * These tests run the ring against a dictionary model:
+ * through index wrap-around, growth (including growth while the contents wrap around the end of the ring),
+ * out of order removal, stale tags, and the wrap-around of the sequence numbers carried by the tags.
+**/
+@interface XMPPSendReceiptRingTests : XCTestCase
+@end
+
+@implementation XMPPSendReceiptRingTests
+
+- (void)checkRing:(XMPPSendReceiptRing *)ring againstModel:(NSMutableDictionary *)model order:(NSMutableArray *)order
+{
+	// Drains the ring via removeAllObservers, which must return what's pending in send order
+
+	NSMutableArray *expected = [NSMutableArray array];
+	for (NSNumber *tag in order)
+	{
+		if (model[tag]) [expected addObject:model[tag]];
+	}
+
+	NSArray *observers = [ring removeAllObservers];
+
+	XCTAssertEqual([observers count], [expected count]);
+	for (NSUInteger i = 0; i < MIN([observers count], [expected count]); i++)
+	{
+		XCTAssertEqual(observers[i], expected[i]);
+	}
+
+	// All the tags are stale now
+
+	for (NSNumber *tag in order)
+	{
+		XCTAssertNil([ring removeObserverForTag:[tag longValue]]);
+	}
+
+	[model removeAllObjects];
+	[order removeAllObjects];
+}
+
+- (long)addObserverToRing:(XMPPSendReceiptRing *)ring model:(NSMutableDictionary *)model order:(NSMutableArray *)order
+{
+	id observer = [[NSObject alloc] init];
+	long tag = [ring addObserver:observer];
+
+	XCTAssertGreaterThanOrEqual(tag, TAG_XMPP_WRITE_RECEIPT_BASE);
+	XCTAssertLessThanOrEqual(tag, TAG_XMPP_WRITE_RECEIPT_BASE + (long)XMPP_RECEIPT_SEQUENCE_MASK);
+	XCTAssertNil(model[@(tag)], @"Tag %ld is already pending", tag);
+
+	model[@(tag)] = observer;
+	[order addObject:@(tag)];
+
+	return tag;
+}
+
+- (void)removeTag:(long)tag fromRing:(XMPPSendReceiptRing *)ring model:(NSMutableDictionary *)model
+{
+	id observer = [ring removeObserverForTag:tag];
+
+	XCTAssertEqual(observer, model[@(tag)], @"Tag %ld", tag);
+	[model removeObjectForKey:@(tag)];
+
+	XCTAssertNil([ring removeObserverForTag:tag], @"Tag %ld removed twice", tag);
+}
+
+#pragma mark Tests
+
+- (void)testInOrderWrapsAround
+{
+	// A few pending observers at a time, so the ring never grows but its indices wrap around many times
+
+	XMPPSendReceiptRing *ring = [[XMPPSendReceiptRing alloc] init];
+
+	NSMutableDictionary *model = [NSMutableDictionary dictionary];
+	NSMutableArray *order = [NSMutableArray array];
+
+	for (NSUInteger i = 0; i < 1000; i++)
+	{
+		[self addObserverToRing:ring model:model order:order];
+
+		if ([order count] > 5)
+		{
+			[self removeTag:[order[0] longValue] fromRing:ring model:model];
+			[order removeObjectAtIndex:0];
+		}
+	}
+
+	[self checkRing:ring againstModel:model order:order];
+}
+
+- (void)testGrowth
+{
+	XMPPSendReceiptRing *ring = [[XMPPSendReceiptRing alloc] init];
+
+	NSMutableDictionary *model = [NSMutableDictionary dictionary];
+	NSMutableArray *order = [NSMutableArray array];
+
+	for (NSUInteger i = 0; i < 5000; i++)
+	{
+		[self addObserverToRing:ring model:model order:order];
+	}
+
+	// Remove every other one, newest first, leaving the oldest (and so the head) in place
+
+	for (NSInteger i = (NSInteger)[order count] - 1; i >= 0; i -= 2)
+	{
+		[self removeTag:[order[i] longValue] fromRing:ring model:model];
+	}
+
+	[self checkRing:ring againstModel:model order:order];
+}
+
+- (void)testGrowthWhileWrapped
+{
+	// Move the head most of the way around the ring, so the pending observers wrap around its end,
+	// then keep adding (with a hole in the middle) until it has to grow.
+
+	XMPPSendReceiptRing *ring = [[XMPPSendReceiptRing alloc] init];
+
+	NSMutableDictionary *model = [NSMutableDictionary dictionary];
+	NSMutableArray *order = [NSMutableArray array];
+
+	for (NSUInteger i = 0; i < XMPP_RECEIPT_RING_MIN_CAPACITY - 3; i++)
+	{
+		long tag = [self addObserverToRing:ring model:model order:order];
+		[self removeTag:tag fromRing:ring model:model];
+	}
+	[order removeAllObjects];
+
+	for (NSUInteger i = 0; i < (XMPP_RECEIPT_RING_MIN_CAPACITY * 4) + 1; i++)
+	{
+		[self addObserverToRing:ring model:model order:order];
+
+		if (i == 5)
+		{
+			[self removeTag:[order[2] longValue] fromRing:ring model:model];
+		}
+	}
+
+	// Remove the oldest, then check the rest are where they should be
+
+	[self removeTag:[order[0] longValue] fromRing:ring model:model];
+
+	for (NSUInteger i = 1; i < [order count]; i += 3)
+	{
+		[self removeTag:[order[i] longValue] fromRing:ring model:model];
+	}
+
+	[self checkRing:ring againstModel:model order:order];
+}
+
+- (void)testRandomOperations
+{
+	XMPPSendReceiptRing *ring = [[XMPPSendReceiptRing alloc] init];
+
+	NSMutableDictionary *model = [NSMutableDictionary dictionary];
+	NSMutableArray *order = [NSMutableArray array];
+	NSMutableArray *removed = [NSMutableArray array];
+
+	// Alternate between phases that mostly add (and grow the ring) and phases that mostly remove
+
+	XMPPRandomOperations *operations = [[XMPPRandomOperations alloc] init];
+	operations.phaseLength = 5000;
+
+	[operations addOperationWithPhaseWeights:@[ @5, @2 ] block:^{
+		[self addObserverToRing:ring model:model order:order];
+	}];
+
+	[operations addOperationWithPhaseWeights:@[ @2, @5 ] block:^{
+
+		// Out of order, but biased towards the oldest, like writes resolving behind a reordered queue
+
+		if ([model count] == 0) return;
+
+		NSUInteger index = (random() % 4 == 0) ? (NSUInteger)(random() % [order count]) : 0;
+		while (model[order[index]] == nil)
+		{
+			index = (index + 1) % [order count];
+		}
+
+		long tag = [order[index] longValue];
+
+		[self removeTag:tag fromRing:ring model:model];
+		[removed addObject:@(tag)];
+	}];
+
+	[operations addOperationWithWeight:1 block:^{
+
+		// A stale tag
+
+		if ([removed count] == 0) return;
+
+		long tag = [removed[random() % [removed count]] longValue];
+		if (model[@(tag)] == nil)
+		{
+			XCTAssertNil([ring removeObserverForTag:tag]);
+		}
+	}];
+
+	operations.checkBlock = ^{
+
+		// Keep the bookkeeping small
+
+		while ([order count] > 0 && model[order[0]] == nil)
+		{
+			[order removeObjectAtIndex:0];
+		}
+		if ([removed count] > 1000)
+		{
+			[removed removeObjectsInRange:NSMakeRange(0, 500)];
+		}
+	};
+
+	[operations runWithSeed:20 iterations:50000];
+
+	[self checkRing:ring againstModel:model order:order];
+}
+
+- (void)testSequenceWrapsAround
+{
+	// The tags carry the lower 30 bits of the sequence number,
+	// and the full sequence number itself eventually wraps around as well.
+
+	NSArray *starts = @[ @(XMPP_RECEIPT_SEQUENCE_MASK - 20), @(NSUIntegerMax - 20) ];
+
+	for (NSNumber *start in starts)
+	{
+		XMPPSendReceiptRing *ring = [[XMPPSendReceiptRing alloc] initWithSequence:[start unsignedIntegerValue]];
+
+		NSMutableDictionary *model = [NSMutableDictionary dictionary];
+		NSMutableArray *order = [NSMutableArray array];
+
+		BOOL wrapped = NO;
+		long previousTag = 0;
+
+		for (NSUInteger i = 0; i < 100; i++)
+		{
+			long tag = [self addObserverToRing:ring model:model order:order];
+
+			if (i > 0 && tag < previousTag)
+			{
+				XCTAssertEqual(previousTag, TAG_XMPP_WRITE_RECEIPT_BASE + (long)XMPP_RECEIPT_SEQUENCE_MASK);
+				XCTAssertEqual(tag, TAG_XMPP_WRITE_RECEIPT_BASE);
+				wrapped = YES;
+			}
+			previousTag = tag;
+
+			// Remove a few, from either side of the wrap
+
+			if (i % 3 == 2)
+			{
+				[self removeTag:[order[i - 1] longValue] fromRing:ring model:model];
+			}
+		}
+
+		XCTAssertTrue(wrapped, @"Starting at %@", start);
+
+		[self removeTag:[order[0] longValue] fromRing:ring model:model];
+
+		[self checkRing:ring againstModel:model order:order];
+
+		// The ring carries on after being drained
+
+		id after = [[NSObject alloc] init];
+
+		long tag = [ring addObserver:after];
+		XCTAssertEqual([ring removeObserverForTag:tag], after);
+	}
+}
+
+- (void)testReleasesObservers
+{
+	__weak id weakPending = nil;
+	__weak id weakRemoved = nil;
+
+	@autoreleasepool {
+
+		XMPPSendReceiptRing *ring = [[XMPPSendReceiptRing alloc] init];
+
+		id pending = [[NSObject alloc] init];
+		id removed = [[NSObject alloc] init];
+
+		weakPending = pending;
+		weakRemoved = removed;
+
+		[ring addObserver:pending];
+		long tag = [ring addObserver:removed];
+
+		pending = nil;
+		removed = nil;
+
+		XCTAssertNotNil(weakPending);
+
+		[ring removeObserverForTag:tag];
+	}
+
+	XCTAssertNil(weakRemoved);
+	XCTAssertNil(weakPending);
+}
+
+@end
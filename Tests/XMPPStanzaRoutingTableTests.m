@@ -0,0 +1,157 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStanzaInterest.h"
+#import "XMPPMessage.h"
+#import "XMPPPresence.h"
+#import "XMPPIQ.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+@interface XMPPStanzaRoutingTableTests : XCTestCase
+{
+	XMPPStanzaRoutingTable *table;
+
+	NSObject *fullDelegate;
+	NSObject *bareDelegate;
+	NSObject *domainDelegate;
+	NSObject *xmlnsDelegate;
+	NSObject *unroutedDelegate;
+}
+@end
+
+@implementation XMPPStanzaRoutingTableTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	table = [[XMPPStanzaRoutingTable alloc] init];
+
+	fullDelegate = [[NSObject alloc] init];
+	bareDelegate = [[NSObject alloc] init];
+	domainDelegate = [[NSObject alloc] init];
+	xmlnsDelegate = [[NSObject alloc] init];
+	unroutedDelegate = [[NSObject alloc] init];
+
+	[table addInterest:[XMPPStanzaInterest interestInKind:XMPPStanzaKindMessage
+	                                              fromJID:[XMPPJID jidWithString:@"alice@example.com/phone"]
+	                                              options:XMPPJIDCompareFull]
+	       forDelegate:fullDelegate];
+
+	[table addInterest:[XMPPStanzaInterest interestInKind:XMPPStanzaKindMessage
+	                                              fromJID:[XMPPJID jidWithString:@"alice@example.com"]
+	                                              options:XMPPJIDCompareBare]
+	       forDelegate:bareDelegate];
+
+	[table addInterest:[XMPPStanzaInterest interestInKind:XMPPStanzaKindMessage
+	                                              fromJID:[XMPPJID jidWithString:@"pubsub.example.com"]
+	                                              options:XMPPJIDCompareBare]
+	       forDelegate:domainDelegate];
+
+	[table addInterest:[XMPPStanzaInterest interestInKind:(XMPPStanzaKindMessage | XMPPStanzaKindIQ)
+	                                            childName:nil
+	                                                xmlns:@"urn:xmpp:receipts"]
+	       forDelegate:xmlnsDelegate];
+}
+
+- (void)tearDown
+{
+	table = nil;
+
+	[super tearDown];
+}
+
+- (XMPPMessage *)messageFrom:(NSString *)from
+{
+	XMPPMessage *message = [XMPPMessage messageWithType:@"chat"];
+	[message addAttributeWithName:@"from" stringValue:from];
+	return message;
+}
+
+- (NSHashTable *)delegatesForMessage:(XMPPMessage *)message
+{
+	return [table delegatesMatchingStanza:message ofKind:XMPPStanzaKindMessage];
+}
+
+- (void)testFullJID
+{
+	NSHashTable *delegates = [self delegatesForMessage:[self messageFrom:@"alice@example.com/phone"]];
+
+	XCTAssertTrue([delegates containsObject:fullDelegate]);
+	XCTAssertTrue([delegates containsObject:bareDelegate]);
+	XCTAssertFalse([delegates containsObject:domainDelegate]);
+	XCTAssertEqual([delegates count], (NSUInteger)2);
+
+	// Another resource only matches the bare interest
+	delegates = [self delegatesForMessage:[self messageFrom:@"alice@example.com/laptop"]];
+
+	XCTAssertTrue([delegates containsObject:bareDelegate]);
+	XCTAssertEqual([delegates count], (NSUInteger)1);
+}
+
+- (void)testBareJID
+{
+	NSHashTable *delegates = [self delegatesForMessage:[self messageFrom:@"alice@example.com"]];
+
+	XCTAssertTrue([delegates containsObject:bareDelegate]);
+	XCTAssertEqual([delegates count], (NSUInteger)1);
+
+	XCTAssertTrue([table mayMatchStanzaOfKind:XMPPStanzaKindMessage
+	                                     from:[XMPPJID jidWithString:@"alice@example.com"]]);
+}
+
+- (void)testDomainOnlyJID
+{
+	// A service (e.g. pubsub or a MUC service) has no node: its bare JID is its domain
+
+	NSHashTable *delegates = [self delegatesForMessage:[self messageFrom:@"pubsub.example.com"]];
+
+	XCTAssertTrue([delegates containsObject:domainDelegate]);
+	XCTAssertEqual([delegates count], (NSUInteger)1);
+
+	XCTAssertTrue([table mayMatchStanzaOfKind:XMPPStanzaKindMessage
+	                                     from:[XMPPJID jidWithString:@"pubsub.example.com"]]);
+}
+
+- (void)testUnroutedDelegate
+{
+	// A delegate without interests isn't routed, and is never returned as a match
+
+	XCTAssertFalse([table isDelegate:unroutedDelegate routedForKind:XMPPStanzaKindMessage]);
+	XCTAssertTrue([table isDelegate:bareDelegate routedForKind:XMPPStanzaKindMessage]);
+	XCTAssertFalse([table isDelegate:bareDelegate routedForKind:XMPPStanzaKindPresence]);
+
+	NSHashTable *delegates = [self delegatesForMessage:[self messageFrom:@"bob@example.com/phone"]];
+
+	XCTAssertFalse([delegates containsObject:unroutedDelegate]);
+	XCTAssertEqual([delegates count], (NSUInteger)0);
+}
+
+- (void)testXmlns
+{
+	XMPPMessage *message = [self messageFrom:@"bob@example.com/phone"];
+	[message addChild:[NSXMLElement elementWithName:@"received" xmlns:@"urn:xmpp:receipts"]];
+
+	NSHashTable *delegates = [self delegatesForMessage:message];
+
+	XCTAssertTrue([delegates containsObject:xmlnsDelegate]);
+	XCTAssertEqual([delegates count], (NSUInteger)1);
+
+	// The interest in IQs doesn't extend to presence
+	XMPPPresence *presence = [XMPPPresence presence];
+	[presence addChild:[NSXMLElement elementWithName:@"received" xmlns:@"urn:xmpp:receipts"]];
+
+	XCTAssertEqual([[table delegatesMatchingStanza:presence ofKind:XMPPStanzaKindPresence] count], (NSUInteger)0);
+}
+
+- (void)testRemoveInterests
+{
+	[table removeInterestsForDelegate:bareDelegate];
+
+	XCTAssertFalse([table isDelegate:bareDelegate routedForKind:XMPPStanzaKindMessage]);
+	XCTAssertEqual([[self delegatesForMessage:[self messageFrom:@"alice@example.com"]] count], (NSUInteger)0);
+	XCTAssertFalse([table mayMatchStanzaOfKind:XMPPStanzaKindPresence from:[XMPPJID jidWithString:@"alice@example.com"]]);
+}
+
+@end
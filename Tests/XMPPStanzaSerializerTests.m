@@ -0,0 +1,166 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStanzaSerializer.h"
+#import "NSXMLElement+XMPP.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * The serializer's output doesn't have to match -XMLString byte for byte (e.g. it escapes '>' in text),
+ * but it has to mean the same thing: parsed back, it must be the very element -XMLString describes.
+**/
+@interface XMPPStanzaSerializerTests : XCTestCase
+{
+	XMPPOutputBufferPool *pool;
+}
+@end
+
+@implementation XMPPStanzaSerializerTests
+
+static NSString *const XMPPStanzaSerializerTestsSpecials = @"Fish & Chips <3 > \"double\" 'single' &amp; ]]>";
+
+- (void)setUp
+{
+	[super setUp];
+
+	pool = [[XMPPOutputBufferPool alloc] init];
+}
+
+- (NSData *)serialize:(NSXMLElement *)element
+{
+	XMPPOutputBuffer *buffer = [pool bufferWithMinimumCapacity:512];
+
+	NSUInteger length = [XMPPStanzaSerializer serializeElement:element intoBuffer:buffer];
+	XCTAssertEqual(length, [buffer length]);
+
+	return [[buffer data] copy];
+}
+
+- (void)checkElement:(NSXMLElement *)element
+{
+	NSData *data = [self serialize:element];
+	XCTAssertGreaterThan([data length], (NSUInteger)0);
+
+	NSString *serialized = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+	XCTAssertNotNil(serialized, @"Not valid UTF-8");
+
+	NSError *error = nil;
+	NSXMLElement *parsed = [[NSXMLElement alloc] initWithXMLString:serialized error:&error];
+
+	XCTAssertNotNil(parsed, @"%@: %@", serialized, error);
+	XCTAssertEqualObjects([parsed XMLString], [element XMLString], @"Serialized as %@", serialized);
+}
+
+- (void)testTextEscaping
+{
+	NSXMLElement *message = [NSXMLElement elementWithName:@"message" xmlns:@"jabber:client"];
+	[message addChild:[NSXMLElement elementWithName:@"body" stringValue:XMPPStanzaSerializerTestsSpecials]];
+	[message addChild:[NSXMLElement elementWithName:@"subject" stringValue:@"line 1\nline 2\r\n\ttabbed"]];
+
+	[self checkElement:message];
+
+	// Markup in the text never makes it into the output literally
+
+	NSString *serialized = [[NSString alloc] initWithData:[self serialize:message] encoding:NSUTF8StringEncoding];
+
+	XCTAssertEqual([serialized rangeOfString:@"<3"].location, (NSUInteger)NSNotFound);
+	XCTAssertEqual([serialized rangeOfString:@"& Chips"].location, (NSUInteger)NSNotFound);
+	XCTAssertEqual([serialized rangeOfString:@"]]>"].location, (NSUInteger)NSNotFound);
+}
+
+- (void)testAttributeEscaping
+{
+	NSXMLElement *element = [NSXMLElement elementWithName:@"presence"];
+	[element addAttributeWithName:@"to" stringValue:@"room@conference.example.com/\"Nick\" & <Co>"];
+	[element addAttributeWithName:@"id" stringValue:XMPPStanzaSerializerTestsSpecials];
+	[element addAttributeWithName:@"whitespace" stringValue:@"tab\there\nnewline\r\nreturn"];
+	[element addAttributeWithName:@"empty" stringValue:@""];
+
+	[self checkElement:element];
+
+	// Whitespace in attribute values must survive attribute value normalization
+
+	NSString *serialized = [[NSString alloc] initWithData:[self serialize:element] encoding:NSUTF8StringEncoding];
+	NSXMLElement *parsed = [[NSXMLElement alloc] initWithXMLString:serialized error:nil];
+
+	XCTAssertEqualObjects([parsed attributeStringValueForName:@"whitespace"], @"tab\there\nnewline\r\nreturn");
+	XCTAssertEqualObjects([parsed attributeStringValueForName:@"id"], XMPPStanzaSerializerTestsSpecials);
+}
+
+- (void)testNamespaces
+{
+	NSXMLElement *iq = [NSXMLElement elementWithName:@"iq" xmlns:@"jabber:client"];
+	[iq addAttributeWithName:@"type" stringValue:@"set"];
+
+	NSXMLElement *query = [NSXMLElement elementWithName:@"query" xmlns:@"urn:example:a&b<c>\"d\""];
+	[query addNamespace:[NSXMLNode namespaceWithName:@"x" stringValue:@"urn:example:x?a=1&b=2"]];
+	[query addChild:[NSXMLElement elementWithName:@"item" stringValue:@"<not-an-element/>"]];
+	[iq addChild:query];
+
+	[self checkElement:iq];
+}
+
+- (void)testNonBMPCharacters
+{
+	// Characters outside the BMP are surrogate pairs in an NSString, and 4 bytes in UTF-8
+
+	NSString *text = @"G clef 𝄞, grinning face 😀, CJK extension B 𠜎, mixed with é and 中文";
+
+	NSXMLElement *message = [NSXMLElement elementWithName:@"message"];
+	[message addAttributeWithName:@"id" stringValue:@"😀&𝄞"];
+	[message addChild:[NSXMLElement elementWithName:@"body" stringValue:text]];
+
+	[self checkElement:message];
+
+	NSData *data = [self serialize:message];
+	NSData *grinningFace = [@"😀" dataUsingEncoding:NSUTF8StringEncoding];
+
+	XCTAssertEqual([grinningFace length], (NSUInteger)4);
+	XCTAssertNotEqual([data rangeOfData:grinningFace options:0 range:NSMakeRange(0, [data length])].location,
+	                  (NSUInteger)NSNotFound, @"Non-BMP characters are written as UTF-8, not as character references");
+}
+
+- (void)testNonBMPCharactersAcrossChunks
+{
+	// Long enough to be transcoded in several chunks, with escaped characters and surrogate pairs
+	// at every possible offset relative to the chunk boundaries.
+
+	NSMutableString *text = [NSMutableString string];
+	for (NSUInteger i = 0; i < 600; i++)
+	{
+		switch (i % 5)
+		{
+			case 0  : [text appendString:@"😀"]; break;
+			case 1  : [text appendString:@"&"];  break;
+			case 2  : [text appendString:@"a"];  break;
+			case 3  : [text appendString:@"é"];  break;
+			default : [text appendString:@"𝄞<"]; break;
+		}
+	}
+
+	NSXMLElement *message = [NSXMLElement elementWithName:@"message"];
+	[message addAttributeWithName:@"id" stringValue:text];
+	[message addChild:[NSXMLElement elementWithName:@"body" stringValue:text]];
+
+	[self checkElement:message];
+}
+
+- (void)testUnpairedSurrogate
+{
+	XMPPOutputBuffer *buffer = [pool bufferWithMinimumCapacity:512];
+	[buffer appendBytes:"<prefix/>" length:9];
+
+	unichar chars[] = { 'a', 0xD83D, 'b' };
+	NSString *malformed = [NSString stringWithCharacters:chars length:3];
+
+	NSXMLElement *message = [NSXMLElement elementWithName:@"message"];
+	[message addChild:[NSXMLElement elementWithName:@"body" stringValue:malformed]];
+
+	XCTAssertEqual([XMPPStanzaSerializer serializeElement:message intoBuffer:buffer], (NSUInteger)0);
+
+	// The buffer is left as it was
+	XCTAssertEqual([buffer length], (NSUInteger)9);
+}
+
+@end
@@ -0,0 +1,68 @@
+#import <Foundation/Foundation.h>
+#import "XMPPStream.h"
+
+@class XMPPArenaElement;
+
+/**
+ * Drives an XMPPStream without a connection.
+ * 
+ * A connected stream without a socket accepts stanzas as usual.
+ * Its writes go nowhere, and stay in flight until completeWriteForTesting is invoked (as the socket would).
+**/
+@interface XMPPStream (Tests)
+
+/**
+ * Puts the stream into the connected state (without a socket).
+**/
+- (void)enterConnectedStateForTesting;
+
+/**
+ * Puts the stream into the connecting state (without a socket).
+**/
+- (void)enterConnectingStateForTesting;
+
+/**
+ * Completes the connection, as the socket would once connected. The stream then opens (see openStream).
+**/
+- (void)connectSocketForTesting;
+
+/**
+ * Completes the oldest write in flight.
+ * Its receipts (or completion handlers) are signaled, including those of every stanza in a corked write.
+**/
+- (void)completeWriteForTesting;
+
+/**
+ * Disconnects the stream, as if the socket had been closed.
+**/
+- (void)disconnectForTesting;
+
+/**
+ * Gives the stream a parser (running on the given queue) that has read the server's opening stream header,
+ * and an outstanding socket read, as if the stream had just been opened.
+**/
+- (void)openParserForTestingWithParserQueue:(dispatch_queue_t)parserQueue;
+
+/**
+ * Hands the given data to the stream, as the socket would once a read completes.
+**/
+- (void)receiveDataForTesting:(NSData *)data;
+
+/**
+ * The state of the receive pipeline: the number of chunks the parser hasn't finished with,
+ * and whether a socket read is outstanding.
+**/
+- (NSUInteger)numberOfPendingParseChunksForTesting;
+- (BOOL)isReadingForTesting;
+
+/**
+ * Hands the given element to the stream, as its parser would when using one of the arena backends.
+**/
+- (void)receiveArenaElementForTesting:(XMPPArenaElement *)arenaElement;
+
+/**
+ * Waits for everything dispatched onto the xmppQueue so far.
+**/
+- (void)waitForXMPPQueue;
+
+@end
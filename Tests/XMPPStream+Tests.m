@@ -0,0 +1,121 @@
+#import "XMPPStream+Tests.h"
+#import "XMPPInternal.h"
+#import "XMPPParser.h"
+#import "XMPPStreamPrivate.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+@implementation XMPPStream (Tests)
+
+- (void)enterConnectedStateForTesting
+{
+	dispatch_sync(self.xmppQueue, ^{
+		
+		// The state is readonly, so it's set through its ivar
+		[self setValue:@(STATE_XMPP_CONNECTED) forKey:@"state"];
+	});
+}
+
+- (void)enterConnectingStateForTesting
+{
+	dispatch_sync(self.xmppQueue, ^{
+		
+		[self setValue:@(STATE_XMPP_CONNECTING) forKey:@"state"];
+	});
+}
+
+- (void)connectSocketForTesting
+{
+	dispatch_sync(self.xmppQueue, ^{ @autoreleasepool {
+		
+		[self socket:nil didConnectToHost:@"127.0.0.1" port:5222];
+	}});
+}
+
+- (void)completeWriteForTesting
+{
+	dispatch_sync(self.xmppQueue, ^{ @autoreleasepool {
+		
+		// The socket reports the write with the tag it was given
+		XMPPPendingWriteQueue *pendingWrites = [self valueForKey:@"pendingWrites"];
+		XMPPPendingWrite *write = [pendingWrites firstWrite];
+		
+		[self socket:nil didWriteDataWithTag:(write ? write->tag : 0)];
+	}});
+}
+
+- (void)disconnectForTesting
+{
+	dispatch_sync(self.xmppQueue, ^{ @autoreleasepool {
+		
+		[self socketDidDisconnect:nil withError:nil];
+	}});
+}
+
+- (void)openParserForTestingWithParserQueue:(dispatch_queue_t)parserQueue
+{
+	dispatch_sync(self.xmppQueue, ^{ @autoreleasepool {
+		
+		XMPPParser *parser = [[XMPPParser alloc] initWithDelegate:self
+		                                            delegateQueue:self.xmppQueue
+		                                              parserQueue:parserQueue
+		                                                  backend:self.parserBackend];
+		
+		NSString *header = @"<?xml version='1.0'?>"
+		                    "<stream:stream xmlns:stream='http://etherx.jabber.org/streams' xmlns='jabber:client' version='1.0'>";
+		[parser parseData:[header dataUsingEncoding:NSUTF8StringEncoding]];
+		
+		// As openStream would, without a socket
+		[self setValue:parser forKey:@"parser"];
+		[self setValue:@(0) forKey:@"pendingParseChunks"];
+		[self setValue:@(YES) forKey:@"isReadingStream"];
+	}});
+	
+	// Let the parser read the header
+	dispatch_sync(parserQueue, ^{});
+	[self waitForXMPPQueue];
+}
+
+- (void)receiveDataForTesting:(NSData *)data
+{
+	dispatch_sync(self.xmppQueue, ^{ @autoreleasepool {
+		
+		[self socket:nil didReadData:data withTag:0];
+	}});
+}
+
+- (NSUInteger)numberOfPendingParseChunksForTesting
+{
+	__block NSUInteger result = 0;
+	dispatch_sync(self.xmppQueue, ^{
+		result = [[self valueForKey:@"pendingParseChunks"] unsignedIntegerValue];
+	});
+	return result;
+}
+
+- (BOOL)isReadingForTesting
+{
+	__block BOOL result = NO;
+	dispatch_sync(self.xmppQueue, ^{
+		result = [[self valueForKey:@"isReadingStream"] boolValue];
+	});
+	return result;
+}
+
+- (void)receiveArenaElementForTesting:(XMPPArenaElement *)arenaElement
+{
+	dispatch_sync(self.xmppQueue, ^{ @autoreleasepool {
+		
+		// Without a connection there's no parser, so a nil sender is the stream's own
+		[(id <XMPPParserDelegate>)self xmppParser:nil didReadArenaElement:arenaElement];
+	}});
+}
+
+- (void)waitForXMPPQueue
+{
+	dispatch_sync(self.xmppQueue, ^{});
+}
+
+@end
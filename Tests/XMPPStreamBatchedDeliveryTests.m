@@ -0,0 +1,228 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStream+Tests.h"
+#import "XMPPInternal.h"
+#import "XMPPIQ.h"
+#import "XMPPMessage.h"
+#import "XMPPPresence.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * Records every delivery as a string: the kind of stanza, and the elementIDs of the delivered stanzas.
+ * E.g. @"messages:m1,m2" for a batch, or @"message:m1" for a single stanza.
+**/
+@interface XMPPStreamBatchedDeliveryTestsDelegate : NSObject
+@property (nonatomic, strong) NSMutableArray *deliveries;
+@end
+
+@implementation XMPPStreamBatchedDeliveryTestsDelegate
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		_deliveries = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (void)recordStanzas:(NSArray *)stanzas withPrefix:(NSString *)prefix
+{
+	NSArray *elementIDs = [stanzas valueForKey:@"elementID"];
+	[self.deliveries addObject:[prefix stringByAppendingString:[elementIDs componentsJoinedByString:@","]]];
+}
+
+- (void)xmppStream:(XMPPStream *)sender didReceiveMessage:(XMPPMessage *)message
+{
+	[self recordStanzas:@[ message ] withPrefix:@"message:"];
+}
+
+@end
+
+/**
+ * Implements the batched variants, as well as the single-stanza method (which it shouldn't receive).
+**/
+@interface XMPPStreamBatchedDeliveryTestsBatchingDelegate : XMPPStreamBatchedDeliveryTestsDelegate
+@end
+
+@implementation XMPPStreamBatchedDeliveryTestsBatchingDelegate
+
+- (void)xmppStream:(XMPPStream *)sender didReceiveMessages:(NSArray *)messages
+{
+	[self recordStanzas:messages withPrefix:@"messages:"];
+}
+
+- (void)xmppStream:(XMPPStream *)sender didReceivePresences:(NSArray *)presences
+{
+	[self recordStanzas:presences withPrefix:@"presences:"];
+}
+
+@end
+
+@interface XMPPStreamBatchedDeliveryTests : XCTestCase
+{
+	XMPPStream *stream;
+
+	dispatch_queue_t delegateQueue;
+	XMPPStreamBatchedDeliveryTestsBatchingDelegate *batchingDelegate;
+	XMPPStreamBatchedDeliveryTestsDelegate *singleDelegate;
+}
+@end
+
+@implementation XMPPStreamBatchedDeliveryTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	stream = [[XMPPStream alloc] init];
+	[stream enterConnectedStateForTesting];
+
+	delegateQueue = dispatch_queue_create("XMPPStreamBatchedDeliveryTests", NULL);
+
+	batchingDelegate = [[XMPPStreamBatchedDeliveryTestsBatchingDelegate alloc] init];
+	singleDelegate = [[XMPPStreamBatchedDeliveryTestsDelegate alloc] init];
+
+	[stream addDelegate:batchingDelegate delegateQueue:delegateQueue];
+	[stream addDelegate:singleDelegate delegateQueue:delegateQueue];
+}
+
+- (void)tearDown
+{
+	[stream removeDelegate:batchingDelegate];
+	[stream removeDelegate:singleDelegate];
+	[stream waitForXMPPQueue];
+
+	stream = nil;
+
+	[super tearDown];
+}
+
+- (NSArray *)deliveriesOf:(XMPPStreamBatchedDeliveryTestsDelegate *)delegate
+{
+	[stream waitForXMPPQueue];
+
+	__block NSArray *result = nil;
+	dispatch_sync(delegateQueue, ^{
+		result = [delegate.deliveries copy];
+	});
+	return result;
+}
+
+- (XMPPMessage *)messageWithID:(NSString *)elementID
+{
+	return [XMPPMessage messageWithType:@"chat" to:[XMPPJID jidWithString:@"alice@example.com"] elementID:elementID];
+}
+
+- (XMPPPresence *)presenceWithID:(NSString *)elementID
+{
+	XMPPPresence *presence = [XMPPPresence presence];
+	[presence addAttributeWithName:@"id" stringValue:elementID];
+
+	return presence;
+}
+
+/**
+ * Injects the given stanzas during a single turn of the xmppQueue, as if they had been received together.
+**/
+- (void)receiveStanzas:(NSArray *)stanzas
+{
+	dispatch_sync(stream.xmppQueue, ^{
+
+		for (NSXMLElement *stanza in stanzas)
+		{
+			[stream injectElement:stanza];
+		}
+	});
+}
+
+- (void)testBatchesFollowStanzaKinds
+{
+	[self receiveStanzas:@[ [self messageWithID:@"m1"],
+	                        [self messageWithID:@"m2"],
+	                        [self presenceWithID:@"p1"],
+	                        [self messageWithID:@"m3"],
+	                        [XMPPIQ iqWithType:@"result" elementID:@"i1"],
+	                        [self messageWithID:@"m4"] ]];
+
+	// A stanza of the other kind, or an IQ, delivers the pending batch first.
+	// The rest is delivered at the end of the queue turn.
+
+	XCTAssertEqualObjects([self deliveriesOf:batchingDelegate],
+	                      (@[ @"messages:m1,m2", @"presences:p1", @"messages:m3", @"messages:m4" ]));
+
+	// Other delegates still get one stanza at a time
+
+	XCTAssertEqualObjects([self deliveriesOf:singleDelegate],
+	                      (@[ @"message:m1", @"message:m2", @"message:m3", @"message:m4" ]));
+}
+
+- (void)testMaxSize
+{
+	stream.deliveryBatchMaxSize = 2;
+
+	[self receiveStanzas:@[ [self messageWithID:@"m1"],
+	                        [self messageWithID:@"m2"],
+	                        [self messageWithID:@"m3"],
+	                        [self messageWithID:@"m4"],
+	                        [self messageWithID:@"m5"] ]];
+
+	XCTAssertEqualObjects([self deliveriesOf:batchingDelegate],
+	                      (@[ @"messages:m1,m2", @"messages:m3,m4", @"messages:m5" ]));
+}
+
+- (void)testLatency
+{
+	stream.deliveryBatchLatency = 0.2;
+
+	// Separate queue turns, within the latency
+
+	[self receiveStanzas:@[ [self messageWithID:@"m1"] ]];
+	[self receiveStanzas:@[ [self messageWithID:@"m2"] ]];
+
+	XCTAssertEqualObjects([self deliveriesOf:batchingDelegate], (@[]));
+
+	[NSThread sleepForTimeInterval:0.5];
+
+	XCTAssertEqualObjects([self deliveriesOf:batchingDelegate], (@[ @"messages:m1,m2" ]));
+}
+
+- (void)testDisconnectDelivers
+{
+	stream.deliveryBatchLatency = 10.0;
+
+	[self receiveStanzas:@[ [self messageWithID:@"m1"] ]];
+	XCTAssertEqualObjects([self deliveriesOf:batchingDelegate], (@[]));
+
+	[stream disconnectForTesting];
+
+	XCTAssertEqualObjects([self deliveriesOf:batchingDelegate], (@[ @"messages:m1" ]));
+}
+
+- (void)testOneBatchPerChunk
+{
+	dispatch_queue_t parserQueue = dispatch_queue_create("XMPPStreamBatchedDeliveryTests.parser", NULL);
+	[stream openParserForTestingWithParserQueue:parserQueue];
+
+	stream.receivePipelineDepth = 2;
+
+	// Both chunks are queued before the parser gets to them, but each is delivered as its own batch
+
+	dispatch_suspend(parserQueue);
+
+	[stream receiveDataForTesting:[@"<message id='m1'/><message id='m2'/><message id='m3'/>"
+	                               dataUsingEncoding:NSUTF8StringEncoding]];
+	[stream receiveDataForTesting:[@"<message id='m4'/><message id='m5'/>"
+	                               dataUsingEncoding:NSUTF8StringEncoding]];
+
+	dispatch_resume(parserQueue);
+	dispatch_sync(parserQueue, ^{});
+
+	XCTAssertEqualObjects([self deliveriesOf:batchingDelegate], (@[ @"messages:m1,m2,m3", @"messages:m4,m5" ]));
+
+	[stream disconnectForTesting];
+}
+
+@end
@@ -0,0 +1,210 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStream+Tests.h"
+#import "XMPPInternal.h"
+#import "XMPPMessage.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * Records the elementIDs of the sent messages.
+**/
+@interface XMPPStreamCorkingTestsDelegate : NSObject
+@property (nonatomic, strong) NSMutableArray *sentIDs;
+@end
+
+@implementation XMPPStreamCorkingTestsDelegate
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		_sentIDs = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (void)xmppStream:(XMPPStream *)sender didSendMessage:(XMPPMessage *)message
+{
+	[self.sentIDs addObject:[message elementID]];
+}
+
+@end
+
+/**
+ * Without a socket, every write stays in flight until completed by the test.
+ * So the numberOfUnsentBytes tells whether corked stanzas have been handed to the socket yet,
+ * and the number of completed writes it takes to clear it tells how many writes they took.
+**/
+@interface XMPPStreamCorkingTests : XCTestCase
+{
+	XMPPStream *stream;
+
+	dispatch_queue_t delegateQueue;
+	XMPPStreamCorkingTestsDelegate *delegate;
+}
+@end
+
+@implementation XMPPStreamCorkingTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	stream = [[XMPPStream alloc] init];
+	[stream enterConnectedStateForTesting];
+
+	delegateQueue = dispatch_queue_create("XMPPStreamCorkingTests", NULL);
+	delegate = [[XMPPStreamCorkingTestsDelegate alloc] init];
+
+	[stream addDelegate:delegate delegateQueue:delegateQueue];
+}
+
+- (void)tearDown
+{
+	[stream removeDelegate:delegate];
+	[stream waitForXMPPQueue];
+
+	stream = nil;
+
+	[super tearDown];
+}
+
+- (NSArray *)sentIDs
+{
+	[stream waitForXMPPQueue];
+
+	__block NSArray *result = nil;
+	dispatch_sync(delegateQueue, ^{
+		result = [delegate.sentIDs copy];
+	});
+	return result;
+}
+
+- (XMPPMessage *)messageWithID:(NSString *)elementID
+{
+	return [XMPPMessage messageWithType:@"chat" to:[XMPPJID jidWithString:@"alice@example.com"] elementID:elementID];
+}
+
+/**
+ * Sends the messages during a single turn of the xmppQueue, and returns their receipts.
+**/
+- (NSArray *)sendMessagesWithIDs:(NSArray *)elementIDs
+{
+	NSMutableArray *receipts = [NSMutableArray arrayWithCapacity:[elementIDs count]];
+
+	dispatch_sync(stream.xmppQueue, ^{
+
+		for (NSString *elementID in elementIDs)
+		{
+			XMPPElementReceipt *receipt = nil;
+			[stream sendElement:[self messageWithID:elementID] andGetReceipt:&receipt];
+
+			[receipts addObject:receipt];
+		}
+	});
+
+	return receipts;
+}
+
+- (void)testBurstIsOneWrite
+{
+	stream.corksWrites = YES;
+
+	NSArray *receipts = [self sendMessagesWithIDs:@[ @"m1", @"m2", @"m3" ]];
+
+	// Flushed at the end of the turn: every stanza is reported as sent, none is written yet
+
+	XCTAssertEqualObjects([self sentIDs], (@[ @"m1", @"m2", @"m3" ]));
+	XCTAssertGreaterThan(stream.numberOfUnsentBytes, (NSUInteger)0);
+
+	for (XMPPElementReceipt *receipt in receipts)
+	{
+		XCTAssertFalse([receipt wait:0]);
+	}
+
+	// A single write, which signals the receipt of each stanza
+
+	[stream completeWriteForTesting];
+
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+
+	for (XMPPElementReceipt *receipt in receipts)
+	{
+		XCTAssertTrue([receipt wait:0]);
+	}
+}
+
+- (void)testWithoutCorking
+{
+	NSArray *receipts = [self sendMessagesWithIDs:@[ @"m1", @"m2", @"m3" ]];
+
+	XCTAssertEqualObjects([self sentIDs], (@[ @"m1", @"m2", @"m3" ]));
+
+	// One write per stanza
+
+	[stream completeWriteForTesting];
+
+	XCTAssertGreaterThan(stream.numberOfUnsentBytes, (NSUInteger)0);
+	XCTAssertTrue([receipts[0] wait:0]);
+	XCTAssertFalse([receipts[1] wait:0]);
+
+	[stream completeWriteForTesting];
+	[stream completeWriteForTesting];
+
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+	XCTAssertTrue([receipts[2] wait:0]);
+}
+
+- (void)testCorkInterval
+{
+	stream.corksWrites = YES;
+	stream.corkInterval = 0.2;
+
+	// Sent during separate queue turns, but within the interval
+
+	NSArray *first = [self sendMessagesWithIDs:@[ @"m1" ]];
+	NSArray *second = [self sendMessagesWithIDs:@[ @"m2" ]];
+
+	XCTAssertEqualObjects([self sentIDs], (@[ @"m1", @"m2" ]));
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+
+	// The cork is flushed once the interval has passed, as a single write
+
+	XCTAssertFalse([first[0] wait:0]);
+
+	[NSThread sleepForTimeInterval:0.5];
+	[stream waitForXMPPQueue];
+
+	XCTAssertGreaterThan(stream.numberOfUnsentBytes, (NSUInteger)0);
+
+	[stream completeWriteForTesting];
+
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+	XCTAssertTrue([first[0] wait:0]);
+	XCTAssertTrue([second[0] wait:0]);
+}
+
+- (void)testDisablingFlushes
+{
+	stream.corksWrites = YES;
+	stream.corkInterval = 10.0;
+
+	NSArray *receipts = [self sendMessagesWithIDs:@[ @"m1", @"m2" ]];
+
+	[stream waitForXMPPQueue];
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+
+	stream.corksWrites = NO;
+
+	XCTAssertGreaterThan(stream.numberOfUnsentBytes, (NSUInteger)0);
+
+	[stream completeWriteForTesting];
+
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+	XCTAssertTrue([receipts[0] wait:0]);
+	XCTAssertTrue([receipts[1] wait:0]);
+}
+
+@end
@@ -0,0 +1,192 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStream+Tests.h"
+#import "XMPPMessage.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * Records the elementIDs of the messages passed to the willSend, didSend and didFailToSend delegate methods.
+**/
+@interface XMPPStreamEarlyDataTestsDelegate : NSObject
+@property (nonatomic, strong) NSMutableArray *willSendIDs;
+@property (nonatomic, strong) NSMutableArray *sentIDs;
+@property (nonatomic, strong) NSMutableArray *failedIDs;
+@property (nonatomic, strong) XCTestExpectation *sendExpectation;
+@end
+
+@implementation XMPPStreamEarlyDataTestsDelegate
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		_willSendIDs = [NSMutableArray array];
+		_sentIDs = [NSMutableArray array];
+		_failedIDs = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (XMPPMessage *)xmppStream:(XMPPStream *)sender willSendMessage:(XMPPMessage *)message
+{
+	[self.willSendIDs addObject:[message elementID]];
+	return message;
+}
+
+- (void)xmppStream:(XMPPStream *)sender didSendMessage:(XMPPMessage *)message
+{
+	[self.sentIDs addObject:[message elementID]];
+	[self.sendExpectation fulfill];
+}
+
+- (void)xmppStream:(XMPPStream *)sender didFailToSendMessage:(XMPPMessage *)message error:(NSError *)error
+{
+	[self.failedIDs addObject:[message elementID]];
+}
+
+@end
+
+/**
+ * The stream is driven through connecting and opening without a socket.
+ * Every write stays in flight until completed by the test, so the numberOfUnsentBytes tells whether
+ * the early stanzas have been written, and the number of completed writes it takes to clear it
+ * tells whether they shared the write of the stream header.
+**/
+@interface XMPPStreamEarlyDataTests : XCTestCase
+{
+	XMPPStream *stream;
+
+	dispatch_queue_t delegateQueue;
+	XMPPStreamEarlyDataTestsDelegate *delegate;
+}
+@end
+
+@implementation XMPPStreamEarlyDataTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	stream = [[XMPPStream alloc] init];
+	stream.myJID = [XMPPJID jidWithString:@"bob@example.com/phone"];
+
+	delegateQueue = dispatch_queue_create("XMPPStreamEarlyDataTests", NULL);
+	delegate = [[XMPPStreamEarlyDataTestsDelegate alloc] init];
+
+	[stream addDelegate:delegate delegateQueue:delegateQueue];
+}
+
+- (void)tearDown
+{
+	[stream removeDelegate:delegate];
+	[stream disconnectForTesting];
+
+	stream = nil;
+
+	[super tearDown];
+}
+
+/**
+ * Waits for the stream, and for the delegate callbacks it caused.
+**/
+- (void)waitForDelegate
+{
+	[stream waitForXMPPQueue];
+	dispatch_sync(delegateQueue, ^{});
+}
+
+- (XMPPMessage *)messageWithID:(NSString *)elementID
+{
+	return [XMPPMessage messageWithType:@"chat" to:[XMPPJID jidWithString:@"alice@example.com"] elementID:elementID];
+}
+
+- (void)testSentWithStreamHeader
+{
+	[stream enterConnectingStateForTesting];
+
+	[stream sendElementAsEarlyData:[self messageWithID:@"m1"]];
+	[stream sendElementAsEarlyData:[self messageWithID:@"m2"]];
+
+	// Buffered until the stream opens
+
+	[self waitForDelegate];
+
+	XCTAssertEqualObjects(delegate.sentIDs, (@[]));
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+
+	[stream connectSocketForTesting];
+	[self waitForDelegate];
+
+	// Written along with the header, skipping the (asynchronous) willSend delegate methods
+
+	XCTAssertEqualObjects(delegate.sentIDs, (@[ @"m1", @"m2" ]));
+	XCTAssertEqualObjects(delegate.willSendIDs, (@[]));
+	XCTAssertGreaterThan(stream.numberOfUnsentBytes, (NSUInteger)0);
+
+	[stream completeWriteForTesting];
+
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+
+	// While the stream is opening, early data follows the header right away
+
+	[stream sendElementAsEarlyData:[self messageWithID:@"m3"]];
+	[self waitForDelegate];
+
+	XCTAssertEqualObjects(delegate.sentIDs, (@[ @"m1", @"m2", @"m3" ]));
+	XCTAssertGreaterThan(stream.numberOfUnsentBytes, (NSUInteger)0);
+}
+
+- (void)testWithoutEarlyData
+{
+	[stream enterConnectingStateForTesting];
+	[stream connectSocketForTesting];
+
+	// Just the header
+
+	XCTAssertGreaterThan(stream.numberOfUnsentBytes, (NSUInteger)0);
+
+	[stream completeWriteForTesting];
+
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+}
+
+- (void)testDisconnectFailsBufferedStanzas
+{
+	[stream enterConnectingStateForTesting];
+
+	[stream sendElementAsEarlyData:[self messageWithID:@"m1"]];
+	[stream sendElementAsEarlyData:[self messageWithID:@"m2"]];
+
+	[stream disconnectForTesting];
+	[self waitForDelegate];
+
+	XCTAssertEqualObjects(delegate.failedIDs, (@[ @"m1", @"m2" ]));
+	XCTAssertEqualObjects(delegate.sentIDs, (@[]));
+}
+
+- (void)testNotConnecting
+{
+	// Disconnected: fails right away
+
+	[stream sendElementAsEarlyData:[self messageWithID:@"m1"]];
+	[self waitForDelegate];
+
+	XCTAssertEqualObjects(delegate.failedIDs, (@[ @"m1" ]));
+
+	// Connected: the same as sendElement:, so it's sent asynchronously, after willSendMessage:
+
+	[stream enterConnectedStateForTesting];
+
+	delegate.sendExpectation = [self expectationWithDescription:@"sent"];
+
+	[stream sendElementAsEarlyData:[self messageWithID:@"m2"]];
+
+	[self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+	XCTAssertEqualObjects(delegate.willSendIDs, (@[ @"m2" ]));
+	XCTAssertEqualObjects(delegate.sentIDs, (@[ @"m2" ]));
+}
+
+@end
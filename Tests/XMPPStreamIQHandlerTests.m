@@ -0,0 +1,157 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStream+Tests.h"
+#import "XMPPInternal.h"
+#import "XMPPIQ.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+#define XMPP_IQ_HANDLER_TESTS_XMLNS @"urn:xmpp:tests"
+
+/**
+ * Records the IQs it receives, and the filtered stanzas it's told about.
+**/
+@interface XMPPStreamIQHandlerTestsDelegate : NSObject
+@property (nonatomic, strong) NSMutableArray *receivedIQs;
+@property (nonatomic, assign) NSUInteger numberOfFilteredStanzas;
+@property (nonatomic, strong) XCTestExpectation *expectation;
+@end
+
+@implementation XMPPStreamIQHandlerTestsDelegate
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		_receivedIQs = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (BOOL)xmppStream:(XMPPStream *)sender didReceiveIQ:(XMPPIQ *)iq
+{
+	[self.receivedIQs addObject:iq];
+	[self.expectation fulfill];
+
+	return YES;
+}
+
+- (void)xmppStreamDidFilterStanza:(XMPPStream *)sender
+{
+	self.numberOfFilteredStanzas++;
+	[self.expectation fulfill];
+}
+
+@end
+
+@interface XMPPStreamIQHandlerTests : XCTestCase
+{
+	XMPPStream *stream;
+
+	dispatch_queue_t delegateQueue;
+	XMPPStreamIQHandlerTestsDelegate *handler;
+	XMPPStreamIQHandlerTestsDelegate *observer;
+}
+@end
+
+@implementation XMPPStreamIQHandlerTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	stream = [[XMPPStream alloc] init];
+	[stream enterConnectedStateForTesting];
+
+	delegateQueue = dispatch_queue_create("XMPPStreamIQHandlerTests", NULL);
+
+	handler = [[XMPPStreamIQHandlerTestsDelegate alloc] init];
+	observer = [[XMPPStreamIQHandlerTestsDelegate alloc] init];
+
+	// The handler is also a delegate, as modules are
+	[stream addDelegate:handler delegateQueue:delegateQueue];
+	[stream addDelegate:observer delegateQueue:delegateQueue];
+
+	[stream registerIQHandler:handler handlerQueue:delegateQueue forXmlns:XMPP_IQ_HANDLER_TESTS_XMLNS];
+}
+
+- (void)tearDown
+{
+	[stream unregisterIQHandler:handler forXmlns:nil];
+	[stream removeDelegate:handler];
+	[stream removeDelegate:observer];
+	[stream waitForXMPPQueue];
+
+	stream = nil;
+
+	[super tearDown];
+}
+
+- (XMPPIQ *)iqWithType:(NSString *)type xmlns:(NSString *)xmlns
+{
+	NSXMLElement *query = [NSXMLElement elementWithName:@"query" xmlns:xmlns];
+
+	XMPPIQ *iq = [XMPPIQ iqWithType:type elementID:@"iq1" child:query];
+	[iq addAttributeWithName:@"from" stringValue:@"example.com"];
+	return iq;
+}
+
+/**
+ * Waits for the stanza to make it through the stream, and for the delegates to have been invoked.
+**/
+- (void)waitForDelegates
+{
+	[self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+	[stream waitForXMPPQueue];
+	dispatch_sync(delegateQueue, ^{});
+}
+
+- (void)testClaimedIQOnlyReachesHandler
+{
+	handler.expectation = [self expectationWithDescription:@"handler"];
+	observer.expectation = [self expectationWithDescription:@"observer"];
+
+	[stream injectElement:[self iqWithType:@"get" xmlns:XMPP_IQ_HANDLER_TESTS_XMLNS]];
+
+	[self waitForDelegates];
+
+	XCTAssertEqual([handler.receivedIQs count], (NSUInteger)1);
+	XCTAssertEqual(handler.numberOfFilteredStanzas, (NSUInteger)0);
+
+	// The other delegates only learn that a stanza was consumed (which is what stream management counts)
+	XCTAssertEqual([observer.receivedIQs count], (NSUInteger)0);
+	XCTAssertEqual(observer.numberOfFilteredStanzas, (NSUInteger)1);
+}
+
+- (void)testUnclaimedIQReachesAllDelegates
+{
+	handler.expectation = [self expectationWithDescription:@"handler"];
+	observer.expectation = [self expectationWithDescription:@"observer"];
+
+	[stream injectElement:[self iqWithType:@"get" xmlns:@"urn:xmpp:other"]];
+
+	[self waitForDelegates];
+
+	XCTAssertEqual([handler.receivedIQs count], (NSUInteger)1);
+	XCTAssertEqual([observer.receivedIQs count], (NSUInteger)1);
+	XCTAssertEqual(observer.numberOfFilteredStanzas, (NSUInteger)0);
+}
+
+- (void)testClaimedNamespaceResultReachesAllDelegates
+{
+	// Only requests are claimed
+
+	handler.expectation = [self expectationWithDescription:@"handler"];
+	observer.expectation = [self expectationWithDescription:@"observer"];
+
+	[stream injectElement:[self iqWithType:@"result" xmlns:XMPP_IQ_HANDLER_TESTS_XMLNS]];
+
+	[self waitForDelegates];
+
+	XCTAssertEqual([handler.receivedIQs count], (NSUInteger)1);
+	XCTAssertEqual([observer.receivedIQs count], (NSUInteger)1);
+}
+
+@end
@@ -0,0 +1,257 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStream+Tests.h"
+#import "XMPPInternal.h"
+#import "XMPPMessage.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * Appends its name to the (shared) log whenever it's invoked, and notes if it ever runs outside the xmppQueue.
+ * It marks the messages it sees with an attribute, and drops those with the body given as dropBody.
+**/
+@interface XMPPStreamInlineFilterTestsFilter : NSObject <XMPPStreamInlineFilter>
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, copy) NSString *dropBody;
+@property (nonatomic, strong) NSMutableArray *log;
+@property (nonatomic, assign) const char *expectedQueueLabel;
+@property (nonatomic, assign) BOOL ranOnOtherQueue;
+@end
+
+@implementation XMPPStreamInlineFilterTestsFilter
+
+- (XMPPMessage *)filterMessage:(XMPPMessage *)message
+{
+	if (strcmp(dispatch_queue_get_label(DISPATCH_CURRENT_QUEUE_LABEL), self.expectedQueueLabel) != 0)
+	{
+		self.ranOnOtherQueue = YES;
+	}
+
+	[self.log addObject:self.name];
+
+	if (self.dropBody && [[message body] isEqualToString:self.dropBody])
+	{
+		return nil;
+	}
+
+	[message addAttributeWithName:self.name stringValue:@"seen"];
+	return message;
+}
+
+- (XMPPMessage *)xmppStream:(XMPPStream *)sender filterOutgoingMessage:(XMPPMessage *)message
+{
+	return [self filterMessage:message];
+}
+
+- (XMPPMessage *)xmppStream:(XMPPStream *)sender filterIncomingMessage:(XMPPMessage *)message
+{
+	return [self filterMessage:message];
+}
+
+@end
+
+/**
+ * Records what the delegate filters and callbacks see.
+**/
+@interface XMPPStreamInlineFilterTestsDelegate : NSObject
+@property (nonatomic, strong) NSMutableArray *willSendAttributes;
+@property (nonatomic, strong) NSMutableArray *sentBodies;
+@property (nonatomic, strong) NSMutableArray *receivedMessages;
+@property (nonatomic, assign) NSUInteger numberOfFilteredStanzas;
+@property (nonatomic, strong) XCTestExpectation *sendExpectation;
+@end
+
+@implementation XMPPStreamInlineFilterTestsDelegate
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		_willSendAttributes = [NSMutableArray array];
+		_sentBodies = [NSMutableArray array];
+		_receivedMessages = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (XMPPMessage *)xmppStream:(XMPPStream *)sender willSendMessage:(XMPPMessage *)message
+{
+	// The inline filters ran first
+	[self.willSendAttributes addObject:[message attributeStringValueForName:@"a"] ?: @"none"];
+	return message;
+}
+
+- (void)xmppStream:(XMPPStream *)sender didSendMessage:(XMPPMessage *)message
+{
+	[self.sentBodies addObject:[message body]];
+	[self.sendExpectation fulfill];
+}
+
+- (void)xmppStream:(XMPPStream *)sender didReceiveMessage:(XMPPMessage *)message
+{
+	[self.receivedMessages addObject:message];
+}
+
+- (void)xmppStreamDidFilterStanza:(XMPPStream *)sender
+{
+	self.numberOfFilteredStanzas++;
+}
+
+@end
+
+@interface XMPPStreamInlineFilterTests : XCTestCase
+{
+	XMPPStream *stream;
+
+	dispatch_queue_t delegateQueue;
+	XMPPStreamInlineFilterTestsDelegate *delegate;
+
+	NSMutableArray *log;
+}
+@end
+
+@implementation XMPPStreamInlineFilterTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	stream = [[XMPPStream alloc] init];
+	[stream enterConnectedStateForTesting];
+
+	delegateQueue = dispatch_queue_create("XMPPStreamInlineFilterTests", NULL);
+	delegate = [[XMPPStreamInlineFilterTestsDelegate alloc] init];
+
+	[stream addDelegate:delegate delegateQueue:delegateQueue];
+
+	log = [NSMutableArray array];
+}
+
+- (void)tearDown
+{
+	[stream removeDelegate:delegate];
+	[stream waitForXMPPQueue];
+
+	stream = nil;
+
+	[super tearDown];
+}
+
+- (XMPPStreamInlineFilterTestsFilter *)filterWithName:(NSString *)name
+{
+	XMPPStreamInlineFilterTestsFilter *filter = [[XMPPStreamInlineFilterTestsFilter alloc] init];
+	filter.name = name;
+	filter.log = log;
+	filter.expectedQueueLabel = dispatch_queue_get_label(stream.xmppQueue);
+
+	return filter;
+}
+
+- (XMPPMessage *)messageWithBody:(NSString *)body
+{
+	XMPPMessage *message = [XMPPMessage messageWithType:@"chat" to:[XMPPJID jidWithString:@"alice@example.com"]];
+	[message addBody:body];
+
+	return message;
+}
+
+/**
+ * Waits for the stream, and for the delegate callbacks it caused.
+**/
+- (void)waitForDelegate
+{
+	[stream waitForXMPPQueue];
+	dispatch_sync(delegateQueue, ^{});
+}
+
+- (void)testOutgoing
+{
+	XMPPStreamInlineFilterTestsFilter *a = [self filterWithName:@"a"];
+	XMPPStreamInlineFilterTestsFilter *b = [self filterWithName:@"b"];
+	b.dropBody = @"drop";
+
+	[stream addInlineFilter:a];
+	[stream addInlineFilter:b];
+	[stream addInlineFilter:a]; // Already added
+
+	// The kept message goes through the willSendMessage: delegate method, and is sent asynchronously
+	delegate.sendExpectation = [self expectationWithDescription:@"sent"];
+
+	[stream sendElement:[self messageWithBody:@"keep"]];
+
+	__block BOOL dropped = NO;
+	XCTestExpectation *expectation = [self expectationWithDescription:@"completion"];
+
+	[stream sendElement:[self messageWithBody:@"drop"] completionQueue:delegateQueue completion:^(BOOL sent) {
+
+		dropped = !sent;
+		[expectation fulfill];
+	}];
+
+	[self waitForExpectationsWithTimeout:5.0 handler:nil];
+	[self waitForDelegate];
+
+	// In the order they were added, on the xmppQueue, before the delegate filters
+
+	XCTAssertEqualObjects(log, (@[ @"a", @"b", @"a", @"b" ]));
+	XCTAssertFalse(a.ranOnOtherQueue);
+	XCTAssertFalse(b.ranOnOtherQueue);
+
+	XCTAssertEqualObjects(delegate.willSendAttributes, (@[ @"seen" ]));
+	XCTAssertEqualObjects(delegate.sentBodies, (@[ @"keep" ]));
+	XCTAssertTrue(dropped);
+}
+
+- (void)testIncoming
+{
+	XMPPStreamInlineFilterTestsFilter *a = [self filterWithName:@"a"];
+	a.dropBody = @"drop";
+
+	[stream addInlineFilter:a];
+
+	[stream injectElement:[self messageWithBody:@"keep"]];
+	[stream injectElement:[self messageWithBody:@"drop"]];
+
+	[self waitForDelegate];
+
+	XCTAssertEqualObjects(log, (@[ @"a", @"a" ]));
+	XCTAssertFalse(a.ranOnOtherQueue);
+
+	// The dropped stanza still counts as received
+
+	XCTAssertEqual([delegate.receivedMessages count], (NSUInteger)1);
+	XCTAssertEqualObjects([delegate.receivedMessages[0] attributeStringValueForName:@"a"], @"seen");
+	XCTAssertEqual(delegate.numberOfFilteredStanzas, (NSUInteger)1);
+}
+
+- (void)testRemovedAndDeallocatedFilters
+{
+	XMPPStreamInlineFilterTestsFilter *a = [self filterWithName:@"a"];
+	[stream addInlineFilter:a];
+
+	@autoreleasepool {
+
+		XMPPStreamInlineFilterTestsFilter *b = [self filterWithName:@"b"];
+		[stream addInlineFilter:b];
+		[stream waitForXMPPQueue];
+
+		b = nil;
+	}
+
+	[stream injectElement:[self messageWithBody:@"1"]];
+	[self waitForDelegate];
+
+	XCTAssertEqualObjects(log, (@[ @"a" ]));
+
+	[stream removeInlineFilter:a];
+
+	[stream injectElement:[self messageWithBody:@"2"]];
+	[self waitForDelegate];
+
+	XCTAssertEqualObjects(log, (@[ @"a" ]));
+	XCTAssertEqual([delegate.receivedMessages count], (NSUInteger)2);
+	XCTAssertNil([delegate.receivedMessages[1] attributeStringValueForName:@"a"]);
+}
+
+@end
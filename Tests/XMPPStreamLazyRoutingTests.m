@@ -0,0 +1,186 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStream+Tests.h"
+#import "XMPPParser.h"
+#import "XMPPStanzaArena.h"
+#import "XMPPMessage.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * Collects the (lazy) arena elements read by a parser.
+**/
+@interface XMPPStreamLazyRoutingTestsCollector : NSObject <XMPPParserDelegate>
+@property (nonatomic, strong) NSMutableArray *elements;
+@end
+
+@implementation XMPPStreamLazyRoutingTestsCollector
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		_elements = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (void)xmppParser:(XMPPParser *)sender didReadArenaElement:(XMPPArenaElement *)element
+{
+	[self.elements addObject:element];
+}
+
+@end
+
+/**
+ * Records the messages it receives, and the filtered stanzas it's told about.
+ * Without interests, it stands for the delegates (such as stream management) that implement didReceiveMessage.
+**/
+@interface XMPPStreamLazyRoutingTestsDelegate : NSObject
+@property (nonatomic, strong) NSMutableArray *receivedMessages;
+@property (nonatomic, assign) NSUInteger numberOfFilteredStanzas;
+@end
+
+@implementation XMPPStreamLazyRoutingTestsDelegate
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		_receivedMessages = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (void)xmppStream:(XMPPStream *)sender didReceiveMessage:(XMPPMessage *)message
+{
+	[self.receivedMessages addObject:message];
+}
+
+- (void)xmppStreamDidFilterStanza:(XMPPStream *)sender
+{
+	self.numberOfFilteredStanzas++;
+}
+
+@end
+
+@interface XMPPStreamLazyRoutingTests : XCTestCase
+{
+	XMPPStream *stream;
+
+	dispatch_queue_t delegateQueue;
+	XMPPStreamLazyRoutingTestsDelegate *routedDelegate;
+	XMPPStreamLazyRoutingTestsDelegate *unroutedDelegate;
+}
+@end
+
+@implementation XMPPStreamLazyRoutingTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	stream = [[XMPPStream alloc] init];
+	[stream enterConnectedStateForTesting];
+
+	delegateQueue = dispatch_queue_create("XMPPStreamLazyRoutingTests", NULL);
+
+	routedDelegate = [[XMPPStreamLazyRoutingTestsDelegate alloc] init];
+	unroutedDelegate = [[XMPPStreamLazyRoutingTestsDelegate alloc] init];
+
+	[stream addDelegate:routedDelegate delegateQueue:delegateQueue];
+	[stream addDelegate:unroutedDelegate delegateQueue:delegateQueue];
+
+	[stream addStanzaInterest:[XMPPStanzaInterest interestInKind:XMPPStanzaKindMessage
+	                                                     fromJID:[XMPPJID jidWithString:@"alice@example.com"]
+	                                                     options:XMPPJIDCompareBare]
+	              forDelegate:routedDelegate];
+}
+
+- (void)tearDown
+{
+	[stream removeDelegate:routedDelegate];
+	[stream removeDelegate:unroutedDelegate];
+	[stream waitForXMPPQueue];
+
+	stream = nil;
+
+	[super tearDown];
+}
+
+/**
+ * Parses the given stanza with the lazy arena backend, so nothing but its top-level element is built.
+**/
+- (XMPPArenaElement *)lazyElementForStanza:(NSString *)stanza
+{
+	dispatch_queue_t parserQueue = dispatch_queue_create("XMPPStreamLazyRoutingTests.parser", NULL);
+	dispatch_queue_t collectorQueue = dispatch_queue_create("XMPPStreamLazyRoutingTests.collector", NULL);
+
+	XMPPStreamLazyRoutingTestsCollector *collector = [[XMPPStreamLazyRoutingTestsCollector alloc] init];
+
+	XMPPParser *parser = [[XMPPParser alloc] initWithDelegate:collector
+	                                            delegateQueue:collectorQueue
+	                                              parserQueue:parserQueue
+	                                                  backend:XMPPParserBackendArenaLazy];
+
+	NSString *data = [@"<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>"
+	                  stringByAppendingString:stanza];
+
+	[parser parseData:[data dataUsingEncoding:NSUTF8StringEncoding]];
+
+	// Wait for the parser, and then for the delegate callbacks it dispatched
+	dispatch_sync(parserQueue, ^{});
+	dispatch_sync(collectorQueue, ^{});
+
+	XCTAssertEqual([collector.elements count], (NSUInteger)1);
+
+	XMPPArenaElement *element = [collector.elements firstObject];
+	XCTAssertFalse(element.isMaterialized);
+
+	return element;
+}
+
+- (void)waitForDelegates
+{
+	[stream waitForXMPPQueue];
+	dispatch_sync(delegateQueue, ^{});
+}
+
+- (void)testUninterestingStanzaIsNotMaterialized
+{
+	XMPPArenaElement *element =
+	  [self lazyElementForStanza:@"<message from='bob@example.com/phone' type='chat'><body>Hi</body></message>"];
+
+	[stream receiveArenaElementForTesting:element];
+	[self waitForDelegates];
+
+	// The delegate without interests implements didReceiveMessage, but doesn't force the stanza to be parsed
+	XCTAssertFalse(element.isMaterialized);
+
+	XCTAssertEqual([routedDelegate.receivedMessages count], (NSUInteger)0);
+	XCTAssertEqual([unroutedDelegate.receivedMessages count], (NSUInteger)0);
+
+	// Everyone (e.g. stream management) still learns that a stanza was received
+	XCTAssertEqual(routedDelegate.numberOfFilteredStanzas, (NSUInteger)1);
+	XCTAssertEqual(unroutedDelegate.numberOfFilteredStanzas, (NSUInteger)1);
+}
+
+- (void)testInterestingStanzaIsDelivered
+{
+	XMPPArenaElement *element =
+	  [self lazyElementForStanza:@"<message from='alice@example.com/phone' type='chat'><body>Hi</body></message>"];
+
+	[stream receiveArenaElementForTesting:element];
+	[self waitForDelegates];
+
+	XCTAssertTrue(element.isMaterialized);
+
+	XCTAssertEqual([routedDelegate.receivedMessages count], (NSUInteger)1);
+	XCTAssertEqual([unroutedDelegate.receivedMessages count], (NSUInteger)1);
+	XCTAssertEqualObjects([[routedDelegate.receivedMessages firstObject] body], @"Hi");
+
+	XCTAssertEqual(unroutedDelegate.numberOfFilteredStanzas, (NSUInteger)0);
+}
+
+@end
@@ -0,0 +1,688 @@
+#import <XCTest/XCTest.h>
+#import <libkern/OSByteOrder.h>
+#import "XMPPStreamManagementFileStoragePrivate.h"
+#import "XMPPStreamManagementMemoryStorage.h"
+#import "XMPPStreamManagementStanzas.h"
+#import "XMPPRandomOperations.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+typedef void (^XMPPJournalTestsOperation)(id <XMPPStreamManagementStorage> storage);
+
+/**
+ * XMPPStreamManagementFileStorage appends every change to a journal, and replays it on init.
+ *
+ * These tests apply the same operations to the file storage and to the memory storage (the model),
+ * then reopen the journal and compare: after a clean flush, after compaction,
+ * and after the tail of the file has been truncated or corrupted at every byte of its last records.
+**/
+@interface XMPPStreamManagementFileStorageTests : XCTestCase
+{
+	NSString *directory;
+	NSString *path;
+	NSUInteger stanzaCounter;
+}
+@end
+
+@implementation XMPPStreamManagementFileStorageTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	NSString *name = [NSString stringWithFormat:@"XMPPStreamManagementFileStorageTests-%@", [[NSUUID UUID] UUIDString]];
+	directory = [NSTemporaryDirectory() stringByAppendingPathComponent:name];
+
+	[[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+
+	path = [directory stringByAppendingPathComponent:@"journal"];
+}
+
+- (void)tearDown
+{
+	[[NSFileManager defaultManager] removeItemAtPath:directory error:nil];
+
+	[super tearDown];
+}
+
+#pragma mark Utilities
+
+- (XMPPStreamManagementOutgoingStanza *)randomStanza
+{
+	// Every kind of stanzaId the journal encodes: strings, other NSCoding objects, and none at all
+
+	stanzaCounter++;
+
+	XMPPStreamManagementOutgoingStanza *stanza;
+	switch (random() % 5)
+	{
+		case 0  : stanza = [[XMPPStreamManagementOutgoingStanza alloc] initAwaitingStanzaId];                                                 break;
+		case 1  : stanza = [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:@(stanzaCounter)];                                   break;
+		case 2  : stanza = [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:nil];                                                break;
+		case 3  : stanza = [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:[NSString stringWithFormat:@"ünï-%lu", (unsigned long)stanzaCounter]]; break;
+		default : stanza = [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:[NSString stringWithFormat:@"%lu", (unsigned long)stanzaCounter]];     break;
+	}
+	return stanza;
+}
+
+- (NSArray *)randomOperations:(NSUInteger)count
+{
+	// Operations are blocks, so the same sequence can be applied to the file storage and to the model.
+	// Everything but removeAllForStream: (which compacts the journal).
+	// This carries on from the current state of random(), so each test seeds it first.
+
+	NSMutableArray *operations = [NSMutableArray arrayWithCapacity:count];
+	XMPPRandomOperations *generator = [[XMPPRandomOperations alloc] init];
+
+	__weak XMPPRandomOperations *weakGenerator = generator;
+
+	NSDate * (^currentDate)(void) = ^{
+		return [NSDate dateWithTimeIntervalSinceReferenceDate:(500000000.0 + weakGenerator.iteration + 0.25)];
+	};
+
+	[generator addOperationWithWeight:1 block:^{
+
+		NSDate *date = currentDate();
+		NSString *resumptionId = (random() % 4 == 0) ? nil : [[NSUUID UUID] UUIDString];
+		uint32_t timeout = (uint32_t)(random() % 600);
+
+		[operations addObject:[^(id <XMPPStreamManagementStorage> storage) {
+			[storage setResumptionId:resumptionId timeout:timeout lastDisconnect:date forStream:nil];
+		} copy]];
+	}];
+
+	[generator addOperationWithWeight:2 block:^{
+
+		NSDate *date = currentDate();
+		uint32_t h = (uint32_t)random();
+
+		[operations addObject:[^(id <XMPPStreamManagementStorage> storage) {
+			[storage setLastDisconnect:date lastHandledByClient:h forStream:nil];
+		} copy]];
+	}];
+
+	[generator addOperationWithWeight:2 block:^{
+
+		NSDate *date = currentDate();
+		uint32_t h = (uint32_t)random();
+
+		NSMutableArray *stanzas = [NSMutableArray array];
+		for (long j = random() % 6; j > 0; j--)
+		{
+			[stanzas addObject:[self randomStanza]];
+		}
+
+		uint32_t hc = (uint32_t)random();
+		BOOL disconnect = (random() % 2 == 0);
+
+		[operations addObject:[^(id <XMPPStreamManagementStorage> storage) {
+			if (disconnect)
+				[storage setLastDisconnect:date lastHandledByClient:hc lastHandledByServer:h pendingOutgoingStanzas:stanzas forStream:nil];
+			else
+				[storage setLastDisconnect:date lastHandledByServer:h pendingOutgoingStanzas:stanzas forStream:nil];
+		} copy]];
+	}];
+
+	[generator addOperationWithWeight:6 block:^{
+
+		NSDate *date = currentDate();
+		XMPPStreamManagementOutgoingStanza *stanza = [self randomStanza];
+
+		[operations addObject:[^(id <XMPPStreamManagementStorage> storage) {
+			[storage setLastDisconnect:date appendingPendingOutgoingStanza:stanza forStream:nil];
+		} copy]];
+	}];
+
+	[generator addOperationWithWeight:2 block:^{
+
+		// Out of range indexes are ignored by both storages
+
+		NSUInteger index = (NSUInteger)(random() % 8);
+		XMPPStreamManagementOutgoingStanza *stanza = [self randomStanza];
+
+		[operations addObject:[^(id <XMPPStreamManagementStorage> storage) {
+			[storage replacePendingOutgoingStanzaAtIndex:index withStanza:stanza forStream:nil];
+		} copy]];
+	}];
+
+	[generator addOperationWithWeight:3 block:^{
+
+		NSDate *date = currentDate();
+		uint32_t h = (uint32_t)random();
+		NSUInteger n = (NSUInteger)(random() % 4);
+
+		[operations addObject:[^(id <XMPPStreamManagementStorage> storage) {
+			[storage setLastDisconnect:date lastHandledByServer:h removingPendingOutgoingStanzas:n forStream:nil];
+		} copy]];
+	}];
+
+	[generator runIterations:count];
+
+	return operations;
+}
+
+- (NSDictionary *)stateOfStorage:(id <XMPPStreamManagementStorage>)storage
+{
+	NSString *resumptionId = nil;
+	uint32_t timeout = 0;
+	NSDate *lastDisconnect = nil;
+	uint32_t lastHandledByClient = 0;
+	uint32_t lastHandledByServer = 0;
+	NSArray *pendingOutgoingStanzas = nil;
+
+	[storage getResumptionId:&resumptionId timeout:&timeout lastDisconnect:&lastDisconnect forStream:nil];
+	[storage getLastHandledByClient:&lastHandledByClient
+	            lastHandledByServer:&lastHandledByServer
+	         pendingOutgoingStanzas:&pendingOutgoingStanzas
+	                      forStream:nil];
+
+	// The file storage hands back decoded copies, so stanzas are compared by value
+
+	NSMutableArray *stanzas = [NSMutableArray arrayWithCapacity:[pendingOutgoingStanzas count]];
+	for (XMPPStreamManagementOutgoingStanza *stanza in pendingOutgoingStanzas)
+	{
+		[stanzas addObject:@[ stanza.stanzaId ?: [NSNull null], @(stanza.awaitingStanzaId) ]];
+	}
+
+	return @{
+		@"resumptionId"        : resumptionId ?: [NSNull null],
+		@"timeout"             : @(timeout),
+		@"lastDisconnect"      : lastDisconnect ?: [NSNull null],
+		@"lastHandledByClient" : @(lastHandledByClient),
+		@"lastHandledByServer" : @(lastHandledByServer),
+		@"stanzas"             : stanzas
+	};
+}
+
+- (NSDictionary *)emptyState
+{
+	return [self stateOfStorage:[[XMPPStreamManagementMemoryStorage alloc] init]];
+}
+
+- (XMPPStreamManagementFileStorage *)openStorage
+{
+	XMPPStreamManagementFileStorage *storage = [[XMPPStreamManagementFileStorage alloc] initWithPath:path];
+	XCTAssertNotNil(storage);
+
+	// Keep every record in the journal, unless a test asks otherwise
+	storage.compactionThreshold = NSUIntegerMax;
+
+	return storage;
+}
+
+- (NSDictionary *)recoveredState
+{
+	// Opens the journal, which replays it, and closes it again
+
+	NSDictionary *state = nil;
+
+	@autoreleasepool {
+
+		XMPPStreamManagementFileStorage *storage = [[XMPPStreamManagementFileStorage alloc] initWithPath:path];
+		XCTAssertNotNil(storage);
+
+		state = [self stateOfStorage:storage];
+	}
+
+	return state;
+}
+
+- (unsigned long long)journalLength
+{
+	return [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil] fileSize];
+}
+
+/**
+ * Applies the operations one at a time, flushing after each.
+ * Returns the length of the journal before the first operation, and after each one,
+ * along with the model state at each of those points.
+**/
+- (void)writeOperations:(NSArray *)operations lengths:(NSMutableArray *)lengths states:(NSMutableArray *)states
+{
+	XMPPStreamManagementMemoryStorage *model = [[XMPPStreamManagementMemoryStorage alloc] init];
+
+	@autoreleasepool {
+
+		XMPPStreamManagementFileStorage *storage = [self openStorage];
+
+		[lengths addObject:@([self journalLength])];
+		[states addObject:[self stateOfStorage:model]];
+
+		for (XMPPJournalTestsOperation operation in operations)
+		{
+			operation(storage);
+			operation(model);
+
+			[storage flush];
+
+			[lengths addObject:@([self journalLength])];
+			[states addObject:[self stateOfStorage:model]];
+
+			XCTAssertGreaterThan([[lengths lastObject] unsignedLongLongValue],
+			                     [lengths[[lengths count] - 2] unsignedLongLongValue]);
+		}
+
+		XCTAssertEqualObjects([self stateOfStorage:storage], [states lastObject]);
+	}
+}
+
+/**
+ * Returns the index of the last complete record within the given number of bytes.
+**/
+- (NSUInteger)indexOfLengths:(NSArray *)lengths within:(unsigned long long)length
+{
+	NSUInteger index = 0;
+	while ((index + 1) < [lengths count] && [lengths[index + 1] unsignedLongLongValue] <= length)
+	{
+		index++;
+	}
+	return index;
+}
+
+#pragma mark Replay
+
+- (void)testReplay
+{
+	srandom(22);
+
+	NSArray *operations = [self randomOperations:3000];
+	XMPPStreamManagementMemoryStorage *model = [[XMPPStreamManagementMemoryStorage alloc] init];
+
+	@autoreleasepool {
+
+		XMPPStreamManagementFileStorage *storage = [self openStorage];
+
+		for (XMPPJournalTestsOperation operation in operations)
+		{
+			operation(storage);
+			operation(model);
+		}
+
+		XCTAssertEqualObjects([self stateOfStorage:storage], [self stateOfStorage:model]);
+
+		[storage flush];
+	}
+
+	XCTAssertEqualObjects([self recoveredState], [self stateOfStorage:model]);
+
+	// Replaying a journal leaves it as it was
+
+	unsigned long long length = [self journalLength];
+	XCTAssertEqualObjects([self recoveredState], [self stateOfStorage:model]);
+	XCTAssertEqual([self journalLength], length);
+}
+
+- (void)testReplayWritesPendingChangesOnDealloc
+{
+	// With a long syncInterval, only disconnects (which flush straight away) have been written
+	// by the time the storage goes away. Everything after the last one is still buffered.
+
+	srandom(122);
+
+	NSArray *operations = [self randomOperations:200];
+	XMPPStreamManagementMemoryStorage *model = [[XMPPStreamManagementMemoryStorage alloc] init];
+
+	@autoreleasepool {
+
+		XMPPStreamManagementFileStorage *storage = [self openStorage];
+		storage.syncInterval = 3600.0;
+
+		for (XMPPJournalTestsOperation operation in operations)
+		{
+			operation(storage);
+			operation(model);
+		}
+
+		XCTAssertEqualObjects([self stateOfStorage:storage], [self stateOfStorage:model]);
+	}
+
+	XCTAssertEqualObjects([self recoveredState], [self stateOfStorage:model]);
+}
+
+- (void)testReplayAcrossReopens
+{
+	// Each session appends to what the previous ones left behind
+
+	srandom(222);
+
+	XMPPStreamManagementMemoryStorage *model = [[XMPPStreamManagementMemoryStorage alloc] init];
+
+	for (NSUInteger session = 0; session < 10; session++)
+	{
+		@autoreleasepool {
+
+			XMPPStreamManagementFileStorage *storage = [self openStorage];
+			XCTAssertEqualObjects([self stateOfStorage:storage], [self stateOfStorage:model], @"Session %lu", (unsigned long)session);
+
+			for (XMPPJournalTestsOperation operation in [self randomOperations:100])
+			{
+				operation(storage);
+				operation(model);
+			}
+
+			[storage flush];
+		}
+	}
+
+	XCTAssertEqualObjects([self recoveredState], [self stateOfStorage:model]);
+}
+
+#pragma mark Truncated & Corrupted Tails
+
+- (void)testTruncatedTail
+{
+	// Cut the journal at every byte of its last records: as if the app crashed in the middle of a write.
+	// Replay must recover exactly the records that were completely written, and drop the torn one.
+
+	srandom(322);
+
+	NSMutableArray *lengths = [NSMutableArray array];
+	NSMutableArray *states = [NSMutableArray array];
+
+	[self writeOperations:[self randomOperations:60] lengths:lengths states:states];
+
+	NSData *journal = [NSData dataWithContentsOfFile:path];
+	XCTAssertEqual((unsigned long long)[journal length], [[lengths lastObject] unsignedLongLongValue]);
+
+	NSUInteger from = [lengths[[lengths count] - 12] unsignedIntegerValue];
+
+	for (NSUInteger cut = from; cut <= [journal length]; cut++)
+	{
+		[[journal subdataWithRange:NSMakeRange(0, cut)] writeToFile:path atomically:NO];
+
+		NSUInteger index = [self indexOfLengths:lengths within:cut];
+
+		XCTAssertEqualObjects([self recoveredState], states[index], @"Cut at %lu", (unsigned long)cut);
+
+		// And the torn record is gone from the file
+		XCTAssertEqual([self journalLength], [lengths[index] unsignedLongLongValue], @"Cut at %lu", (unsigned long)cut);
+	}
+}
+
+- (void)testCorruptedTail
+{
+	// Flip every byte of the last records in turn: a bad checksum, a bad length, or a bad payload.
+	// Replay must stop at the corrupt record, and drop everything after it.
+
+	srandom(422);
+
+	NSMutableArray *lengths = [NSMutableArray array];
+	NSMutableArray *states = [NSMutableArray array];
+
+	[self writeOperations:[self randomOperations:60] lengths:lengths states:states];
+
+	NSData *journal = [NSData dataWithContentsOfFile:path];
+	NSUInteger from = [lengths[[lengths count] - 6] unsignedIntegerValue];
+
+	for (NSUInteger offset = from; offset < [journal length]; offset++)
+	{
+		NSMutableData *corrupted = [journal mutableCopy];
+		((uint8_t *)[corrupted mutableBytes])[offset] ^= (uint8_t)(1 << (offset % 8));
+
+		[corrupted writeToFile:path atomically:NO];
+
+		NSUInteger index = [self indexOfLengths:lengths within:offset];
+
+		XCTAssertEqualObjects([self recoveredState], states[index], @"Corrupted at %lu", (unsigned long)offset);
+		XCTAssertEqual([self journalLength], [lengths[index] unsignedLongLongValue], @"Corrupted at %lu", (unsigned long)offset);
+	}
+}
+
+- (void)testCorruptedMiddle
+{
+	// A corrupt record in the middle of the journal also discards every record after it
+
+	srandom(522);
+
+	NSMutableArray *lengths = [NSMutableArray array];
+	NSMutableArray *states = [NSMutableArray array];
+
+	[self writeOperations:[self randomOperations:60] lengths:lengths states:states];
+
+	NSData *journal = [NSData dataWithContentsOfFile:path];
+
+	for (NSUInteger index = 0; (index + 1) < [lengths count]; index += 7)
+	{
+		NSUInteger start = [lengths[index] unsignedIntegerValue];
+		NSUInteger end = [lengths[index + 1] unsignedIntegerValue];
+
+		NSMutableData *corrupted = [journal mutableCopy];
+		((uint8_t *)[corrupted mutableBytes])[start + ((end - start) / 2)] ^= 0xFF;
+
+		[corrupted writeToFile:path atomically:NO];
+
+		XCTAssertEqualObjects([self recoveredState], states[index], @"Record %lu", (unsigned long)index);
+		XCTAssertEqual([self journalLength], (unsigned long long)start, @"Record %lu", (unsigned long)index);
+	}
+}
+
+- (void)testGarbageTail
+{
+	// Junk after the last record: zeros (as from a file extended but not written), random bytes,
+	// and a record header claiming more bytes than follow it.
+
+	srandom(622);
+
+	NSMutableArray *lengths = [NSMutableArray array];
+	NSMutableArray *states = [NSMutableArray array];
+
+	[self writeOperations:[self randomOperations:20] lengths:lengths states:states];
+
+	NSData *journal = [NSData dataWithContentsOfFile:path];
+
+	uint8_t noise[64];
+	for (NSUInteger i = 0; i < sizeof(noise); i++)
+	{
+		noise[i] = (uint8_t)random();
+	}
+
+	uint8_t header[] = { 0x00, 0x10, 0x00, 0x00, 0xDE, 0xAD, 0xBE, 0xEF, 0x06, 0x00, 0x00 };
+
+	NSArray *tails = @[
+		[NSMutableData dataWithLength:3],
+		[NSMutableData dataWithLength:4096],
+		[NSData dataWithBytes:noise length:sizeof(noise)],
+		[NSData dataWithBytes:header length:sizeof(header)]
+	];
+
+	for (NSData *tail in tails)
+	{
+		NSMutableData *data = [journal mutableCopy];
+		[data appendData:tail];
+
+		[data writeToFile:path atomically:NO];
+
+		XCTAssertEqualObjects([self recoveredState], [states lastObject]);
+		XCTAssertEqual([self journalLength], (unsigned long long)[journal length]);
+	}
+}
+
+- (void)testAppendAfterRecovery
+{
+	// The records written after a torn tail has been discarded must not end up behind it,
+	// where the next replay would discard them as well.
+
+	srandom(722);
+
+	NSArray *before = [self randomOperations:30];
+	NSArray *after = [self randomOperations:30];
+
+	NSMutableArray *lengths = [NSMutableArray array];
+	NSMutableArray *states = [NSMutableArray array];
+
+	[self writeOperations:before lengths:lengths states:states];
+
+	// Tear the last record
+
+	NSData *journal = [NSData dataWithContentsOfFile:path];
+	NSUInteger cut = [lengths[[lengths count] - 2] unsignedIntegerValue] + 5;
+
+	[[journal subdataWithRange:NSMakeRange(0, cut)] writeToFile:path atomically:NO];
+
+	XMPPStreamManagementMemoryStorage *model = [[XMPPStreamManagementMemoryStorage alloc] init];
+	for (NSUInteger i = 0; i < [before count] - 1; i++)
+	{
+		((XMPPJournalTestsOperation)before[i])(model);
+	}
+
+	@autoreleasepool {
+
+		XMPPStreamManagementFileStorage *storage = [self openStorage];
+		XCTAssertEqualObjects([self stateOfStorage:storage], [self stateOfStorage:model]);
+
+		for (XMPPJournalTestsOperation operation in after)
+		{
+			operation(storage);
+			operation(model);
+		}
+
+		[storage flush];
+	}
+
+	XCTAssertEqualObjects([self recoveredState], [self stateOfStorage:model]);
+}
+
+- (void)testUnrecognizedJournal
+{
+	// A file that isn't a journal (or is one from another version) is discarded, and replaced with an empty one
+
+	NSMutableData *wrongVersion = [NSMutableData data];
+	uint32_t wrongVersionHeader[] = { OSSwapHostToLittleInt32(JOURNAL_MAGIC), OSSwapHostToLittleInt32(JOURNAL_VERSION + 1) };
+	[wrongVersion appendBytes:wrongVersionHeader length:sizeof(wrongVersionHeader)];
+	[wrongVersion appendData:[NSMutableData dataWithLength:64]];
+
+	NSArray *files = @[
+		[NSData data],
+		[@"XSM" dataUsingEncoding:NSUTF8StringEncoding],
+		[@"<?xml version='1.0'?><stream/>" dataUsingEncoding:NSUTF8StringEncoding],
+		wrongVersion
+	];
+
+	for (NSData *file in files)
+	{
+		[file writeToFile:path atomically:NO];
+
+		XCTAssertEqualObjects([self recoveredState], [self emptyState]);
+		XCTAssertEqual([self journalLength], (unsigned long long)JOURNAL_HEADER_SIZE);
+	}
+
+	// The new journal works
+
+	srandom(822);
+
+	XMPPStreamManagementMemoryStorage *model = [[XMPPStreamManagementMemoryStorage alloc] init];
+
+	@autoreleasepool {
+
+		XMPPStreamManagementFileStorage *storage = [self openStorage];
+
+		for (XMPPJournalTestsOperation operation in [self randomOperations:50])
+		{
+			operation(storage);
+			operation(model);
+		}
+
+		[storage flush];
+	}
+
+	XCTAssertEqualObjects([self recoveredState], [self stateOfStorage:model]);
+}
+
+#pragma mark Compaction
+
+- (void)testCompaction
+{
+	srandom(922);
+
+	NSArray *operations = [self randomOperations:500];
+	XMPPStreamManagementMemoryStorage *model = [[XMPPStreamManagementMemoryStorage alloc] init];
+
+	@autoreleasepool {
+
+		XMPPStreamManagementFileStorage *storage = [self openStorage];
+
+		for (XMPPJournalTestsOperation operation in operations)
+		{
+			operation(storage);
+			operation(model);
+		}
+
+		[storage flush];
+		unsigned long long length = [self journalLength];
+
+		[storage compact];
+		XCTAssertLessThan([self journalLength], length);
+	}
+
+	NSDictionary *state = [self stateOfStorage:model];
+	XCTAssertEqualObjects([self recoveredState], state);
+
+	XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[path stringByAppendingString:@".tmp"]]);
+
+	// The snapshot is the only record, so a torn snapshot loses everything (but nothing else)
+
+	NSData *journal = [NSData dataWithContentsOfFile:path];
+
+	for (NSUInteger cut = JOURNAL_HEADER_SIZE; cut < [journal length]; cut += 7)
+	{
+		[[journal subdataWithRange:NSMakeRange(0, cut)] writeToFile:path atomically:NO];
+
+		XCTAssertEqualObjects([self recoveredState], [self emptyState], @"Cut at %lu", (unsigned long)cut);
+		XCTAssertEqual([self journalLength], (unsigned long long)JOURNAL_HEADER_SIZE);
+	}
+}
+
+- (void)testAutomaticCompaction
+{
+	srandom(1022);
+
+	XMPPStreamManagementMemoryStorage *model = [[XMPPStreamManagementMemoryStorage alloc] init];
+
+	@autoreleasepool {
+
+		XMPPStreamManagementFileStorage *storage = [self openStorage];
+		storage.compactionThreshold = 4096;
+
+		unsigned long long maxLength = 0;
+
+		for (XMPPJournalTestsOperation operation in [self randomOperations:3000])
+		{
+			operation(storage);
+			operation(model);
+
+			[storage flush];
+			maxLength = MAX(maxLength, [self journalLength]);
+		}
+
+		// Twice the size of the largest snapshot (a few hundred pending stanzas at most), plus a record
+		XCTAssertLessThan(maxLength, 64ULL * 1024);
+	}
+
+	XCTAssertEqualObjects([self recoveredState], [self stateOfStorage:model]);
+}
+
+- (void)testRemoveAll
+{
+	srandom(1122);
+
+	@autoreleasepool {
+
+		XMPPStreamManagementFileStorage *storage = [self openStorage];
+
+		for (XMPPJournalTestsOperation operation in [self randomOperations:200])
+		{
+			operation(storage);
+		}
+
+		[storage removeAllForStream:nil];
+		[storage flush];
+
+		XCTAssertEqualObjects([self stateOfStorage:storage], [self emptyState]);
+	}
+
+	XCTAssertEqualObjects([self recoveredState], [self emptyState]);
+}
+
+@end
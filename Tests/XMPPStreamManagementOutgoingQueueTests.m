@@ -0,0 +1,415 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStreamManagementStanzas.h"
+#import "XMPPStreamManagementMemoryStorage.h"
+#import "XMPPRandomOperations.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * XMPPStreamManagementOutgoingQueue keeps the unacked outgoing stanzas in a ring.
+ *
+ * These tests run the ring against an array model:
+ * through head wrap-around, growth (including growth while the contents wrap around the end of the ring),
+ * and the delta updates the memory storage applies to it.
+**/
+@interface XMPPStreamManagementOutgoingQueueTests : XCTestCase
+@end
+
+@implementation XMPPStreamManagementOutgoingQueueTests
+
+static NSUInteger stanzaCounter = 0;
+
+- (XMPPStreamManagementOutgoingStanza *)newStanza
+{
+	// A mix of stanzas with an id, and stanzas still waiting on the delegate for one
+
+	stanzaCounter++;
+
+	if (stanzaCounter % 5 == 0)
+		return [[XMPPStreamManagementOutgoingStanza alloc] initAwaitingStanzaId];
+	else
+		return [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:@(stanzaCounter)];
+}
+
+- (void)checkQueue:(XMPPStreamManagementOutgoingQueue *)queue againstModel:(NSArray *)model
+{
+	XCTAssertEqual(queue.count, [model count]);
+
+	if (queue.count != [model count]) return;
+
+	for (NSUInteger i = 0; i < [model count]; i++)
+	{
+		XCTAssertEqual([queue stanzaAtIndex:i], model[i], @"Index %lu", (unsigned long)i);
+	}
+
+	NSArray *stanzas = [queue stanzasCopyingItems:NO];
+
+	XCTAssertEqual([stanzas count], [model count]);
+	for (NSUInteger i = 0; i < MIN([stanzas count], [model count]); i++)
+	{
+		XCTAssertEqual(stanzas[i], model[i], @"Index %lu", (unsigned long)i);
+	}
+}
+
+- (void)addStanzaToQueue:(XMPPStreamManagementOutgoingQueue *)queue model:(NSMutableArray *)model
+{
+	XMPPStreamManagementOutgoingStanza *stanza = [self newStanza];
+
+	[queue addStanza:stanza];
+	[model addObject:stanza];
+}
+
+- (void)removeFirstStanzas:(NSUInteger)n fromQueue:(XMPPStreamManagementOutgoingQueue *)queue model:(NSMutableArray *)model
+{
+	[queue removeFirstStanzas:n];
+	[model removeObjectsInRange:NSMakeRange(0, MIN(n, [model count]))];
+}
+
+#pragma mark Tests
+
+- (void)testWrapsAround
+{
+	// A few pending stanzas at a time, so the ring never grows but its head wraps around many times
+
+	XMPPStreamManagementOutgoingQueue *queue = [[XMPPStreamManagementOutgoingQueue alloc] init];
+	NSMutableArray *model = [NSMutableArray array];
+
+	for (NSUInteger i = 0; i < 1000; i++)
+	{
+		[self addStanzaToQueue:queue model:model];
+
+		if ([model count] > 5)
+		{
+			[self removeFirstStanzas:(i % 3) fromQueue:queue model:model];
+		}
+
+		[self checkQueue:queue againstModel:model];
+	}
+}
+
+- (void)testGrowth
+{
+	XMPPStreamManagementOutgoingQueue *queue = [[XMPPStreamManagementOutgoingQueue alloc] init];
+	NSMutableArray *model = [NSMutableArray array];
+
+	for (NSUInteger i = 0; i < 5000; i++)
+	{
+		[self addStanzaToQueue:queue model:model];
+	}
+	[self checkQueue:queue againstModel:model];
+
+	[self removeFirstStanzas:4999 fromQueue:queue model:model];
+	[self checkQueue:queue againstModel:model];
+
+	[self addStanzaToQueue:queue model:model];
+	[self checkQueue:queue againstModel:model];
+}
+
+- (void)testGrowthWhileWrapped
+{
+	// Move the head most of the way around the ring (keeping one stanza pending, so it isn't reset),
+	// then keep adding until the contents wrap around the end of the ring, and it has to grow.
+
+	for (NSUInteger offset = 1; offset < OUTGOING_QUEUE_MIN_CAPACITY; offset++)
+	{
+		XMPPStreamManagementOutgoingQueue *queue = [[XMPPStreamManagementOutgoingQueue alloc] init];
+		NSMutableArray *model = [NSMutableArray array];
+
+		for (NSUInteger i = 0; i < offset + 1; i++)
+		{
+			[self addStanzaToQueue:queue model:model];
+		}
+		[self removeFirstStanzas:offset fromQueue:queue model:model];
+
+		for (NSUInteger i = 0; i < (OUTGOING_QUEUE_MIN_CAPACITY * 4) + 1; i++)
+		{
+			[self addStanzaToQueue:queue model:model];
+
+			if ([model count] >= OUTGOING_QUEUE_MIN_CAPACITY - 1)
+			{
+				[self checkQueue:queue againstModel:model];
+			}
+		}
+
+		[self removeFirstStanzas:offset fromQueue:queue model:model];
+		[self checkQueue:queue againstModel:model];
+	}
+}
+
+- (void)testInitWithStanzas
+{
+	NSArray *counts = @[ @0, @1, @(OUTGOING_QUEUE_MIN_CAPACITY), @(OUTGOING_QUEUE_MIN_CAPACITY + 1), @1000 ];
+
+	for (NSNumber *n in counts)
+	{
+		NSMutableArray *model = [NSMutableArray array];
+		for (NSUInteger i = 0; i < [n unsignedIntegerValue]; i++)
+		{
+			[model addObject:[self newStanza]];
+		}
+
+		XMPPStreamManagementOutgoingQueue *queue = [[XMPPStreamManagementOutgoingQueue alloc] initWithStanzas:model];
+		[self checkQueue:queue againstModel:model];
+
+		// It has to carry on from a full ring
+
+		for (NSUInteger i = 0; i < 3; i++)
+		{
+			[self addStanzaToQueue:queue model:model];
+		}
+		[self removeFirstStanzas:2 fromQueue:queue model:model];
+
+		[self checkQueue:queue againstModel:model];
+	}
+}
+
+- (void)testRandomOperations
+{
+	XMPPStreamManagementOutgoingQueue *queue = [[XMPPStreamManagementOutgoingQueue alloc] init];
+	NSMutableArray *model = [NSMutableArray array];
+
+	// Alternate between phases that mostly add (and grow the ring) and phases that mostly ack
+
+	XMPPRandomOperations *operations = [[XMPPRandomOperations alloc] init];
+	operations.phaseLength = 5000;
+
+	[operations addOperationWithPhaseWeights:@[ @9, @5 ] block:^{
+		[self addStanzaToQueue:queue model:model];
+	}];
+
+	[operations addOperationWithPhaseWeights:@[ @3, @7 ] block:^{
+
+		// An ack, which can (harmlessly) cover more than is pending
+
+		NSUInteger n = (NSUInteger)(random() % 4);
+		if (random() % 64 == 0) n = [model count] + 2;
+
+		[self removeFirstStanzas:n fromQueue:queue model:model];
+	}];
+
+	[operations addOperationWithWeight:2 block:^{
+
+		// The delegate handing back the stanzaId for a stanza
+
+		if ([model count] == 0) return;
+
+		NSUInteger index = (NSUInteger)(random() % [model count]);
+		XMPPStreamManagementOutgoingStanza *stanza = [self newStanza];
+
+		[queue replaceStanzaAtIndex:index withStanza:stanza];
+		model[index] = stanza;
+	}];
+
+	[operations addOperationWithWeight:2 block:^{
+
+		if ([model count] > 0 && (random() % 4) != 0)
+		{
+			NSUInteger index = (NSUInteger)(random() % [model count]);
+			XCTAssertEqual([queue indexOfStanza:model[index]], index);
+		}
+		else
+		{
+			XCTAssertEqual([queue indexOfStanza:[self newStanza]], (NSUInteger)NSNotFound);
+		}
+	}];
+
+	operations.checkInterval = 1000;
+	operations.checkBlock = ^{
+		[self checkQueue:queue againstModel:model];
+	};
+
+	[operations runWithSeed:21 iterations:50000];
+
+	[queue removeAllStanzas];
+	[model removeAllObjects];
+	[self checkQueue:queue againstModel:model];
+
+	// And it carries on after being emptied
+
+	[self addStanzaToQueue:queue model:model];
+	[self checkQueue:queue againstModel:model];
+}
+
+- (void)testIndexOfStanzaFindsIdentity
+{
+	// The lookup is by identity, not by stanzaId
+
+	XMPPStreamManagementOutgoingStanza *a = [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:@"same"];
+	XMPPStreamManagementOutgoingStanza *b = [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:@"same"];
+
+	XMPPStreamManagementOutgoingQueue *queue = [[XMPPStreamManagementOutgoingQueue alloc] init];
+	[queue addStanza:a];
+
+	XCTAssertEqual([queue indexOfStanza:a], (NSUInteger)0);
+	XCTAssertEqual([queue indexOfStanza:b], (NSUInteger)NSNotFound);
+
+	[queue removeFirstStanzas:1];
+	XCTAssertEqual([queue indexOfStanza:a], (NSUInteger)NSNotFound);
+}
+
+- (void)testStanzasCopyingItems
+{
+	XMPPStreamManagementOutgoingQueue *queue = [[XMPPStreamManagementOutgoingQueue alloc] init];
+	NSMutableArray *model = [NSMutableArray array];
+
+	// Wrapped around the end of the ring
+
+	for (NSUInteger i = 0; i < OUTGOING_QUEUE_MIN_CAPACITY; i++)
+	{
+		[self addStanzaToQueue:queue model:model];
+	}
+	[self removeFirstStanzas:10 fromQueue:queue model:model];
+	for (NSUInteger i = 0; i < 8; i++)
+	{
+		[self addStanzaToQueue:queue model:model];
+	}
+
+	NSArray *copies = [queue stanzasCopyingItems:YES];
+
+	XCTAssertEqual([copies count], [model count]);
+	for (NSUInteger i = 0; i < MIN([copies count], [model count]); i++)
+	{
+		XMPPStreamManagementOutgoingStanza *copy = copies[i];
+		XMPPStreamManagementOutgoingStanza *original = model[i];
+
+		XCTAssertNotEqual(copy, original);
+		XCTAssertEqualObjects(copy.stanzaId, original.stanzaId);
+		XCTAssertEqual(copy.awaitingStanzaId, original.awaitingStanzaId);
+	}
+
+	// The copies are detached from the queue
+
+	((XMPPStreamManagementOutgoingStanza *)copies[0]).stanzaId = @"changed";
+	XCTAssertNotEqualObjects([queue stanzaAtIndex:0].stanzaId, @"changed");
+
+	[self checkQueue:queue againstModel:model];
+}
+
+- (void)testReleasesStanzas
+{
+	__weak id weakRemoved = nil;
+	__weak id weakReplaced = nil;
+	__weak id weakPending = nil;
+
+	@autoreleasepool {
+
+		XMPPStreamManagementOutgoingQueue *queue = [[XMPPStreamManagementOutgoingQueue alloc] init];
+
+		XMPPStreamManagementOutgoingStanza *removed = [self newStanza];
+		XMPPStreamManagementOutgoingStanza *replaced = [self newStanza];
+		XMPPStreamManagementOutgoingStanza *pending = [self newStanza];
+
+		weakRemoved = removed;
+		weakReplaced = replaced;
+		weakPending = pending;
+
+		[queue addStanza:removed];
+		[queue addStanza:replaced];
+		[queue addStanza:pending];
+
+		removed = nil;
+		replaced = nil;
+		pending = nil;
+
+		[queue removeFirstStanzas:1];
+		[queue replaceStanzaAtIndex:0 withStanza:[self newStanza]];
+
+		XCTAssertNil(weakRemoved);
+		XCTAssertNil(weakReplaced);
+		XCTAssertNotNil(weakPending);
+	}
+
+	XCTAssertNil(weakPending);
+}
+
+#pragma mark Memory Storage
+
+- (void)testMemoryStorageDeltas
+{
+	// The delta updates must leave the storage with the same stanzas as a full snapshot would
+
+	XMPPStreamManagementMemoryStorage *storage = [[XMPPStreamManagementMemoryStorage alloc] init];
+	NSMutableArray *model = [NSMutableArray array];
+
+	__block uint32_t h = 0;
+	__block NSDate *lastDate = nil;
+
+	XMPPRandomOperations *operations = [[XMPPRandomOperations alloc] init];
+	__weak XMPPRandomOperations *weakOperations = operations;
+
+	NSDate * (^currentDate)(void) = ^{
+		return [NSDate dateWithTimeIntervalSinceReferenceDate:(NSTimeInterval)weakOperations.iteration];
+	};
+
+	[operations addOperationWithWeight:3 block:^{
+
+		XMPPStreamManagementOutgoingStanza *stanza = [self newStanza];
+		NSDate *date = currentDate();
+
+		[storage setLastDisconnect:date appendingPendingOutgoingStanza:stanza forStream:nil];
+		[model addObject:stanza];
+		lastDate = date;
+	}];
+
+	[operations addOperationWithWeight:2 block:^{
+
+		NSUInteger n = (NSUInteger)(random() % 3);
+		NSDate *date = currentDate();
+		h += (uint32_t)n;
+
+		[storage setLastDisconnect:date lastHandledByServer:h removingPendingOutgoingStanzas:n forStream:nil];
+		[model removeObjectsInRange:NSMakeRange(0, MIN(n, [model count]))];
+		lastDate = date;
+	}];
+
+	[operations addOperationWithWeight:2 block:^{
+
+		// Out of range replacements are ignored
+
+		NSUInteger index = (NSUInteger)(random() % ([model count] + 1));
+		XMPPStreamManagementOutgoingStanza *stanza = [self newStanza];
+
+		[storage replacePendingOutgoingStanzaAtIndex:index withStanza:stanza forStream:nil];
+		if (index < [model count]) {
+			model[index] = stanza;
+		}
+	}];
+
+	[operations addOperationWithWeight:1 block:^{
+
+		if (random() % 64 != 0) return;
+
+		// An occasional full snapshot, as after a resume
+
+		NSDate *date = currentDate();
+
+		[storage setLastDisconnect:date lastHandledByServer:h pendingOutgoingStanzas:model forStream:nil];
+		lastDate = date;
+	}];
+
+	operations.checkInterval = 500;
+	operations.checkBlock = ^{
+
+		uint32_t lastHandledByServer = 0;
+		NSArray *stanzas = nil;
+		NSDate *lastDisconnect = nil;
+
+		[storage getLastHandledByClient:NULL lastHandledByServer:&lastHandledByServer pendingOutgoingStanzas:&stanzas forStream:nil];
+		[storage getResumptionId:NULL timeout:NULL lastDisconnect:&lastDisconnect forStream:nil];
+
+		XCTAssertEqual(lastHandledByServer, h);
+		XCTAssertEqualObjects(lastDisconnect, lastDate);
+
+		XCTAssertEqual([stanzas count], [model count]);
+		for (NSUInteger j = 0; j < MIN([stanzas count], [model count]); j++)
+		{
+			XCTAssertEqual(stanzas[j], model[j], @"Index %lu", (unsigned long)j);
+		}
+	};
+
+	[operations runWithSeed:1021 iterations:20000];
+}
+
+@end
@@ -0,0 +1,441 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStreamManagement.h"
+#import "XMPPStreamManagementMemoryStorage.h"
+#import "XMPPStreamManagementStanzas.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * Records the XMPPStreamManagementDelegate callbacks.
+**/
+@interface XMPPStreamManagementTestsDelegate : NSObject
+@property (nonatomic, strong) NSMutableArray *ackedStanzaIds;
+@property (nonatomic, strong) NSMutableArray *failedToResumeStanzaIds;
+@property (nonatomic, assign) NSUInteger numberOfRequests;
+@property (nonatomic, assign) NSUInteger numberOfNotEnabled;
+@property (nonatomic, strong) NSMutableArray *adaptedRequestStanzaCounts;
+@property (nonatomic, strong) NSMutableArray *adaptedAckStanzaCounts;
+@end
+
+@implementation XMPPStreamManagementTestsDelegate
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		_ackedStanzaIds = [NSMutableArray array];
+		_failedToResumeStanzaIds = [NSMutableArray array];
+		_adaptedRequestStanzaCounts = [NSMutableArray array];
+		_adaptedAckStanzaCounts = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (void)xmppStreamManagement:(XMPPStreamManagement *)sender didReceiveAckForStanzaIds:(NSArray *)stanzaIds
+{
+	[self.ackedStanzaIds addObjectsFromArray:stanzaIds];
+}
+
+- (void)xmppStreamManagement:(XMPPStreamManagement *)sender didFailToResumeWithUnackedStanzaIds:(NSArray *)stanzaIds
+{
+	[self.failedToResumeStanzaIds addObjectsFromArray:stanzaIds];
+}
+
+- (void)xmppStreamManagement:(XMPPStreamManagement *)sender wasNotEnabled:(NSXMLElement *)failed
+{
+	self.numberOfNotEnabled++;
+}
+
+- (void)xmppStreamManagementDidRequestAck:(XMPPStreamManagement *)sender
+{
+	self.numberOfRequests++;
+}
+
+- (void)xmppStreamManagement:(XMPPStreamManagement *)sender
+    didAdaptAutoRequestStanzaCount:(NSUInteger)stanzaCount
+                           timeout:(NSTimeInterval)timeout
+                     roundTripTime:(NSTimeInterval)roundTripTime
+                        stanzaRate:(double)stanzaRate
+{
+	[self.adaptedRequestStanzaCounts addObject:@(stanzaCount)];
+}
+
+- (void)xmppStreamManagement:(XMPPStreamManagement *)sender
+    didAdaptAutoAckStanzaCount:(NSUInteger)stanzaCount
+                       timeout:(NSTimeInterval)timeout
+                    stanzaRate:(double)stanzaRate
+{
+	[self.adaptedAckStanzaCounts addObject:@(stanzaCount)];
+}
+
+@end
+
+/**
+ * These tests drive the module directly through its XMPPStream delegate methods (on its moduleQueue),
+ * as a stream would, without a connection.
+**/
+@interface XMPPStreamManagementTests : XCTestCase
+{
+	XMPPStream *stream;
+	XMPPStreamManagementMemoryStorage *storage;
+	XMPPStreamManagement *streamManagement;
+
+	dispatch_queue_t delegateQueue;
+	XMPPStreamManagementTestsDelegate *delegate;
+}
+@end
+
+@implementation XMPPStreamManagementTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	stream = [[XMPPStream alloc] init];
+	storage = [[XMPPStreamManagementMemoryStorage alloc] init];
+
+	streamManagement = [[XMPPStreamManagement alloc] initWithStorage:storage];
+	[streamManagement activate:stream];
+
+	delegateQueue = dispatch_queue_create("XMPPStreamManagementTests", NULL);
+	delegate = [[XMPPStreamManagementTestsDelegate alloc] init];
+
+	[streamManagement addDelegate:delegate delegateQueue:delegateQueue];
+}
+
+- (void)tearDown
+{
+	[streamManagement removeDelegate:delegate];
+	[streamManagement deactivate];
+
+	streamManagement = nil;
+	storage = nil;
+	stream = nil;
+
+	[super tearDown];
+}
+
+#pragma mark Utilities
+
+/**
+ * Runs the block on the moduleQueue, then waits for the delegate callbacks it caused.
+**/
+- (void)onModuleQueue:(dispatch_block_t)block
+{
+	dispatch_sync(streamManagement.moduleQueue, block);
+	dispatch_sync(delegateQueue, ^{});
+}
+
+- (id <XMPPStreamDelegate>)streamDelegate
+{
+	return (id <XMPPStreamDelegate>)streamManagement;
+}
+
+- (XMPPMessage *)messageWithID:(NSString *)elementID
+{
+	return [XMPPMessage messageWithType:@"chat" to:[XMPPJID jidWithString:@"alice@example.com"] elementID:elementID];
+}
+
+- (NSXMLElement *)elementWithName:(NSString *)name h:(NSString *)h
+{
+	NSXMLElement *element = [NSXMLElement elementWithName:name xmlns:@"urn:xmpp:sm:3"];
+	if (h) {
+		[element addAttributeWithName:@"h" stringValue:h];
+	}
+	return element;
+}
+
+/**
+ * Stores a previous session, with the given unacked stanzaIds, as left by a disconnect.
+**/
+- (void)storePreviousSessionWithLastHandledByServer:(uint32_t)h unackedStanzaIds:(NSArray *)stanzaIds
+{
+	NSMutableArray *stanzas = [NSMutableArray arrayWithCapacity:[stanzaIds count]];
+	for (id stanzaId in stanzaIds)
+	{
+		[stanzas addObject:[[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:stanzaId]];
+	}
+
+	[storage setResumptionId:@"previous" timeout:0 lastDisconnect:[NSDate date] forStream:stream];
+	[storage setLastDisconnect:[NSDate date]
+	       lastHandledByClient:0
+	       lastHandledByServer:h
+	    pendingOutgoingStanzas:stanzas
+	                 forStream:stream];
+}
+
+#pragma mark Replay
+
+- (void)testFailedResumeReplaysPreviousAndEarlyStanzas
+{
+	// The server handled one of the three stanzas left unacked by the previous session (h = 5 + 1).
+	// The stanza sent along with the stream header is never acked either, as stream management wasn't enabled.
+
+	[self storePreviousSessionWithLastHandledByServer:5 unackedStanzaIds:@[ @"a", @"b", @"c" ]];
+
+	[self onModuleQueue:^{
+
+		[streamManagement resetState];
+		[[self streamDelegate] xmppStream:stream didSendMessage:[self messageWithID:@"d"]];
+		[[self streamDelegate] xmppStream:stream didReceiveCustomElement:[self elementWithName:@"failed" h:@"6"]];
+	}];
+
+	XCTAssertEqualObjects(delegate.ackedStanzaIds, (@[ @"a" ]));
+	XCTAssertEqualObjects(delegate.failedToResumeStanzaIds, (@[ @"b", @"c", @"d" ]));
+	XCTAssertEqual(delegate.numberOfNotEnabled, (NSUInteger)1);
+
+	XCTAssertEqualObjects([streamManagement unackedStanzaIdsToReplay], (@[ @"b", @"c", @"d" ]));
+
+	// And only then is the storage cleared
+
+	NSString *resumptionId = nil;
+	NSArray *pending = nil;
+
+	[storage getResumptionId:&resumptionId timeout:NULL lastDisconnect:NULL forStream:stream];
+	[storage getLastHandledByClient:NULL lastHandledByServer:NULL pendingOutgoingStanzas:&pending forStream:stream];
+
+	XCTAssertNil(resumptionId);
+	XCTAssertEqual([pending count], (NSUInteger)0);
+}
+
+- (void)testFailedResumeWithoutH
+{
+	[self storePreviousSessionWithLastHandledByServer:5 unackedStanzaIds:@[ @"a", @"b" ]];
+
+	[self onModuleQueue:^{
+
+		[streamManagement resetState];
+		[[self streamDelegate] xmppStream:stream didReceiveCustomElement:[self elementWithName:@"failed" h:nil]];
+	}];
+
+	XCTAssertEqualObjects(delegate.ackedStanzaIds, (@[]));
+	XCTAssertEqualObjects(delegate.failedToResumeStanzaIds, (@[ @"a", @"b" ]));
+}
+
+- (void)testEnabledAfterFailedResume
+{
+	[self storePreviousSessionWithLastHandledByServer:7 unackedStanzaIds:@[ @"a", @"b", @"c", @"d" ]];
+
+	[self onModuleQueue:^{
+
+		[streamManagement resetState];
+		[[self streamDelegate] xmppStream:stream didReceiveCustomElement:[self elementWithName:@"enabled" h:@"9"]];
+	}];
+
+	XCTAssertEqualObjects(delegate.ackedStanzaIds, (@[ @"a", @"b" ]));
+	XCTAssertEqualObjects(delegate.failedToResumeStanzaIds, (@[ @"c", @"d" ]));
+	XCTAssertEqualObjects([streamManagement unackedStanzaIdsToReplay], (@[ @"c", @"d" ]));
+}
+
+- (void)testReplayCompletesWhenNotStarted
+{
+	[self storePreviousSessionWithLastHandledByServer:0 unackedStanzaIds:@[ @"a" ]];
+
+	[self onModuleQueue:^{
+
+		[streamManagement resetState];
+		[[self streamDelegate] xmppStream:stream didReceiveCustomElement:[self elementWithName:@"failed" h:nil]];
+	}];
+
+	XCTestExpectation *expectation = [self expectationWithDescription:@"completion"];
+
+	__block NSUInteger elementBlockCalls = 0;
+
+	[streamManagement replayUnackedStanzasWithElementBlock:^XMPPElement *(id stanzaId) {
+
+		elementBlockCalls++;
+		return nil;
+
+	} rewriteIds:NO completionQueue:delegateQueue stanzaCompletion:nil completion:^(NSUInteger numberOfSentStanzas, NSError *error) {
+
+		XCTAssertEqual(numberOfSentStanzas, (NSUInteger)0);
+		XCTAssertEqualObjects([error domain], XMPPStreamErrorDomain);
+		XCTAssertEqual([error code], (NSInteger)XMPPStreamInvalidState);
+
+		[expectation fulfill];
+	}];
+
+	[self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+	// Nothing was lost
+
+	XCTAssertEqual(elementBlockCalls, (NSUInteger)0);
+	XCTAssertEqualObjects([streamManagement unackedStanzaIdsToReplay], (@[ @"a" ]));
+}
+
+- (void)testReplayCompletesWithoutElementBlock
+{
+	XCTestExpectation *expectation = [self expectationWithDescription:@"completion"];
+
+	[streamManagement replayUnackedStanzasWithElementBlock:nil
+	                                            rewriteIds:NO
+	                                       completionQueue:delegateQueue
+	                                      stanzaCompletion:nil
+	                                            completion:^(NSUInteger numberOfSentStanzas, NSError *error) {
+
+		XCTAssertEqual([error code], (NSInteger)XMPPStreamInvalidParameter);
+		[expectation fulfill];
+	}];
+
+	[self waitForExpectationsWithTimeout:5.0 handler:nil];
+}
+
+- (void)testReplayCompletesAfterEveryStanza
+{
+	// Enabled, with nothing to replay but skipped stanzas: every stanzaCompletion, then the completion
+
+	[self storePreviousSessionWithLastHandledByServer:0 unackedStanzaIds:@[ @"a", @"b", @"c" ]];
+
+	[self onModuleQueue:^{
+
+		[streamManagement resetState];
+		[[self streamDelegate] xmppStream:stream didReceiveCustomElement:[self elementWithName:@"enabled" h:nil]];
+	}];
+
+	XCTestExpectation *expectation = [self expectationWithDescription:@"completion"];
+	NSMutableArray *outcomes = [NSMutableArray array];
+
+	[streamManagement replayUnackedStanzasWithElementBlock:^XMPPElement *(id stanzaId) {
+
+		return nil;
+
+	} rewriteIds:NO completionQueue:delegateQueue stanzaCompletion:^(id stanzaId, XMPPElement *element, BOOL sent) {
+
+		XCTAssertNil(element);
+		XCTAssertFalse(sent);
+		[outcomes addObject:stanzaId];
+
+	} completion:^(NSUInteger numberOfSentStanzas, NSError *error) {
+
+		XCTAssertNil(error);
+		XCTAssertEqual(numberOfSentStanzas, (NSUInteger)0);
+		XCTAssertEqualObjects(outcomes, (@[ @"a", @"b", @"c" ]));
+
+		[expectation fulfill];
+	}];
+
+	[self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+	// A second replay has nothing left to do, and still completes
+
+	XCTestExpectation *emptyExpectation = [self expectationWithDescription:@"empty completion"];
+
+	[streamManagement replayUnackedStanzasWithElementBlock:^XMPPElement *(id stanzaId) {
+
+		XCTFail(@"Nothing to replay");
+		return nil;
+
+	} rewriteIds:NO completionQueue:delegateQueue stanzaCompletion:nil completion:^(NSUInteger numberOfSentStanzas, NSError *error) {
+
+		XCTAssertNil(error);
+		XCTAssertEqual(numberOfSentStanzas, (NSUInteger)0);
+
+		[emptyExpectation fulfill];
+	}];
+
+	[self waitForExpectationsWithTimeout:5.0 handler:nil];
+}
+
+#pragma mark Adaptive Acks
+
+/**
+ * Sends the given number of messages, in a burst.
+**/
+- (void)sendMessages:(NSUInteger)count
+{
+	[self onModuleQueue:^{
+
+		for (NSUInteger i = 0; i < count; i++)
+		{
+			[[self streamDelegate] xmppStream:stream didSendMessage:[self messageWithID:[[NSUUID UUID] UUIDString]]];
+		}
+	}];
+}
+
+- (NSUInteger)autoRequestStanzaCount
+{
+	NSUInteger stanzaCount = 0;
+	[streamManagement getAutomaticallyRequestAcksAfterStanzaCount:&stanzaCount orTimeout:NULL];
+
+	return stanzaCount;
+}
+
+- (void)testAdaptiveAckRequestInterval
+{
+	[self onModuleQueue:^{
+
+		[streamManagement resetState];
+		[[self streamDelegate] xmppStream:stream didReceiveCustomElement:[self elementWithName:@"enabled" h:nil]];
+
+		[streamManagement automaticallyAdaptAcksWithMaxStanzasAtRisk:100 maxAckOverhead:10.0];
+	}];
+
+	// Nothing measured yet: nothing is sent during a round trip, so the whole budget goes to the interval.
+	// Acks are sent every 10 stanzas (10% overhead).
+
+	XCTAssertEqual([self autoRequestStanzaCount], (NSUInteger)100);
+	XCTAssertEqualObjects(delegate.adaptedRequestStanzaCounts, (@[ @100 ]));
+	XCTAssertEqualObjects(delegate.adaptedAckStanzaCounts, (@[ @10 ]));
+
+	// A burst of 100 stanzas: the 100th forces a request.
+	// At ~20 stanzas per second, ~20 are sent during the (assumed) 1 second round trip,
+	// so the interval shrinks to keep them within the budget.
+
+	[self sendMessages:100];
+
+	XCTAssertEqual([delegate.adaptedRequestStanzaCounts count], (NSUInteger)2);
+
+	NSUInteger afterBurst = [self autoRequestStanzaCount];
+	XCTAssertLessThan(afterBurst, (NSUInteger)90);
+	XCTAssertGreaterThan(afterBurst, (NSUInteger)70);
+
+	// The ack arrives right away: the measured round trip is short, and the interval grows back.
+
+	[self onModuleQueue:^{
+		[[self streamDelegate] xmppStream:stream didReceiveCustomElement:[self elementWithName:@"a" h:@"100"]];
+	}];
+
+	NSTimeInterval fastRoundTripTime = streamManagement.roundTripTime;
+	XCTAssertGreaterThan(fastRoundTripTime, 0.0);
+	XCTAssertLessThan(fastRoundTripTime, 0.5);
+
+	NSUInteger afterFastAck = [self autoRequestStanzaCount];
+	XCTAssertGreaterThan(afterFastAck, afterBurst);
+	XCTAssertEqual([delegate.ackedStanzaIds count], (NSUInteger)100);
+
+	// The next ack is late: while the request is outstanding, the interval backs off,
+	// before any new round trip has been measured.
+
+	[self sendMessages:50];
+	[self onModuleQueue:^{
+		[streamManagement requestAck];
+	}];
+
+	[NSThread sleepForTimeInterval:1.0];
+
+	[self onModuleQueue:^{
+		[streamManagement requestAck];
+	}];
+
+	NSUInteger whileAwaitingAck = [self autoRequestStanzaCount];
+	XCTAssertLessThan(whileAwaitingAck, afterFastAck);
+	XCTAssertEqual(streamManagement.roundTripTime, fastRoundTripTime);
+
+	// When it finally arrives, the slow sample raises the (smoothed) round trip time,
+	// but the interval grows again, as the request is no longer outstanding.
+
+	[self onModuleQueue:^{
+		[[self streamDelegate] xmppStream:stream didReceiveCustomElement:[self elementWithName:@"a" h:@"150"]];
+	}];
+
+	XCTAssertGreaterThan(streamManagement.roundTripTime, fastRoundTripTime);
+	XCTAssertGreaterThan([self autoRequestStanzaCount], whileAwaitingAck);
+	XCTAssertEqual([delegate.ackedStanzaIds count], (NSUInteger)150);
+
+	// The ack configuration only depends on the overhead target here
+	XCTAssertEqualObjects(delegate.adaptedAckStanzaCounts, (@[ @10 ]));
+}
+
+@end
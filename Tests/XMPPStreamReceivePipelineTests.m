@@ -0,0 +1,171 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStream+Tests.h"
+#import "XMPPMessage.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * Records the bodies of the received messages.
+**/
+@interface XMPPStreamReceivePipelineTestsDelegate : NSObject
+@property (nonatomic, strong) NSMutableArray *bodies;
+@end
+
+@implementation XMPPStreamReceivePipelineTestsDelegate
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		_bodies = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (void)xmppStream:(XMPPStream *)sender didReceiveMessage:(XMPPMessage *)message
+{
+	[self.bodies addObject:[message body]];
+}
+
+@end
+
+/**
+ * The parser runs on a queue of our own, which is suspended to keep the parser busy,
+ * so the received chunks pile up in the pipeline.
+**/
+@interface XMPPStreamReceivePipelineTests : XCTestCase
+{
+	XMPPStream *stream;
+	dispatch_queue_t parserQueue;
+
+	dispatch_queue_t delegateQueue;
+	XMPPStreamReceivePipelineTestsDelegate *delegate;
+}
+@end
+
+@implementation XMPPStreamReceivePipelineTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	stream = [[XMPPStream alloc] init];
+	[stream enterConnectedStateForTesting];
+
+	delegateQueue = dispatch_queue_create("XMPPStreamReceivePipelineTests", NULL);
+	delegate = [[XMPPStreamReceivePipelineTestsDelegate alloc] init];
+
+	[stream addDelegate:delegate delegateQueue:delegateQueue];
+
+	parserQueue = dispatch_queue_create("XMPPStreamReceivePipelineTests.parser", NULL);
+	[stream openParserForTestingWithParserQueue:parserQueue];
+}
+
+- (void)tearDown
+{
+	[stream removeDelegate:delegate];
+	[stream disconnectForTesting];
+
+	stream = nil;
+
+	[super tearDown];
+}
+
+- (void)receiveString:(NSString *)string
+{
+	[stream receiveDataForTesting:[string dataUsingEncoding:NSUTF8StringEncoding]];
+}
+
+/**
+ * Lets the parser catch up with everything received so far, and waits for the resulting delegate callbacks.
+**/
+- (NSArray *)resumeParser
+{
+	dispatch_resume(parserQueue);
+
+	dispatch_sync(parserQueue, ^{});
+	[stream waitForXMPPQueue];
+
+	__block NSArray *result = nil;
+	dispatch_sync(delegateQueue, ^{
+		result = [delegate.bodies copy];
+	});
+	return result;
+}
+
+- (void)testStopAndWait
+{
+	XCTAssertEqual(stream.receivePipelineDepth, (NSUInteger)1);
+	XCTAssertTrue([stream isReadingForTesting]);
+
+	dispatch_suspend(parserQueue);
+
+	// With a depth of 1, the next read waits for the parser
+
+	[self receiveString:@"<message><body>1</body></message>"];
+
+	XCTAssertEqual([stream numberOfPendingParseChunksForTesting], (NSUInteger)1);
+	XCTAssertFalse([stream isReadingForTesting]);
+
+	XCTAssertEqualObjects([self resumeParser], (@[ @"1" ]));
+
+	XCTAssertEqual([stream numberOfPendingParseChunksForTesting], (NSUInteger)0);
+	XCTAssertTrue([stream isReadingForTesting]);
+}
+
+- (void)testPipelinedReads
+{
+	stream.receivePipelineDepth = 3;
+
+	dispatch_suspend(parserQueue);
+
+	// The socket keeps reading while the parser is busy, until 3 chunks are waiting.
+	// Stanzas may straddle chunks.
+
+	[self receiveString:@"<message><body>1</body></message><message><bo"];
+	XCTAssertEqual([stream numberOfPendingParseChunksForTesting], (NSUInteger)1);
+	XCTAssertTrue([stream isReadingForTesting]);
+
+	[self receiveString:@"dy>2</body></message>"];
+	XCTAssertEqual([stream numberOfPendingParseChunksForTesting], (NSUInteger)2);
+	XCTAssertTrue([stream isReadingForTesting]);
+
+	[self receiveString:@"<message><body>3</body></message>"];
+	XCTAssertEqual([stream numberOfPendingParseChunksForTesting], (NSUInteger)3);
+	XCTAssertFalse([stream isReadingForTesting]);
+
+	// Once the parser catches up, everything arrives in order, and reading resumes
+
+	XCTAssertEqualObjects([self resumeParser], (@[ @"1", @"2", @"3" ]));
+
+	XCTAssertEqual([stream numberOfPendingParseChunksForTesting], (NSUInteger)0);
+	XCTAssertTrue([stream isReadingForTesting]);
+}
+
+- (void)testGrowingDepthResumesReading
+{
+	dispatch_suspend(parserQueue);
+
+	[self receiveString:@"<message><body>1</body></message>"];
+	XCTAssertFalse([stream isReadingForTesting]);
+
+	// The pipeline has room again, without waiting for the parser
+
+	stream.receivePipelineDepth = 2;
+	XCTAssertTrue([stream isReadingForTesting]);
+
+	[self receiveString:@"<message><body>2</body></message>"];
+	XCTAssertEqual([stream numberOfPendingParseChunksForTesting], (NSUInteger)2);
+	XCTAssertFalse([stream isReadingForTesting]);
+
+	XCTAssertEqualObjects([self resumeParser], (@[ @"1", @"2" ]));
+
+	// Values less than 1 are treated as 1
+
+	stream.receivePipelineDepth = 0;
+	XCTAssertEqual(stream.receivePipelineDepth, (NSUInteger)1);
+}
+
+@end
@@ -0,0 +1,205 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStream+Tests.h"
+#import "XMPPIQ.h"
+#import "XMPPMessage.h"
+#import "XMPPPresence.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * Records the elementIDs of the sent (and failed) stanzas, in the order the delegate methods are invoked.
+**/
+@interface XMPPStreamSendQueueTestsDelegate : NSObject
+@property (nonatomic, strong) NSMutableArray *sentIDs;
+@property (nonatomic, strong) NSMutableArray *failedIDs;
+@end
+
+@implementation XMPPStreamSendQueueTestsDelegate
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		_sentIDs = [NSMutableArray array];
+		_failedIDs = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (void)xmppStream:(XMPPStream *)sender didSendIQ:(XMPPIQ *)iq
+{
+	[self.sentIDs addObject:[iq elementID]];
+}
+
+- (void)xmppStream:(XMPPStream *)sender didSendMessage:(XMPPMessage *)message
+{
+	[self.sentIDs addObject:[message elementID]];
+}
+
+- (void)xmppStream:(XMPPStream *)sender didSendPresence:(XMPPPresence *)presence
+{
+	[self.sentIDs addObject:[presence elementID]];
+}
+
+- (void)xmppStream:(XMPPStream *)sender didFailToSendMessage:(XMPPMessage *)message error:(NSError *)error
+{
+	[self.failedIDs addObject:[message elementID]];
+}
+
+@end
+
+/**
+ * With a send window of a single write, every stanza sent while a write is in flight is queued.
+**/
+@interface XMPPStreamSendQueueTests : XCTestCase
+{
+	XMPPStream *stream;
+
+	dispatch_queue_t delegateQueue;
+	XMPPStreamSendQueueTestsDelegate *delegate;
+}
+@end
+
+@implementation XMPPStreamSendQueueTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	stream = [[XMPPStream alloc] init];
+	[stream enterConnectedStateForTesting];
+
+	stream.sendWindowSize = 1;
+
+	delegateQueue = dispatch_queue_create("XMPPStreamSendQueueTests", NULL);
+	delegate = [[XMPPStreamSendQueueTestsDelegate alloc] init];
+
+	[stream addDelegate:delegate delegateQueue:delegateQueue];
+}
+
+- (void)tearDown
+{
+	[stream removeDelegate:delegate];
+	[stream waitForXMPPQueue];
+
+	stream = nil;
+
+	[super tearDown];
+}
+
+- (NSArray *)sentIDs
+{
+	[stream waitForXMPPQueue];
+
+	__block NSArray *result = nil;
+	dispatch_sync(delegateQueue, ^{
+		result = [delegate.sentIDs copy];
+	});
+	return result;
+}
+
+- (void)sendMessageWithID:(NSString *)elementID
+{
+	[stream sendElement:[XMPPMessage messageWithType:@"chat" to:[XMPPJID jidWithString:@"alice@example.com"] elementID:elementID]];
+}
+
+- (void)sendPresenceWithID:(NSString *)elementID
+{
+	XMPPPresence *presence = [XMPPPresence presenceWithType:@"subscribe" to:[XMPPJID jidWithString:@"alice@example.com"]];
+	[presence addAttributeWithName:@"id" stringValue:elementID];
+
+	[stream sendElement:presence];
+}
+
+- (void)sendIQWithID:(NSString *)elementID
+{
+	[stream sendElement:[XMPPIQ iqWithType:@"get" elementID:elementID child:[NSXMLElement elementWithName:@"ping" xmlns:@"urn:xmpp:ping"]]];
+}
+
+- (void)testHigherClassesOvertakeQueuedStanzas
+{
+	[self sendMessageWithID:@"m1"];   // In flight
+	[self sendPresenceWithID:@"p1"];
+	[self sendMessageWithID:@"m2"];
+	[self sendIQWithID:@"i1"];
+	[self sendMessageWithID:@"m3"];
+
+	// Queued stanzas aren't reported as sent
+
+	XCTAssertEqualObjects([self sentIDs], (@[ @"m1" ]));
+
+	XCTAssertEqual([stream numberOfQueuedStanzasForPriority:XMPPSendPriorityIQ], (NSUInteger)1);
+	XCTAssertEqual([stream numberOfQueuedStanzasForPriority:XMPPSendPriorityMessage], (NSUInteger)2);
+	XCTAssertEqual([stream numberOfQueuedStanzasForPriority:XMPPSendPriorityPresence], (NSUInteger)1);
+
+	// Each completed write lets the next queued stanza through: by class, then in send order
+
+	[stream completeWriteForTesting];
+	XCTAssertEqualObjects([self sentIDs], (@[ @"m1", @"i1" ]));
+
+	[stream completeWriteForTesting];
+	[stream completeWriteForTesting];
+	[stream completeWriteForTesting];
+	XCTAssertEqualObjects([self sentIDs], (@[ @"m1", @"i1", @"m2", @"m3", @"p1" ]));
+
+	XCTAssertEqual([stream numberOfQueuedBytesForPriority:XMPPSendPriorityMessage], (NSUInteger)0);
+
+	[stream completeWriteForTesting];
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+}
+
+- (void)testBulkStanzasGoLast
+{
+	stream.bulkStanzaThreshold = 512;
+
+	NSXMLElement *body = [NSXMLElement elementWithName:@"body" stringValue:[@"" stringByPaddingToLength:1024
+	                                                                                         withString:@"x"
+	                                                                                    startingAtIndex:0]];
+
+	[self sendMessageWithID:@"m1"];   // In flight
+	[stream sendElement:[XMPPMessage messageWithType:@"chat" elementID:@"bulk" child:body]];
+	[self sendPresenceWithID:@"p1"];
+
+	XCTAssertEqual([stream numberOfQueuedStanzasForPriority:XMPPSendPriorityBulk], (NSUInteger)1);
+
+	[stream completeWriteForTesting];
+	[stream completeWriteForTesting];
+	XCTAssertEqualObjects([self sentIDs], (@[ @"m1", @"p1", @"bulk" ]));
+}
+
+- (void)testQueuedStanzasFailOnDisconnect
+{
+	[self sendMessageWithID:@"m1"];   // In flight
+	[self sendMessageWithID:@"m2"];
+	[self sendMessageWithID:@"m3"];
+
+	[stream disconnectForTesting];
+
+	XCTAssertEqualObjects([self sentIDs], (@[ @"m1" ]));
+
+	__block NSArray *failedIDs = nil;
+	dispatch_sync(delegateQueue, ^{
+		failedIDs = [delegate.failedIDs copy];
+	});
+
+	XCTAssertEqualObjects(failedIDs, (@[ @"m2", @"m3" ]));
+	XCTAssertEqual(stream.numberOfUnsentBytes, (NSUInteger)0);
+}
+
+- (void)testWindowSizeChangePumpsQueue
+{
+	[self sendMessageWithID:@"m1"];
+	[self sendMessageWithID:@"m2"];
+	[self sendMessageWithID:@"m3"];
+
+	XCTAssertEqualObjects([self sentIDs], (@[ @"m1" ]));
+
+	stream.sendWindowSize = 64 * 1024;
+
+	XCTAssertEqualObjects([self sentIDs], (@[ @"m1", @"m2", @"m3" ]));
+	XCTAssertEqual(stream.sendWindowSize, (NSUInteger)(64 * 1024));
+}
+
+@end
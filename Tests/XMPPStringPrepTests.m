@@ -0,0 +1,163 @@
+#import <XCTest/XCTest.h>
+#import "XMPPStringPrep.h"
+#import "stringprep.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * XMPPStringPrep handles plain ASCII strings itself, and hands everything else to libidn.
+ *
+ * These tests check both routes:
+ * - against a corpus of expected results (Resources/XMPPStringPrepCorpus.json, see Tools/stringprep_corpus.py),
+ *   covering case folding, compatibility mappings, prohibited code points and the bidi rules
+ * - against libidn itself, for every ASCII string of up to two characters, and for random ASCII strings
+**/
+@interface XMPPStringPrepTests : XCTestCase
+@end
+
+@implementation XMPPStringPrepTests
+
+static NSString *XMPPStringPrepTestsEscape(NSString *string)
+{
+	NSMutableString *result = [NSMutableString stringWithCapacity:[string length]];
+
+	for (NSUInteger i = 0; i < [string length]; i++)
+	{
+		unichar c = [string characterAtIndex:i];
+
+		if (c >= 0x20 && c < 0x7F)
+			[result appendFormat:@"%C", c];
+		else
+			[result appendFormat:@"\\u%04X", c];
+	}
+
+	return result;
+}
+
+/**
+ * Runs the given libidn profile directly, the same way XMPPStringPrep does.
+**/
+static NSString *XMPPStringPrepTestsLibidn(NSString *string, const Stringprep_profile *profile)
+{
+	char buf[1024];
+
+	strncpy(buf, [string UTF8String], sizeof(buf));
+
+	if (stringprep(buf, sizeof(buf), 0, profile) != 0) return nil;
+
+	return [NSString stringWithUTF8String:buf];
+}
+
+- (NSString *)prep:(NSString *)string profile:(NSString *)profile
+{
+	if ([profile isEqualToString:@"nodeprep"])
+		return [XMPPStringPrep prepNode:string];
+	else if ([profile isEqualToString:@"resourceprep"])
+		return [XMPPStringPrep prepResource:string];
+	else if ([profile isEqualToString:@"nameprep"])
+		return [XMPPStringPrep prepDomain:string];
+
+	XCTFail(@"Unknown profile: %@", profile);
+	return nil;
+}
+
+- (void)testCorpus
+{
+	NSString *corpusPath = [[NSBundle bundleForClass:[self class]] pathForResource:@"XMPPStringPrepCorpus" ofType:@"json"];
+	NSData *corpusData = [NSData dataWithContentsOfFile:corpusPath];
+	XCTAssertNotNil(corpusData, @"Missing corpus");
+
+	NSError *error = nil;
+	NSArray *corpus = [NSJSONSerialization JSONObjectWithData:corpusData options:0 error:&error];
+	XCTAssertNotNil(corpus, @"Invalid corpus: %@", error);
+	XCTAssertGreaterThan([corpus count], (NSUInteger)0);
+
+	for (NSDictionary *entry in corpus)
+	{
+		NSString *profile = entry[@"profile"];
+		NSString *input = entry[@"input"];
+		id output = entry[@"output"];
+
+		NSString *expected = (output == [NSNull null]) ? nil : output;
+		NSString *result = [self prep:input profile:profile];
+
+		XCTAssertEqualObjects(result, expected, @"%@ of \"%@\"", profile, XMPPStringPrepTestsEscape(input));
+	}
+}
+
+- (void)checkASCIIString:(NSString *)string
+{
+	XCTAssertEqualObjects([XMPPStringPrep prepNode:string],
+	                      XMPPStringPrepTestsLibidn(string, stringprep_xmpp_nodeprep),
+	                      @"nodeprep of \"%@\"", XMPPStringPrepTestsEscape(string));
+
+	XCTAssertEqualObjects([XMPPStringPrep prepResource:string],
+	                      XMPPStringPrepTestsLibidn(string, stringprep_xmpp_resourceprep),
+	                      @"resourceprep of \"%@\"", XMPPStringPrepTestsEscape(string));
+
+	XCTAssertEqualObjects([XMPPStringPrep prepDomain:string],
+	                      XMPPStringPrepTestsLibidn(string, stringprep_nameprep),
+	                      @"nameprep of \"%@\"", XMPPStringPrepTestsEscape(string));
+}
+
+- (void)testASCIIMatchesLibidn
+{
+	// Every string of one or two ASCII characters (NUL aside, as it truncates the UTF8String)
+
+	for (unichar c1 = 0x01; c1 < 0x80; c1++)
+	{
+		[self checkASCIIString:[NSString stringWithCharacters:&c1 length:1]];
+
+		for (unichar c2 = 0x01; c2 < 0x80; c2++)
+		{
+			unichar chars[2] = { c1, c2 };
+			[self checkASCIIString:[NSString stringWithCharacters:chars length:2]];
+		}
+	}
+}
+
+- (void)testRandomASCIIMatchesLibidn
+{
+	// Random strings, across the 8 byte words of the fast path.
+	// Mostly letters (to exercise case folding), with the occasional symbol, space or control character.
+
+	const char *alphabet = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-._";
+	const char *specials = " \"&'/:<>@\t\x7F";
+
+	srandom(6122);
+
+	for (int i = 0; i < 20000; i++)
+	{
+		NSUInteger length = 1 + (random() % 64);
+		unichar chars[64];
+
+		for (NSUInteger j = 0; j < length; j++)
+		{
+			if (random() % 32 == 0)
+				chars[j] = (unichar)specials[random() % strlen(specials)];
+			else
+				chars[j] = (unichar)alphabet[random() % strlen(alphabet)];
+		}
+
+		[self checkASCIIString:[NSString stringWithCharacters:chars length:length]];
+	}
+}
+
+- (void)testMaximumLength
+{
+	NSString *longest = [@"" stringByPaddingToLength:1023 withString:@"aB" startingAtIndex:0];
+	[self checkASCIIString:longest];
+
+	XCTAssertEqual([[XMPPStringPrep prepNode:longest] length], (NSUInteger)1023);
+}
+
+- (void)testNil
+{
+	XCTAssertNil([XMPPStringPrep prepNode:nil]);
+	XCTAssertNil([XMPPStringPrep prepDomain:nil]);
+	XCTAssertNil([XMPPStringPrep prepResource:nil]);
+}
+
+@end
@@ -0,0 +1,373 @@
+#import <XCTest/XCTest.h>
+#import "XMPPTimer.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+@interface XMPPTimingWheel (Testing)
+- (uint64_t)monotonicTime;
+@end
+
+/**
+ * A timing wheel driven by a virtual clock.
+ *
+ * The wheel's dispatch_source still ticks in real time (every tickInterval),
+ * but each tick only processes the ticks up to the virtual time.
+**/
+@interface XMPPTestTimingWheel : XMPPTimingWheel
+@property (atomic, assign) uint64_t virtualTime;
+@end
+
+@implementation XMPPTestTimingWheel
+
+- (uint64_t)monotonicTime
+{
+	return self.virtualTime;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define TICK_MS          1
+#define NSEC_PER_TICK    (TICK_MS * NSEC_PER_MSEC)
+#define LEVEL0_RANGE_MS  (256 * TICK_MS)
+#define WHEEL_RANGE_MS   (256 * 64 * TICK_MS)
+
+@interface XMPPTimingWheelTests : XCTestCase
+{
+	XMPPTestTimingWheel *wheel;
+	dispatch_queue_t firedQueue;
+	NSMutableArray *fired;      // Of the scheduled numbers, in firing order
+	NSMutableArray *firedTimes; // The virtual time (in ms) at which each of them fired
+}
+@end
+
+@implementation XMPPTimingWheelTests
+
+- (void)setUp
+{
+	[super setUp];
+
+	wheel = [[XMPPTestTimingWheel alloc] initWithTickInterval:(TICK_MS / 1000.0)];
+	firedQueue = dispatch_queue_create("XMPPTimingWheelTests.fired", NULL);
+	fired = [[NSMutableArray alloc] init];
+	firedTimes = [[NSMutableArray alloc] init];
+}
+
+- (void)tearDown
+{
+	wheel = nil;
+
+	[super tearDown];
+}
+
+- (id)schedule:(NSUInteger)number afterMilliseconds:(uint64_t)delay
+{
+	__weak XMPPTestTimingWheel *weakWheel = wheel;
+
+	return [wheel scheduleBlock:^{
+
+		[fired addObject:@(number)];
+		[firedTimes addObject:@(weakWheel.virtualTime / NSEC_PER_MSEC)];
+
+	} onQueue:firedQueue afterDelay:(delay / 1000.0)];
+}
+
+- (void)setTime:(uint64_t)milliseconds
+{
+	wheel.virtualTime = milliseconds * NSEC_PER_MSEC;
+}
+
+- (NSArray *)fired
+{
+	__block NSArray *result;
+	dispatch_sync(firedQueue, ^{
+		result = [fired copy];
+	});
+	return result;
+}
+
+/**
+ * Waits until (at least) the given number of blocks have fired, or a few seconds have passed.
+ * Then waits a little longer, so that any block firing too early shows up.
+**/
+- (NSArray *)waitForFiredCount:(NSUInteger)count
+{
+	NSDate *limit = [NSDate dateWithTimeIntervalSinceNow:5.0];
+
+	while ([[self fired] count] < count && [limit timeIntervalSinceNow] > 0)
+	{
+		usleep(1000);
+	}
+
+	usleep(20 * 1000);
+	return [self fired];
+}
+
+/**
+ * Returns the tick at which the wheel considers a block with the given delay (scheduled at time zero) due.
+**/
+static uint64_t XMPPTimingWheelTestsDeadline(uint64_t delay)
+{
+	uint64_t nanoseconds = (uint64_t)((delay / 1000.0) * NSEC_PER_SEC);
+	uint64_t tick = (nanoseconds + NSEC_PER_TICK - 1) / NSEC_PER_TICK;
+
+	return MAX(tick, 1);
+}
+
+- (void)testFiresAtDeadlineOnEveryLevel
+{
+	uint64_t level0 = 5;
+	uint64_t level1 = 300;                  // Cascades down from the second level
+	uint64_t overflow = WHEEL_RANGE_MS + 3000; // Beyond the range of the wheel
+
+	[self schedule:0 afterMilliseconds:level0];
+	[self schedule:1 afterMilliseconds:level1];
+	[self schedule:2 afterMilliseconds:overflow];
+
+	level0 = XMPPTimingWheelTestsDeadline(level0);
+	level1 = XMPPTimingWheelTestsDeadline(level1);
+	overflow = XMPPTimingWheelTestsDeadline(overflow);
+
+	usleep(20 * 1000);
+
+	[self setTime:level0 - 1];
+	XCTAssertEqualObjects([self waitForFiredCount:0], @[]);
+
+	[self setTime:level0];
+	XCTAssertEqualObjects([self waitForFiredCount:1], @[@0]);
+
+	[self setTime:level1 - 1];
+	XCTAssertEqualObjects([self waitForFiredCount:1], @[@0]);
+
+	[self setTime:level1];
+	XCTAssertEqualObjects([self waitForFiredCount:2], (@[@0, @1]));
+
+	[self setTime:overflow - 1];
+	XCTAssertEqualObjects([self waitForFiredCount:2], (@[@0, @1]));
+
+	[self setTime:overflow];
+	XCTAssertEqualObjects([self waitForFiredCount:3], (@[@0, @1, @2]));
+}
+
+- (void)testLevelBoundaries
+{
+	// Deadlines right around the boundaries between the levels
+
+	uint64_t delays[] = {
+		1, LEVEL0_RANGE_MS - 1, LEVEL0_RANGE_MS, LEVEL0_RANGE_MS + 1,
+		2 * LEVEL0_RANGE_MS - 1, 2 * LEVEL0_RANGE_MS,
+		WHEEL_RANGE_MS - 1, WHEEL_RANGE_MS, WHEEL_RANGE_MS + 1, 2 * WHEEL_RANGE_MS + 7,
+	};
+	NSUInteger count = sizeof(delays) / sizeof(delays[0]);
+
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		[self schedule:i afterMilliseconds:delays[i]];
+	}
+
+	usleep(20 * 1000);
+
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		uint64_t deadline = XMPPTimingWheelTestsDeadline(delays[i]);
+
+		[self setTime:deadline - 1];
+		XCTAssertEqual([[self waitForFiredCount:i] count], i, @"delay %llu fired early", delays[i]);
+
+		[self setTime:deadline];
+		XCTAssertEqual([[self waitForFiredCount:i + 1] count], i + 1, @"delay %llu didn't fire", delays[i]);
+	}
+}
+
+- (void)testRandomDeadlinesAndCancellations
+{
+	// Random deadlines, spread over more than two rotations of the second level (and thus of the overflow),
+	// every third of them cancelled. Time advances in steps, and after each step, every due block must have fired.
+
+	const NSUInteger count = 2000;
+	const uint64_t step = 53;
+
+	uint64_t deadlines[count];
+	NSMutableArray *tokens = [NSMutableArray arrayWithCapacity:count];
+	NSMutableSet *expected = [NSMutableSet set];
+
+	srandom(11);
+
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		uint64_t delay = (uint64_t)(random() % (2 * WHEEL_RANGE_MS + 5000));
+
+		deadlines[i] = XMPPTimingWheelTestsDeadline(delay);
+		[tokens addObject:[self schedule:i afterMilliseconds:delay]];
+	}
+
+	for (NSUInteger i = 0; i < count; i += 3)
+	{
+		[wheel cancelScheduledBlock:tokens[i]];
+	}
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		if (i % 3 != 0) [expected addObject:@(i)];
+	}
+
+	usleep(50 * 1000);
+
+	uint64_t end = 2 * WHEEL_RANGE_MS + 5000 + step;
+
+	for (uint64_t time = step; time <= end; time += step)
+	{
+		[self setTime:time];
+
+		NSUInteger due = 0;
+		for (NSUInteger i = 0; i < count; i++)
+		{
+			if ((i % 3 != 0) && deadlines[i] <= time) due++;
+		}
+
+		NSArray *firedNow = [self waitForFiredCount:due];
+		XCTAssertEqual([firedNow count], due, @"at %llu ms", time);
+		if ([firedNow count] != due) break;
+	}
+
+	__block NSArray *firedNumbers;
+	__block NSArray *times;
+	dispatch_sync(firedQueue, ^{
+		firedNumbers = [fired copy];
+		times = [firedTimes copy];
+	});
+
+	XCTAssertEqualObjects([NSSet setWithArray:firedNumbers], expected);
+	XCTAssertEqual([firedNumbers count], [expected count], @"A block fired more than once");
+
+	for (NSUInteger j = 0; j < [firedNumbers count]; j++)
+	{
+		NSUInteger i = [firedNumbers[j] unsignedIntegerValue];
+		uint64_t firedAt = [times[j] unsignedLongLongValue];
+
+		XCTAssertGreaterThanOrEqual(firedAt, deadlines[i], @"%lu fired early", (unsigned long)i);
+		XCTAssertLessThan(firedAt, deadlines[i] + step, @"%lu fired late", (unsigned long)i);
+	}
+}
+
+- (void)testCancelOnEveryLevel
+{
+	id token0 = [self schedule:0 afterMilliseconds:5];
+	id token1 = [self schedule:1 afterMilliseconds:300];
+	id token2 = [self schedule:2 afterMilliseconds:WHEEL_RANGE_MS + 3000];
+
+	[self schedule:3 afterMilliseconds:6];
+	[self schedule:4 afterMilliseconds:301];
+	[self schedule:5 afterMilliseconds:WHEEL_RANGE_MS + 3001];
+
+	[wheel cancelScheduledBlock:token0];
+	[wheel cancelScheduledBlock:token1];
+	[wheel cancelScheduledBlock:token2];
+
+	// Cancelling twice, or something that isn't a token, is harmless
+	[wheel cancelScheduledBlock:token1];
+	[wheel cancelScheduledBlock:nil];
+	[wheel cancelScheduledBlock:@"token"];
+
+	usleep(20 * 1000);
+
+	[self setTime:WHEEL_RANGE_MS + 4000];
+	XCTAssertEqualObjects([self waitForFiredCount:3], (@[@3, @4, @5]));
+
+	// Cancelling after firing is harmless too
+	[wheel cancelScheduledBlock:token0];
+}
+
+- (void)testCancelAfterCascade
+{
+	// Cancels an entry after it has moved down from the second level to the first
+
+	id token = [self schedule:0 afterMilliseconds:LEVEL0_RANGE_MS + 100];
+	[self schedule:1 afterMilliseconds:LEVEL0_RANGE_MS + 50];
+
+	usleep(20 * 1000);
+
+	[self setTime:LEVEL0_RANGE_MS + 10];
+	XCTAssertEqualObjects([self waitForFiredCount:0], @[]);
+
+	[wheel cancelScheduledBlock:token];
+
+	[self setTime:LEVEL0_RANGE_MS + 200];
+	XCTAssertEqualObjects([self waitForFiredCount:1], @[@1]);
+}
+
+- (void)testCancelOnTargetQueueWhileFiring
+{
+	// Once due, the block is dispatched to its queue.
+	// Cancelling it on that queue (before the block gets to run) must still prevent it from running.
+
+	id token = [self schedule:0 afterMilliseconds:5];
+
+	usleep(20 * 1000);
+
+	dispatch_sync(firedQueue, ^{
+
+		[self setTime:10];
+		usleep(50 * 1000);
+
+		[wheel cancelScheduledBlock:token];
+	});
+
+	XCTAssertEqualObjects([self waitForFiredCount:0], @[]);
+}
+
+- (void)testTimerOnWheel
+{
+	__block NSUInteger fireCount = 0;
+
+	XMPPTimer *timer = [[XMPPTimer alloc] initWithQueue:firedQueue timingWheel:wheel eventHandler:^{
+		fireCount++;
+	}];
+
+	NSUInteger (^getFireCount)(void) = ^{
+		usleep(20 * 1000);
+
+		__block NSUInteger result;
+		dispatch_sync(firedQueue, ^{
+			result = fireCount;
+		});
+		return result;
+	};
+
+	[timer startWithTimeout:0.010 interval:0.020];
+
+	usleep(20 * 1000);
+
+	[self setTime:9];
+	XCTAssertEqual(getFireCount(), (NSUInteger)0);
+
+	[self setTime:10];
+	XCTAssertEqual(getFireCount(), (NSUInteger)1);
+
+	[self setTime:30];
+	XCTAssertEqual(getFireCount(), (NSUInteger)2);
+
+	[self setTime:50];
+	XCTAssertEqual(getFireCount(), (NSUInteger)3);
+
+	// Push the next firing out, relative to now
+	[timer updateTimeout:0.100 fromOriginalStartTime:NO];
+	usleep(20 * 1000);
+
+	[self setTime:149];
+	XCTAssertEqual(getFireCount(), (NSUInteger)3);
+
+	[self setTime:150];
+	XCTAssertEqual(getFireCount(), (NSUInteger)4);
+
+	[timer cancel];
+
+	[self setTime:1000];
+	XCTAssertEqual(getFireCount(), (NSUInteger)4);
+}
+
+@end
@@ -38,6 +38,23 @@
 
 - (BOOL)hasDelegateThatRespondsToSelector:(SEL)aSelector;
 
+/**
+ * Invokes the given block for every delegate that responds to the given selector,
+ * asynchronously on the delegate's queue.
+ * The block is expected to invoke the given selector on the delegate it's passed.
+ * 
+ * This is equivalent to invoking the method on the multicast delegate,
+ * but the arguments are simply captured by the block,
+ * instead of being copied into a new NSInvocation for every delegate.
+ * 
+ * For example:
+ * 
+ * [multicastDelegate invokeSelector:@selector(cog:didFindThing:) withBlock:^(id delegate) {
+ *     [delegate cog:self didFindThing:thing];
+ * }];
+**/
+- (void)invokeSelector:(SEL)aSelector withBlock:(void (^)(id delegate))block;
+
 - (GCDMulticastDelegateEnumerator *)delegateEnumerator;
 
 @end
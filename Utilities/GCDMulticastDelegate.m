@@ -22,6 +22,12 @@
  * 
  * This class is designed to be used from within a single dispatch queue.
  * In other words, it is NOT thread-safe, and should only be used from within the external dedicated dispatch_queue.
+ * 
+ * Concerning performance:
+ * 
+ * The list of delegates rarely changes, but the same few delegate methods are invoked over and over.
+ * So for every selector, we cache the list of nodes whose delegate responds to it (and the method signature).
+ * The cached lists are discarded whenever a delegate is added or removed.
 **/
 
 @interface GCDMulticastDelegateNode : NSObject {
@@ -58,8 +64,15 @@
 @interface GCDMulticastDelegate ()
 {
 	NSMutableArray *delegateNodes;
+	
+	CFMutableDictionaryRef respondingNodesCache;  // SEL -> NSArray of GCDMulticastDelegateNode
+	CFMutableDictionaryRef methodSignatureCache;  // SEL -> NSMethodSignature
 }
 
+- (NSArray *)respondingNodesForSelector:(SEL)aSelector;
+- (void)invalidateRespondingNodesCache;
+- (void)removeNilDelegateNodes;
+
 - (NSInvocation *)duplicateInvocation:(NSInvocation *)origInvocation;
 
 @end
@@ -87,6 +100,9 @@
 	if ((self = [super init]))
 	{
 		delegateNodes = [[NSMutableArray alloc] init];
+		
+		respondingNodesCache = CFDictionaryCreateMutable(NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+		methodSignatureCache = CFDictionaryCreateMutable(NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks);
 	}
 	return self;
 }
@@ -100,6 +116,7 @@
 	    [[GCDMulticastDelegateNode alloc] initWithDelegate:delegate delegateQueue:delegateQueue];
 	
 	[delegateNodes addObject:node];
+	[self invalidateRespondingNodesCache];
 }
 
 - (void)removeDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue
@@ -139,6 +156,8 @@
 			}
 		}
 	}
+	
+	[self invalidateRespondingNodesCache];
 }
 
 - (void)removeDelegate:(id)delegate
@@ -157,6 +176,7 @@
 	}
 	
 	[delegateNodes removeAllObjects];
+	[self invalidateRespondingNodesCache];
 }
 
 - (NSUInteger)count
@@ -189,7 +209,7 @@
 {
 	NSUInteger count = 0;
 	
-	for (GCDMulticastDelegateNode *node in delegateNodes)
+	for (GCDMulticastDelegateNode *node in [self respondingNodesForSelector:aSelector])
 	{
 		id nodeDelegate = node.delegate;
 		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
@@ -197,7 +217,7 @@
 			nodeDelegate = node.unsafeDelegate;
 		#endif
 		
-		if ([nodeDelegate respondsToSelector:aSelector])
+		if (nodeDelegate)
 		{
 			count++;
 		}
@@ -208,7 +228,10 @@
 
 - (BOOL)hasDelegateThatRespondsToSelector:(SEL)aSelector
 {
-	for (GCDMulticastDelegateNode *node in delegateNodes)
+	// The cached list only contains nodes that responded to the selector.
+	// So unless delegates have since been deallocated, this returns on the first node (if any).
+	
+	for (GCDMulticastDelegateNode *node in [self respondingNodesForSelector:aSelector])
 	{
 		id nodeDelegate = node.delegate;
 		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
@@ -216,7 +239,7 @@
 			nodeDelegate = node.unsafeDelegate;
 		#endif
 		
-		if ([nodeDelegate respondsToSelector:aSelector])
+		if (nodeDelegate)
 		{
 			return YES;
 		}
@@ -225,6 +248,107 @@
 	return NO;
 }
 
+- (void)invokeSelector:(SEL)aSelector withBlock:(void (^)(id delegate))block
+{
+	BOOL foundNilDelegate = NO;
+	
+	for (GCDMulticastDelegateNode *node in [self respondingNodesForSelector:aSelector])
+	{
+		id nodeDelegate = node.delegate;
+		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
+		if (nodeDelegate == [NSNull null])
+			nodeDelegate = node.unsafeDelegate;
+		#endif
+		
+		if (nodeDelegate)
+		{
+			// All delegates MUST be invoked ASYNCHRONOUSLY.
+			
+			dispatch_async(node.delegateQueue, ^{ @autoreleasepool {
+				
+				block(nodeDelegate);
+				
+			}});
+		}
+		else
+		{
+			foundNilDelegate = YES;
+		}
+	}
+	
+	if (foundNilDelegate)
+	{
+		[self removeNilDelegateNodes];
+	}
+}
+
+/**
+ * Returns the (cached) list of nodes whose delegate responds to the given selector.
+ * 
+ * Note that the delegate of a node in the list may have been deallocated since the list was created.
+**/
+- (NSArray *)respondingNodesForSelector:(SEL)aSelector
+{
+	NSArray *nodes = (__bridge NSArray *)CFDictionaryGetValue(respondingNodesCache, (const void *)aSelector);
+	if (nodes) return nodes;
+	
+	NSMutableArray *respondingNodes = [[NSMutableArray alloc] initWithCapacity:[delegateNodes count]];
+	
+	for (GCDMulticastDelegateNode *node in delegateNodes)
+	{
+		id nodeDelegate = node.delegate;
+		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
+		if (nodeDelegate == [NSNull null])
+			nodeDelegate = node.unsafeDelegate;
+		#endif
+		
+		if ([nodeDelegate respondsToSelector:aSelector])
+		{
+			[respondingNodes addObject:node];
+		}
+	}
+	
+	nodes = [respondingNodes copy];
+	CFDictionarySetValue(respondingNodesCache, (const void *)aSelector, (__bridge const void *)nodes);
+	
+	return nodes;
+}
+
+- (void)invalidateRespondingNodesCache
+{
+	CFDictionaryRemoveAllValues(respondingNodesCache);
+}
+
+- (void)removeNilDelegateNodes
+{
+	// At lease one weak delegate reference disappeared.
+	// Remove nil delegate nodes from the list.
+	// 
+	// This is expected to happen very infrequently.
+	// This is why we handle it separately (as it requires allocating an indexSet).
+	
+	NSMutableIndexSet *indexSet = [[NSMutableIndexSet alloc] init];
+	
+	NSUInteger i = 0;
+	for (GCDMulticastDelegateNode *node in delegateNodes)
+	{
+		id nodeDelegate = node.delegate;
+		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
+		if (nodeDelegate == [NSNull null])
+			nodeDelegate = node.unsafeDelegate;
+		#endif
+		
+		if (nodeDelegate == nil)
+		{
+			[indexSet addIndex:i];
+		}
+		i++;
+	}
+	
+	[delegateNodes removeObjectsAtIndexes:indexSet];
+	[self invalidateRespondingNodesCache];
+}
+
 - (GCDMulticastDelegateEnumerator *)delegateEnumerator
 {
 	return [[GCDMulticastDelegateEnumerator alloc] initFromDelegateNodes:delegateNodes];
@@ -232,7 +356,14 @@
 
 - (NSMethodSignature *)methodSignatureForSelector:(SEL)aSelector
 {
-	for (GCDMulticastDelegateNode *node in delegateNodes)
+	NSMethodSignature *result = (__bridge NSMethodSignature *)CFDictionaryGetValue(methodSignatureCache,
+	                                                                                 (const void *)aSelector);
+	if (result)
+	{
+		return result;
+	}
+	
+	for (GCDMulticastDelegateNode *node in [self respondingNodesForSelector:aSelector])
 	{
 		id nodeDelegate = node.delegate;
 		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
@@ -240,10 +371,14 @@
 			nodeDelegate = node.unsafeDelegate;
 		#endif
 		
-		NSMethodSignature *result = [nodeDelegate methodSignatureForSelector:aSelector];
+		result = [nodeDelegate methodSignatureForSelector:aSelector];
 		
 		if (result != nil)
 		{
+			// The signature of a delegate method doesn't depend on the delegate,
+			// so this entry remains valid even if the delegates change.
+			
+			CFDictionarySetValue(methodSignatureCache, (const void *)aSelector, (__bridge const void *)result);
 			return result;
 		}
 	}
@@ -262,7 +397,7 @@
 	SEL selector = [origInvocation selector];
 	BOOL foundNilDelegate = NO;
 	
-	for (GCDMulticastDelegateNode *node in delegateNodes)
+	for (GCDMulticastDelegateNode *node in [self respondingNodesForSelector:selector])
 	{
 		id nodeDelegate = node.delegate;
 		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
@@ -270,7 +405,7 @@
 			nodeDelegate = node.unsafeDelegate;
 		#endif
 		
-		if ([nodeDelegate respondsToSelector:selector])
+		if (nodeDelegate)
 		{
 			// All delegates MUST be invoked ASYNCHRONOUSLY.
 			
@@ -282,7 +417,7 @@
 				
 			}});
 		}
-		else if (nodeDelegate == nil)
+		else
 		{
 			foundNilDelegate = YES;
 		}
@@ -290,31 +425,7 @@
 	
 	if (foundNilDelegate)
 	{
-		// At lease one weak delegate reference disappeared.
-		// Remove nil delegate nodes from the list.
-		// 
-		// This is expected to happen very infrequently.
-		// This is why we handle it separately (as it requires allocating an indexSet).
-		
-		NSMutableIndexSet *indexSet = [[NSMutableIndexSet alloc] init];
-		
-		NSUInteger i = 0;
-		for (GCDMulticastDelegateNode *node in delegateNodes)
-		{
-			id nodeDelegate = node.delegate;
-			#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
-			if (nodeDelegate == [NSNull null])
-				nodeDelegate = node.unsafeDelegate;
-			#endif
-			
-			if (nodeDelegate == nil)
-			{
-				[indexSet addIndex:i];
-			}
-			i++;
-		}
-		
-		[delegateNodes removeObjectsAtIndexes:indexSet];
+		[self removeNilDelegateNodes];
 	}
 }
 
@@ -328,6 +439,9 @@
 - (void)dealloc
 {
 	[self removeAllDelegates];
+	
+	CFRelease(respondingNodesCache);
+	CFRelease(methodSignatureCache);
 }
 
 - (NSInvocation *)duplicateInvocation:(NSInvocation *)origInvocation
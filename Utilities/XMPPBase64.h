@@ -0,0 +1,81 @@
+#import <Foundation/Foundation.h>
+
+/**
+ * Base64 (RFC 4648) encoding and decoding.
+ *
+ * The bulk of the work is done with SIMD instructions where available
+ * (NEON on arm64, AVX2 or SSSE3 on x86, chosen at runtime), with a table driven scalar fallback.
+ *
+ * The encoder and decoder also work incrementally, chunk by chunk.
+ * This allows large payloads (e.g. in-band bytestreams, avatars) to be processed
+ * without first building one giant contiguous string or data object.
+ *
+ * For example:
+ *
+ * XMPPBase64Decoder *decoder = [[XMPPBase64Decoder alloc] init];
+ *
+ * for (NSString *chunk in chunks) {
+ *     [fileHandle writeData:[decoder decodeString:chunk]];
+ * }
+ *
+ * Instances are NOT thread-safe.
+**/
+@interface XMPPBase64Encoder : NSObject
+
+/**
+ * Encodes the given data in one go, including the padding.
+**/
++ (NSString *)encodeData:(NSData *)data;
+
+/**
+ * Encodes the given chunk, and returns the encoded text for all complete 3 byte groups seen so far.
+ * Up to 2 bytes may be held back until the next chunk (or until finish).
+**/
+- (NSString *)encodeData:(NSData *)data;
+- (NSString *)encodeBytes:(const void *)bytes length:(NSUInteger)length;
+
+/**
+ * Encodes any held back bytes, including the padding.
+ * The encoder may be reused afterwards.
+**/
+- (NSString *)finish;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The decoder is lenient in the same way NSData's xmpp_base64Decoded always has been:
+ * characters outside the base64 alphabet (e.g. whitespace and line breaks) are ignored,
+ * and decoding stops at the first padding character.
+**/
+@interface XMPPBase64Decoder : NSObject
+
+/**
+ * Decodes the given text in one go.
+**/
++ (NSData *)decodeString:(NSString *)string;
++ (NSData *)decodeData:(NSData *)data;
+
+/**
+ * Decodes the given chunk, and returns the decoded bytes for all complete 4 character groups seen so far.
+ * Up to 3 characters may be held back until the next chunk.
+**/
+- (NSData *)decodeString:(NSString *)string;
+- (NSData *)decodeData:(NSData *)data;
+- (NSData *)decodeBytes:(const void *)bytes length:(NSUInteger)length;
+
+/**
+ * Returns YES once the padding has been seen.
+ * Any further input is ignored.
+**/
+@property (nonatomic, readonly) BOOL isFinished;
+
+/**
+ * Resets the decoder, discarding any held back characters, so it may be reused.
+**/
+- (void)reset;
+
+@end
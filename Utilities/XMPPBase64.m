@@ -0,0 +1,719 @@
+#import "XMPPBase64.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define XMPP_BASE64_X86 1
+#elif defined(__aarch64__)
+	#include <arm_neon.h>
+	#define XMPP_BASE64_NEON 1
+#endif
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Values in the decoding table that aren't part of the alphabet
+#define XMPP_BASE64_PAD     0xFE
+#define XMPP_BASE64_IGNORED 0xFF
+
+// After a SIMD block fails (e.g. due to a line break), this many characters are decoded by the scalar loop
+#define XMPP_BASE64_SCALAR_RUN 64
+
+static const char XMPPBase64EncodingTable[64] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static uint8_t XMPPBase64DecodingTable[256];
+
+/**
+ * Encodes whole 3 byte groups from the start of the input.
+ * Returns the number of input bytes consumed (a multiple of 3), having written 4 characters for every 3 bytes.
+**/
+typedef size_t (*XMPPBase64BlockEncoder)(const uint8_t *in, size_t length, char *out);
+
+/**
+ * Decodes whole blocks from the start of the input, stopping at the first block that isn't entirely
+ * made of alphabet characters (i.e. that contains padding, whitespace, etc).
+ * Returns the number of characters consumed (a multiple of 4), having written 3 bytes for every 4 characters.
+**/
+typedef size_t (*XMPPBase64BlockDecoder)(const uint8_t *in, size_t length, uint8_t *out);
+
+static XMPPBase64BlockEncoder XMPPBase64SIMDEncoder = NULL;
+static XMPPBase64BlockDecoder XMPPBase64SIMDDecoder = NULL;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Scalar
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void XMPPBase64EncodeScalar(const uint8_t *in, size_t length, char *out)
+{
+	// The length must be a multiple of 3
+
+	for (size_t i = 0; i < length; i += 3)
+	{
+		uint32_t triple = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8) | (uint32_t)in[i + 2];
+
+		*out++ = XMPPBase64EncodingTable[(triple >> 18) & 0x3F];
+		*out++ = XMPPBase64EncodingTable[(triple >> 12) & 0x3F];
+		*out++ = XMPPBase64EncodingTable[(triple >>  6) & 0x3F];
+		*out++ = XMPPBase64EncodingTable[(triple      ) & 0x3F];
+	}
+}
+
+static void XMPPBase64EncodeTail(const uint8_t *in, size_t length, char *out)
+{
+	// The length must be 1 or 2
+
+	uint32_t triple = (uint32_t)in[0] << 16;
+	if (length > 1) triple |= (uint32_t)in[1] << 8;
+
+	out[0] = XMPPBase64EncodingTable[(triple >> 18) & 0x3F];
+	out[1] = XMPPBase64EncodingTable[(triple >> 12) & 0x3F];
+	out[2] = (length > 1) ? XMPPBase64EncodingTable[(triple >> 6) & 0x3F] : '=';
+	out[3] = '=';
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark SSSE3 / AVX2
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if XMPP_BASE64_X86
+
+// The encoding and decoding below follows the approach of Wojciech Muła and Daniel Lemire,
+// "Faster Base64 Encoding and Decoding using AVX2 Instructions" (2018).
+
+__attribute__((target("ssse3")))
+static inline __m128i XMPPBase64EncodeSSSE3Block(__m128i in)
+{
+	// Spread 12 input bytes into 4 lanes of 32 bits, each holding one 3 byte group
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+	// Move each 6 bit index into its own byte
+	__m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	__m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	__m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	__m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	__m128i indices = _mm_or_si128(t1, t3);
+
+	// Translate the indices into ASCII, by adding the offset of the range each index falls in
+	__m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+	__m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+	reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+	const __m128i shiftLUT = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                                       '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	                                       '/' - 63, 'A', 0, 0);
+
+	return _mm_add_epi8(_mm_shuffle_epi8(shiftLUT, reduced), indices);
+}
+
+__attribute__((target("ssse3")))
+static size_t XMPPBase64EncodeSSSE3(const uint8_t *in, size_t length, char *out)
+{
+	size_t i = 0;
+
+	// Each block consumes 12 bytes, but loads 16
+	for (; i + 16 <= length; i += 12)
+	{
+		__m128i chars = XMPPBase64EncodeSSSE3Block(_mm_loadu_si128((const __m128i *)(in + i)));
+		_mm_storeu_si128((__m128i *)out, chars);
+		out += 16;
+	}
+
+	return i;
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i XMPPBase64TranslateSSE(__m128i in, int *validMask)
+{
+	// Bytes >= 0x80 are negative as signed bytes, so they fall outside all of the ranges below
+
+	__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('Z' + 1)));
+	__m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('z' + 1)));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+	__m128i plus  = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+	__m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+
+	__m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+	*validMask = _mm_movemask_epi8(valid);
+
+	__m128i shift = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-65)), _mm_and_si128(lower, _mm_set1_epi8(-71)));
+	shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(4)));
+	shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(19)));
+	shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(16)));
+
+	return _mm_add_epi8(in, shift);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i XMPPBase64PackSSSE3(__m128i values)
+{
+	// Merge the 4 x 6 bits of each 32 bit lane into 24 bits, then gather the 3 bytes of each lane in order
+	__m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+	merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+
+	return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3")))
+static size_t XMPPBase64DecodeSSSE3(const uint8_t *in, size_t length, uint8_t *out)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= length; i += 16)
+	{
+		int validMask;
+		__m128i values = XMPPBase64TranslateSSE(_mm_loadu_si128((const __m128i *)(in + i)), &validMask);
+
+		if (validMask != 0xFFFF) break;
+
+		uint8_t buffer[16];
+		_mm_storeu_si128((__m128i *)buffer, XMPPBase64PackSSSE3(values));
+		memcpy(out, buffer, 12);
+		out += 12;
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t XMPPBase64EncodeAVX2(const uint8_t *in, size_t length, char *out)
+{
+	size_t i = 0;
+
+	const __m256i spread = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+	                                       10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+
+	const __m256i shiftLUT = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	                                          '/' - 63, 'A', 0, 0,
+	                                          'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	                                          '/' - 63, 'A', 0, 0);
+
+	// Each block consumes 24 bytes (12 per 128 bit lane), but loads 28
+	for (; i + 28 <= length; i += 24)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(in + i + 12));
+
+		__m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		block = _mm256_shuffle_epi8(block, spread);
+
+		__m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+		__m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		__m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+		__m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		__m256i indices = _mm256_or_si256(t1, t3);
+
+		__m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		__m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+		reduced = _mm256_or_si256(reduced, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+
+		__m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(shiftLUT, reduced), indices);
+
+		_mm256_storeu_si256((__m256i *)out, chars);
+		out += 32;
+	}
+
+	return i + XMPPBase64EncodeSSSE3(in + i, length - i, out);
+}
+
+__attribute__((target("avx2")))
+static size_t XMPPBase64DecodeAVX2(const uint8_t *in, size_t length, uint8_t *out)
+{
+	size_t i = 0;
+
+	for (; i + 32 <= length; i += 32)
+	{
+		__m256i chars = _mm256_loadu_si256((const __m256i *)(in + i));
+
+		__m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('A' - 1)),
+		                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), chars));
+		__m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('a' - 1)),
+		                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), chars));
+		__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)),
+		                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+		__m256i plus  = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('+'));
+		__m256i slash = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('/'));
+
+		__m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_or_si256(plus, slash)));
+		if (_mm256_movemask_epi8(valid) != -1) break;
+
+		__m256i shift = _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-65)),
+		                                _mm256_and_si256(lower, _mm256_set1_epi8(-71)));
+		shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(4)));
+		shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(19)));
+		shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(16)));
+
+		__m256i values = _mm256_add_epi8(chars, shift);
+
+		__m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+		merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+		merged = _mm256_shuffle_epi8(merged, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		                                                      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+		uint8_t buffer[32];
+		_mm256_storeu_si256((__m256i *)buffer, merged);
+		memcpy(out, buffer, 24);
+		out += 24;
+	}
+
+	return i + XMPPBase64DecodeSSSE3(in + i, length - i, out);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark NEON
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if XMPP_BASE64_NEON
+
+static size_t XMPPBase64EncodeNEON(const uint8_t *in, size_t length, char *out)
+{
+	const uint8_t *table = (const uint8_t *)XMPPBase64EncodingTable;
+
+	uint8x16x4_t lookup;
+	lookup.val[0] = vld1q_u8(table);
+	lookup.val[1] = vld1q_u8(table + 16);
+	lookup.val[2] = vld1q_u8(table + 32);
+	lookup.val[3] = vld1q_u8(table + 48);
+
+	size_t i = 0;
+
+	for (; i + 48 <= length; i += 48)
+	{
+		// De-interleave 16 groups of 3 bytes
+		uint8x16x3_t bytes = vld3q_u8(in + i);
+
+		uint8x16x4_t indices;
+		indices.val[0] = vshrq_n_u8(bytes.val[0], 2);
+		indices.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(bytes.val[0], vdupq_n_u8(0x03)), 4), vshrq_n_u8(bytes.val[1], 4));
+		indices.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(bytes.val[1], vdupq_n_u8(0x0F)), 2), vshrq_n_u8(bytes.val[2], 6));
+		indices.val[3] = vandq_u8(bytes.val[2], vdupq_n_u8(0x3F));
+
+		uint8x16x4_t chars;
+		chars.val[0] = vqtbl4q_u8(lookup, indices.val[0]);
+		chars.val[1] = vqtbl4q_u8(lookup, indices.val[1]);
+		chars.val[2] = vqtbl4q_u8(lookup, indices.val[2]);
+		chars.val[3] = vqtbl4q_u8(lookup, indices.val[3]);
+
+		// Re-interleave into 16 groups of 4 characters
+		vst4q_u8((uint8_t *)out, chars);
+		out += 64;
+	}
+
+	return i;
+}
+
+static inline uint8x16_t XMPPBase64TranslateNEON(uint8x16_t c, uint8x16_t *invalid)
+{
+	uint8x16_t upper = vandq_u8(vcgeq_u8(c, vdupq_n_u8('A')), vcleq_u8(c, vdupq_n_u8('Z')));
+	uint8x16_t lower = vandq_u8(vcgeq_u8(c, vdupq_n_u8('a')), vcleq_u8(c, vdupq_n_u8('z')));
+	uint8x16_t digit = vandq_u8(vcgeq_u8(c, vdupq_n_u8('0')), vcleq_u8(c, vdupq_n_u8('9')));
+	uint8x16_t plus  = vceqq_u8(c, vdupq_n_u8('+'));
+	uint8x16_t slash = vceqq_u8(c, vdupq_n_u8('/'));
+
+	uint8x16_t valid = vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, vorrq_u8(plus, slash)));
+	*invalid = vorrq_u8(*invalid, vmvnq_u8(valid));
+
+	uint8x16_t shift = vorrq_u8(vandq_u8(upper, vdupq_n_u8((uint8_t)-65)), vandq_u8(lower, vdupq_n_u8((uint8_t)-71)));
+	shift = vorrq_u8(shift, vandq_u8(digit, vdupq_n_u8(4)));
+	shift = vorrq_u8(shift, vandq_u8(plus, vdupq_n_u8(19)));
+	shift = vorrq_u8(shift, vandq_u8(slash, vdupq_n_u8(16)));
+
+	return vaddq_u8(c, shift);
+}
+
+static size_t XMPPBase64DecodeNEON(const uint8_t *in, size_t length, uint8_t *out)
+{
+	size_t i = 0;
+
+	for (; i + 64 <= length; i += 64)
+	{
+		// De-interleave 16 groups of 4 characters
+		uint8x16x4_t chars = vld4q_u8(in + i);
+
+		uint8x16_t invalid = vdupq_n_u8(0);
+
+		uint8x16_t v0 = XMPPBase64TranslateNEON(chars.val[0], &invalid);
+		uint8x16_t v1 = XMPPBase64TranslateNEON(chars.val[1], &invalid);
+		uint8x16_t v2 = XMPPBase64TranslateNEON(chars.val[2], &invalid);
+		uint8x16_t v3 = XMPPBase64TranslateNEON(chars.val[3], &invalid);
+
+		if (vmaxvq_u8(invalid) != 0) break;
+
+		uint8x16x3_t bytes;
+		bytes.val[0] = vorrq_u8(vshlq_n_u8(v0, 2), vshrq_n_u8(v1, 4));
+		bytes.val[1] = vorrq_u8(vshlq_n_u8(v1, 4), vshrq_n_u8(v2, 2));
+		bytes.val[2] = vorrq_u8(vshlq_n_u8(v2, 6), v3);
+
+		// Re-interleave into 16 groups of 3 bytes
+		vst3q_u8(out, bytes);
+		out += 48;
+	}
+
+	return i;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Codec
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void XMPPBase64SelectDefault(void)
+{
+	XMPPBase64SIMDEncoder = NULL;
+	XMPPBase64SIMDDecoder = NULL;
+
+#if XMPP_BASE64_X86
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		XMPPBase64SIMDEncoder = XMPPBase64EncodeAVX2;
+		XMPPBase64SIMDDecoder = XMPPBase64DecodeAVX2;
+	}
+	else if (__builtin_cpu_supports("ssse3"))
+	{
+		XMPPBase64SIMDEncoder = XMPPBase64EncodeSSSE3;
+		XMPPBase64SIMDDecoder = XMPPBase64DecodeSSSE3;
+	}
+
+#elif XMPP_BASE64_NEON
+
+	XMPPBase64SIMDEncoder = XMPPBase64EncodeNEON;
+	XMPPBase64SIMDDecoder = XMPPBase64DecodeNEON;
+
+#endif
+}
+
+static void XMPPBase64Setup(void)
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+
+		memset(XMPPBase64DecodingTable, XMPP_BASE64_IGNORED, sizeof(XMPPBase64DecodingTable));
+
+		for (uint8_t i = 0; i < 64; i++)
+		{
+			XMPPBase64DecodingTable[(uint8_t)XMPPBase64EncodingTable[i]] = i;
+		}
+		XMPPBase64DecodingTable['='] = XMPP_BASE64_PAD;
+
+		XMPPBase64SelectDefault();
+	});
+}
+
+static void XMPPBase64EncodeGroups(const uint8_t *in, size_t length, char *out)
+{
+	// The length must be a multiple of 3
+
+	size_t done = 0;
+	if (XMPPBase64SIMDEncoder)
+	{
+		done = XMPPBase64SIMDEncoder(in, length, out);
+	}
+
+	XMPPBase64EncodeScalar(in + done, length - done, out + (done / 3 * 4));
+}
+
+typedef struct {
+	uint8_t quad[4];
+	uint8_t count;
+	BOOL finished;
+} XMPPBase64DecodeState;
+
+static size_t XMPPBase64Decode(XMPPBase64DecodeState *state, const uint8_t *in, size_t length, uint8_t *out)
+{
+	// The output must have room for ((state->count + length) / 4 * 3) bytes
+
+	size_t i = 0;
+	size_t o = 0;
+
+	while (i < length && !state->finished)
+	{
+		size_t scalarEnd = length;
+
+		if (XMPPBase64SIMDDecoder)
+		{
+			if (state->count == 0)
+			{
+				size_t consumed = XMPPBase64SIMDDecoder(in + i, length - i, out + o);
+
+				i += consumed;
+				o += consumed / 4 * 3;
+
+				if (i >= length) break;
+			}
+
+			// The next block contains characters outside the alphabet (or is too short for the SIMD path),
+			// so decode a little with the scalar loop before trying again.
+			scalarEnd = MIN(length, i + XMPP_BASE64_SCALAR_RUN);
+		}
+
+		for (; i < scalarEnd; i++)
+		{
+			uint8_t value = XMPPBase64DecodingTable[in[i]];
+
+			if (value < 64)
+			{
+				state->quad[state->count++] = value;
+
+				if (state->count == 4)
+				{
+					out[o++] = (uint8_t)((state->quad[0] << 2) | (state->quad[1] >> 4));
+					out[o++] = (uint8_t)((state->quad[1] << 4) | (state->quad[2] >> 2));
+					out[o++] = (uint8_t)((state->quad[2] << 6) | (state->quad[3]));
+
+					state->count = 0;
+				}
+			}
+			else if (value == XMPP_BASE64_PAD)
+			{
+				// Padding ends the data.
+				// A partial group of 1 or 2 characters yields 1 byte, and a group of 3 yields 2 bytes.
+
+				if (state->count > 0)
+				{
+					if (state->count < 2) state->quad[1] = 0;
+					if (state->count < 3) state->quad[2] = 0;
+
+					out[o++] = (uint8_t)((state->quad[0] << 2) | (state->quad[1] >> 4));
+
+					if (state->count == 3)
+						out[o++] = (uint8_t)((state->quad[1] << 4) | (state->quad[2] >> 2));
+				}
+
+				state->count = 0;
+				state->finished = YES;
+
+				i++;
+				break;
+			}
+
+			// Anything else is ignored
+		}
+	}
+
+	return o;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface XMPPBase64Encoder ()
+
++ (BOOL)selectImplementation:(NSString *)name;
+
+@end
+
+@implementation XMPPBase64Encoder
+{
+	uint8_t pending[2];
+	NSUInteger pendingLength;
+}
+
++ (void)initialize
+{
+	XMPPBase64Setup();
+}
+
+/**
+ * Switches both the encoder and decoder to the named implementation ("scalar", "ssse3", "avx2" or "neon"),
+ * or back to the one chosen for this CPU if the name is nil.
+ * Returns NO if the implementation isn't available here.
+ *
+ * This lets the unit tests cover every path the CPU supports. It is not thread-safe.
+**/
++ (BOOL)selectImplementation:(NSString *)name
+{
+	XMPPBase64Setup();
+
+	if (name == nil)
+	{
+		XMPPBase64SelectDefault();
+		return YES;
+	}
+
+	if ([name isEqualToString:@"scalar"])
+	{
+		XMPPBase64SIMDEncoder = NULL;
+		XMPPBase64SIMDDecoder = NULL;
+		return YES;
+	}
+
+#if XMPP_BASE64_X86
+
+	if ([name isEqualToString:@"avx2"] && __builtin_cpu_supports("avx2"))
+	{
+		XMPPBase64SIMDEncoder = XMPPBase64EncodeAVX2;
+		XMPPBase64SIMDDecoder = XMPPBase64DecodeAVX2;
+		return YES;
+	}
+
+	if ([name isEqualToString:@"ssse3"] && __builtin_cpu_supports("ssse3"))
+	{
+		XMPPBase64SIMDEncoder = XMPPBase64EncodeSSSE3;
+		XMPPBase64SIMDDecoder = XMPPBase64DecodeSSSE3;
+		return YES;
+	}
+
+#elif XMPP_BASE64_NEON
+
+	if ([name isEqualToString:@"neon"])
+	{
+		XMPPBase64SIMDEncoder = XMPPBase64EncodeNEON;
+		XMPPBase64SIMDDecoder = XMPPBase64DecodeNEON;
+		return YES;
+	}
+
+#endif
+
+	return NO;
+}
+
++ (NSString *)encodeData:(NSData *)data
+{
+	XMPPBase64Encoder *encoder = [[XMPPBase64Encoder alloc] init];
+
+	NSString *body = [encoder encodeData:data];
+	NSString *tail = [encoder finish];
+
+	return ([tail length] > 0) ? [body stringByAppendingString:tail] : body;
+}
+
+- (NSString *)encodeData:(NSData *)data
+{
+	return [self encodeBytes:[data bytes] length:[data length]];
+}
+
+- (NSString *)encodeBytes:(const void *)buffer length:(NSUInteger)length
+{
+	const uint8_t *bytes = (const uint8_t *)buffer;
+
+	if (pendingLength + length < 3)
+	{
+		memcpy(pending + pendingLength, bytes, length);
+		pendingLength += length;
+
+		return @"";
+	}
+
+	NSUInteger groups = (pendingLength + length) / 3;
+
+	char *out = malloc(groups * 4);
+	char *o = out;
+
+	if (pendingLength > 0)
+	{
+		// Complete the held back group with the first bytes of this chunk
+
+		uint8_t group[3];
+		memcpy(group, pending, pendingLength);
+		memcpy(group + pendingLength, bytes, 3 - pendingLength);
+
+		XMPPBase64EncodeScalar(group, 3, o);
+		o += 4;
+
+		bytes += (3 - pendingLength);
+		length -= (3 - pendingLength);
+		pendingLength = 0;
+	}
+
+	NSUInteger wholeLength = length / 3 * 3;
+
+	XMPPBase64EncodeGroups(bytes, wholeLength, o);
+
+	pendingLength = length - wholeLength;
+	memcpy(pending, bytes + wholeLength, pendingLength);
+
+	return [[NSString alloc] initWithBytesNoCopy:out
+	                                      length:(groups * 4)
+	                                    encoding:NSASCIIStringEncoding
+	                                freeWhenDone:YES];
+}
+
+- (NSString *)finish
+{
+	if (pendingLength == 0) return @"";
+
+	char out[4];
+	XMPPBase64EncodeTail(pending, pendingLength, out);
+
+	pendingLength = 0;
+
+	return [[NSString alloc] initWithBytes:out length:4 encoding:NSASCIIStringEncoding];
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPBase64Decoder
+{
+	XMPPBase64DecodeState state;
+}
+
++ (void)initialize
+{
+	XMPPBase64Setup();
+}
+
++ (NSData *)decodeString:(NSString *)string
+{
+	return [[[XMPPBase64Decoder alloc] init] decodeString:string];
+}
+
++ (NSData *)decodeData:(NSData *)data
+{
+	return [[[XMPPBase64Decoder alloc] init] decodeData:data];
+}
+
+- (BOOL)isFinished
+{
+	return state.finished;
+}
+
+- (void)reset
+{
+	memset(&state, 0, sizeof(state));
+}
+
+- (NSData *)decodeString:(NSString *)string
+{
+	// Valid base64 is ASCII, so try to use the string's own buffer before converting it
+
+	const char *cString = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingASCII);
+	if (cString)
+	{
+		return [self decodeBytes:cString length:strlen(cString)];
+	}
+
+	NSData *data = [string dataUsingEncoding:NSUTF8StringEncoding];
+
+	return [self decodeBytes:[data bytes] length:[data length]];
+}
+
+- (NSData *)decodeData:(NSData *)data
+{
+	return [self decodeBytes:[data bytes] length:[data length]];
+}
+
+- (NSData *)decodeBytes:(const void *)bytes length:(NSUInteger)length
+{
+	if (state.finished || length == 0) return [NSData data];
+
+	NSUInteger capacity = (state.count + length) / 4 * 3 + 3;
+	uint8_t *out = malloc(capacity);
+
+	size_t outLength = XMPPBase64Decode(&state, (const uint8_t *)bytes, length, out);
+
+	return [[NSData alloc] initWithBytesNoCopy:out length:outLength freeWhenDone:YES];
+}
+
+@end
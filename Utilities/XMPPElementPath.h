@@ -0,0 +1,41 @@
+#import <Foundation/Foundation.h>
+
+@import KissXML;
+
+/**
+ * A compiled path query for finding descendant elements, e.g. the body of a MAM result:
+ * 
+ * XMPPElementPath *path = [XMPPElementPath pathWithString:@"result[urn:xmpp:mam:2]/forwarded/message/body"];
+ * NSXMLElement *body = [path firstMatchInElement:message];
+ * 
+ * The syntax is a list of steps separated by '/'.
+ * Each step is an element name (or '*' to match any name),
+ * optionally followed by an xmlns predicate in square brackets.
+ * 
+ * The path is evaluated relative to the given element (i.e. the first step matches its children),
+ * in a single depth-first pass over the matching children, without creating any temporary arrays.
+ * If a matching child doesn't lead to a match, its following siblings are considered as well.
+ * 
+ * Compiled paths are immutable, and may be shared between threads.
+ * It's recommended to compile the paths used on hot paths once, and keep them around.
+**/
+@interface XMPPElementPath : NSObject
+
+/**
+ * Returns nil if the given path is invalid (e.g. empty steps or unbalanced brackets).
+**/
++ (XMPPElementPath *)pathWithString:(NSString *)pathString;
+
+/**
+ * Returns a compiled path for the given string from a process-wide cache, compiling it if needed.
+**/
++ (XMPPElementPath *)cachedPathWithString:(NSString *)pathString;
+
+@property (nonatomic, readonly) NSString *pathString;
+
+- (NSXMLElement *)firstMatchInElement:(NSXMLElement *)element;
+
+- (void)enumerateMatchesInElement:(NSXMLElement *)element
+                       usingBlock:(void (^)(NSXMLElement *match, BOOL *stop))block;
+
+@end
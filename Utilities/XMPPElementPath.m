@@ -0,0 +1,204 @@
+#import "XMPPElementPath.h"
+#import "NSXMLElement+XMPP.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+@interface XMPPElementPathStep : NSObject
+{
+  @public
+	NSString *name;  // nil matches any name
+	NSString *xmlns; // nil matches any xmlns
+}
+@end
+
+@implementation XMPPElementPathStep
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPElementPath
+{
+	NSString *pathString;
+	NSArray *steps;
+	NSUInteger stepCount;
+}
+
+@synthesize pathString;
+
++ (XMPPElementPath *)pathWithString:(NSString *)string
+{
+	NSMutableArray *steps = [NSMutableArray array];
+	
+	NSUInteger length = [string length];
+	NSUInteger stepStart = 0;
+	NSUInteger bracketStart = NSNotFound;
+	NSUInteger bracketEnd = NSNotFound;
+	
+	// The xmlns predicates may contain '/' characters (e.g. http://jabber.org/protocol/disco#info),
+	// so the separators are only recognized outside of brackets.
+	
+	for (NSUInteger i = 0; i <= length; i++)
+	{
+		unichar c = (i < length) ? [string characterAtIndex:i] : '/';
+		
+		if (bracketStart != NSNotFound && bracketEnd == NSNotFound)
+		{
+			if (c == ']') bracketEnd = i;
+			else if (i == length) return nil; // Unbalanced bracket
+			
+			continue;
+		}
+		
+		if (c == '[')
+		{
+			if (bracketStart != NSNotFound) return nil; // Only one predicate per step
+			bracketStart = i;
+		}
+		else if (c == ']')
+		{
+			return nil; // Unbalanced bracket
+		}
+		else if (c == '/')
+		{
+			NSUInteger nameEnd = (bracketStart != NSNotFound) ? bracketStart : i;
+			
+			// Nothing may follow the predicate
+			if (bracketEnd != NSNotFound && bracketEnd != i - 1) return nil;
+			
+			NSString *name = [string substringWithRange:NSMakeRange(stepStart, nameEnd - stepStart)];
+			if ([name length] == 0) return nil;
+			
+			XMPPElementPathStep *step = [[XMPPElementPathStep alloc] init];
+			step->name = [name isEqualToString:@"*"] ? nil : name;
+			
+			if (bracketStart != NSNotFound)
+			{
+				NSString *xmlns = [string substringWithRange:NSMakeRange(bracketStart + 1, bracketEnd - bracketStart - 1)];
+				if ([xmlns length] == 0) return nil;
+				
+				step->xmlns = xmlns;
+			}
+			
+			[steps addObject:step];
+			
+			stepStart = i + 1;
+			bracketStart = NSNotFound;
+			bracketEnd = NSNotFound;
+		}
+	}
+	
+	XMPPElementPath *path = [[XMPPElementPath alloc] init];
+	path->pathString = [string copy];
+	path->steps = [steps copy];
+	path->stepCount = [steps count];
+	
+	return path;
+}
+
++ (XMPPElementPath *)cachedPathWithString:(NSString *)string
+{
+	static NSCache *cache;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		cache = [[NSCache alloc] init];
+		cache.countLimit = 256;
+	});
+	
+	XMPPElementPath *path = [cache objectForKey:string];
+	if (path == nil)
+	{
+		path = [self pathWithString:string];
+		if (path)
+		{
+			[cache setObject:path forKey:path->pathString];
+		}
+	}
+	
+	return path;
+}
+
+static inline BOOL XMPPElementPathStepMatches(XMPPElementPathStep *step, NSXMLNode *node)
+{
+	if ([node kind] != NSXMLElementKind) return NO;
+	
+	if (step->name && ![[node localName] isEqualToString:step->name]) return NO;
+	
+	if (step->xmlns)
+	{
+		if (![[node URI] isEqualToString:step->xmlns] && ![[(NSXMLElement *)node xmlns] isEqualToString:step->xmlns])
+			return NO;
+	}
+	
+	return YES;
+}
+
+static inline NSXMLNode * XMPPElementPathFirstChild(NSXMLElement *element)
+{
+	return ([element childCount] > 0) ? [element childAtIndex:0] : nil;
+}
+
+/**
+ * Depth-first search for matches of the steps (starting at the given index) among the children of the given element.
+ * Returns YES if the enumeration was stopped.
+**/
+static BOOL XMPPElementPathEnumerate(NSArray *steps,
+                                     NSUInteger stepCount,
+                                     NSUInteger stepIndex,
+                                     NSXMLElement *element,
+                                     void (^block)(NSXMLElement *match, BOOL *stop))
+{
+	XMPPElementPathStep *step = steps[stepIndex];
+	
+	for (NSXMLNode *node = XMPPElementPathFirstChild(element); node; node = [node nextSibling])
+	{
+		if (!XMPPElementPathStepMatches(step, node)) continue;
+		
+		if (stepIndex + 1 == stepCount)
+		{
+			BOOL stop = NO;
+			block((NSXMLElement *)node, &stop);
+			
+			if (stop) return YES;
+		}
+		else if (XMPPElementPathEnumerate(steps, stepCount, stepIndex + 1, (NSXMLElement *)node, block))
+		{
+			return YES;
+		}
+	}
+	
+	return NO;
+}
+
+- (NSXMLElement *)firstMatchInElement:(NSXMLElement *)element
+{
+	__block NSXMLElement *result = nil;
+	
+	[self enumerateMatchesInElement:element usingBlock:^(NSXMLElement *match, BOOL *stop) {
+		
+		result = match;
+		*stop = YES;
+	}];
+	
+	return result;
+}
+
+- (void)enumerateMatchesInElement:(NSXMLElement *)element
+                       usingBlock:(void (^)(NSXMLElement *match, BOOL *stop))block
+{
+	NSParameterAssert(block != nil);
+	
+	if (element == nil || stepCount == 0) return;
+	
+	XMPPElementPathEnumerate(steps, stepCount, 0, element, block);
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<XMPPElementPath %p: %@>", self, pathString];
+}
+
+@end
@@ -1,6 +1,7 @@
 #import <Foundation/Foundation.h>
 
 @protocol XMPPTrackingInfo;
+@class XMPPTimer;
 
 @class XMPPElement;
 
@@ -114,6 +115,17 @@ extern const NSTimeInterval XMPPIDTrackerTimeoutNone;
  *     }
  * }
  * 
+ * ---- Compact IDs ----
+ *
+ * Any id will work with the tracker, but compact ids are tracked more efficiently.
+ * A compact id is the canonical base-62 encoding of a 64 bit integer (e.g. "Bx3kq0a9").
+ * The tracker parses such ids back into their integer value,
+ * and stores them in an open-addressed table keyed by that integer, instead of hashing and comparing strings.
+ * Other ids (e.g. UUIDs) are stored in a dictionary, as before.
+ *
+ * XMPPStream's generateElementID method returns compact ids from a per-stream counter,
+ * which is the recommended way to generate ids for tracked requests.
+ * 
  * This class is NOT thread-safe.
  * It is designed to be used within a thread-safe context (e.g. within a single dispatch_queue).
 **/
@@ -154,6 +166,18 @@ extern const NSTimeInterval XMPPIDTrackerTimeoutNone;
 - (void)removeID:(NSString *)elementID;
 - (void)removeAllIDs;
 
+/**
+ * Returns the compact (base-62) id for the given value.
+ * The value must be non-zero.
+**/
++ (NSString *)compactIDWithValue:(uint64_t)value;
+
+/**
+ * If the given id is a compact id, sets valuePtr to the value it encodes and returns YES.
+ * Otherwise returns NO.
+**/
++ (BOOL)getValue:(uint64_t *)valuePtr fromCompactID:(NSString *)elementID;
+
 @end
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -190,7 +214,7 @@ extern const NSTimeInterval XMPPIDTrackerTimeoutNone;
 	
 	NSString *elementID;
     XMPPElement *element;
-	dispatch_source_t timer;
+	XMPPTimer *timer;
 }
 
 - (id)initWithTarget:(id)target selector:(SEL)selector timeout:(NSTimeInterval)timeout;
@@ -1,6 +1,8 @@
 #import "XMPPIDTracker.h"
+#import "XMPPIDTrackerPrivate.h"
 #import "XMPP.h"
 #import "XMPPLogging.h"
+#import "XMPPTimer.h"
 
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
@@ -18,6 +20,20 @@ static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
 
 const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 
+// Compact ids are the canonical base-62 encoding of a uint64_t, which takes at most 11 characters
+#define XMPP_COMPACT_ID_MAX_LENGTH 11
+
+static const char XMPPCompactIDDigits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+static inline int XMPPCompactIDDigitValue(unichar c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'A' && c <= 'Z') return c - 'A' + 10;
+	if (c >= 'a' && c <= 'z') return c - 'a' + 36;
+	
+	return -1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark -
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -25,6 +41,15 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 @interface XMPPIDTracker ()
 {
 	void *queueTag;
+	
+	// Open-addressed (linear probing) table for compact ids.
+	// A key of zero marks an empty slot, which is fine as zero is not a valid compact id value.
+	// The infos are retained via CFBridgingRetain.
+	
+	uint64_t *slotKeys;
+	void **slotInfos;
+	NSUInteger slotCapacity;
+	NSUInteger slotCount;
 }
 
 @end
@@ -60,6 +85,10 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 #endif
 		
 		dict = [[NSMutableDictionary alloc] init];
+		
+		slotCapacity = XMPP_ID_TRACKER_INITIAL_SLOT_CAPACITY;
+		slotKeys = calloc(slotCapacity, sizeof(uint64_t));
+		slotInfos = calloc(slotCapacity, sizeof(void *));
 	}
 	return self;
 }
@@ -74,6 +103,10 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 	}
 	[dict removeAllObjects];
 	
+	[self removeAllSlots];
+	free(slotKeys);
+	free(slotInfos);
+	
 	#if !OS_OBJECT_USE_OBJC
 	dispatch_release(queue);
 	#endif
@@ -128,7 +161,7 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 {
 	AssertProperQueue();
 	
-	dict[elementID] = trackingInfo;
+	[self setInfo:trackingInfo forID:elementID];
 	
 	[trackingInfo setElementID:elementID];
 	[trackingInfo createTimerWithDispatchQueue:queue];
@@ -140,7 +173,7 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
     
     if([[element elementID] length] == 0) return;
 	
-	dict[[element elementID]] = trackingInfo;
+	[self setInfo:trackingInfo forID:[element elementID]];
 	
 	[trackingInfo setElementID:[element elementID]];
     [trackingInfo setElement:element];
@@ -153,13 +186,13 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
     
     if([elementID length] == 0) return NO;
 	
-	id <XMPPTrackingInfo> info = dict[elementID];
+	id <XMPPTrackingInfo> info = [self infoForID:elementID];
     
 	if (info)
 	{
 		[info invokeWithObject:obj];
 		[info cancelTimer];
-		[dict removeObjectForKey:elementID];
+		[self removeInfoForID:elementID];
 		
 		return YES;
 	}
@@ -175,7 +208,7 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 	
 	if ([elementID length] == 0) return NO;
 	
-	id <XMPPTrackingInfo> info = dict[elementID];
+	id <XMPPTrackingInfo> info = [self infoForID:elementID];
 	if(info)
     {
         BOOL valid = YES;
@@ -199,7 +232,7 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
         {
             [info invokeWithObject:obj];
             [info cancelTimer];
-            [dict removeObjectForKey:[element elementID]];
+            [self removeInfoForID:elementID];
             
             return YES;
         }
@@ -212,18 +245,18 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 {
     AssertProperQueue();
 	
-	return [[dict allKeys] count];
+	return [dict count] + slotCount;
 }
 
 - (void)removeID:(NSString *)elementID
 {
 	AssertProperQueue();
 	
-	id <XMPPTrackingInfo> info = dict[elementID];
+	id <XMPPTrackingInfo> info = [self infoForID:elementID];
 	if (info)
 	{
 		[info cancelTimer];
-		[dict removeObjectForKey:elementID];
+		[self removeInfoForID:elementID];
 	}
 }
 
@@ -236,6 +269,220 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 		[info cancelTimer];
 	}
 	[dict removeAllObjects];
+	
+	[self removeAllSlots];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Storage
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (id <XMPPTrackingInfo>)infoForID:(NSString *)elementID
+{
+	uint64_t key;
+	if ([[self class] getValue:&key fromCompactID:elementID])
+	{
+		NSUInteger index = [self slotIndexForKey:key];
+		
+		if (slotKeys[index] == key)
+			return (__bridge id <XMPPTrackingInfo>)slotInfos[index];
+		else
+			return nil;
+	}
+	
+	return dict[elementID];
+}
+
+- (void)setInfo:(id <XMPPTrackingInfo>)info forID:(NSString *)elementID
+{
+	uint64_t key;
+	if ([[self class] getValue:&key fromCompactID:elementID])
+	{
+		if ((slotCount + 1) * 2 > slotCapacity)
+		{
+			[self growSlots];
+		}
+		
+		NSUInteger index = [self slotIndexForKey:key];
+		
+		if (slotKeys[index] == key)
+		{
+			CFRelease(slotInfos[index]);
+		}
+		else
+		{
+			slotKeys[index] = key;
+			slotCount++;
+		}
+		slotInfos[index] = (void *)CFBridgingRetain(info);
+	}
+	else
+	{
+		dict[elementID] = info;
+	}
+}
+
+- (void)removeInfoForID:(NSString *)elementID
+{
+	uint64_t key;
+	if (![[self class] getValue:&key fromCompactID:elementID])
+	{
+		[dict removeObjectForKey:elementID];
+		return;
+	}
+	
+	NSUInteger mask = slotCapacity - 1;
+	NSUInteger i = [self slotIndexForKey:key];
+	
+	if (slotKeys[i] != key) return;
+	
+	void *removedInfo = slotInfos[i];
+	
+	// Backward shift deletion:
+	// Move any following entries of the probe sequence into the hole,
+	// so that lookups never need tombstones.
+	
+	NSUInteger j = (i + 1) & mask;
+	while (slotKeys[j] != 0)
+	{
+		NSUInteger home = [self homeIndexForKey:slotKeys[j]];
+		
+		BOOL canMove;
+		if (i <= j)
+			canMove = (home <= i) || (home > j);
+		else
+			canMove = (home <= i) && (home > j);
+		
+		if (canMove)
+		{
+			slotKeys[i] = slotKeys[j];
+			slotInfos[i] = slotInfos[j];
+			i = j;
+		}
+		
+		j = (j + 1) & mask;
+	}
+	
+	slotKeys[i] = 0;
+	slotInfos[i] = NULL;
+	slotCount--;
+	
+	// Released last, as the info's dealloc may re-enter the tracker
+	CFRelease(removedInfo);
+}
+
+- (void)removeAllSlots
+{
+	for (NSUInteger i = 0; i < slotCapacity; i++)
+	{
+		if (slotKeys[i] != 0)
+		{
+			id <XMPPTrackingInfo> info = (__bridge_transfer id <XMPPTrackingInfo>)slotInfos[i];
+			
+			slotKeys[i] = 0;
+			slotInfos[i] = NULL;
+			
+			[info cancelTimer];
+		}
+	}
+	slotCount = 0;
+}
+
+- (NSUInteger)homeIndexForKey:(uint64_t)key
+{
+	return XMPPIDTrackerHomeIndex(key, slotCapacity);
+}
+
+- (NSUInteger)slotIndexForKey:(uint64_t)key
+{
+	// Returns the index of the slot holding the key, or else the empty slot where it would be inserted.
+	// The table is never more than half full, so the loop always terminates.
+	
+	NSUInteger mask = slotCapacity - 1;
+	NSUInteger index = [self homeIndexForKey:key];
+	
+	while (slotKeys[index] != 0 && slotKeys[index] != key)
+	{
+		index = (index + 1) & mask;
+	}
+	
+	return index;
+}
+
+- (void)growSlots
+{
+	uint64_t *oldKeys = slotKeys;
+	void **oldInfos = slotInfos;
+	NSUInteger oldCapacity = slotCapacity;
+	
+	slotCapacity = oldCapacity * 2;
+	slotKeys = calloc(slotCapacity, sizeof(uint64_t));
+	slotInfos = calloc(slotCapacity, sizeof(void *));
+	
+	for (NSUInteger i = 0; i < oldCapacity; i++)
+	{
+		if (oldKeys[i] != 0)
+		{
+			NSUInteger index = [self slotIndexForKey:oldKeys[i]];
+			
+			slotKeys[index] = oldKeys[i];
+			slotInfos[index] = oldInfos[i];
+		}
+	}
+	
+	free(oldKeys);
+	free(oldInfos);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Compact IDs
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
++ (NSString *)compactIDWithValue:(uint64_t)value
+{
+	NSParameterAssert(value != 0);
+	
+	char buffer[XMPP_COMPACT_ID_MAX_LENGTH];
+	NSUInteger offset = XMPP_COMPACT_ID_MAX_LENGTH;
+	
+	do
+	{
+		buffer[--offset] = XMPPCompactIDDigits[value % 62];
+		value /= 62;
+		
+	} while (value > 0);
+	
+	return [[NSString alloc] initWithBytes:(buffer + offset)
+	                                length:(XMPP_COMPACT_ID_MAX_LENGTH - offset)
+	                              encoding:NSASCIIStringEncoding];
+}
+
++ (BOOL)getValue:(uint64_t *)valuePtr fromCompactID:(NSString *)elementID
+{
+	NSUInteger length = [elementID length];
+	if (length == 0 || length > XMPP_COMPACT_ID_MAX_LENGTH) return NO;
+	
+	unichar buffer[XMPP_COMPACT_ID_MAX_LENGTH];
+	[elementID getCharacters:buffer range:NSMakeRange(0, length)];
+	
+	// Only the canonical encoding (no leading zeros) is a compact id,
+	// so that distinct ids never map to the same value.
+	if (buffer[0] == '0') return NO;
+	
+	uint64_t value = 0;
+	
+	for (NSUInteger i = 0; i < length; i++)
+	{
+		int digit = XMPPCompactIDDigitValue(buffer[i]);
+		if (digit < 0) return NO;
+		
+		if (value > ((UINT64_MAX - (uint64_t)digit) / 62)) return NO; // Overflow
+		
+		value = (value * 62) + (uint64_t)digit;
+	}
+	
+	if (valuePtr) *valuePtr = value;
+	return YES;
 }
 
 @end
@@ -301,19 +548,17 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 	
 	if (timeout > 0.0)
 	{
-		timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+		// Most requests are answered long before they time out,
+		// so the timeouts share the process-wide timing wheel instead of each creating a kernel timer.
 		
-		dispatch_source_set_event_handler(timer, ^{ @autoreleasepool {
+		timer = [[XMPPTimer alloc] initWithQueue:queue timingWheel:nil eventHandler:^{ @autoreleasepool {
 			
 			[self invokeWithObject:nil];
             [self cancelTimer];
             
-		}});
-		
-		dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (timeout * NSEC_PER_SEC));
+		}}];
 		
-		dispatch_source_set_timer(timer, tt, DISPATCH_TIME_FOREVER, 0);
-		dispatch_resume(timer);
+		[timer startWithTimeout:timeout interval:0];
 	}
 }
 
@@ -321,11 +566,8 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 {
 	if (timer)
 	{
-		dispatch_source_cancel(timer);
-		#if !OS_OBJECT_USE_OBJC
-		dispatch_release(timer);
-		#endif
-		timer = NULL;
+		[timer cancel];
+		timer = nil;
 	}
 }
 
@@ -0,0 +1,19 @@
+//
+//  This file is for XMPPIDTracker and its tests.
+//
+
+#import <Foundation/Foundation.h>
+#import "XMPPIDTracker.h"
+
+// Define the initial capacity of the compact id table (must be a power of 2)
+#define XMPP_ID_TRACKER_INITIAL_SLOT_CAPACITY 16
+
+/**
+ * Returns the home slot of the given compact id value, in a table of the given capacity (a power of 2).
+ * 
+ * Fibonacci hashing, as consecutive counter values would otherwise cluster.
+**/
+static inline NSUInteger XMPPIDTrackerHomeIndex(uint64_t key, NSUInteger capacity)
+{
+	return (NSUInteger)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
@@ -0,0 +1,103 @@
+#import <Foundation/Foundation.h>
+
+@import KissXML;
+
+@class XMPPOutputBuffer;
+
+/**
+ * XMPPStanzaSerializer converts an element tree directly into escaped UTF-8 bytes.
+ *
+ * The traditional way of sending an element is:
+ *
+ * NSString *str = [element compactXMLString];                // builds the entire stanza as an NSString
+ * NSData *data = [str dataUsingEncoding:NSUTF8StringEncoding]; // then copies it all again
+ *
+ * The serializer instead walks the element tree and writes the escaped UTF-8 output
+ * straight into an XMPPOutputBuffer, which is taken from (and later returned to) an XMPPOutputBufferPool.
+ * There is no intermediate string representation of the stanza,
+ * and in the steady state the output buffers are simply reused.
+ *
+ * This class is NOT thread-safe.
+ * It is designed to be used within a thread-safe context (e.g. within a single dispatch_queue).
+**/
+@interface XMPPStanzaSerializer : NSObject
+
+/**
+ * Serializes the given element (and its entire subtree) into the given buffer.
+ * The output is appended to any bytes already in the buffer.
+ *
+ * Returns the number of bytes written, or zero if the element could not be serialized
+ * (e.g. it contains a malformed string). In the latter case the buffer is restored to its original length.
+**/
++ (NSUInteger)serializeElement:(NSXMLElement *)element intoBuffer:(XMPPOutputBuffer *)buffer;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A growable byte buffer used as the target for serialized output.
+ *
+ * Buffers are grouped into size classes (based on their capacity) by the XMPPOutputBufferPool.
+**/
+@interface XMPPOutputBuffer : NSObject
+
+@property (nonatomic, readonly) NSUInteger length;
+@property (nonatomic, readonly) NSUInteger capacity;
+
+/**
+ * Appends the given bytes, growing the buffer if needed.
+ * Returns NO if the buffer could not be grown.
+**/
+- (BOOL)appendBytes:(const void *)bytes length:(NSUInteger)length;
+
+/**
+ * Returns an NSData instance that references (but does NOT copy) the bytes of the buffer.
+ *
+ * The returned data is only valid until the buffer is reset or recycled.
+ * So the buffer must not be returned to the pool until the data is no longer in use.
+ * (E.g. until the socket has reported the data as written.)
+**/
+- (NSData *)data;
+
+/**
+ * Sets the length to zero, while retaining the capacity.
+**/
+- (void)reset;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A small pool of reusable output buffers, organized in size classes.
+ *
+ * The size classes are 512 bytes, 2 KB, 8 KB, 32 KB, 128 KB and 512 KB.
+ * Buffers that have grown beyond the largest size class are not pooled, and are simply released.
+ *
+ * This class is NOT thread-safe.
+ * It is designed to be used within a thread-safe context (e.g. within a single dispatch_queue).
+**/
+@interface XMPPOutputBufferPool : NSObject
+
+/**
+ * Returns an empty buffer with at least the given capacity.
+ * A pooled buffer is returned if one is available, otherwise a new buffer is allocated.
+**/
+- (XMPPOutputBuffer *)bufferWithMinimumCapacity:(NSUInteger)capacity;
+
+/**
+ * Returns the given buffer to the pool so that it may be reused.
+**/
+- (void)recycleBuffer:(XMPPOutputBuffer *)buffer;
+
+/**
+ * Releases all pooled buffers.
+**/
+- (void)removeAllBuffers;
+
+@end
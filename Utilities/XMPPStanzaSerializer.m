@@ -0,0 +1,403 @@
+#import "XMPPStanzaSerializer.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Size classes are: 512 << (2 * index)
+// That is: 512 bytes, 2 KB, 8 KB, 32 KB, 128 KB, 512 KB
+#define XMPP_OUTPUT_BUFFER_MIN_CAPACITY    512
+#define XMPP_OUTPUT_BUFFER_NUM_CLASSES       6
+#define XMPP_OUTPUT_BUFFER_MAX_PER_CLASS     8
+
+// Size of the stack buffer used to transcode strings into UTF-8
+#define XMPP_SERIALIZER_CHUNK_SIZE         256
+
+static NSUInteger XMPPOutputBufferCapacityForSizeClass(NSUInteger sizeClass)
+{
+	return ((NSUInteger)XMPP_OUTPUT_BUFFER_MIN_CAPACITY) << (2 * sizeClass);
+}
+
+@interface XMPPOutputBuffer ()
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity;
+
+- (BOOL)ensureSpace:(NSUInteger)needed;
+- (void)truncateToLength:(NSUInteger)length;
+
+@end
+
+@implementation XMPPOutputBuffer
+{
+	uint8_t *bytes;
+	NSUInteger length;
+	NSUInteger capacity;
+}
+
+@synthesize length = length;
+@synthesize capacity = capacity;
+
+- (instancetype)initWithCapacity:(NSUInteger)inCapacity
+{
+	if ((self = [super init]))
+	{
+		capacity = MAX(inCapacity, (NSUInteger)XMPP_OUTPUT_BUFFER_MIN_CAPACITY);
+		bytes = malloc(capacity);
+
+		if (bytes == NULL) {
+			return nil;
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	if (bytes) {
+		free(bytes);
+	}
+}
+
+- (BOOL)ensureSpace:(NSUInteger)needed
+{
+	if ((capacity - length) >= needed) return YES;
+
+	NSUInteger newCapacity = capacity;
+	while ((newCapacity - length) < needed)
+	{
+		newCapacity *= 2;
+	}
+
+	uint8_t *newBytes = realloc(bytes, newCapacity);
+	if (newBytes == NULL) return NO;
+
+	bytes = newBytes;
+	capacity = newCapacity;
+
+	return YES;
+}
+
+- (BOOL)appendBytes:(const void *)inBytes length:(NSUInteger)inLength
+{
+	if (inLength == 0) return YES;
+	if (![self ensureSpace:inLength]) return NO;
+
+	memcpy(bytes + length, inBytes, inLength);
+	length += inLength;
+
+	return YES;
+}
+
+- (NSData *)data
+{
+	return [NSData dataWithBytesNoCopy:bytes length:length freeWhenDone:NO];
+}
+
+- (void)reset
+{
+	length = 0;
+}
+
+- (void)truncateToLength:(NSUInteger)newLength
+{
+	if (newLength < length) {
+		length = newLength;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Serialization
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The serialization functions are defined within the implementation of XMPPOutputBuffer,
+// which gives them direct access to the buffer's ivars.
+// This keeps the (very hot) inner loops free of objc_msgSend calls.
+
+static inline BOOL xmpp_appendLiteral(XMPPOutputBuffer *buffer, const char *literal, NSUInteger literalLength)
+{
+	if ((buffer->capacity - buffer->length) < literalLength)
+	{
+		if (![buffer ensureSpace:literalLength]) return NO;
+	}
+
+	memcpy(buffer->bytes + buffer->length, literal, literalLength);
+	buffer->length += literalLength;
+
+	return YES;
+}
+
+#define APPEND_LITERAL(buffer, str) xmpp_appendLiteral(buffer, str, sizeof(str) - 1)
+
+/**
+ * Appends the given UTF-8 bytes, escaping the characters that must not appear literally in xml.
+ *
+ * Within attribute values we additionally escape the double-quote (our attribute delimiter),
+ * along with newlines and tabs, which would otherwise be normalized away by the receiving parser.
+**/
+static BOOL xmpp_appendEscapedUTF8(XMPPOutputBuffer *buffer, const uint8_t *src, NSUInteger srcLength, BOOL isAttr)
+{
+	NSUInteger start = 0;
+
+	for (NSUInteger i = 0; i < srcLength; i++)
+	{
+		const char *entity;
+		NSUInteger entityLength;
+
+		switch (src[i])
+		{
+			case '&'  : entity = "&amp;";  entityLength = 5; break;
+			case '<'  : entity = "&lt;";   entityLength = 4; break;
+			case '>'  : entity = "&gt;";   entityLength = 4; break;
+			case '\r' : entity = "&#13;";  entityLength = 5; break;
+			case '"'  : if (!isAttr) continue; entity = "&quot;"; entityLength = 6; break;
+			case '\n' : if (!isAttr) continue; entity = "&#10;";  entityLength = 5; break;
+			case '\t' : if (!isAttr) continue; entity = "&#9;";   entityLength = 4; break;
+			default   : continue;
+		}
+
+		if (!xmpp_appendLiteral(buffer, (const char *)(src + start), i - start)) return NO;
+		if (!xmpp_appendLiteral(buffer, entity, entityLength)) return NO;
+
+		start = i + 1;
+	}
+
+	return xmpp_appendLiteral(buffer, (const char *)(src + start), srcLength - start);
+}
+
+/**
+ * Transcodes the given string into UTF-8, in small chunks via a stack buffer,
+ * and appends it (optionally escaped) to the output buffer.
+**/
+static BOOL xmpp_appendString(XMPPOutputBuffer *buffer, NSString *string, BOOL escape, BOOL isAttr)
+{
+	NSUInteger stringLength = [string length];
+	if (stringLength == 0) return YES;
+
+	uint8_t chunk[XMPP_SERIALIZER_CHUNK_SIZE];
+	NSRange range = NSMakeRange(0, stringLength);
+
+	while (range.length > 0)
+	{
+		NSUInteger used = 0;
+		NSRange remaining = NSMakeRange(0, 0);
+
+		[string getBytes:chunk
+		       maxLength:sizeof(chunk)
+		      usedLength:&used
+		        encoding:NSUTF8StringEncoding
+		         options:0
+		           range:range
+		  remainingRange:&remaining];
+
+		if (used == 0)
+		{
+			// The string contains something that can't be represented in UTF-8 (e.g. an unpaired surrogate)
+			return NO;
+		}
+
+		BOOL result;
+		if (escape)
+			result = xmpp_appendEscapedUTF8(buffer, chunk, used, isAttr);
+		else
+			result = xmpp_appendLiteral(buffer, (const char *)chunk, used);
+
+		if (!result) return NO;
+
+		range = remaining;
+	}
+
+	return YES;
+}
+
+static BOOL xmpp_appendElement(XMPPOutputBuffer *buffer, NSXMLElement *element)
+{
+	NSString *name = [element name];
+
+	if (!APPEND_LITERAL(buffer, "<")) return NO;
+	if (!xmpp_appendString(buffer, name, NO, NO)) return NO;
+
+	for (NSXMLNode *ns in [element namespaces])
+	{
+		NSString *prefix = [ns name];
+
+		if ([prefix length] > 0)
+		{
+			if (!APPEND_LITERAL(buffer, " xmlns:")) return NO;
+			if (!xmpp_appendString(buffer, prefix, NO, NO)) return NO;
+			if (!APPEND_LITERAL(buffer, "=\"")) return NO;
+		}
+		else
+		{
+			if (!APPEND_LITERAL(buffer, " xmlns=\"")) return NO;
+		}
+
+		if (!xmpp_appendString(buffer, [ns stringValue], YES, YES)) return NO;
+		if (!APPEND_LITERAL(buffer, "\"")) return NO;
+	}
+
+	for (NSXMLNode *attr in [element attributes])
+	{
+		if (!APPEND_LITERAL(buffer, " ")) return NO;
+		if (!xmpp_appendString(buffer, [attr name], NO, NO)) return NO;
+		if (!APPEND_LITERAL(buffer, "=\"")) return NO;
+		if (!xmpp_appendString(buffer, [attr stringValue], YES, YES)) return NO;
+		if (!APPEND_LITERAL(buffer, "\"")) return NO;
+	}
+
+	NSArray *children = [element children];
+
+	if ([children count] == 0)
+	{
+		// Equivalent to NSXMLNodeCompactEmptyElement
+		return APPEND_LITERAL(buffer, "/>");
+	}
+
+	if (!APPEND_LITERAL(buffer, ">")) return NO;
+
+	for (NSXMLNode *child in children)
+	{
+		NSXMLNodeKind kind = [child kind];
+
+		if (kind == NSXMLElementKind)
+		{
+			if (!xmpp_appendElement(buffer, (NSXMLElement *)child)) return NO;
+		}
+		else if (kind == NSXMLTextKind)
+		{
+			if (!xmpp_appendString(buffer, [child stringValue], YES, NO)) return NO;
+		}
+
+		// Comments and processing instructions are not allowed in xmpp streams, and are skipped.
+	}
+
+	if (!APPEND_LITERAL(buffer, "</")) return NO;
+	if (!xmpp_appendString(buffer, name, NO, NO)) return NO;
+
+	return APPEND_LITERAL(buffer, ">");
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPStanzaSerializer
+
++ (NSUInteger)serializeElement:(NSXMLElement *)element intoBuffer:(XMPPOutputBuffer *)buffer
+{
+	if (element == nil || buffer == nil) return 0;
+
+	NSUInteger originalLength = [buffer length];
+
+	if (!xmpp_appendElement(buffer, element))
+	{
+		[buffer truncateToLength:originalLength];
+		return 0;
+	}
+
+	return [buffer length] - originalLength;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPOutputBufferPool
+{
+	NSMutableArray *sizeClasses[XMPP_OUTPUT_BUFFER_NUM_CLASSES];
+}
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		for (NSUInteger i = 0; i < XMPP_OUTPUT_BUFFER_NUM_CLASSES; i++)
+		{
+			sizeClasses[i] = [[NSMutableArray alloc] initWithCapacity:XMPP_OUTPUT_BUFFER_MAX_PER_CLASS];
+		}
+	}
+	return self;
+}
+
+/**
+ * Returns the smallest size class that can hold the given capacity,
+ * or NSNotFound if it's larger than the largest size class.
+**/
+static NSUInteger XMPPOutputBufferSizeClassForCapacity(NSUInteger capacity)
+{
+	for (NSUInteger i = 0; i < XMPP_OUTPUT_BUFFER_NUM_CLASSES; i++)
+	{
+		if (capacity <= XMPPOutputBufferCapacityForSizeClass(i)) return i;
+	}
+
+	return NSNotFound;
+}
+
+- (XMPPOutputBuffer *)bufferWithMinimumCapacity:(NSUInteger)capacity
+{
+	NSUInteger sizeClass = XMPPOutputBufferSizeClassForCapacity(capacity);
+
+	if (sizeClass == NSNotFound)
+	{
+		return [[XMPPOutputBuffer alloc] initWithCapacity:capacity];
+	}
+
+	// Prefer a buffer from the requested size class,
+	// but we'll happily take a larger buffer over allocating a new one.
+
+	for (NSUInteger i = sizeClass; i < XMPP_OUTPUT_BUFFER_NUM_CLASSES; i++)
+	{
+		XMPPOutputBuffer *buffer = [sizeClasses[i] lastObject];
+		if (buffer)
+		{
+			[sizeClasses[i] removeLastObject];
+			return buffer;
+		}
+	}
+
+	return [[XMPPOutputBuffer alloc] initWithCapacity:XMPPOutputBufferCapacityForSizeClass(sizeClass)];
+}
+
+- (void)recycleBuffer:(XMPPOutputBuffer *)buffer
+{
+	if (buffer == nil) return;
+
+	// A buffer that has grown is filed under the largest size class it fully satisfies.
+	// Buffers that have grown beyond the largest size class are simply released.
+
+	NSUInteger capacity = [buffer capacity];
+	if (capacity > XMPPOutputBufferCapacityForSizeClass(XMPP_OUTPUT_BUFFER_NUM_CLASSES - 1)) return;
+
+	NSUInteger sizeClass = NSNotFound;
+
+	for (NSUInteger i = XMPP_OUTPUT_BUFFER_NUM_CLASSES; i > 0; i--)
+	{
+		if (capacity >= XMPPOutputBufferCapacityForSizeClass(i - 1))
+		{
+			sizeClass = i - 1;
+			break;
+		}
+	}
+
+	if (sizeClass == NSNotFound) return;
+
+	NSMutableArray *pool = sizeClasses[sizeClass];
+	if ([pool count] < XMPP_OUTPUT_BUFFER_MAX_PER_CLASS)
+	{
+		[buffer reset];
+		[pool addObject:buffer];
+	}
+}
+
+- (void)removeAllBuffers
+{
+	for (NSUInteger i = 0; i < XMPP_OUTPUT_BUFFER_NUM_CLASSES; i++)
+	{
+		[sizeClasses[i] removeAllObjects];
+	}
+}
+
+@end
@@ -1,13 +1,199 @@
 #import "XMPPStringPrep.h"
 #import "stringprep.h"
 
+// Each allowable portion of a JID MUST NOT be more than 1023 bytes in length.
+#define XMPP_STRINGPREP_MAX_LENGTH 1023
+
+#define XMPP_ASCII_WORD(b) ((uint64_t)(b) * 0x0101010101010101ULL)
+
+/**
+ * Most JID parts are plain ASCII, for which the stringprep profiles reduce to a few simple rules.
+ * From RFC 3454 (tables B.2, C.1.1, C.2.1), RFC 3491 (nameprep) and RFC 6122 (nodeprep, resourceprep):
+ * 
+ * - nodeprep     : case folds A-Z, and prohibits space, control characters, and " & ' / : < > @
+ * - nameprep     : case folds A-Z, and prohibits nothing in the ASCII range
+ * - resourceprep : no case folding, and prohibits control characters (but not space)
+ * 
+ * NFKC normalization and the bidi rules have no effect on ASCII strings.
+ * 
+ * So for ASCII strings, we classify each character with a lookup table,
+ * and then either return the string as is, lowercase it, or reject it, without entering libidn.
+ * Anything else (non-ASCII, NUL characters, empty or overlong strings) goes through libidn as before.
+**/
+typedef NS_ENUM(uint8_t, XMPPStringPrepProfile) {
+	XMPPStringPrepProfileNode     = 0,
+	XMPPStringPrepProfileDomain   = 1,
+	XMPPStringPrepProfileResource = 2,
+};
+
+enum {
+	XMPPASCIIClassUpper      = 1 << 0, // Case folded by nodeprep and nameprep
+	XMPPASCIIClassNUL        = 1 << 1, // Truncates the UTF8String, so leave it to libidn
+	XMPPASCIIClassControl    = 1 << 2, // Prohibited by nodeprep and resourceprep (C.2.1)
+	XMPPASCIIClassSpace      = 1 << 3, // Prohibited by nodeprep (C.1.1)
+	XMPPASCIIClassNodeSymbol = 1 << 4, // Prohibited by nodeprep
+};
+
+typedef NS_ENUM(NSInteger, XMPPASCIIPrepResult) {
+	XMPPASCIIPrepResultUnchanged,
+	XMPPASCIIPrepResultFolded,
+	XMPPASCIIPrepResultProhibited,
+	XMPPASCIIPrepResultNeedsFullPrep,
+};
+
+static uint8_t XMPPASCIIClassTable[128];
+
+static const uint8_t XMPPASCIIProhibitedMask[3] = {
+	XMPPASCIIClassControl | XMPPASCIIClassSpace | XMPPASCIIClassNodeSymbol, // nodeprep
+	0,                                                                       // nameprep
+	XMPPASCIIClassControl,                                                   // resourceprep
+};
+
+static const BOOL XMPPASCIIFoldsCase[3] = {
+	YES, // nodeprep
+	YES, // nameprep
+	NO,  // resourceprep
+};
+
+static inline uint64_t XMPPASCIILowercaseWord(uint64_t w)
+{
+	// For a word of 8 ASCII bytes, sets bit 0x20 of every byte in the range A-Z.
+	// Adding (0x80 - c) to a byte sets its high bit iff the byte is >= c, and never carries into the next byte.
+	
+	uint64_t geA = w + XMPP_ASCII_WORD(0x80 - 'A');
+	uint64_t gtZ = w + XMPP_ASCII_WORD(0x80 - 'Z' - 1);
+	
+	uint64_t upper = (geA & ~gtZ) & XMPP_ASCII_WORD(0x80);
+	
+	return w | (upper >> 2);
+}
+
+/**
+ * Classifies (and if needed case folds, in place) the given ASCII bytes.
+**/
+static XMPPASCIIPrepResult XMPPASCIIPrep(uint8_t *bytes, NSUInteger length, XMPPStringPrepProfile profile)
+{
+	uint8_t classes = 0;
+	NSUInteger i = 0;
+	
+	// Process 8 bytes at a time, bailing out as soon as a non-ASCII byte shows up
+	for (; i + 8 <= length; i += 8)
+	{
+		uint64_t w;
+		memcpy(&w, bytes + i, 8);
+		
+		if (w & XMPP_ASCII_WORD(0x80)) return XMPPASCIIPrepResultNeedsFullPrep;
+		
+		classes |= XMPPASCIIClassTable[bytes[i + 0]] | XMPPASCIIClassTable[bytes[i + 1]]
+		         | XMPPASCIIClassTable[bytes[i + 2]] | XMPPASCIIClassTable[bytes[i + 3]]
+		         | XMPPASCIIClassTable[bytes[i + 4]] | XMPPASCIIClassTable[bytes[i + 5]]
+		         | XMPPASCIIClassTable[bytes[i + 6]] | XMPPASCIIClassTable[bytes[i + 7]];
+	}
+	for (; i < length; i++)
+	{
+		if (bytes[i] & 0x80) return XMPPASCIIPrepResultNeedsFullPrep;
+		
+		classes |= XMPPASCIIClassTable[bytes[i]];
+	}
+	
+	if (classes & XMPPASCIIClassNUL) return XMPPASCIIPrepResultNeedsFullPrep;
+	
+	if (classes & XMPPASCIIProhibitedMask[profile]) return XMPPASCIIPrepResultProhibited;
+	
+	if (!(classes & XMPPASCIIClassUpper) || !XMPPASCIIFoldsCase[profile]) return XMPPASCIIPrepResultUnchanged;
+	
+	for (i = 0; i + 8 <= length; i += 8)
+	{
+		uint64_t w;
+		memcpy(&w, bytes + i, 8);
+		
+		w = XMPPASCIILowercaseWord(w);
+		memcpy(bytes + i, &w, 8);
+	}
+	for (; i < length; i++)
+	{
+		if (bytes[i] >= 'A' && bytes[i] <= 'Z') bytes[i] |= 0x20;
+	}
+	
+	return XMPPASCIIPrepResultFolded;
+}
+
+@interface XMPPStringPrep ()
+
++ (NSString *)prepASCII:(NSString *)string profile:(XMPPStringPrepProfile)profile handled:(BOOL *)handledPtr;
+
+@end
+
 
 @implementation XMPPStringPrep
 
++ (void)initialize
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		
+		XMPPASCIIClassTable[0] = XMPPASCIIClassNUL;
+		
+		for (int c = 0x01; c < 0x20; c++) XMPPASCIIClassTable[c] = XMPPASCIIClassControl;
+		XMPPASCIIClassTable[0x7F] = XMPPASCIIClassControl;
+		
+		XMPPASCIIClassTable[' '] = XMPPASCIIClassSpace;
+		
+		const char *nodeSymbols = "\"&'/:<>@";
+		for (const char *p = nodeSymbols; *p; p++) XMPPASCIIClassTable[(uint8_t)*p] = XMPPASCIIClassNodeSymbol;
+		
+		for (int c = 'A'; c <= 'Z'; c++) XMPPASCIIClassTable[c] = XMPPASCIIClassUpper;
+	});
+}
+
++ (NSString *)prepASCII:(NSString *)string profile:(XMPPStringPrepProfile)profile handled:(BOOL *)handledPtr
+{
+	*handledPtr = NO;
+	
+	NSUInteger length = [string length];
+	if (length == 0 || length > XMPP_STRINGPREP_MAX_LENGTH) return nil;
+	
+	uint8_t buf[XMPP_STRINGPREP_MAX_LENGTH];
+	NSUInteger usedLength = 0;
+	NSRange remainingRange = NSMakeRange(0, 0);
+	
+	BOOL ascii = [string getBytes:buf
+	                    maxLength:sizeof(buf)
+	                   usedLength:&usedLength
+	                     encoding:NSASCIIStringEncoding
+	                      options:0
+	                        range:NSMakeRange(0, length)
+	               remainingRange:&remainingRange];
+	
+	if (!ascii || remainingRange.length > 0 || usedLength != length) return nil;
+	
+	switch (XMPPASCIIPrep(buf, usedLength, profile))
+	{
+		case XMPPASCIIPrepResultUnchanged:
+			*handledPtr = YES;
+			return [string copy];
+			
+		case XMPPASCIIPrepResultFolded:
+			*handledPtr = YES;
+			return [[NSString alloc] initWithBytes:buf length:usedLength encoding:NSASCIIStringEncoding];
+			
+		case XMPPASCIIPrepResultProhibited:
+			*handledPtr = YES;
+			return nil;
+			
+		default:
+			return nil;
+	}
+}
+
 + (NSString *)prepNode:(NSString *)node
 {
 	if(node == nil) return nil;
 	
+	BOOL handled;
+	NSString *result = [self prepASCII:node profile:XMPPStringPrepProfileNode handled:&handled];
+	if (handled) return result;
+	
 	// Each allowable portion of a JID MUST NOT be more than 1023 bytes in length.
 	// We make the buffer just big enough to hold a null-terminated string of this length. 
 	char buf[1024];
@@ -23,6 +209,10 @@
 {
 	if(domain == nil) return nil;
 	
+	BOOL handled;
+	NSString *result = [self prepASCII:domain profile:XMPPStringPrepProfileDomain handled:&handled];
+	if (handled) return result;
+	
 	// Each allowable portion of a JID MUST NOT be more than 1023 bytes in length.
 	// We make the buffer just big enough to hold a null-terminated string of this length. 
 	char buf[1024];
@@ -38,6 +228,10 @@
 {
 	if(resource == nil) return nil;
 	
+	BOOL handled;
+	NSString *result = [self prepASCII:resource profile:XMPPStringPrepProfileResource handled:&handled];
+	if (handled) return result;
+	
 	// Each allowable portion of a JID MUST NOT be more than 1023 bytes in length.
 	// We make the buffer just big enough to hold a null-terminated string of this length. 
 	char buf[1024];
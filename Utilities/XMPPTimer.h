@@ -1,10 +1,16 @@
 #import <Foundation/Foundation.h>
 
+@class XMPPTimingWheel;
+
 /**
  * This class is a simple wrapper around dispatch_source_t timers.
  * 
  * The primary motivation for this is to allow timers to be stored in collections.
  * But the class also makes it easier to code timers, as it simplifies the API.
+ * 
+ * A timer may alternatively be backed by a timing wheel (see XMPPTimingWheel),
+ * which is preferable for the many short-lived timeouts (e.g. for outstanding requests)
+ * that are usually cancelled long before they fire.
 **/
 @interface XMPPTimer : NSObject
 
@@ -14,6 +20,17 @@
 **/
 - (instancetype)initWithQueue:(dispatch_queue_t)queue eventHandler:(dispatch_block_t)block;
 
+/**
+ * Creates an instance of a timer that is scheduled on the given timing wheel,
+ * instead of using its own dispatch_source.
+ * 
+ * Its accuracy is limited to the tickInterval of the wheel. (It never fires early.)
+ * If the given wheel is nil, the sharedTimingWheel is used.
+**/
+- (instancetype)initWithQueue:(dispatch_queue_t)queue
+                  timingWheel:(XMPPTimingWheel *)wheel
+                 eventHandler:(dispatch_block_t)block;
+
 /**
  * Starts the timer.
  * It will first fire after the timeout.
@@ -39,3 +56,51 @@
 - (void)cancel;
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A hierarchical timing wheel, which multiplexes any number of one-shot timeouts onto a single dispatch_source.
+ * 
+ * Scheduling and cancelling a timeout are O(1) operations, regardless of the number of pending timeouts.
+ * The price is accuracy: timeouts fire on the first tick of the wheel at or after their deadline.
+ * 
+ * The wheel has two levels:
+ * - 256 slots of one tick each
+ * - 64 slots of 256 ticks each (timeouts are moved down to the first level as they approach)
+ * Timeouts beyond the range of the second level are kept aside, and reconsidered whenever it wraps around.
+ * 
+ * The underlying timer only runs while timeouts are pending.
+ * 
+ * This class is thread-safe.
+**/
+@interface XMPPTimingWheel : NSObject
+
+/**
+ * The process-wide wheel, with a tickInterval of 100 milliseconds.
+ * This is what XMPPStream, XMPPIDTracker and the various modules use for their timeouts.
+**/
++ (XMPPTimingWheel *)sharedTimingWheel;
+
+- (instancetype)initWithTickInterval:(NSTimeInterval)tickInterval;
+
+@property (nonatomic, readonly) NSTimeInterval tickInterval;
+
+/**
+ * Schedules the given block to be invoked (asynchronously) on the given queue after the given delay.
+ * 
+ * Returns an opaque token that may be passed to cancelScheduledBlock:.
+**/
+- (id)scheduleBlock:(dispatch_block_t)block onQueue:(dispatch_queue_t)queue afterDelay:(NSTimeInterval)delay;
+
+/**
+ * Cancels a scheduled block.
+ * 
+ * If invoked on the queue the block was scheduled on, it's guaranteed that the block won't be invoked.
+ * Otherwise the block might already be on its way.
+**/
+- (void)cancelScheduledBlock:(id)token;
+
+@end
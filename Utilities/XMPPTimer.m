@@ -1,5 +1,7 @@
 #import "XMPPTimer.h"
 #import "XMPPLogging.h"
+#import <libkern/OSAtomic.h>
+#import <mach/mach_time.h>
 
 // Log levels: off, error, warn, info, verbose
 // Log flags: trace
@@ -9,15 +11,55 @@
   static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
 #endif
 
+#define XMPP_WHEEL_DEFAULT_TICK_INTERVAL 0.1
+
+#define XMPP_WHEEL_LEVEL0_BITS  8
+#define XMPP_WHEEL_LEVEL1_BITS  6
+#define XMPP_WHEEL_LEVEL0_SLOTS (1 << XMPP_WHEEL_LEVEL0_BITS)
+#define XMPP_WHEEL_LEVEL1_SLOTS (1 << XMPP_WHEEL_LEVEL1_BITS)
+#define XMPP_WHEEL_LEVEL0_MASK  (XMPP_WHEEL_LEVEL0_SLOTS - 1)
+#define XMPP_WHEEL_LEVEL1_MASK  (XMPP_WHEEL_LEVEL1_SLOTS - 1)
+#define XMPP_WHEEL_RANGE        (XMPP_WHEEL_LEVEL0_SLOTS * XMPP_WHEEL_LEVEL1_SLOTS)
+
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds.
+**/
+static uint64_t XMPPMonotonicNanoseconds(void)
+{
+	static mach_timebase_info_data_t timebase;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		mach_timebase_info(&timebase);
+	});
+
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
+@interface XMPPTimingWheel ()
+
+/**
+ * The current time of the wheel's (monotonic) clock, in nanoseconds.
+ * The unit tests override this method to drive a wheel with a virtual clock.
+**/
+- (uint64_t)monotonicTime;
+
+@end
+
 @implementation XMPPTimer
 {
 	BOOL isStarted;
-	
+
 	dispatch_time_t start;
 	uint64_t timeout;
 	uint64_t interval;
-	
+
 	dispatch_source_t timer;
+
+	XMPPTimingWheel *wheel;
+	dispatch_queue_t wheelQueue;
+	dispatch_block_t wheelEventHandler;
+	id wheelToken;
+	uint64_t wheelStart;
 }
 
 - (instancetype)initWithQueue:(dispatch_queue_t)queue eventHandler:(dispatch_block_t)block
@@ -26,7 +68,29 @@
 	{
 		timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
 		dispatch_source_set_event_handler(timer, block);
-		
+
+		isStarted = NO;
+	}
+	return self;
+}
+
+- (instancetype)initWithQueue:(dispatch_queue_t)queue
+                  timingWheel:(XMPPTimingWheel *)aWheel
+                 eventHandler:(dispatch_block_t)block
+{
+	NSParameterAssert(queue != NULL);
+
+	if ((self = [super init]))
+	{
+		wheel = aWheel ?: [XMPPTimingWheel sharedTimingWheel];
+
+		wheelQueue = queue;
+		#if !OS_OBJECT_USE_OBJC
+		dispatch_retain(wheelQueue);
+		#endif
+
+		wheelEventHandler = [block copy];
+
 		isStarted = NO;
 	}
 	return self;
@@ -35,6 +99,11 @@
 - (void)dealloc
 {
 	[self cancel];
+
+	#if !OS_OBJECT_USE_OBJC
+	if (wheelQueue)
+		dispatch_release(wheelQueue);
+	#endif
 }
 
 - (void)startWithTimeout:(NSTimeInterval)inTimeout interval:(NSTimeInterval)inInterval
@@ -44,14 +113,22 @@
 		XMPPLogWarn(@"Unable to start timer - already started");
 		return;
 	}
-	
+
 	start = dispatch_time(DISPATCH_TIME_NOW, 0);
 	timeout = (inTimeout * NSEC_PER_SEC);
 	interval = (inInterval > 0.0) ? (inInterval * NSEC_PER_SEC) : DISPATCH_TIME_FOREVER;
-	
-	dispatch_source_set_timer(timer, dispatch_time(start, timeout), interval, 0);
-	dispatch_resume(timer);
-	
+
+	if (wheel)
+	{
+		wheelStart = [wheel monotonicTime];
+		[self scheduleOnWheelAfter:timeout];
+	}
+	else
+	{
+		dispatch_source_set_timer(timer, dispatch_time(start, timeout), interval, 0);
+		dispatch_resume(timer);
+	}
+
 	isStarted = YES;
 }
 
@@ -62,13 +139,60 @@
 		XMPPLogWarn(@"Unable to update timer - not yet started");
 		return;
 	}
-	
+
 	if (!useOriginalStartTime) {
 		start = dispatch_time(DISPATCH_TIME_NOW, 0);
 	}
 	timeout = (inTimeout * NSEC_PER_SEC);
-	
-	dispatch_source_set_timer(timer, dispatch_time(start, timeout), interval, 0);
+
+	if (wheel)
+	{
+		if (wheelEventHandler == nil) return; // Cancelled
+
+		uint64_t now = [wheel monotonicTime];
+		if (!useOriginalStartTime) {
+			wheelStart = now;
+		}
+
+		uint64_t deadline = wheelStart + timeout;
+
+		[wheel cancelScheduledBlock:wheelToken];
+		[self scheduleOnWheelAfter:(deadline > now) ? (deadline - now) : 0];
+	}
+	else
+	{
+		dispatch_source_set_timer(timer, dispatch_time(start, timeout), interval, 0);
+	}
+}
+
+- (void)scheduleOnWheelAfter:(uint64_t)delay
+{
+	__weak XMPPTimer *weakSelf = self;
+
+	wheelToken = [wheel scheduleBlock:^{
+
+		[weakSelf fireFromWheel];
+
+	} onQueue:wheelQueue afterDelay:((NSTimeInterval)delay / NSEC_PER_SEC)];
+}
+
+- (void)fireFromWheel
+{
+	// This method is invoked on the wheelQueue
+
+	dispatch_block_t handler = wheelEventHandler;
+	if (handler == nil) return; // Cancelled
+
+	if (interval != DISPATCH_TIME_FOREVER)
+	{
+		[self scheduleOnWheelAfter:interval];
+	}
+	else
+	{
+		wheelToken = nil;
+	}
+
+	handler();
 }
 
 - (void)cancel
@@ -81,6 +205,338 @@
 		#endif
 		timer = NULL;
 	}
+
+	if (wheelToken)
+	{
+		[wheel cancelScheduledBlock:wheelToken];
+		wheelToken = nil;
+	}
+	wheelEventHandler = nil;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface XMPPTimingWheelEntry : NSObject
+{
+  @public
+	dispatch_block_t block;
+	dispatch_queue_t queue;
+
+	uint64_t deadlineTick;
+	volatile uint32_t cancelled;
+
+	__unsafe_unretained NSMutableSet *slot; // The slot containing this entry, or nil if not (or no longer) scheduled
+}
+@end
+
+@implementation XMPPTimingWheelEntry
+
+- (void)dealloc
+{
+	#if !OS_OBJECT_USE_OBJC
+	if (queue)
+		dispatch_release(queue);
+	#endif
+}
+
+@end
+
+/**
+ * All the state of the wheel is only accessed on the wheel's own (serial) queue.
+ *
+ * Time is measured in ticks since the epoch of the wheel (i.e. its creation).
+ * The currentTick is the last tick that has been processed.
+**/
+@implementation XMPPTimingWheel
+{
+	dispatch_queue_t wheelQueue;
+	dispatch_source_t wheelTimer;
+	BOOL wheelTimerSuspended;
+
+	uint64_t epoch;
+	uint64_t tickNanoseconds;
+	uint64_t currentTick;
+
+	NSMutableSet *level0[XMPP_WHEEL_LEVEL0_SLOTS];
+	NSMutableSet *level1[XMPP_WHEEL_LEVEL1_SLOTS];
+	NSMutableSet *overflow;
+
+	NSUInteger entryCount;
+}
+
+@synthesize tickInterval;
+
++ (XMPPTimingWheel *)sharedTimingWheel
+{
+	static XMPPTimingWheel *sharedTimingWheel;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		sharedTimingWheel = [[XMPPTimingWheel alloc] initWithTickInterval:XMPP_WHEEL_DEFAULT_TICK_INTERVAL];
+	});
+
+	return sharedTimingWheel;
+}
+
+- (instancetype)init
+{
+	return [self initWithTickInterval:XMPP_WHEEL_DEFAULT_TICK_INTERVAL];
+}
+
+- (instancetype)initWithTickInterval:(NSTimeInterval)inTickInterval
+{
+	if ((self = [super init]))
+	{
+		tickInterval = MAX(inTickInterval, 0.001);
+		tickNanoseconds = (uint64_t)(tickInterval * NSEC_PER_SEC);
+
+		epoch = [self monotonicTime];
+		currentTick = 0;
+
+		overflow = [[NSMutableSet alloc] init];
+
+		wheelQueue = dispatch_queue_create("xmpp.timingWheel", DISPATCH_QUEUE_SERIAL);
+		wheelTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, wheelQueue);
+
+		__weak XMPPTimingWheel *weakSelf = self;
+		dispatch_source_set_event_handler(wheelTimer, ^{ @autoreleasepool {
+
+			[weakSelf advance];
+		}});
+
+		dispatch_source_set_timer(wheelTimer, dispatch_time(DISPATCH_TIME_NOW, tickNanoseconds),
+		                          tickNanoseconds, tickNanoseconds / 10);
+
+		// The timer is only resumed while entries are pending
+		wheelTimerSuspended = YES;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	if (wheelTimerSuspended)
+		dispatch_resume(wheelTimer);
+
+	dispatch_source_cancel(wheelTimer);
+
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_release(wheelTimer);
+	dispatch_release(wheelQueue);
+	#endif
+}
+
+- (uint64_t)monotonicTime
+{
+	return XMPPMonotonicNanoseconds();
+}
+
+/**
+ * Returns the tick corresponding to the given (monotonic) time.
+**/
+- (uint64_t)tickForTime:(uint64_t)time roundingUp:(BOOL)roundUp
+{
+	if (time <= epoch) return 0;
+
+	uint64_t elapsed = time - epoch;
+
+	if (roundUp)
+		return (elapsed + tickNanoseconds - 1) / tickNanoseconds;
+	else
+		return elapsed / tickNanoseconds;
+}
+
+- (void)insertEntry:(XMPPTimingWheelEntry *)entry
+{
+	// Invoked on the wheelQueue
+
+	uint64_t delta = entry->deadlineTick - currentTick;
+	NSMutableSet *slot;
+
+	if (delta < XMPP_WHEEL_LEVEL0_SLOTS)
+	{
+		NSUInteger index = (NSUInteger)(entry->deadlineTick & XMPP_WHEEL_LEVEL0_MASK);
+
+		if (level0[index] == nil)
+			level0[index] = [[NSMutableSet alloc] init];
+
+		slot = level0[index];
+	}
+	else if (delta < XMPP_WHEEL_RANGE)
+	{
+		NSUInteger index = (NSUInteger)((entry->deadlineTick >> XMPP_WHEEL_LEVEL0_BITS) & XMPP_WHEEL_LEVEL1_MASK);
+
+		if (level1[index] == nil)
+			level1[index] = [[NSMutableSet alloc] init];
+
+		slot = level1[index];
+	}
+	else
+	{
+		slot = overflow;
+	}
+
+	[slot addObject:entry];
+	entry->slot = slot;
+}
+
+- (void)fireEntry:(XMPPTimingWheelEntry *)entry
+{
+	// Invoked on the wheelQueue
+
+	entry->slot = nil;
+	entryCount--;
+
+	dispatch_async(entry->queue, ^{ @autoreleasepool {
+
+		if (OSAtomicOr32Barrier(0, &entry->cancelled) == 0)
+		{
+			entry->block();
+		}
+
+		entry->block = nil;
+	}});
+}
+
+/**
+ * Moves all the entries of the given slot to wherever they now belong (or fires them if they're due).
+**/
+- (void)cascadeSlot:(NSMutableSet *)slot
+{
+	if ([slot count] == 0) return;
+
+	NSArray *entries = [slot allObjects];
+	[slot removeAllObjects];
+
+	for (XMPPTimingWheelEntry *entry in entries)
+	{
+		if (entry->deadlineTick <= currentTick)
+			[self fireEntry:entry];
+		else
+			[self insertEntry:entry];
+	}
+}
+
+/**
+ * Processes all the ticks up to the current time.
+**/
+- (void)advance
+{
+	// Invoked on the wheelQueue
+
+	uint64_t targetTick = [self tickForTime:[self monotonicTime] roundingUp:NO];
+
+	while (currentTick < targetTick && entryCount > 0)
+	{
+		currentTick++;
+
+		NSUInteger index0 = (NSUInteger)(currentTick & XMPP_WHEEL_LEVEL0_MASK);
+
+		if (index0 == 0)
+		{
+			NSUInteger index1 = (NSUInteger)((currentTick >> XMPP_WHEEL_LEVEL0_BITS) & XMPP_WHEEL_LEVEL1_MASK);
+
+			if (index1 == 0)
+			{
+				[self cascadeSlot:overflow];
+			}
+
+			[self cascadeSlot:level1[index1]];
+		}
+
+		NSMutableSet *slot = level0[index0];
+		if ([slot count] > 0)
+		{
+			NSArray *dueEntries = [slot allObjects];
+			[slot removeAllObjects];
+
+			for (XMPPTimingWheelEntry *entry in dueEntries)
+			{
+				[self fireEntry:entry];
+			}
+		}
+	}
+
+	if (entryCount == 0)
+	{
+		// Nothing is pending, so there's no need to walk through the idle ticks
+		currentTick = MAX(currentTick, targetTick);
+
+		if (!wheelTimerSuspended)
+		{
+			dispatch_suspend(wheelTimer);
+			wheelTimerSuspended = YES;
+		}
+	}
+}
+
+- (id)scheduleBlock:(dispatch_block_t)block onQueue:(dispatch_queue_t)queue afterDelay:(NSTimeInterval)delay
+{
+	NSParameterAssert(block != nil);
+	NSParameterAssert(queue != NULL);
+
+	uint64_t deadline = [self monotonicTime] + (uint64_t)(MAX(delay, 0.0) * NSEC_PER_SEC);
+
+	XMPPTimingWheelEntry *entry = [[XMPPTimingWheelEntry alloc] init];
+	entry->block = [block copy];
+	entry->queue = queue;
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_retain(queue);
+	#endif
+
+	dispatch_async(wheelQueue, ^{ @autoreleasepool {
+
+		if (OSAtomicOr32Barrier(0, &entry->cancelled)) return;
+
+		if (entryCount == 0)
+		{
+			// Skip over the idle ticks
+			currentTick = MAX(currentTick, [self tickForTime:[self monotonicTime] roundingUp:NO]);
+		}
+
+		entry->deadlineTick = MAX([self tickForTime:deadline roundingUp:YES], currentTick + 1);
+		entryCount++;
+
+		[self insertEntry:entry];
+
+		if (wheelTimerSuspended)
+		{
+			dispatch_source_set_timer(wheelTimer, dispatch_time(DISPATCH_TIME_NOW, tickNanoseconds),
+			                          tickNanoseconds, tickNanoseconds / 10);
+			dispatch_resume(wheelTimer);
+			wheelTimerSuspended = NO;
+		}
+	}});
+
+	return entry;
+}
+
+- (void)cancelScheduledBlock:(id)token
+{
+	if (![token isKindOfClass:[XMPPTimingWheelEntry class]]) return;
+
+	XMPPTimingWheelEntry *entry = (XMPPTimingWheelEntry *)token;
+
+	if (OSAtomicTestAndSetBarrier(0, &entry->cancelled)) return; // Already cancelled
+
+	dispatch_async(wheelQueue, ^{ @autoreleasepool {
+
+		// If the entry has already fired, its block is owned by the target queue
+
+		NSMutableSet *slot = entry->slot;
+		if (slot)
+		{
+			[slot removeObject:entry];
+			entry->slot = nil;
+			entryCount--;
+
+			entry->block = nil;
+		}
+	}});
 }
 
 @end